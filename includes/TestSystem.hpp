@@ -14,14 +14,29 @@ namespace TestSystem
         OK = 1,
         EXCEPTION = 2,
         ERROR = 3,
-        TIMEOUT = 4
+        TIMEOUT = 4,
+        // Тест прошёл, но медленнее базового времени больше допустимого.
+        SLOW = 5
     };
 
+    // Разбор параметров командной строки теста:
+    //   --repeat N             число запусков каждого теста (сравнивается медиана);
+    //   --baseline FILE        сравнение со временем из файла;
+    //   --update-baseline FILE запись измеренного времени в файл;
+    //   --threshold X          допустимое относительное замедление (0.5 - на 50%);
+    //   --inspect              запуск в текущем процессе без тайм-аута (для отладчика).
+    void configure(int argc, char *argv[]);
+
+    // Запуск теста в дочернем процессе: тайм-аут timeout_ms на один запуск, время
+    // (реальное и процессорное) - медиана по повторам. inspect - запуск в текущем процессе.
     TestResult run_test(
         const char *name,
         TestScenario test,
         size_t timeout_ms = 1000U,
         bool inspect = false);
+
+    // Итог: число непройденных тестов, запись базового времени; код возврата программы.
+    int summary();
 };
 
-#endif
\ No newline at end of file
+#endif
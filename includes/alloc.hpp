@@ -0,0 +1,58 @@
+#ifndef HEADER_GUARD_ALLOC_HPP_INCLUDED
+#define HEADER_GUARD_ALLOC_HPP_INCLUDED
+
+#include <cstdint>
+
+// Учёт выделений динамической памяти.
+//
+// В сборках с -DEXPR_COUNT_ALLOCATIONS (тесты, make ALLOC=1) глобальные operator new и
+// operator delete заменяются версиями со счётчиками: по каждому потоку и по всей
+// программе. Без этого флага счётчики всегда нулевые, а counting() возвращает false.
+struct AllocStats
+{
+    // Число вызовов operator new и operator delete (для ненулевых указателей).
+    uint64_t allocations = 0;
+    uint64_t deallocations = 0;
+    // Суммарный запрошенный размер выделений в байтах.
+    uint64_t bytes = 0;
+
+    AllocStats operator-(const AllocStats &other) const
+    {
+        return {allocations - other.allocations, deallocations - other.deallocations, bytes - other.bytes};
+    }
+};
+
+class Allocations
+{
+public:
+    // Заменены ли operator new и operator delete в этой сборке.
+    static bool counting();
+    // Выделения текущего потока с его запуска.
+    static AllocStats thread();
+    // Выделения всех потоков с запуска программы.
+    static AllocStats total();
+};
+
+// Выделения текущего потока от создания объекта: проверка, что операция не выделяет
+// память, - AllocScope scope; operation(); scope.allocations() == 0.
+class AllocScope
+{
+public:
+    AllocScope() : begin_(Allocations::thread())
+    {
+    }
+
+    AllocStats stats() const
+    {
+        return Allocations::thread() - begin_;
+    }
+    uint64_t allocations() const
+    {
+        return stats().allocations;
+    }
+
+private:
+    AllocStats begin_;
+};
+
+#endif // HEADER_GUARD_ALLOC_HPP_INCLUDED
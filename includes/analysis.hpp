@@ -0,0 +1,51 @@
+#ifndef HEADER_GUARD_ANALYSIS_HPP_INCLUDED
+#define HEADER_GUARD_ANALYSIS_HPP_INCLUDED
+
+#include <array>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "expression.hpp"
+#include "rewriter.hpp"
+
+// Число видов узлов (NodeKind).
+static constexpr size_t NODE_KINDS = NODE_PRODUCT + 1;
+
+// Сведения о выражении для выбора способа вычисления.
+//
+// Общие поддеревья - одни и те же узлы в куче (одинаковый node()); структурно равные,
+// но созданные отдельно поддеревья считаются разными. Листья хранятся в выражении и
+// считаются вместе с узлом, которому принадлежат.
+struct ExpressionStats
+{
+    // Узлы дерева с повторением общих поддеревьев (столько обходит Expression::eval) и
+    // без повторения; при переполнении tree_nodes равно SIZE_MAX.
+    size_t tree_nodes = 0;
+    size_t unique_nodes = 0;
+    // tree_nodes / unique_nodes.
+    double sharing = 1;
+    // Память узлов в куче (с блоками управления shared_ptr и массивами операндов n-арных
+    // узлов) и число таких узлов.
+    size_t bytes = 0;
+    size_t heap_nodes = 0;
+    // Наибольшее число узлов на пути от корня до листа.
+    size_t depth = 0;
+    // Число узлов каждого вида без повторения (индекс - NodeKind).
+    std::array<size_t, NODE_KINDS> operations{};
+    // Свободные переменные в лексикографическом порядке.
+    std::vector<std::string> variables;
+    // Оценка стоимости в тактах по CostModel: вычисление дерева с повторением общих
+    // поддеревьев и с однократным вычислением каждого узла.
+    long double tree_cost = 0;
+    long double dag_cost = 0;
+};
+
+// Сведения о выражении за один нерекурсивный обход различных узлов.
+template <typename T>
+ExpressionStats analyze(const Expression<T> &expr, const CostModel &costs = {});
+
+// Имя вида узла ("add", "sin", ...).
+const char *node_kind_name(NodeKind kind);
+
+#endif // HEADER_GUARD_ANALYSIS_HPP_INCLUDED
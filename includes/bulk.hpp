@@ -0,0 +1,69 @@
+#ifndef HEADER_GUARD_BULK_HPP_INCLUDED
+#define HEADER_GUARD_BULK_HPP_INCLUDED
+
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "compiler.hpp"
+#include "expression.hpp"
+
+// Файл, отображённый в память только для чтения.
+//
+// Данные не копируются: читаются только те страницы, к которым обращается разбор.
+class MappedFile
+{
+public:
+    explicit MappedFile(const std::string &path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    const char *data() const;
+    size_t size() const;
+
+private:
+    void *address_;
+    size_t size_;
+};
+
+// Вычисление выражения для всех строк таблицы значений переменных.
+//
+// Столбцы сопоставляются переменным по имени, остальные переменные берутся из params.
+// Строки разбиваются на части, которые разбираются и вычисляются независимо в
+// нескольких потоках; внутри части значения разбираются блоками и сразу
+// передаются в пакетное вычисление скомпилированной программы.
+template <typename T>
+class BulkEvaluator
+{
+public:
+    BulkEvaluator(const Expression<T> &expr, const std::map<std::string, T> &params = {});
+
+    // CSV с заголовком из имён столбцов; пустые строки пропускаются.
+    std::vector<T> eval_csv(const char *data, size_t size, size_t threads = 1, char delimiter = ',') const;
+
+    // Сырые столбцы double (little-endian) подряд: names[k] - имя k-го столбца,
+    // число строк равно size / (8 * names.size()).
+    std::vector<T> eval_columns(const char *data, size_t size, const std::vector<std::string> &names,
+                                size_t threads = 1) const;
+
+    // Запись результатов столбцом double или текстом, по одному значению в строке.
+    static void write_binary(std::ostream &out, const std::vector<T> &results);
+    static void write_text(std::ostream &out, const std::vector<T> &results, size_t threads = 1);
+
+    const std::vector<std::string> &variables() const;
+
+    // Разбор десятичного числа [first, last) целиком (как в столбцах CSV).
+    static bool parse_value(const char *first, const char *last, T &value);
+
+private:
+    CompiledExpression<T> compiled_;
+    std::map<std::string, T> params_;
+
+    // Номера переменных программы для столбцов таблицы (-1 - столбец не используется).
+    std::vector<int> bind(const std::vector<std::string> &names) const;
+};
+
+#endif // HEADER_GUARD_BULK_HPP_INCLUDED
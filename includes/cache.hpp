@@ -0,0 +1,109 @@
+#ifndef HEADER_GUARD_CACHE_HPP_INCLUDED
+#define HEADER_GUARD_CACHE_HPP_INCLUDED
+
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "compiler.hpp"
+#include "expression.hpp"
+
+// Параметры кэша разобранных выражений.
+struct ParseCacheOptions
+{
+    // Наибольшее число хранимых выражений (делится поровну между сегментами).
+    size_t capacity = 4096;
+    // Число независимо блокируемых сегментов.
+    size_t stripes = 16;
+};
+
+// Статистика кэша.
+struct ParseCacheStats
+{
+    size_t hits = 0;
+    size_t misses = 0;
+    size_t evictions = 0;
+    size_t entries = 0;
+    // Оценка занимаемой памяти: ключи, узлы деревьев и скомпилированные программы.
+    size_t memory = 0;
+    double hit_rate = 0;
+};
+
+// Потокобезопасный кэш разобранных выражений с вытеснением давно не используемых.
+//
+// Ключ - исходный текст без пробелов, не влияющих на разбор. Ключи распределяются по
+// сегментам хешем, у каждого сегмента свой мьютекс и свой список LRU, поэтому потоки,
+// запрашивающие разные выражения, почти не ждут друг друга. Разбор при промахе
+// выполняется без блокировки. Выражения в кэше не изменяются и разделяются всеми,
+// кто их получил; вытеснение лишь убирает ссылку кэша.
+template <typename T>
+class ParseCache
+{
+public:
+    // Запись кэша: выражение и (по первому требованию) его скомпилированная программа
+    // по свободным переменным в лексикографическом порядке.
+    class Entry
+    {
+    public:
+        Entry(Expression<T> expression, size_t bytes);
+
+        const Expression<T> &expression() const;
+        const std::vector<std::string> &variables() const;
+        // Программа компилируется один раз при первом вызове.
+        std::shared_ptr<const CompiledExpression<T>> compiled() const;
+        // Уже скомпилированная программа или nullptr.
+        std::shared_ptr<const CompiledExpression<T>> compiled_if_ready() const;
+        size_t memory() const;
+
+    private:
+        Expression<T> expression_;
+        std::vector<std::string> variables_;
+        size_t bytes_;
+        mutable std::once_flag once_;
+        mutable std::shared_ptr<const CompiledExpression<T>> compiled_;
+        mutable std::atomic<bool> ready_{false};
+    };
+
+    explicit ParseCache(const ParseCacheOptions &options = {});
+
+    ParseCache(const ParseCache &) = delete;
+    ParseCache &operator=(const ParseCache &) = delete;
+
+    // Запись для текста выражения (при промахе текст разбирается и запоминается;
+    // ошибки разбора передаются вызывающему, а в кэш ничего не попадает).
+    std::shared_ptr<const Entry> get(const std::string &source);
+    Expression<T> parse(const std::string &source);
+    std::shared_ptr<const CompiledExpression<T>> compile(const std::string &source);
+
+    bool contains(const std::string &source) const;
+    void clear();
+    ParseCacheStats stats() const;
+
+    // Текст без пробелов и табуляций, кроме разделяющих два имени или числа.
+    static std::string normalize(const std::string &source);
+
+private:
+    using Item = std::pair<std::string, std::shared_ptr<const Entry>>;
+
+    struct Stripe
+    {
+        mutable std::mutex mutex;
+        // Начало списка - последние использованные записи.
+        std::list<Item> order;
+        std::unordered_map<std::string, typename std::list<Item>::iterator> index;
+        size_t hits = 0;
+        size_t misses = 0;
+        size_t evictions = 0;
+    };
+
+    size_t stripe_capacity_;
+    std::vector<std::unique_ptr<Stripe>> stripes_;
+
+    Stripe &stripe(const std::string &key) const;
+};
+
+#endif // HEADER_GUARD_CACHE_HPP_INCLUDED
@@ -0,0 +1,54 @@
+#ifndef HEADER_GUARD_CODEGEN_HPP_INCLUDED
+#define HEADER_GUARD_CODEGEN_HPP_INCLUDED
+
+#include <string>
+#include <vector>
+
+#include "compiler.hpp"
+#include "expression.hpp"
+
+// Параметры генерации кода.
+struct CodegenOptions
+{
+    // Пространство имён сгенерированных функций.
+    std::string namespace_name = "generated";
+    // Заголовок (inline-функции, #pragma once) или отдельная единица трансляции.
+    bool header = true;
+};
+
+// Генератор самодостаточного исходного кода C++ по выражениям.
+//
+// Каждое выражение становится функцией T name(const T *vars) над массивом значений
+// переменных в порядке variables(). Тело строится по скомпилированной программе:
+// общие подвыражения вычисляются один раз в локальных константах, константные
+// целые показатели раскрываются в цепочки умножений (в том же порядке, что и
+// integer_power, поэтому результаты совпадают с вычислением дерева). Кроме того,
+// генерируется функция evaluate_all(vars, out), вычисляющая все выражения с общими
+// подвыражениями.
+template <typename T>
+class CodeGenerator
+{
+public:
+    explicit CodeGenerator(const std::vector<std::string> &variables);
+
+    // Добавление функции с заданным именем (идентификатор C++).
+    void add(const std::string &name, const Expression<T> &expr);
+    // Добавление функции и её частных производных name_d_<переменная> по всем переменным.
+    void add_with_gradient(const std::string &name, const Expression<T> &expr);
+
+    std::string emit(const CodegenOptions &options = {}) const;
+
+    const std::vector<std::string> &variables() const;
+    const std::vector<std::string> &names() const;
+
+private:
+    std::vector<std::string> variables_;
+    std::vector<std::string> names_;
+    std::vector<Expression<T>> exprs_;
+
+    // Тело функции по программе: локальные константы и выражения результатов.
+    static void emit_body(std::string &code, const CompiledExpression<T> &compiled,
+                          std::vector<std::string> &results);
+};
+
+#endif // HEADER_GUARD_CODEGEN_HPP_INCLUDED
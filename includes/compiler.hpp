@@ -0,0 +1,157 @@
+#ifndef HEADER_GUARD_COMPILER_HPP_INCLUDED
+#define HEADER_GUARD_COMPILER_HPP_INCLUDED
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "expression.hpp"
+
+// Код операции линейной программы вычисления выражения.
+enum OpCode : uint8_t
+{
+    // Загрузка константы constants[lhs].
+    OP_CONST = 0,
+    // Загрузка переменной с номером lhs.
+    OP_VAR = 1,
+    // Унарные операции над ячейкой lhs.
+    OP_NEG = 2,
+    OP_SIN = 3,
+    OP_COS = 4,
+    OP_LN = 5,
+    OP_EXP = 6,
+    // Бинарные операции над ячейками lhs и rhs.
+    OP_ADD = 7,
+    OP_SUB = 8,
+    OP_MUL = 9,
+    OP_DIV = 10,
+    OP_POW = 11,
+    // Степени с константным показателем: целым (хранится в rhs), 0.5 и -0.5.
+    OP_POWI = 12,
+    OP_SQRT = 13,
+    OP_RSQRT = 14,
+    // sin и cos одного аргумента lhs: OP_SINCOS записывает sin в свою ячейку и cos в
+    // следующую, где стоит OP_SINCOS_COS (её повторно вычислять не нужно).
+    OP_SINCOS = 15,
+    OP_SINCOS_COS = 16,
+    // lhs * rhs + addend с одним округлением.
+    OP_FMA = 17
+};
+
+// Инструкция программы: результат записывается в ячейку с номером инструкции.
+struct Instruction
+{
+    OpCode op;
+    uint32_t lhs;
+    uint32_t rhs;
+    // Третий операнд (только для OP_FMA).
+    uint32_t addend = 0;
+};
+
+// Число операндов-ячеек инструкции (показатель OP_POWI хранится в rhs и ячейкой не является).
+inline size_t operand_count(OpCode op)
+{
+    switch (op)
+    {
+    case OP_CONST:
+    case OP_VAR:
+        return 0;
+    case OP_ADD:
+    case OP_SUB:
+    case OP_MUL:
+    case OP_DIV:
+    case OP_POW:
+        return 2;
+    case OP_FMA:
+        return 3;
+    default:
+        return 1;
+    }
+}
+
+// Параметры компиляции.
+struct CompileOptions
+{
+    // Объединение sin и cos одного аргумента в одну инструкцию OP_SINCOS.
+    bool sincos = true;
+    // Замена a * b + c (произведение используется один раз) на OP_FMA. Меняет
+    // округление, поэтому по умолчанию выключено; для long double на x86 fmal
+    // эмулируется программно и медленнее отдельных умножения и сложения.
+    bool fma = false;
+};
+
+// Результат проверяемого вычисления программы.
+struct ProgramStatus
+{
+    // Объединение флагов EvalFlag всех инструкций.
+    uint32_t flags = EVAL_OK;
+    // Первая возникшая ошибка и номер инструкции, на которой она возникла.
+    EvalFlag error = EVAL_OK;
+    uint32_t slot = 0;
+
+    bool ok() const noexcept
+    {
+        return flags == EVAL_OK;
+    }
+};
+
+// Выражение, скомпилированное в линейную программу над массивом ячеек.
+//
+// Дерево (или набор деревьев) обходится один раз, общие подвыражения
+// объединяются, переменные заменяются номерами. Вычисление не использует
+// std::map и виртуальные вызовы, а пакетный режим выполняет каждую
+// инструкцию сразу для блока точек, что позволяет компилятору векторизовать циклы.
+template <typename T>
+class CompiledExpression
+{
+public:
+    // Компиляция выражения; порядок переменных задаёт порядок аргументов.
+    CompiledExpression(const Expression<T> &expr, const std::vector<std::string> &variables,
+                       const CompileOptions &options = {});
+    // Компиляция нескольких выражений в общую программу с несколькими результатами.
+    CompiledExpression(const std::vector<Expression<T>> &exprs, const std::vector<std::string> &variables,
+                       const CompileOptions &options = {});
+
+    // Вычисление первого результата в точке vars[0..variables().size()).
+    T eval(const T *vars) const;
+    // Вычисление всех результатов в точке.
+    void eval(const T *vars, T *results) const;
+    // То же с проверкой каждой инструкции (см. eval_flags) и без исключений.
+    ProgramStatus eval_checked(const T *vars, T *results) const noexcept;
+
+    // Пакетное вычисление в count точках.
+    // columns[v] - значения переменной v с шагом strides[v] (шаг 0 - одно значение на все точки,
+    // strides == nullptr - все шаги равны 1); results[k] - массив из count значений k-го результата.
+    // Если задан flags, в flags[i] записывается объединение флагов EvalFlag i-й точки;
+    // без него проверки не выполняются.
+    void eval_batch(size_t count, const T *const *columns, T *const *results,
+                    const size_t *strides = nullptr, uint32_t *flags = nullptr) const;
+
+    const std::vector<std::string> &variables() const;
+    size_t outputs() const;
+    // Ячейки программы, в которых находятся результаты.
+    const std::vector<uint32_t> &output_slots() const;
+    const std::vector<Instruction> &program() const;
+    const std::vector<T> &constants() const;
+
+    // Список свободных переменных выражения в лексикографическом порядке.
+    static std::vector<std::string> free_variables(const Expression<T> &expr);
+
+private:
+    std::vector<std::string> variables_;
+    std::vector<Instruction> program_;
+    std::vector<T> constants_;
+    std::vector<uint32_t> outputs_;
+
+    void compile(const std::vector<Expression<T>> &exprs);
+    // Вычисление с проверками (Checked) или без; проверки отсутствуют в коде варианта без них.
+    template <bool Checked>
+    void run(const T *vars, T *results, ProgramStatus *status) const;
+    template <bool Checked>
+    void run_batch(size_t count, const T *const *columns, T *const *results, const size_t *strides,
+                   uint32_t *flags) const;
+    // Проход слияния инструкций (sincos, fma) по готовой программе.
+    void fuse(const CompileOptions &options);
+};
+
+#endif // HEADER_GUARD_COMPILER_HPP_INCLUDED
@@ -5,10 +5,217 @@
 #include <memory>
 #include <sstream>
 #include <complex>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <vector>
 
 template <typename T>
 class Expression;
 
+// Вид узла дерева выражения.
+enum NodeKind
+{
+    NODE_VALUE = 0,
+    NODE_VARIABLE = 1,
+    NODE_NEGATE = 2,
+    NODE_ADD = 3,
+    NODE_SUB = 4,
+    NODE_MULT = 5,
+    NODE_DIV = 6,
+    NODE_POW = 7,
+    NODE_SIN = 8,
+    NODE_COS = 9,
+    NODE_LN = 10,
+    NODE_EXP = 11,
+    // n-арные сумма (слагаемые со знаками) и произведение.
+    NODE_SUM = 12,
+    NODE_PRODUCT = 13
+};
+
+// Способ вычисления степени x ^ c с константным показателем c.
+enum PowerKind
+{
+    // Общий случай: std::pow.
+    POWER_GENERAL = 0,
+    // Целый показатель: возведение в степень двоичным методом (отрицательный - через 1 / x).
+    POWER_INTEGER = 1,
+    // Показатель 0.5: sqrt(x).
+    POWER_SQRT = 2,
+    // Показатель -0.5: 1 / sqrt(x).
+    POWER_RSQRT = 3
+};
+
+// Наибольший по модулю целый показатель, раскрываемый в цепочку умножений.
+constexpr int MAX_INTEGER_POWER = 64;
+
+// Классификация константного показателя степени; для целого показателя он записывается в n.
+template <typename T>
+PowerKind classify_exponent(const T &exponent, int &n)
+{
+    long double re = std::real(exponent);
+    if (std::imag(exponent) != 0)
+    {
+        return POWER_GENERAL;
+    }
+    if (re == 0.5L)
+    {
+        return POWER_SQRT;
+    }
+    if (re == -0.5L)
+    {
+        return POWER_RSQRT;
+    }
+    if (re >= -MAX_INTEGER_POWER && re <= MAX_INTEGER_POWER &&
+        re == static_cast<long double>(static_cast<int>(re)))
+    {
+        n = static_cast<int>(re);
+        return POWER_INTEGER;
+    }
+    return POWER_GENERAL;
+}
+
+// Возведение в целую степень двоичным методом.
+template <typename T>
+T integer_power(T base, int n)
+{
+    unsigned int power = n < 0 ? -static_cast<unsigned int>(n) : static_cast<unsigned int>(n);
+    T result = T(1);
+    while (power != 0)
+    {
+        if (power & 1U)
+        {
+            result *= base;
+        }
+        power >>= 1;
+        if (power != 0)
+        {
+            base *= base;
+        }
+    }
+    return n < 0 ? T(1) / result : result;
+}
+
+// Ошибки вычисления (битовые флаги).
+enum EvalFlag : uint32_t
+{
+    EVAL_OK = 0,
+    // Переменной нет в контексте; вместо значения используется NaN.
+    EVAL_MISSING_VARIABLE = 1,
+    // Деление на ноль или ноль в отрицательной степени.
+    EVAL_DIVISION_BY_ZERO = 2,
+    // Логарифм неположительного числа (для комплексных - нуля).
+    EVAL_LOG_DOMAIN = 4,
+    // Отрицательное основание с нецелым показателем, в том числе sqrt.
+    EVAL_POW_DOMAIN = 8,
+    // Бесконечный или неопределённый результат из конечных операндов.
+    EVAL_OVERFLOW = 16,
+    // Не удалось выделить рабочую память вычисления (или захватить блокировку таблицы
+    // имён); значение - NaN.
+    EVAL_NO_MEMORY = 32
+};
+
+template <typename T>
+bool is_finite_value(const T &value) noexcept
+{
+    if constexpr (std::is_floating_point_v<T>)
+    {
+        return std::isfinite(value);
+    }
+    else
+    {
+        return std::isfinite(value.real()) && std::isfinite(value.imag());
+    }
+}
+
+// Флаги одной операции вида kind по значениям операндов и результату (для степени
+// операнды - основание и показатель). Ошибка, пришедшая из операндов (NaN или
+// бесконечность), повторно не отмечается.
+template <typename T>
+uint32_t eval_flags(NodeKind kind, const T *operands, size_t arity, const T &result) noexcept
+{
+    uint32_t flags = EVAL_OK;
+    switch (kind)
+    {
+    case NODE_DIV:
+        if (operands[1] == T(0))
+        {
+            flags |= EVAL_DIVISION_BY_ZERO;
+        }
+        break;
+    case NODE_LN:
+        if constexpr (std::is_floating_point_v<T>)
+        {
+            flags |= operands[0] <= 0 ? EVAL_LOG_DOMAIN : EVAL_OK;
+        }
+        else
+        {
+            flags |= operands[0] == T(0) ? EVAL_LOG_DOMAIN : EVAL_OK;
+        }
+        break;
+    case NODE_POW:
+        if (operands[0] == T(0) && std::real(operands[1]) < 0)
+        {
+            flags |= EVAL_DIVISION_BY_ZERO;
+        }
+        if constexpr (std::is_floating_point_v<T>)
+        {
+            if (operands[0] < 0 && operands[1] != std::trunc(operands[1]))
+            {
+                flags |= EVAL_POW_DOMAIN;
+            }
+        }
+        break;
+    default:
+        break;
+    }
+    if (flags == EVAL_OK && !is_finite_value(result))
+    {
+        bool finite = true;
+        for (size_t i = 0; i < arity; ++i)
+        {
+            finite = finite && is_finite_value(operands[i]);
+        }
+        flags |= finite ? EVAL_OVERFLOW : EVAL_OK;
+    }
+    return flags;
+}
+
+// Результат вычисления без исключений.
+template <typename T>
+struct EvalResult
+{
+    T value = T(0);
+    // Объединение флагов всех операций.
+    uint32_t flags = EVAL_OK;
+    // Первая возникшая ошибка (младший флаг операции) и поддерево, в котором она возникла
+    // (указатель внутрь вычисленного выражения).
+    EvalFlag error = EVAL_OK;
+    const Expression<T> *node = nullptr;
+
+    bool ok() const noexcept
+    {
+        return flags == EVAL_OK;
+    }
+};
+
+// Глобальная таблица имён переменных.
+//
+// Каждому имени при первом обращении присваивается постоянный номер; листья-переменные
+// хранят только номер, поэтому сравнение переменных - сравнение целых чисел.
+class SymbolTable
+{
+public:
+    static uint32_t intern(const std::string &name);
+    // Номер уже известного имени (false, если имя не встречалось).
+    static bool find(const std::string &name, uint32_t &symbol);
+    // Номера имён names[0..count) под одной блокировкой (UINT32_MAX - имя не встречалось).
+    static void find(const std::string *const *names, size_t count, uint32_t *symbols);
+    static const std::string &name(uint32_t symbol);
+    static size_t size();
+};
+
 template <typename T>
 class ExpressionBase
 {
@@ -16,24 +223,60 @@ public:
     ExpressionBase() = default;
     virtual ~ExpressionBase() = default;
 
-    virtual T eval(std::map<std::string, T> context) const = 0;
-
-    virtual Expression<T> diff(const std::string &by) = 0;
-
-    virtual std::string to_string() const = 0;
+    // Вычисление, дифференцирование и печать поддерева.
+    virtual T eval(const std::map<std::string, T> &context) const;
+
+    virtual Expression<T> diff(const std::string &by);
+
+    virtual std::string to_string() const;
+
+    // Правила для одного узла по уже найденным значениям и производным операндов
+    // (используются нерекурсивными обходами). format(i) - текст узла перед i-м операндом,
+    // format(arity()) - после последнего.
+    virtual T apply(const T *operands, const std::map<std::string, T> &context) const = 0;
+    virtual Expression<T> derive(const Expression<T> *derivatives, const std::string &by) const = 0;
+    // derive по производным только зависящих от переменной операндов: indices[0..count) -
+    // их номера по возрастанию. По умолчанию остальные производные заменяются нулями.
+    virtual Expression<T> derive_sparse(const uint32_t *indices, const Expression<T> *derivatives, size_t count,
+                                        const std::string &by) const;
+    virtual std::string format(size_t part) const = 0;
+
+    // Вид узла, число операндов и доступ к ним (для обходов дерева без eval).
+    virtual NodeKind kind() const = 0;
+    virtual size_t arity() const = 0;
+    virtual const Expression<T> &operand(size_t index) const = 0;
+    // Узел того же вида с другими операндами (для преобразований дерева).
+    virtual Expression<T> rebuild(const Expression<T> *operands) const = 0;
+
+    // Передача владения операндами (для нерекурсивного удаления дерева).
+    void release_operands(std::vector<std::shared_ptr<ExpressionBase<T>>> &nodes);
+
+    // Маска свободных переменных поддерева: объединение битов variable_bit всех его
+    // переменных. Нулевой бит гарантирует, что переменной в поддереве нет.
+    uint64_t variable_mask() const;
+    static uint64_t variable_bit(uint32_t symbol);
+    // Пересчёт маски по операндам (вызывается при создании узла).
+    void update_variable_mask();
+
+protected:
+    uint64_t mask = 0;
 };
 
+// Выражение: лист (константа или переменная), хранящийся в самом объекте без
+// выделения памяти, или общий узел дерева в куче.
 template <typename T>
 class Expression
 {
 public:
-    Expression() = default;
+    Expression();
     Expression(T value);
     Expression(const std::string &variable);
     Expression(const Expression<T> &other);
+    Expression(Expression<T> &&other) noexcept;
     Expression(std::shared_ptr<ExpressionBase<T>> base_);
 
-    ~Expression() = default;
+    // Удаление дерева без рекурсии, допускающее деревья любой глубины.
+    ~Expression();
 
     // friend Expression operator""_val(T val);
     // friend Expression operator""_var(const char *variable);
@@ -41,6 +284,13 @@ public:
 
     Expression<T> diff(const std::string &by) const;
 
+    // Производные по всем свободным переменным за один обход дерева. Производные
+    // общих поддеревьев строятся один раз и разделяются между результатами, а
+    // поддерево не дифференцируется по переменным, которых в нём нет.
+    std::map<std::string, Expression<T>> diff_all() const;
+    // Производные по переменным variables в том же порядке (0 для отсутствующих).
+    std::vector<Expression<T>> diff_all(const std::vector<std::string> &variables) const;
+
     Expression<T> operator-() const;
 
     Expression<T> &operator=(const Expression<T> &other);
@@ -66,45 +316,67 @@ public:
     Expression<T> ExprLn() const;
     Expression<T> ExprExp() const;
 
-    T eval(std::map<std::string, T> context) const;
-    std::string to_string() const;
-
-private:
-    std::shared_ptr<ExpressionBase<T>> base;
-};
-
-template <typename T>
-class Value : public ExpressionBase<T>
-{
-public:
-    Value(T number);
+    // n-арные сумма и произведение; negated[i] - вычитается ли i-е слагаемое,
+    // compensated - суммирование по Кэхэну.
+    static Expression<T> ExprSum(std::vector<Expression<T>> terms, std::vector<bool> negated = {},
+                                 bool compensated = false);
+    static Expression<T> ExprProduct(std::vector<Expression<T>> factors);
 
-    virtual ~Value() override = default;
+    // Замена цепочек бинарных сумм, разностей и произведений n-арными узлами.
+    Expression<T> flatten(bool compensated = false) const;
 
-    virtual Expression<T> diff(const std::string &by) override;
+    // Без выделения памяти (рабочие стеки обхода свои у каждого потока).
+    T eval(const std::map<std::string, T> &context) const;
+    // Вычисление без исключений с флагами ошибок; отсутствующая переменная даёт NaN.
+    EvalResult<T> try_eval(const std::map<std::string, T> &context) const noexcept;
+    std::string to_string() const;
 
-    virtual T eval(std::map<std::string, T> context) const override;
-    virtual std::string to_string() const override;
+    // Структура дерева: вид узла, операнды, значение константы и имя переменной.
+    NodeKind kind() const;
+    size_t arity() const;
+    const Expression<T> &operand(size_t index) const;
+    T constant() const;
+    const std::string &variable() const;
+    // Номер переменной в SymbolTable.
+    uint32_t symbol() const;
 
-private:
-    T value;
-};
+    // Маска свободных переменных (см. ExpressionBase::variable_mask).
+    uint64_t variable_mask() const;
 
-template <typename T>
-class Variable : public ExpressionBase<T>
-{
-public:
-    Variable(std::string name_);
-
-    virtual ~Variable() override = default;
+    // Указатель на узел (одинаков для общих поддеревьев); для листьев - nullptr.
+    const ExpressionBase<T> *node() const;
 
-    virtual Expression<T> diff(const std::string &by) override;
-
-    virtual T eval(std::map<std::string, T> context) const override;
-    virtual std::string to_string() const override;
+    // Передача владения узлом; выражение становится пустым (листья не меняются).
+    std::shared_ptr<ExpressionBase<T>> release();
 
 private:
-    std::string name;
+    enum Storage : uint8_t
+    {
+        STORAGE_NODE = 0,
+        STORAGE_VALUE = 1,
+        STORAGE_VARIABLE = 2
+    };
+
+    // Значение константы хранится побайтно с выравниванием указателя: без этого
+    // выравнивание long double (16) увеличило бы размер выражения с 24 до 32 байт.
+    union
+    {
+        std::shared_ptr<ExpressionBase<T>> base;
+        alignas(alignof(void *)) unsigned char number[sizeof(T)];
+        uint32_t symbol_id;
+    };
+    Storage storage;
+
+    T stored_value() const;
+
+    // Создание копии other в неинициализированном объединении.
+    void construct(const Expression<T> &other);
+    void construct(Expression<T> &&other);
+    // Освобождение содержимого; выражение становится пустым узлом.
+    void clear();
+
+    // Нерекурсивное освобождение дерева, если на него больше нет ссылок.
+    static void destroy(std::shared_ptr<ExpressionBase<T>> &&node);
 };
 
 template <typename T>
@@ -115,10 +387,14 @@ public:
 
     virtual ~Negate() override = default;
 
-    virtual Expression<T> diff(const std::string &by) override;
+    virtual T apply(const T *operands, const std::map<std::string, T> &context) const override;
+    virtual Expression<T> derive(const Expression<T> *derivatives, const std::string &by) const override;
+    virtual std::string format(size_t part) const override;
 
-    virtual T eval(std::map<std::string, T> context) const override;
-    virtual std::string to_string() const override;
+    virtual NodeKind kind() const override;
+    virtual size_t arity() const override;
+    virtual const Expression<T> &operand(size_t index) const override;
+    virtual Expression<T> rebuild(const Expression<T> *operands) const override;
 
 private:
     Expression<T> expr;
@@ -132,10 +408,14 @@ public:
 
     virtual ~OpAdd() override = default;
 
-    virtual Expression<T> diff(const std::string &by) override;
+    virtual T apply(const T *operands, const std::map<std::string, T> &context) const override;
+    virtual Expression<T> derive(const Expression<T> *derivatives, const std::string &by) const override;
+    virtual std::string format(size_t part) const override;
 
-    virtual T eval(std::map<std::string, T> context) const override;
-    virtual std::string to_string() const override;
+    virtual NodeKind kind() const override;
+    virtual size_t arity() const override;
+    virtual const Expression<T> &operand(size_t index) const override;
+    virtual Expression<T> rebuild(const Expression<T> *operands) const override;
 
 private:
     Expression<T> left;
@@ -150,10 +430,14 @@ public:
 
     virtual ~OpMult() override = default;
 
-    virtual Expression<T> diff(const std::string &by) override;
+    virtual T apply(const T *operands, const std::map<std::string, T> &context) const override;
+    virtual Expression<T> derive(const Expression<T> *derivatives, const std::string &by) const override;
+    virtual std::string format(size_t part) const override;
 
-    virtual T eval(std::map<std::string, T> context) const override;
-    virtual std::string to_string() const override;
+    virtual NodeKind kind() const override;
+    virtual size_t arity() const override;
+    virtual const Expression<T> &operand(size_t index) const override;
+    virtual Expression<T> rebuild(const Expression<T> *operands) const override;
 
 private:
     Expression<T> left;
@@ -168,10 +452,14 @@ public:
 
     virtual ~OpSub() override = default;
 
-    virtual Expression<T> diff(const std::string &by) override;
+    virtual T apply(const T *operands, const std::map<std::string, T> &context) const override;
+    virtual Expression<T> derive(const Expression<T> *derivatives, const std::string &by) const override;
+    virtual std::string format(size_t part) const override;
 
-    virtual T eval(std::map<std::string, T> context) const override;
-    virtual std::string to_string() const override;
+    virtual NodeKind kind() const override;
+    virtual size_t arity() const override;
+    virtual const Expression<T> &operand(size_t index) const override;
+    virtual Expression<T> rebuild(const Expression<T> *operands) const override;
 
 private:
     Expression<T> left;
@@ -186,10 +474,14 @@ public:
 
     virtual ~OpDiv() override = default;
 
-    virtual Expression<T> diff(const std::string &by) override;
+    virtual T apply(const T *operands, const std::map<std::string, T> &context) const override;
+    virtual Expression<T> derive(const Expression<T> *derivatives, const std::string &by) const override;
+    virtual std::string format(size_t part) const override;
 
-    virtual T eval(std::map<std::string, T> context) const override;
-    virtual std::string to_string() const override;
+    virtual NodeKind kind() const override;
+    virtual size_t arity() const override;
+    virtual const Expression<T> &operand(size_t index) const override;
+    virtual Expression<T> rebuild(const Expression<T> *operands) const override;
 
 private:
     Expression<T> left;
@@ -204,14 +496,21 @@ public:
 
     virtual ~OpPow() override = default;
 
-    virtual Expression<T> diff(const std::string &by) override;
+    virtual T apply(const T *operands, const std::map<std::string, T> &context) const override;
+    virtual Expression<T> derive(const Expression<T> *derivatives, const std::string &by) const override;
+    virtual std::string format(size_t part) const override;
 
-    virtual T eval(std::map<std::string, T> context) const override;
-    virtual std::string to_string() const override;
+    virtual NodeKind kind() const override;
+    virtual size_t arity() const override;
+    virtual const Expression<T> &operand(size_t index) const override;
+    virtual Expression<T> rebuild(const Expression<T> *operands) const override;
 
 private:
     Expression<T> left;
     Expression<T> right;
+    // Способ вычисления степени, выбранный по константному показателю.
+    PowerKind power_kind;
+    int power_integer;
 };
 
 template <typename T>
@@ -222,10 +521,14 @@ public:
 
     virtual ~SinFunc() override = default;
 
-    virtual Expression<T> diff(const std::string &by) override;
+    virtual T apply(const T *operands, const std::map<std::string, T> &context) const override;
+    virtual Expression<T> derive(const Expression<T> *derivatives, const std::string &by) const override;
+    virtual std::string format(size_t part) const override;
 
-    virtual T eval(std::map<std::string, T> context) const override;
-    virtual std::string to_string() const override;
+    virtual NodeKind kind() const override;
+    virtual size_t arity() const override;
+    virtual const Expression<T> &operand(size_t index) const override;
+    virtual Expression<T> rebuild(const Expression<T> *operands) const override;
 
 private:
     Expression<T> arg;
@@ -239,10 +542,14 @@ public:
 
     virtual ~CosFunc() override = default;
 
-    virtual Expression<T> diff(const std::string &by) override;
+    virtual T apply(const T *operands, const std::map<std::string, T> &context) const override;
+    virtual Expression<T> derive(const Expression<T> *derivatives, const std::string &by) const override;
+    virtual std::string format(size_t part) const override;
 
-    virtual T eval(std::map<std::string, T> context) const override;
-    virtual std::string to_string() const override;
+    virtual NodeKind kind() const override;
+    virtual size_t arity() const override;
+    virtual const Expression<T> &operand(size_t index) const override;
+    virtual Expression<T> rebuild(const Expression<T> *operands) const override;
 
 private:
     Expression<T> arg;
@@ -256,10 +563,14 @@ public:
 
     virtual ~LnFunc() override = default;
 
-    virtual Expression<T> diff(const std::string &by) override;
+    virtual T apply(const T *operands, const std::map<std::string, T> &context) const override;
+    virtual Expression<T> derive(const Expression<T> *derivatives, const std::string &by) const override;
+    virtual std::string format(size_t part) const override;
 
-    virtual T eval(std::map<std::string, T> context) const override;
-    virtual std::string to_string() const override;
+    virtual NodeKind kind() const override;
+    virtual size_t arity() const override;
+    virtual const Expression<T> &operand(size_t index) const override;
+    virtual Expression<T> rebuild(const Expression<T> *operands) const override;
 
 private:
     Expression<T> arg;
@@ -273,13 +584,68 @@ public:
 
     virtual ~ExpFunc() override = default;
 
-    virtual Expression<T> diff(const std::string &by) override;
+    virtual T apply(const T *operands, const std::map<std::string, T> &context) const override;
+    virtual Expression<T> derive(const Expression<T> *derivatives, const std::string &by) const override;
+    virtual std::string format(size_t part) const override;
 
-    virtual T eval(std::map<std::string, T> context) const override;
-    virtual std::string to_string() const override;
+    virtual NodeKind kind() const override;
+    virtual size_t arity() const override;
+    virtual const Expression<T> &operand(size_t index) const override;
+    virtual Expression<T> rebuild(const Expression<T> *operands) const override;
 
 private:
     Expression<T> arg;
 };
 
+template <typename T>
+class OpSum : public ExpressionBase<T>
+{
+public:
+    OpSum(std::vector<Expression<T>> terms_, std::vector<bool> negated_, bool compensated_);
+
+    virtual ~OpSum() override = default;
+
+    virtual T apply(const T *operands, const std::map<std::string, T> &context) const override;
+    virtual Expression<T> derive(const Expression<T> *derivatives, const std::string &by) const override;
+    virtual Expression<T> derive_sparse(const uint32_t *indices, const Expression<T> *derivatives, size_t count,
+                                        const std::string &by) const override;
+    virtual std::string format(size_t part) const override;
+
+    virtual NodeKind kind() const override;
+    virtual size_t arity() const override;
+    virtual const Expression<T> &operand(size_t index) const override;
+    virtual Expression<T> rebuild(const Expression<T> *operands) const override;
+
+    bool is_negated(size_t index) const;
+    bool is_compensated() const;
+
+private:
+    std::vector<Expression<T>> terms;
+    std::vector<bool> negated;
+    // Знаки слагаемых (+1 или -1): умножение на знак не нарушает векторизацию.
+    std::vector<T> signs;
+    bool compensated;
+};
+
+template <typename T>
+class OpProduct : public ExpressionBase<T>
+{
+public:
+    OpProduct(std::vector<Expression<T>> factors_);
+
+    virtual ~OpProduct() override = default;
+
+    virtual T apply(const T *operands, const std::map<std::string, T> &context) const override;
+    virtual Expression<T> derive(const Expression<T> *derivatives, const std::string &by) const override;
+    virtual std::string format(size_t part) const override;
+
+    virtual NodeKind kind() const override;
+    virtual size_t arity() const override;
+    virtual const Expression<T> &operand(size_t index) const override;
+    virtual Expression<T> rebuild(const Expression<T> *operands) const override;
+
+private:
+    std::vector<Expression<T>> factors;
+};
+
 #endif
\ No newline at end of file
@@ -0,0 +1,98 @@
+#ifndef HEADER_GUARD_INCREMENTAL_HPP_INCLUDED
+#define HEADER_GUARD_INCREMENTAL_HPP_INCLUDED
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "expression.hpp"
+#include "lexer.hpp"
+#include "parser.hpp"
+
+// Работа, выполненная последними edit и parse.
+struct IncrementalStats
+{
+    // Лексемы, заново прочитанные лексером, и лексемы, сохранённые без изменений.
+    size_t relexed = 0;
+    size_t kept = 0;
+    // Скобки, функции и слагаемые, результат которых взят из прошлого разбора, и
+    // скобки и функции, разобранные заново.
+    size_t reused_groups = 0;
+    size_t reused_terms = 0;
+    size_t parsed_groups = 0;
+    // Лексемы, пройденные разбором (содержимое повторно использованных скобок не проходится).
+    size_t parsed_tokens = 0;
+};
+
+// Разбор редактируемого текста выражения с повторным использованием результатов.
+//
+// Хранятся лексемы с положением в тексте и результаты разбора каждой скобки,
+// функции и слагаемого из нескольких множителей (поддеревья Expression<T> вместе с
+// числом их лексем).
+// При правке лексер перечитывает текст с последней лексемы перед правкой до первой
+// прежней лексемы после неё, а результаты скобок, содержащих правку, сбрасываются.
+// Разбор повторяет шаги Parser<T>, но вместо сохранившихся скобок и слагаемых
+// подставляет их готовый результат. Они разбираются независимо от окружения, поэтому
+// результат и ошибки совпадают с полным разбором текста.
+template <typename T>
+class IncrementalParser
+{
+public:
+    explicit IncrementalParser(const std::string &source = "");
+
+    // Замена deleted символов с позиции offset на inserted.
+    // Ошибки разбора нового текста сообщает parse.
+    void edit(size_t offset, size_t deleted, const std::string &inserted);
+    // Замена всего текста (без повторного использования).
+    void reset(const std::string &source);
+
+    // Выражение для текущего текста; ошибки те же, что у Parser<T>::parseExpression.
+    Expression<T> parse();
+
+    const std::string &text() const;
+    // Лексемы текста (без завершающей TOK_EOF); при ошибке лексера - до места ошибки.
+    std::vector<Token> tokens() const;
+    IncrementalStats stats() const;
+
+private:
+    using Operand = typename Parser<T>::Operand;
+
+    struct Item
+    {
+        Token token;
+        // Для открывающей скобки и функции: результат последнего успешного разбора
+        // содержимого и расстояние до закрывающей скобки в лексемах.
+        std::shared_ptr<const Operand> group;
+        // Тот же результат, свёрнутый в один узел (для незавершённой цепочки '+' или '*').
+        std::shared_ptr<const Operand> built;
+        size_t span = 0;
+        // Для первой лексемы слагаемого из нескольких множителей: его узел и число лексем.
+        std::shared_ptr<const Operand> term;
+        size_t term_span = 0;
+    };
+
+    std::string text_;
+    std::vector<Item> items_;
+    // Ошибка лексера после последней лексемы items_ (пусто, если текст прочитан до конца).
+    std::string lex_error_;
+    Token eof_{TOK_EOF, "", 0};
+    bool parsed_ = false;
+    Expression<T> result_;
+    IncrementalStats stats_;
+
+    // Чтение текста с позиции offset в fresh до конца или до лексемы, совпадающей по
+    // началу с прежней лексемой items_[resume..], сдвинутой на shift; возвращает номер
+    // совпавшей прежней лексемы или items_.size().
+    size_t lex(size_t offset, size_t resume, long long shift, std::vector<Item> &fresh);
+    // Может ли операция next продолжить цепочку chain, стоящую перед ней.
+    static bool continues(TokenType chain, TokenType next);
+    // Сворачивается ли в узел слагаемое (first - первое на своём уровне) перед лексемой next.
+    static bool closes_term(bool first, TokenType next);
+    // Лексема с номером index (TOK_EOF за последней).
+    const Token &token(size_t index) const;
+    // Переход к лексеме index; если на ней лексер остановился с ошибкой - эта ошибка.
+    size_t reach(size_t index);
+    [[noreturn]] void unexpected(size_t index) const;
+};
+
+#endif // HEADER_GUARD_INCREMENTAL_HPP_INCLUDED
@@ -0,0 +1,61 @@
+#ifndef HEADER_GUARD_INTEGRATOR_HPP_INCLUDED
+#define HEADER_GUARD_INTEGRATOR_HPP_INCLUDED
+
+#include <map>
+#include <string>
+
+#include "compiler.hpp"
+#include "expression.hpp"
+
+// Параметры адаптивного интегрирования.
+struct IntegrationOptions
+{
+    // Требуемая абсолютная и относительная погрешность.
+    long double abs_tolerance = 1e-12L;
+    long double rel_tolerance = 1e-12L;
+    // Предельное число вычислений подынтегральной функции.
+    size_t max_evaluations = 1000000U;
+    // Сколько панелей с наибольшей погрешностью делится за один раунд.
+    size_t panels_per_round = 16U;
+    // Число потоков для вычисления панелей раунда.
+    size_t threads = 1U;
+};
+
+// Результат интегрирования и статистика.
+struct IntegrationResult
+{
+    long double value = 0;
+    long double error = 0;
+    bool converged = false;
+    // Число вычислений функции, панелей и раундов деления.
+    size_t evaluations = 0;
+    size_t panels = 0;
+    size_t rounds = 0;
+    // Затраченное время в секундах.
+    double seconds = 0;
+};
+
+// Адаптивное интегрирование по правилу Гаусса-Кронрода (7, 15).
+//
+// Выражение компилируется один раз; все 15 узлов каждой панели (и всех панелей раунда)
+// вычисляются одним пакетным вызовом. Панели с наибольшей оценкой погрешности
+// хранятся в очереди с приоритетом и делятся пополам, пока не достигнута точность.
+template <typename T>
+class Integrator
+{
+public:
+    // Интеграл expr по переменной by; остальные переменные берутся из params.
+    Integrator(const Expression<T> &expr, const std::string &by,
+               const std::map<std::string, T> &params = {});
+
+    // Интеграл на отрезке [a, b].
+    IntegrationResult integrate(T a, T b, const IntegrationOptions &options = {}) const;
+
+private:
+    CompiledExpression<T> compiled_;
+    std::vector<T> params_;
+
+    static std::vector<std::string> variables_of(const std::string &by, const std::map<std::string, T> &params);
+};
+
+#endif // HEADER_GUARD_INTEGRATOR_HPP_INCLUDED
@@ -5,6 +5,8 @@
 #include <string>
 #include <regex>
 
+#include "trace.hpp"
+
 // Тип лексемы языка выражений.
 enum TokenType
 {
@@ -42,7 +44,9 @@ constexpr const char* REGEXP_VALUE          = "(\\+|-)?(0|[1-9][0-9]*)(\\.[0-9]+
 struct Token
 {
     TokenType type;
+    // Текст лексемы (совпадает с исходным текстом от column до column + lexeme.size()).
     std::string lexeme;
+    // Смещение начала лексемы в тексте.
     size_t column;
 };
 
@@ -52,6 +56,8 @@ class Lexer
 public:
     // Создание лексера для разбора строки.
     Lexer(const std::string& input);
+    // Создание лексера для разбора строки с позиции offset.
+    Lexer(const std::string& input, size_t offset);
 
     // Создание, удаление, копирование и перемещение лексического анализатора.
     Lexer()  = delete;
@@ -66,6 +72,9 @@ public:
     // Извлечение следующей лексемы строки.
     Token getNextToken();
 
+    // Текущая позиция в тексте.
+    size_t position() const;
+
 private:
     // Текст для лексического разбора.
     std::string input_;
@@ -73,8 +82,12 @@ private:
     const char* pos_;
     // Финальная позиция в разбираемом тексте.
     const char* end_;
-    // Номер символа в строке разбираемого текста.
+    // Смещение начала текущей лексемы в разбираемом тексте.
     size_t column_;
+#ifndef EXPR_NO_TRACE
+    // Время чтения лексем (одно событие трассировки на пачку лексем).
+    TraceBatch trace_;
+#endif
 
     // Просмотр следующего символа текста без извлечения.
     char peek() const;
@@ -0,0 +1,168 @@
+#ifndef HEADER_GUARD_MEMO_HPP_INCLUDED
+#define HEADER_GUARD_MEMO_HPP_INCLUDED
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "expression.hpp"
+#include "rewriter.hpp"
+
+// Выбор записи, вытесняемой при вставке в заполненную цепочку проб.
+enum MemoEviction
+{
+    // Давно не использовавшаяся запись.
+    MEMO_EVICT_LRU = 0,
+    // Раньше всех вставленная запись.
+    MEMO_EVICT_FIFO = 1,
+    // Без вытеснения: новые значения не запоминаются.
+    MEMO_EVICT_NONE = 2
+};
+
+// Параметры запоминающего вычисления.
+struct MemoOptions
+{
+    // Число записей кэша значений выражения (округляется вверх до степени двойки).
+    size_t capacity = 1024;
+    MemoEviction eviction = MEMO_EVICT_LRU;
+    // Длина цепочки проб: запись ищется и вставляется в probes ячейках подряд от хеша.
+    size_t probes = 8;
+    // Запоминание значений дорогих поддеревьев с функцией (sin, cos, ln, exp, pow) в
+    // корне по значениям их собственных переменных.
+    bool subtrees = false;
+    // Число записей кэша каждого такого поддерева и наименьшая стоимость поддерева.
+    size_t subtree_capacity = 256;
+    long double subtree_cost = 50;
+    CostModel costs;
+};
+
+struct MemoStats
+{
+    size_t hits = 0;
+    size_t misses = 0;
+    size_t evictions = 0;
+    size_t entries = 0;
+    double hit_rate = 0;
+    // Запоминаемые поддеревья и обращения к их кэшам (только при промахе кэша выражения).
+    size_t subtrees = 0;
+    size_t subtree_hits = 0;
+    size_t subtree_misses = 0;
+    double subtree_hit_rate = 0;
+    // Память таблиц.
+    size_t memory = 0;
+};
+
+// Вычисление выражения с запоминанием результатов по значениям переменных.
+//
+// Кэш - таблица фиксированного размера с открытой адресацией: ключ (значения
+// переменных подряд) хешируется, запись ищется в options.probes ячейках подряд, а при
+// вставке в заполненную цепочку вытесняется запись по options.eviction. Значения
+// сравниваются точно (0 и -0 различаются, NaN совпадает сам с собой), поэтому
+// результат совпадает с Expression<T>::eval во всех битах.
+//
+// При промахе выражение вычисляется по узлам без повторения общих поддеревьев. С
+// options.subtrees у поддеревьев с функцией в корне, стоимость которых не меньше
+// options.subtree_cost и которые зависят не от всех переменных, свой кэш такого же
+// устройства: при совпадении их переменных поддерево не вычисляется.
+//
+// Объект хранит свою копию выражения (узлы общие), поэтому исходное может быть
+// временным. Таблицы выделяются при создании, eval не выделяет память. Объект не потокобезопасен:
+// нужен свой на каждый поток.
+template <typename T>
+class MemoEvaluator
+{
+public:
+    explicit MemoEvaluator(const Expression<T> &expr, const MemoOptions &options = {});
+
+    // Значения - по variables(); переменные в лексикографическом порядке.
+    T eval(const T *values);
+    T eval(const std::map<std::string, T> &context);
+
+    const std::vector<std::string> &variables() const;
+    MemoStats stats() const;
+    // Очистка кэшей и счётчиков.
+    void clear();
+
+private:
+    // Таблица с открытой адресацией: ключи по width значений и результаты.
+    class Table
+    {
+    public:
+        Table(size_t capacity, size_t width, size_t probes, MemoEviction eviction);
+
+        // Поиск ключа key; при успехе результат записывается в value.
+        bool find(const T *key, uint64_t hash, T &value);
+        void insert(const T *key, uint64_t hash, const T &value);
+        void clear();
+
+        size_t entries() const;
+        size_t memory() const;
+
+        size_t hits = 0;
+        size_t misses = 0;
+        size_t evictions = 0;
+
+    private:
+        static bool same(const T *a, const T *b, size_t count);
+
+        size_t mask_;
+        size_t width_;
+        size_t probes_;
+        MemoEviction eviction_;
+        // Хеш ключа (0 - свободная ячейка) и отметка вставки или последнего использования.
+        std::vector<uint64_t> hashes_;
+        std::vector<uint64_t> stamps_;
+        std::vector<T> keys_;
+        std::vector<T> values_;
+        uint64_t clock_ = 0;
+        size_t entries_ = 0;
+    };
+
+    // Шаг вычисления: узел, начало номеров ячеек его операндов в operands_ и
+    // запоминаемое поддерево с корнем в этом узле (NO_SUBTREE - нет).
+    struct Step
+    {
+        const ExpressionBase<T> *node;
+        uint32_t first;
+        uint32_t arity;
+        uint32_t subtree;
+    };
+
+    static constexpr uint32_t NO_SUBTREE = UINT32_MAX;
+
+    // Запоминаемое поддерево: шаги [begin, end] (end - его корень) используются только
+    // внутри него; ключ - значения переменных keys.
+    struct Subtree
+    {
+        uint32_t begin;
+        uint32_t end;
+        std::vector<uint32_t> keys;
+        Table table;
+    };
+
+    // Копия выражения держит узлы, на которые ссылаются шаги.
+    Expression<T> expression_;
+    std::vector<std::string> variables_;
+    // Ячейки значений: переменные, результаты шагов, константы.
+    std::vector<T> slots_;
+    uint32_t result_;
+    std::vector<Step> steps_;
+    std::vector<uint32_t> operands_;
+    // Поддеревья по возрастанию begin (объемлющее раньше вложенного).
+    std::vector<Subtree> subtrees_;
+    // Рабочие буферы ключа поддерева и операндов шага.
+    std::vector<T> key_;
+    std::vector<T> arguments_;
+    Table table_;
+
+    // Поиск в кэше по значениям переменных в slots_ и вычисление при промахе.
+    T evaluate();
+    // Вычисление по шагам с кэшами поддеревьев.
+    T compute();
+    // Ключ поддерева в key_ и его хеш.
+    uint64_t subtree_key(const Subtree &subtree);
+    static uint64_t hash(const T *values, size_t count);
+};
+
+#endif // HEADER_GUARD_MEMO_HPP_INCLUDED
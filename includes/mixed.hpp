@@ -0,0 +1,64 @@
+#ifndef HEADER_GUARD_MIXED_HPP_INCLUDED
+#define HEADER_GUARD_MIXED_HPP_INCLUDED
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "compiler.hpp"
+#include "expression.hpp"
+
+// Статистика вычислений со смешанной точностью.
+struct MixedPrecisionStats
+{
+    // Число вычисленных точек и сколько из них пересчитано в long double.
+    size_t evaluations = 0;
+    size_t fallbacks = 0;
+
+    double fallback_rate() const
+    {
+        return evaluations == 0 ? 0.0 : static_cast<double>(fallbacks) / static_cast<double>(evaluations);
+    }
+};
+
+// Вычисление выражения в double с оценкой погрешности и пересчётом в long double.
+//
+// Программа выполняется в double, и для каждой ячейки одновременно ведётся
+// априорная граница абсолютной погрешности (линейная оценка распространения ошибок
+// операндов плюс погрешность округления самой операции; sin, cos, ln, exp и pow
+// вычисляются векторными функциями VecMath с их границами ошибки в ulp). Если граница результата превышает
+// tolerance * |результат| или результат не конечен, точка пересчитывается в long double.
+class MixedPrecisionExpression
+{
+public:
+    MixedPrecisionExpression(const Expression<long double> &expr, const std::vector<std::string> &variables,
+                             long double tolerance = 1e-12L);
+
+    // Вычисление в точке vars[0..variables().size()).
+    long double eval(const long double *vars);
+    // Вычисление в double с границей абсолютной погрешности, без пересчёта.
+    double eval_double(const long double *vars, double &error_bound) const;
+
+    // Пакетное вычисление; параметры как у CompiledExpression::eval_batch.
+    void eval_batch(size_t count, const long double *const *columns, long double *results,
+                    const size_t *strides = nullptr);
+
+    const std::vector<std::string> &variables() const;
+    long double tolerance() const;
+    void set_tolerance(long double tolerance);
+
+    MixedPrecisionStats stats() const;
+    void reset_stats();
+
+private:
+    CompiledExpression<long double> compiled_;
+    // Константы программы в double и погрешности их округления.
+    std::vector<double> constants_;
+    std::vector<double> constant_errors_;
+    long double tolerance_;
+
+    std::atomic<size_t> evaluations_;
+    std::atomic<size_t> fallbacks_;
+};
+
+#endif // HEADER_GUARD_MIXED_HPP_INCLUDED
@@ -0,0 +1,104 @@
+#ifndef HEADER_GUARD_ODE_HPP_INCLUDED
+#define HEADER_GUARD_ODE_HPP_INCLUDED
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "compiler.hpp"
+#include "expression.hpp"
+
+// Метод интегрирования системы ОДУ.
+enum OdeMethod
+{
+    // Явный адаптивный метод Дормана-Принса 5(4).
+    ODE_RK45 = 0,
+    // Линейно-неявный метод Розенброка 2(3) для жёстких систем (как ode23s).
+    ODE_ROSENBROCK = 1
+};
+
+// Параметры интегрирования.
+struct OdeOptions
+{
+    OdeMethod method = ODE_RK45;
+    long double rel_tolerance = 1e-10L;
+    long double abs_tolerance = 1e-12L;
+    // Начальный шаг (0 - выбирается автоматически) и предельное число шагов.
+    long double initial_step = 0;
+    size_t max_steps = 1000000U;
+    // Сохранять ли все принятые шаги в траектории.
+    bool record_steps = false;
+    // Число потоков для набора начальных условий.
+    size_t threads = 1U;
+};
+
+// Результат интегрирования одной задачи Коши.
+struct OdeResult
+{
+    // Конечное время и состояние.
+    long double t = 0;
+    std::vector<long double> y;
+    bool success = false;
+    // Принятые и отброшенные шаги, вычисления правой части и якобиана.
+    size_t steps = 0;
+    size_t rejected = 0;
+    size_t evaluations = 0;
+    size_t jacobians = 0;
+    double seconds = 0;
+    // Траектория (при record_steps).
+    std::vector<long double> times;
+    std::vector<std::vector<long double>> states;
+};
+
+// Система ОДУ dy_i/dt = f_i(y, t) с правыми частями, заданными выражениями.
+//
+// Все правые части компилируются в одну программу над общим вектором
+// [y_0, ..., y_{n-1}, t, параметры]. Якобиан df/dy и производная df/dt строятся через
+// diff и компилируются отдельной программой при первом вызове jacobian (его вызывает
+// только неявный метод).
+template <typename T>
+class OdeSystem
+{
+public:
+    OdeSystem(const std::vector<Expression<T>> &rhs, const std::vector<std::string> &state,
+              const std::string &time = "t", const std::map<std::string, T> &params = {});
+
+    // Интегрирование от t0 до t1 из состояния y0.
+    OdeResult integrate(const std::vector<T> &y0, T t0, T t1, const OdeOptions &options = {}) const;
+
+    // Интегрирование набора независимых начальных условий (параллельно при options.threads > 1).
+    std::vector<OdeResult> integrate_many(const std::vector<std::vector<T>> &y0s, T t0, T t1,
+                                          const OdeOptions &options = {}) const;
+
+    // Правая часть f(y, t) и якобиан df/dy (по строкам) вместе с df/dt.
+    void rhs(const T *y, T t, T *dydt) const;
+    void jacobian(const T *y, T t, T *dfdy, T *dfdt) const;
+
+    size_t dimension() const;
+
+private:
+    size_t dimension_;
+    std::vector<T> params_;
+    CompiledExpression<T> rhs_;
+    // Исходные данные для построения якобиана.
+    std::vector<Expression<T>> expressions_;
+    std::vector<std::string> state_;
+    std::string time_;
+    std::vector<std::string> variables_;
+    mutable std::once_flag jacobian_once_;
+    mutable std::unique_ptr<const CompiledExpression<T>> jacobian_;
+
+    OdeResult integrate_rk45(const std::vector<T> &y0, T t0, T t1, const OdeOptions &options) const;
+    OdeResult integrate_rosenbrock(const std::vector<T> &y0, T t0, T t1, const OdeOptions &options) const;
+
+    // Размерность системы; число правых частей должно совпадать с числом переменных.
+    static size_t dimension_of(const std::vector<Expression<T>> &rhs, const std::vector<std::string> &state);
+    static std::vector<std::string> variables_of(const std::vector<std::string> &state, const std::string &time,
+                                                 const std::map<std::string, T> &params);
+    static std::vector<Expression<T>> jacobian_of(const std::vector<Expression<T>> &rhs,
+                                                  const std::vector<std::string> &state, const std::string &time);
+};
+
+#endif // HEADER_GUARD_ODE_HPP_INCLUDED
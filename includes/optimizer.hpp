@@ -0,0 +1,79 @@
+#ifndef HEADER_GUARD_OPTIMIZER_HPP_INCLUDED
+#define HEADER_GUARD_OPTIMIZER_HPP_INCLUDED
+
+#include <string>
+#include <vector>
+
+#include "compiler.hpp"
+#include "expression.hpp"
+
+// Параметры минимизации.
+struct OptimizationOptions
+{
+    // Число пар (s, y), хранимых L-BFGS.
+    size_t memory = 10U;
+    size_t max_iterations = 1000U;
+    // Остановка по норме проекции градиента и по относительному изменению значения.
+    long double gradient_tolerance = 1e-10L;
+    long double value_tolerance = 1e-18L;
+    // Предельное число вычислений функции в одном линейном поиске.
+    size_t max_line_search = 40U;
+    // Границы переменных (пустые векторы - без ограничений).
+    std::vector<long double> lower;
+    std::vector<long double> upper;
+};
+
+// Состояние после одной итерации.
+struct IterationInfo
+{
+    long double value = 0;
+    long double gradient_norm = 0;
+    long double step = 0;
+    // Вычислений функции и градиента на итерации и время итерации в секундах.
+    size_t evaluations = 0;
+    double seconds = 0;
+};
+
+// Результат минимизации.
+struct OptimizationResult
+{
+    std::vector<long double> x;
+    long double value = 0;
+    long double gradient_norm = 0;
+    bool converged = false;
+    size_t iterations = 0;
+    size_t evaluations = 0;
+    double seconds = 0;
+    std::vector<IterationInfo> history;
+};
+
+// Минимизация выражения методом L-BFGS с ограничениями-отрезками на переменные.
+//
+// Значение и частные производные по всем переменным компилируются один раз в общую
+// программу (общие подвыражения функции и градиента вычисляются однократно).
+// Ограничения учитываются проекцией: переменные на границе, градиент по которым
+// направлен наружу, фиксируются на итерации, а линейный поиск (условие Армихо)
+// идёт по проекции луча на допустимый брус.
+template <typename T>
+class Optimizer
+{
+public:
+    Optimizer(const Expression<T> &objective, const std::vector<std::string> &variables);
+
+    // Минимизация из начальной точки x0.
+    OptimizationResult minimize(std::vector<T> x0, const OptimizationOptions &options = {}) const;
+
+    // Значение и градиент в точке x (градиент записывается в gradient).
+    T evaluate(const T *x, T *gradient) const;
+
+    const std::vector<std::string> &variables() const;
+
+private:
+    std::vector<std::string> variables_;
+    CompiledExpression<T> compiled_;
+
+    static std::vector<Expression<T>> outputs_of(const Expression<T> &objective,
+                                                 const std::vector<std::string> &variables);
+};
+
+#endif // HEADER_GUARD_OPTIMIZER_HPP_INCLUDED
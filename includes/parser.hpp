@@ -2,6 +2,7 @@
 #define HEADER_GUARD_PARSER_HPP_INCLUDED
 
 #include <set>
+#include <vector>
 
 #include "expression.hpp"
 #include "lexer.hpp"
@@ -29,6 +30,9 @@
 
 // Синтаксический анализатор для синтаксического разбора языка выражений.
 
+template <typename T>
+class IncrementalParser;
+
 template <typename T>
 class Parser
 {
@@ -40,6 +44,9 @@ public:
     Expression<T> parseExpression();
 
 private:
+    // Разбор с повторным использованием поддеревьев повторяет шаги этого разбора.
+    friend class IncrementalParser<T>;
+
     // Ссылка на лексический анализатор.
     Lexer &lexer_;
     // Текущая лексема.
@@ -54,11 +61,26 @@ private:
     // Сдвиг "каретки" синтаксического анализатора при совпадении типа лексемы.
     bool match(TokenType type);
 
-    // Методы для синтаксического разбора согласно формальной грамматике.
+    // Синтаксический разбор согласно формальной грамматике без рекурсии:
+    // приоритеты Expr < Term < Power задают порядок свёртки операций.
     Expression<T> parseExpr();
-    Expression<T> parseTerm();
-    Expression<T> parsePower();
-    Expression<T> parseFactor();
+    // Операнд на стеке разбора: готовое выражение (chain == TOK_EOF) или ещё
+    // накапливаемая n-арная сумма (TOK_PLUS) либо произведение (TOK_MULTIPLY).
+    struct Operand
+    {
+        std::vector<Expression<T>> terms;
+        std::vector<bool> negated;
+        TokenType chain;
+    };
+
+    // Приоритет бинарной операции (0 - лексема не является бинарной операцией).
+    static int precedence(TokenType type);
+    // Построение выражения для операнда.
+    static Expression<T> build(Operand &operand);
+    // Свёртка двух верхних операндов стека бинарной операцией.
+    static void reduce(std::vector<Operand> &operands, TokenType operation);
+    // Завершение скобки или функции group, содержимое которой - операнд operand.
+    static void close(const Token &group, Operand &operand);
 };
 
 #endif // HEADER_GUARD_PARSER_HPP_INCLUDED
\ No newline at end of file
@@ -0,0 +1,97 @@
+#ifndef HEADER_GUARD_REWRITER_HPP_INCLUDED
+#define HEADER_GUARD_REWRITER_HPP_INCLUDED
+
+#include <map>
+#include <string>
+
+#include "compiler.hpp"
+#include "expression.hpp"
+
+// Допустимые последствия переписывания для вычислений с плавающей точкой.
+enum RewriteSafety
+{
+    // Только преобразования, дающие тот же результат во всех битах.
+    SAFETY_EXACT = 0,
+    // Допускается другое округление и другое поведение при переполнении промежуточных
+    // значений, бесконечных и неопределённых входах (sin(x) ^ 2 + cos(x) ^ 2 = 1).
+    SAFETY_FINITE = 1,
+    // Дополнительно предполагается, что аргументы лежат в области определения
+    // (ln(a) + ln(b) = ln(a * b) неверно при a, b < 0).
+    SAFETY_DOMAIN = 2
+};
+
+// Оценка стоимости операций в условных тактах.
+struct CostModel
+{
+    long double add = 1;
+    long double multiply = 1;
+    long double divide = 10;
+    long double sqrt = 10;
+    // sin, cos, ln, exp.
+    long double transcendental = 50;
+    // pow с неконстантным или нецелым показателем.
+    long double power = 100;
+};
+
+// Стоимость операции узла expr без операндов (для листьев - 0).
+template <typename T>
+long double operation_cost(const Expression<T> &expr, const CostModel &costs);
+
+// Параметры переписывания.
+struct RewriteOptions
+{
+    RewriteSafety safety = SAFETY_FINITE;
+    CostModel costs;
+    // Число случайных точек для измерения ускорения (0 - не измерять) и отрезок,
+    // из которого берутся значения переменных.
+    size_t samples = 0;
+    long double sample_low = 0.5L;
+    long double sample_high = 2;
+};
+
+// Результат переписывания.
+struct RewriteReport
+{
+    // Оценка стоимости до и после (общие подвыражения учитываются один раз).
+    long double cost_before = 0;
+    long double cost_after = 0;
+    double estimated_speedup = 1;
+    // Отношение времени пакетного вычисления скомпилированных программ (0 - не измерялось).
+    double measured_speedup = 0;
+    double seconds_before = 0;
+    double seconds_after = 0;
+    // Число применений каждого правила.
+    std::map<std::string, size_t> rules;
+};
+
+// Переписывание выражения в более дешёвую равносильную форму по образцам.
+//
+// Правила применяются снизу вверх, каждое - только если оценка стоимости поддерева
+// уменьшается и его класс безопасности не выше заданного:
+//   exp(a) * exp(b) -> exp(a + b), exp(a) / exp(b) -> exp(a - b)      (SAFETY_FINITE)
+//   ln(a) + ln(b) -> ln(a * b), ln(a) - ln(b) -> ln(a / b)            (SAFETY_DOMAIN)
+//   x / y / z -> x / (y * z), x / (y / z) -> x * z / y                (SAFETY_FINITE)
+//   a / d + b / d -> (a + b) / d                                       (SAFETY_FINITE)
+//   sin(x) ^ 2 + cos(x) ^ 2 -> 1                                       (SAFETY_FINITE)
+//   x / c -> x * (1 / c) для константы c; точно, если c - степень двойки
+// Затем несколько делений на один и тот же знаменатель d заменяются умножениями на
+// общее 1 / d (SAFETY_FINITE). Если итоговая оценка не меньше исходной, возвращается
+// исходное выражение.
+template <typename T>
+class Rewriter
+{
+public:
+    explicit Rewriter(const RewriteOptions &options = {});
+
+    Expression<T> rewrite(const Expression<T> &expr, RewriteReport *report = nullptr) const;
+
+    // Оценка стоимости вычисления выражения.
+    long double cost(const Expression<T> &expr) const;
+
+    const RewriteOptions &options() const;
+
+private:
+    RewriteOptions options_;
+};
+
+#endif // HEADER_GUARD_REWRITER_HPP_INCLUDED
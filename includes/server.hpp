@@ -0,0 +1,183 @@
+#ifndef HEADER_GUARD_SERVER_HPP_INCLUDED
+#define HEADER_GUARD_SERVER_HPP_INCLUDED
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "cache.hpp"
+
+// Протокол сервера вычислений.
+//
+// Запрос: uint32 длина остатка кадра, uint8 операция, uint32 номер запроса, данные.
+// Ответ: uint32 длина остатка кадра, uint8 состояние, uint32 номер запроса, данные.
+// Числа передаются в порядке байтов машины (сокет локальный), значения - double.
+// Запросы одного соединения выполняются по порядку и ответы приходят в том же
+// порядке, поэтому клиент может отправлять запросы, не дожидаясь ответов.
+enum ServerOp : uint8_t
+{
+    // Текст выражения -> uint64 описатель, uint32 число переменных, имена (uint32 длина, байты).
+    SERVER_PARSE = 1,
+    // uint64 описатель, имя переменной -> ответ как у SERVER_PARSE.
+    SERVER_DIFF = 2,
+    // uint64 описатель, double значения переменных -> double.
+    SERVER_EVAL = 3,
+    // uint64 описатель, uint32 число точек, double значения по точкам подряд -> double по точкам.
+    SERVER_BATCH = 4,
+    // uint64 описатель -> текст выражения.
+    SERVER_PRINT = 5,
+    // uint64 описатель -> пустой ответ.
+    SERVER_RELEASE = 6
+};
+
+enum ServerStatus : uint8_t
+{
+    SERVER_OK = 0,
+    // Данные ответа - текст ошибки.
+    SERVER_ERROR = 1
+};
+
+// Размер заголовка кадра после поля длины и наибольший размер кадра.
+static constexpr size_t SERVER_HEADER_SIZE = 5;
+static constexpr size_t SERVER_MAX_FRAME = 64u << 20;
+
+struct ServerOptions
+{
+    // Путь сокета Unix; существующий файл по этому пути удаляется.
+    std::string path;
+    // Число потоков, выполняющих запросы (0 - по числу ядер).
+    size_t workers = 0;
+    // Кэш разобранных и скомпилированных выражений, общий для всех соединений.
+    ParseCacheOptions cache;
+};
+
+struct ServerStats
+{
+    size_t connections = 0;
+    size_t requests = 0;
+    size_t errors = 0;
+    ParseCacheStats cache;
+};
+
+// Сервер вычислений на сокете Unix.
+//
+// Главный поток ждёт событий epoll: принимает соединения, читает кадры запросов и
+// отправляет готовые ответы. Соединение с новыми запросами ставится в очередь пула
+// потоков; поток забирает все накопленные запросы соединения, выполняет их по порядку и
+// передаёт ответы главному потоку через eventfd. Разные соединения обслуживаются
+// параллельно. Описатели выражений принадлежат соединению и освобождаются при его
+// закрытии; разбор и компиляция одинаковых текстов разделяются через ParseCache.
+class EvalServer
+{
+public:
+    explicit EvalServer(const ServerOptions &options);
+    ~EvalServer();
+
+    EvalServer(const EvalServer &) = delete;
+    EvalServer &operator=(const EvalServer &) = delete;
+
+    // Обслуживание до вызова stop() (из любого потока).
+    void run();
+    void stop();
+
+    ServerStats stats() const;
+
+private:
+    struct Connection;
+    struct State;
+
+    ServerOptions options_;
+    std::unique_ptr<State> state_;
+};
+
+// Ответ сервера.
+struct ServerResponse
+{
+    ServerStatus status = SERVER_OK;
+    uint32_t id = 0;
+    std::string payload;
+};
+
+// Разобранное сервером выражение.
+struct ServerHandle
+{
+    uint64_t handle = 0;
+    std::vector<std::string> variables;
+};
+
+// Блокирующий клиент сервера вычислений.
+//
+// Методы parse, diff, eval, eval_batch, print, release отправляют запрос и ждут ответа;
+// ошибка сервера передаётся исключением std::runtime_error. Для конвейера запросы
+// отправляются send, а ответы читаются receive в том же порядке.
+class EvalClient
+{
+public:
+    explicit EvalClient(const std::string &path);
+    ~EvalClient();
+
+    EvalClient(const EvalClient &) = delete;
+    EvalClient &operator=(const EvalClient &) = delete;
+
+    ServerHandle parse(const std::string &source);
+    ServerHandle diff(uint64_t handle, const std::string &by);
+    double eval(uint64_t handle, const std::vector<double> &values);
+    // values - count точек по handle.variables.size() значений подряд.
+    std::vector<double> eval_batch(uint64_t handle, size_t count, const std::vector<double> &values);
+    std::string print(uint64_t handle);
+    void release(uint64_t handle);
+
+    // Отправка запроса без ожидания ответа; возвращает номер запроса.
+    uint32_t send(ServerOp op, const std::string &payload);
+    ServerResponse receive();
+
+    // Данные запросов.
+    static std::string handle_payload(uint64_t handle);
+    static std::string eval_payload(uint64_t handle, const std::vector<double> &values);
+    static std::string batch_payload(uint64_t handle, size_t count, const std::vector<double> &values);
+
+private:
+    int fd_;
+    uint32_t next_id_ = 1;
+    std::string buffer_;
+
+    ServerResponse call(ServerOp op, const std::string &payload);
+};
+
+// Параметры нагрузочного теста.
+struct LoadOptions
+{
+    std::string path;
+    std::string expression;
+    // Значения переменных выражения (недостающие равны 1).
+    std::map<std::string, long double> params;
+    size_t connections = 4;
+    // Число запросов на каждое соединение.
+    size_t requests = 10000;
+    // Наибольшее число запросов без ответа в одном соединении.
+    size_t pipeline = 16;
+    // Число точек в запросе (1 - SERVER_EVAL, больше - SERVER_BATCH).
+    size_t batch = 1;
+};
+
+struct LoadReport
+{
+    size_t requests = 0;
+    size_t points = 0;
+    double seconds = 0;
+    double requests_per_second = 0;
+    double points_per_second = 0;
+    // Задержка от отправки запроса до получения ответа, микросекунды.
+    double latency_mean = 0;
+    double latency_p50 = 0;
+    double latency_p99 = 0;
+    double latency_max = 0;
+};
+
+// Нагрузка сервера из нескольких соединений с конвейером запросов.
+LoadReport run_load(const LoadOptions &options);
+
+#endif // HEADER_GUARD_SERVER_HPP_INCLUDED
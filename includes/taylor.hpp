@@ -0,0 +1,88 @@
+#ifndef HEADER_GUARD_TAYLOR_HPP_INCLUDED
+#define HEADER_GUARD_TAYLOR_HPP_INCLUDED
+
+#include <string>
+#include <vector>
+
+#include "compiler.hpp"
+#include "expression.hpp"
+
+// Усечённый ряд Тейлора f(t0 + t) = c[0] + c[1] t + ... + c[k] t^k.
+//
+// Арифметика над такими числами вычисляет значение и все производные до порядка k
+// одновременно: переменная задаётся рядом x0 + t, и результат любого выражения от неё
+// содержит f(x0) и f^(n)(x0) / n!.
+template <typename T>
+class Taylor
+{
+public:
+    // Константа value в виде ряда порядка order.
+    explicit Taylor(size_t order = 0, const T &value = T(0));
+    // Независимая переменная value + t.
+    static Taylor<T> variable(const T &value, size_t order);
+
+    size_t order() const;
+    const T &operator[](size_t n) const;
+    T &operator[](size_t n);
+    const std::vector<T> &coefficients() const;
+
+    // Производная порядка n: n! * c[n].
+    T derivative(size_t n) const;
+    // Все производные 0..order.
+    std::vector<T> derivatives() const;
+
+    Taylor<T> operator-() const;
+    Taylor<T> operator+(const Taylor<T> &other) const;
+    Taylor<T> operator-(const Taylor<T> &other) const;
+    Taylor<T> operator*(const Taylor<T> &other) const;
+    Taylor<T> operator/(const Taylor<T> &other) const;
+
+private:
+    std::vector<T> c;
+};
+
+template <typename T>
+Taylor<T> sin(const Taylor<T> &a);
+template <typename T>
+Taylor<T> cos(const Taylor<T> &a);
+template <typename T>
+Taylor<T> ln(const Taylor<T> &a);
+template <typename T>
+Taylor<T> exp(const Taylor<T> &a);
+template <typename T>
+Taylor<T> sqrt(const Taylor<T> &a);
+template <typename T>
+Taylor<T> pow(const Taylor<T> &a, int n);
+template <typename T>
+Taylor<T> pow(const Taylor<T> &a, const T &p);
+template <typename T>
+Taylor<T> pow(const Taylor<T> &a, const Taylor<T> &b);
+
+// Вычисление производных высоких порядков выражения.
+//
+// Выражение компилируется в линейную программу (общие подвыражения вычисляются один
+// раз), которая затем выполняется над рядами Тейлора вместо чисел: стоимость - O(k^2)
+// на инструкцию вместо экспоненциального роста дерева при повторном diff.
+template <typename T>
+class TaylorEvaluator
+{
+public:
+    TaylorEvaluator(const Expression<T> &expr, const std::vector<std::string> &variables, size_t order);
+
+    // Коэффициенты ряда f(point + t * direction), out[0..order].
+    void coefficients(const T *point, const T *direction, T *out) const;
+
+    // Производные d^n f / dx^n, n = 0..order, по переменной с номером variable
+    // (остальные переменные фиксированы).
+    void derivatives(const T *point, size_t variable, T *out) const;
+    std::vector<T> derivatives(const T *point, size_t variable) const;
+
+    size_t order() const;
+    const std::vector<std::string> &variables() const;
+
+private:
+    CompiledExpression<T> compiled_;
+    size_t order_;
+};
+
+#endif // HEADER_GUARD_TAYLOR_HPP_INCLUDED
@@ -0,0 +1,166 @@
+#ifndef HEADER_GUARD_TRACE_HPP_INCLUDED
+#define HEADER_GUARD_TRACE_HPP_INCLUDED
+
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+
+// Трассировка этапов (разбор, дифференцирование, компиляция, вычисление).
+//
+// Интервалы записываются в кольцевой буфер своего потока (старые события затираются)
+// и выгружаются в формате Chrome trace event (chrome://tracing, Perfetto). Пока запись
+// не включена, отметка интервала - одна атомарная загрузка флага. С -DEXPR_NO_TRACE
+// (make TRACE=0) макросы TRACE_SCOPE и TRACE_BATCH_SCOPE не порождают кода.
+class Trace
+{
+public:
+    // Число событий в буфере одного потока.
+    static constexpr size_t BUFFER_EVENTS = 1 << 15;
+
+    static void start();
+    static void stop();
+    static bool recording()
+    {
+        return recording_.load(std::memory_order_relaxed);
+    }
+    // Удаление записанных событий.
+    static void clear();
+    // Число событий во всех буферах.
+    static size_t size();
+    // Число буферов: буфер завершившегося потока переиспользуется следующим.
+    static size_t buffers();
+
+    // Выгрузка в JSON: {"traceEvents": [{"name", "ph": "X", "ts", "dur", "pid", "tid"}, ...]}.
+    static void write_chrome(std::ostream &out);
+
+    // Наносекунды от момента загрузки программы.
+    static uint64_t now();
+    // Запись интервала; name должен жить до выгрузки (строковый литерал).
+    // count - необязательный счётчик (например, число лексем), выгружается в args;
+    // такие события (пачки TraceBatch) выводятся на отдельной дорожке с pid 2.
+    static void record(const char *name, uint64_t begin, uint64_t duration, uint64_t count = 0);
+
+private:
+    static std::atomic<bool> recording_;
+};
+
+// Интервал от создания до уничтожения объекта.
+class TraceScope
+{
+public:
+    explicit TraceScope(const char *name)
+        : name_(name), active_(Trace::recording()), begin_(active_ ? Trace::now() : 0)
+    {
+    }
+    ~TraceScope()
+    {
+        if (active_)
+        {
+            Trace::record(name_, begin_, Trace::now() - begin_);
+        }
+    }
+
+    TraceScope(const TraceScope &) = delete;
+    TraceScope &operator=(const TraceScope &) = delete;
+
+private:
+    const char *name_;
+    bool active_;
+    uint64_t begin_;
+};
+
+// Накопление коротких интервалов (например, чтение отдельных лексем) в одно событие
+// на limit интервалов: длительность события - их суммарное время, count - их число.
+class TraceBatch
+{
+public:
+    explicit TraceBatch(const char *name, uint64_t limit = 256) : name_(name), limit_(limit)
+    {
+    }
+    ~TraceBatch()
+    {
+        flush();
+    }
+
+    TraceBatch(const TraceBatch &) = delete;
+    TraceBatch &operator=(const TraceBatch &) = delete;
+    TraceBatch(TraceBatch &&other) noexcept
+        : name_(other.name_), limit_(other.limit_), total_(other.total_), count_(other.count_)
+    {
+        other.count_ = 0;
+    }
+    TraceBatch &operator=(TraceBatch &&other) noexcept
+    {
+        flush();
+        name_ = other.name_;
+        limit_ = other.limit_;
+        total_ = other.total_;
+        count_ = other.count_;
+        other.count_ = 0;
+        return *this;
+    }
+
+    void add(uint64_t duration)
+    {
+        total_ += duration;
+        if (++count_ == limit_)
+        {
+            flush();
+        }
+    }
+    // Запись накопленного события.
+    void flush()
+    {
+        if (count_ != 0)
+        {
+            uint64_t end = Trace::now();
+            Trace::record(name_, end - total_, total_, count_);
+            total_ = 0;
+            count_ = 0;
+        }
+    }
+
+private:
+    const char *name_;
+    uint64_t limit_;
+    uint64_t total_ = 0;
+    uint64_t count_ = 0;
+};
+
+// Один интервал, добавляемый в TraceBatch.
+class TraceBatchScope
+{
+public:
+    explicit TraceBatchScope(TraceBatch &batch)
+        : batch_(batch), active_(Trace::recording()), begin_(active_ ? Trace::now() : 0)
+    {
+    }
+    ~TraceBatchScope()
+    {
+        if (active_)
+        {
+            batch_.add(Trace::now() - begin_);
+        }
+    }
+
+    TraceBatchScope(const TraceBatchScope &) = delete;
+    TraceBatchScope &operator=(const TraceBatchScope &) = delete;
+
+private:
+    TraceBatch &batch_;
+    bool active_;
+    uint64_t begin_;
+};
+
+#define TRACE_CONCAT_IMPL(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_IMPL(a, b)
+
+#ifdef EXPR_NO_TRACE
+#define TRACE_SCOPE(name)
+#define TRACE_BATCH_SCOPE(batch)
+#else
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#define TRACE_BATCH_SCOPE(batch) TraceBatchScope TRACE_CONCAT(trace_scope_, __LINE__)(batch)
+#endif
+
+#endif // HEADER_GUARD_TRACE_HPP_INCLUDED
@@ -0,0 +1,59 @@
+#ifndef HEADER_GUARD_VECMATH_HPP_INCLUDED
+#define HEADER_GUARD_VECMATH_HPP_INCLUDED
+
+#include <cstddef>
+
+// Набор инструкций векторных функций.
+enum VecMathLevel
+{
+    // Поэлементный вызов стандартной библиотеки (libm).
+    VECMATH_LIBM = 0,
+    VECMATH_SSE2 = 1,
+    VECMATH_AVX2 = 2,
+    VECMATH_AVX512 = 3
+};
+
+// Векторные sin, cos, ln, exp и pow над массивами double и float.
+//
+// Аргумент приводится к малому интервалу (по модулю pi/2 или ln 2, выделением
+// двоичного порядка), на котором функция приближается многочленом; ветви заменены
+// выбором по маске, поэтому одна реализация компилируется под SSE2, AVX2 и AVX-512, а
+// нужная выбирается по процессору при первом вызове. Аргументы вне быстрого пути
+// (|x| > 1e5 у sin и cos, x <= 0 и не конечные x у ln и pow, |y| > 2^900 у pow)
+// вычисляются libm, как и pow на SSE2. Версии для float вычисляются в double и округляются.
+//
+// Границы ошибки *_ULP (в ulp double) выполняются и для libm и проверяются тестом на
+// всём диапазоне аргументов. Сборка make VECMATH=0 (-DEXPR_NO_VECMATH) или
+// set_level(VECMATH_LIBM) оставляет только libm.
+class VecMath
+{
+public:
+    static constexpr double SIN_ULP = 1.0;
+    static constexpr double COS_ULP = 1.0;
+    static constexpr double LN_ULP = 1.0;
+    static constexpr double EXP_ULP = 1.5;
+    static constexpr double POW_ULP = 2.0;
+
+    // Наилучший набор инструкций процессора и используемый сейчас.
+    static VecMathLevel best();
+    static VecMathLevel level();
+    // Выбор набора инструкций (не выше best()); VECMATH_LIBM - отключение векторных версий.
+    static void set_level(VecMathLevel level);
+    static const char *name(VecMathLevel level);
+
+    // out[i] = f(x[i]), i < count; out может совпадать с x.
+    static void sin(const double *x, double *out, size_t count);
+    static void cos(const double *x, double *out, size_t count);
+    static void ln(const double *x, double *out, size_t count);
+    static void exp(const double *x, double *out, size_t count);
+    // out[i] = x[i] ^ y[i].
+    static void pow(const double *x, const double *y, double *out, size_t count);
+
+    static void sin(const float *x, float *out, size_t count);
+    static void cos(const float *x, float *out, size_t count);
+    static void ln(const float *x, float *out, size_t count);
+    static void exp(const float *x, float *out, size_t count);
+    static void pow(const float *x, const float *y, float *out, size_t count);
+};
+
+#endif // HEADER_GUARD_VECMATH_HPP_INCLUDED
@@ -1,5 +1,23 @@
 #include "../includes/TestSystem.hpp"
+#include "../includes/alloc.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <exception>
+#include <fstream>
 #include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 // Colors
 
@@ -12,27 +30,313 @@
 
 using namespace TestSystem;
 
-TestResult TestSystem::run_test(const char *name, TestScenario test, size_t timeout_ms [[maybe_unused]], bool inspect [[maybe_unused]])
+// Замедление меньше этого (мс) не считается регрессией: шум измерения коротких тестов.
+static constexpr double MIN_REGRESSION_MS = 2;
+
+// Время одного теста (медиана по повторам).
+struct Timing
 {
-    printf("Running test %20s: ", name);
+    double wall_ms = 0;
+    double cpu_ms = 0;
+};
+
+// Результат, передаваемый дочерним процессом родителю.
+struct Report
+{
+    TestResult result;
+    Timing timing;
+    // Выделения памяти за последний запуск (во всех потоках теста).
+    uint64_t allocations;
+    char message[256];
+};
+
+struct Settings
+{
+    size_t repeats = 1;
+    double threshold = 0.5;
+    bool inspect = false;
+    std::string baseline_path;
+    std::string update_path;
+    std::map<std::string, Timing> baseline;
+    // Измеренное время в порядке запуска (для записи базового файла).
+    std::vector<std::pair<std::string, Timing>> measured;
+    size_t failed = 0;
+    size_t total = 0;
+};
+
+static Settings &settings()
+{
+    static Settings instance;
+    return instance;
+}
+
+// Базовый файл: строки "имя<TAB>реальное мс<TAB>процессорное мс", # - комментарий.
+static std::map<std::string, Timing> read_baseline(const std::string &path)
+{
+    std::map<std::string, Timing> baseline;
+    std::ifstream file(path);
+    std::string line;
+    while (std::getline(file, line))
+    {
+        size_t tab = line.find('\t');
+        if (line.empty() || line[0] == '#' || tab == std::string::npos)
+        {
+            continue;
+        }
+        std::istringstream values(line.substr(tab + 1));
+        Timing timing;
+        if (values >> timing.wall_ms >> timing.cpu_ms)
+        {
+            baseline[line.substr(0, tab)] = timing;
+        }
+    }
+    return baseline;
+}
+
+void TestSystem::configure(int argc, char *argv[])
+{
+    Settings &config = settings();
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--repeat" && i + 1 < argc)
+        {
+            config.repeats = std::max<size_t>(1, std::stoul(argv[++i]));
+        }
+        else if (arg == "--baseline" && i + 1 < argc)
+        {
+            config.baseline_path = argv[++i];
+            config.baseline = read_baseline(config.baseline_path);
+        }
+        else if (arg == "--update-baseline" && i + 1 < argc)
+        {
+            config.update_path = argv[++i];
+        }
+        else if (arg == "--threshold" && i + 1 < argc)
+        {
+            config.threshold = std::stod(argv[++i]);
+        }
+        else if (arg == "--inspect")
+        {
+            config.inspect = true;
+        }
+        else
+        {
+            fprintf(stderr, "Unknown test option %s\n", arg.c_str());
+            exit(ERROR);
+        }
+    }
+}
+
+static double cpu_now_ms()
+{
+    timespec time;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time);
+    return time.tv_sec * 1e3 + time.tv_nsec / 1e6;
+}
+
+static double median(std::vector<double> values)
+{
+    std::sort(values.begin(), values.end());
+    size_t middle = values.size() / 2;
+    return values.size() % 2 == 1 ? values[middle] : (values[middle - 1] + values[middle]) / 2;
+}
+
+// Выполнение теста repeats раз в текущем процессе.
+static Report execute(TestScenario test, size_t repeats)
+{
+    Report report{OK, {}, 0, {}};
+    std::vector<double> wall;
+    std::vector<double> cpu;
+    for (size_t i = 0; i < repeats && report.result == OK; ++i)
+    {
+        AllocStats alloc_begin = Allocations::total();
+        auto wall_begin = std::chrono::steady_clock::now();
+        double cpu_begin = cpu_now_ms();
+        try
+        {
+            report.result = test() ? OK : FAIL;
+        }
+        catch (const std::exception &exc)
+        {
+            report.result = EXCEPTION;
+            snprintf(report.message, sizeof(report.message), "%s", exc.what());
+        }
+        cpu.push_back(cpu_now_ms() - cpu_begin);
+        wall.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - wall_begin).count());
+        report.allocations = (Allocations::total() - alloc_begin).allocations;
+    }
+    report.timing = Timing{median(wall), median(cpu)};
+    return report;
+}
+
+// Выполнение в дочернем процессе; родитель ждёт отчёт не дольше timeout_ms на запуск.
+static Report execute_forked(TestScenario test, size_t repeats, size_t timeout_ms)
+{
+    Report report{ERROR, {}, 0, {}};
+    int channel[2];
+    if (pipe(channel) != 0)
+    {
+        snprintf(report.message, sizeof(report.message), "pipe: %s", strerror(errno));
+        return report;
+    }
     fflush(stdout);
-    try
+    fflush(stderr);
+    pid_t child = fork();
+    if (child < 0)
+    {
+        snprintf(report.message, sizeof(report.message), "fork: %s", strerror(errno));
+        close(channel[0]);
+        close(channel[1]);
+        return report;
+    }
+    if (child == 0)
+    {
+        close(channel[0]);
+        Report result = execute(test, repeats);
+        fflush(stdout);
+        fflush(stderr);
+        ssize_t written = write(channel[1], &result, sizeof(result));
+        _exit(written == static_cast<ssize_t>(sizeof(result)) ? 0 : 1);
+    }
+
+    close(channel[1]);
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms * repeats);
+    size_t received = 0;
+    bool timed_out = false;
+    while (received < sizeof(report))
+    {
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+        pollfd descriptor{channel[0], POLLIN, 0};
+        int ready = poll(&descriptor, 1, static_cast<int>(std::max<long long>(0, left.count())));
+        if (ready < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (ready == 0)
+        {
+            timed_out = true;
+            break;
+        }
+        ssize_t count = read(channel[0], reinterpret_cast<char *>(&report) + received, sizeof(report) - received);
+        if (count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (count <= 0)
+        {
+            break;
+        }
+        received += count;
+    }
+    close(channel[0]);
+    if (timed_out)
     {
-        bool result = test();
-        if (result)
+        kill(child, SIGKILL);
+    }
+    int status = 0;
+    waitpid(child, &status, 0);
+
+    if (timed_out)
+    {
+        report = Report{TIMEOUT, {}, 0, {}};
+        snprintf(report.message, sizeof(report.message), "timeout %zu ms", timeout_ms);
+    }
+    else if (received < sizeof(report))
+    {
+        report = Report{ERROR, {}, 0, {}};
+        if (WIFSIGNALED(status))
         {
-            printf(BGREEN "[OK]\n" RESET);
+            snprintf(report.message, sizeof(report.message), "killed by signal %d (%s)", WTERMSIG(status),
+                     strsignal(WTERMSIG(status)));
         }
         else
         {
-            printf(BRED "[FAIL]\n" RESET);
+            snprintf(report.message, sizeof(report.message), "exited with status %d", WEXITSTATUS(status));
         }
     }
-    catch (const std::exception &exc)
+    return report;
+}
+
+TestResult TestSystem::run_test(const char *name, TestScenario test, size_t timeout_ms, bool inspect)
+{
+    Settings &config = settings();
+    printf("Running test %20s: ", name);
+    fflush(stdout);
+    Report report = inspect || config.inspect ? execute(test, config.repeats)
+                                              : execute_forked(test, config.repeats, timeout_ms);
+
+    // Сравнение с базовым временем (только для прошедших тестов).
+    auto base = config.baseline.find(name);
+    bool has_base = base != config.baseline.end();
+    if (report.result == OK && has_base &&
+        report.timing.wall_ms > base->second.wall_ms * (1 + config.threshold) &&
+        report.timing.wall_ms - base->second.wall_ms > MIN_REGRESSION_MS)
     {
-        printf(BPURPLE "[EXC] (exception: %s)\n" RESET, exc.what());
-        exit(EXCEPTION);
+        report.result = SLOW;
     }
 
-    return OK;
+    switch (report.result)
+    {
+    case OK:
+        printf(BGREEN "[OK]" RESET);
+        break;
+    case FAIL:
+        printf(BRED "[FAIL]" RESET);
+        break;
+    case EXCEPTION:
+        printf(BPURPLE "[EXC] (exception: %s)" RESET, report.message);
+        break;
+    case TIMEOUT:
+        printf(BYELLOW "[TIMEOUT] (%s)" RESET, report.message);
+        break;
+    case SLOW:
+        printf(BYELLOW "[SLOW]" RESET);
+        break;
+    default:
+        printf(BRED "[ERROR] (%s)" RESET, report.message);
+        break;
+    }
+    if (report.result == OK || report.result == FAIL || report.result == SLOW)
+    {
+        printf(BCYAN " wall %.2f ms, cpu %.2f ms" RESET, report.timing.wall_ms, report.timing.cpu_ms);
+        if (Allocations::counting())
+        {
+            printf(BCYAN ", alloc %llu" RESET, static_cast<unsigned long long>(report.allocations));
+        }
+        if (has_base)
+        {
+            printf(" (baseline %.2f ms)", base->second.wall_ms);
+        }
+        config.measured.emplace_back(name, report.timing);
+    }
+    printf("\n");
+
+    ++config.total;
+    if (report.result != OK)
+    {
+        ++config.failed;
+    }
+    return report.result;
+}
+
+int TestSystem::summary()
+{
+    Settings &config = settings();
+    if (!config.update_path.empty())
+    {
+        std::ofstream file(config.update_path);
+        file << "# test\twall ms\tcpu ms (median of " << config.repeats << ")\n";
+        for (const auto &[name, timing] : config.measured)
+        {
+            file << name << '\t' << timing.wall_ms << '\t' << timing.cpu_ms << '\n';
+        }
+        if (!file)
+        {
+            fprintf(stderr, "Cannot write %s\n", config.update_path.c_str());
+            return EXIT_FAILURE;
+        }
+    }
+    printf("%zu of %zu tests passed\n", config.total - config.failed, config.total);
+    return config.failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
@@ -0,0 +1,205 @@
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include "../includes/alloc.hpp"
+
+// Счётчики потока инициализируются константой и не требуют выделений при первом
+// обращении, поэтому доступны из operator new.
+static thread_local AllocStats thread_stats;
+static std::atomic<uint64_t> total_allocations{0};
+static std::atomic<uint64_t> total_deallocations{0};
+static std::atomic<uint64_t> total_bytes{0};
+
+bool Allocations::counting()
+{
+#ifdef EXPR_COUNT_ALLOCATIONS
+    return true;
+#else
+    return false;
+#endif
+}
+
+AllocStats Allocations::thread()
+{
+    return thread_stats;
+}
+
+AllocStats Allocations::total()
+{
+    return {total_allocations.load(std::memory_order_relaxed), total_deallocations.load(std::memory_order_relaxed),
+            total_bytes.load(std::memory_order_relaxed)};
+}
+
+#ifdef EXPR_COUNT_ALLOCATIONS
+
+// =====================
+// |operator new/delete|
+// =====================
+
+static void *counted_allocate(size_t size, size_t alignment) noexcept
+{
+    size = size == 0 ? 1 : size;
+    void *ptr = nullptr;
+    if (alignment <= __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+    {
+        ptr = std::malloc(size);
+    }
+    else
+    {
+        // aligned_alloc требует размер, кратный выравниванию.
+        ptr = std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+    }
+    if (ptr != nullptr)
+    {
+        ++thread_stats.allocations;
+        thread_stats.bytes += size;
+        total_allocations.fetch_add(1, std::memory_order_relaxed);
+        total_bytes.fetch_add(size, std::memory_order_relaxed);
+    }
+    return ptr;
+}
+
+// Как у стандартного operator new: при нехватке памяти вызывается обработчик
+// std::set_new_handler, пока он установлен; без обработчика - std::bad_alloc.
+static void *counted_allocate_or_throw(size_t size, size_t alignment)
+{
+    for (;;)
+    {
+        void *ptr = counted_allocate(size, alignment);
+        if (ptr != nullptr)
+        {
+            return ptr;
+        }
+        std::new_handler handler = std::get_new_handler();
+        if (handler == nullptr)
+        {
+            throw std::bad_alloc();
+        }
+        handler();
+    }
+}
+
+// Версия nothrow тоже вызывает обработчик, а его исключение превращает в nullptr.
+static void *counted_allocate_nothrow(size_t size, size_t alignment) noexcept
+{
+    try
+    {
+        return counted_allocate_or_throw(size, alignment);
+    }
+    catch (const std::bad_alloc &)
+    {
+        return nullptr;
+    }
+}
+
+static void counted_free(void *ptr) noexcept
+{
+    if (ptr != nullptr)
+    {
+        ++thread_stats.deallocations;
+        total_deallocations.fetch_add(1, std::memory_order_relaxed);
+        std::free(ptr);
+    }
+}
+
+void *operator new(size_t size)
+{
+    return counted_allocate_or_throw(size, 0);
+}
+
+void *operator new[](size_t size)
+{
+    return counted_allocate_or_throw(size, 0);
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+    return counted_allocate_nothrow(size, 0);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept
+{
+    return counted_allocate_nothrow(size, 0);
+}
+
+void *operator new(size_t size, std::align_val_t alignment)
+{
+    return counted_allocate_or_throw(size, static_cast<size_t>(alignment));
+}
+
+void *operator new[](size_t size, std::align_val_t alignment)
+{
+    return counted_allocate_or_throw(size, static_cast<size_t>(alignment));
+}
+
+void *operator new(size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept
+{
+    return counted_allocate_nothrow(size, static_cast<size_t>(alignment));
+}
+
+void *operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept
+{
+    return counted_allocate_nothrow(size, static_cast<size_t>(alignment));
+}
+
+void operator delete(void *ptr) noexcept
+{
+    counted_free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept
+{
+    counted_free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+    counted_free(ptr);
+}
+
+void operator delete[](void *ptr, size_t) noexcept
+{
+    counted_free(ptr);
+}
+
+void operator delete(void *ptr, const std::nothrow_t &) noexcept
+{
+    counted_free(ptr);
+}
+
+void operator delete[](void *ptr, const std::nothrow_t &) noexcept
+{
+    counted_free(ptr);
+}
+
+void operator delete(void *ptr, std::align_val_t) noexcept
+{
+    counted_free(ptr);
+}
+
+void operator delete[](void *ptr, std::align_val_t) noexcept
+{
+    counted_free(ptr);
+}
+
+void operator delete(void *ptr, size_t, std::align_val_t) noexcept
+{
+    counted_free(ptr);
+}
+
+void operator delete[](void *ptr, size_t, std::align_val_t) noexcept
+{
+    counted_free(ptr);
+}
+
+void operator delete(void *ptr, std::align_val_t, const std::nothrow_t &) noexcept
+{
+    counted_free(ptr);
+}
+
+void operator delete[](void *ptr, std::align_val_t, const std::nothrow_t &) noexcept
+{
+    counted_free(ptr);
+}
+
+#endif // EXPR_COUNT_ALLOCATIONS
@@ -0,0 +1,200 @@
+#include "../includes/analysis.hpp"
+#include "../includes/trace.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <set>
+#include <unordered_map>
+#include <utility>
+
+// Блок make_shared: счётчики ссылок с указателем таблицы виртуальных функций и сам узел.
+static constexpr size_t SHARED_CONTROL_BYTES = 2 * sizeof(void *);
+
+static size_t saturating_add(size_t a, size_t b)
+{
+    return a > std::numeric_limits<size_t>::max() - b ? std::numeric_limits<size_t>::max() : a + b;
+}
+
+// Память узла в куче; для n-арных узлов - с массивами операндов (по числу операндов,
+// без запаса ёмкости).
+template <typename T>
+static size_t node_bytes(const Expression<T> &expr)
+{
+    size_t arity = expr.arity();
+    switch (expr.kind())
+    {
+    case NODE_NEGATE:
+        return SHARED_CONTROL_BYTES + sizeof(Negate<T>);
+    case NODE_ADD:
+        return SHARED_CONTROL_BYTES + sizeof(OpAdd<T>);
+    case NODE_SUB:
+        return SHARED_CONTROL_BYTES + sizeof(OpSub<T>);
+    case NODE_MULT:
+        return SHARED_CONTROL_BYTES + sizeof(OpMult<T>);
+    case NODE_DIV:
+        return SHARED_CONTROL_BYTES + sizeof(OpDiv<T>);
+    case NODE_POW:
+        return SHARED_CONTROL_BYTES + sizeof(OpPow<T>);
+    case NODE_SIN:
+        return SHARED_CONTROL_BYTES + sizeof(SinFunc<T>);
+    case NODE_COS:
+        return SHARED_CONTROL_BYTES + sizeof(CosFunc<T>);
+    case NODE_LN:
+        return SHARED_CONTROL_BYTES + sizeof(LnFunc<T>);
+    case NODE_EXP:
+        return SHARED_CONTROL_BYTES + sizeof(ExpFunc<T>);
+    case NODE_SUM:
+        // Слагаемые, знаки (T) и биты вычитания (словами по 64 бита).
+        return SHARED_CONTROL_BYTES + sizeof(OpSum<T>) + arity * (sizeof(Expression<T>) + sizeof(T)) +
+               (arity + 63) / 64 * sizeof(uint64_t);
+    case NODE_PRODUCT:
+        return SHARED_CONTROL_BYTES + sizeof(OpProduct<T>) + arity * sizeof(Expression<T>);
+    default:
+        return 0;
+    }
+}
+
+const char *node_kind_name(NodeKind kind)
+{
+    switch (kind)
+    {
+    case NODE_VALUE:
+        return "value";
+    case NODE_VARIABLE:
+        return "variable";
+    case NODE_NEGATE:
+        return "negate";
+    case NODE_ADD:
+        return "add";
+    case NODE_SUB:
+        return "sub";
+    case NODE_MULT:
+        return "mult";
+    case NODE_DIV:
+        return "div";
+    case NODE_POW:
+        return "pow";
+    case NODE_SIN:
+        return "sin";
+    case NODE_COS:
+        return "cos";
+    case NODE_LN:
+        return "ln";
+    case NODE_EXP:
+        return "exp";
+    case NODE_SUM:
+        return "sum";
+    case NODE_PRODUCT:
+        return "product";
+    }
+    return "unknown";
+}
+
+template <typename T>
+ExpressionStats analyze(const Expression<T> &expr, const CostModel &costs)
+{
+    TRACE_SCOPE("analyze");
+
+    // Для каждого различного узла в куче: размер дерева, глубина и стоимость с
+    // повторением общих поддеревьев.
+    struct Info
+    {
+        size_t tree_nodes;
+        size_t depth;
+        long double cost;
+    };
+
+    ExpressionStats stats;
+    std::set<uint32_t> symbols;
+    std::unordered_map<const ExpressionBase<T> *, Info> nodes;
+
+    // Учёт листа, принадлежащего уже учтённому узлу (или корня-листа).
+    auto leaf = [&](const Expression<T> &operand)
+    {
+        ++stats.unique_nodes;
+        ++stats.operations[operand.kind()];
+        if (operand.kind() == NODE_VARIABLE)
+        {
+            symbols.insert(operand.symbol());
+        }
+    };
+
+    if (expr.node() == nullptr)
+    {
+        leaf(expr);
+        stats.tree_nodes = 1;
+        stats.depth = 1;
+    }
+    else
+    {
+        // Обратный порядок обхода: узел учитывается после всех своих операндов.
+        std::vector<std::pair<const Expression<T> *, bool>> stack{{&expr, false}};
+        while (!stack.empty())
+        {
+            auto [current, expanded] = stack.back();
+            const ExpressionBase<T> *node = current->node();
+            if (nodes.count(node) != 0)
+            {
+                stack.pop_back();
+                continue;
+            }
+            if (!expanded)
+            {
+                stack.back().second = true;
+                for (size_t i = 0; i < current->arity(); ++i)
+                {
+                    const Expression<T> &operand = current->operand(i);
+                    if (operand.node() != nullptr && nodes.count(operand.node()) == 0)
+                    {
+                        stack.emplace_back(&operand, false);
+                    }
+                }
+                continue;
+            }
+            stack.pop_back();
+
+            long double operation = operation_cost(*current, costs);
+            Info info{1, 1, operation};
+            for (size_t i = 0; i < current->arity(); ++i)
+            {
+                const Expression<T> &operand = current->operand(i);
+                Info child{1, 1, 0};
+                if (operand.node() == nullptr)
+                {
+                    leaf(operand);
+                }
+                else
+                {
+                    child = nodes.at(operand.node());
+                }
+                info.tree_nodes = saturating_add(info.tree_nodes, child.tree_nodes);
+                info.depth = std::max(info.depth, child.depth + 1);
+                info.cost += child.cost;
+            }
+            nodes.emplace(node, info);
+
+            ++stats.unique_nodes;
+            ++stats.heap_nodes;
+            ++stats.operations[current->kind()];
+            stats.bytes += node_bytes(*current);
+            stats.dag_cost += operation;
+        }
+
+        const Info &root = nodes.at(expr.node());
+        stats.tree_nodes = root.tree_nodes;
+        stats.depth = root.depth;
+        stats.tree_cost = root.cost;
+    }
+
+    stats.sharing = static_cast<double>(stats.tree_nodes) / static_cast<double>(stats.unique_nodes);
+    for (uint32_t symbol : symbols)
+    {
+        stats.variables.push_back(SymbolTable::name(symbol));
+    }
+    std::sort(stats.variables.begin(), stats.variables.end());
+    return stats;
+}
+
+template ExpressionStats analyze(const Expression<long double> &, const CostModel &);
+template ExpressionStats analyze(const Expression<std::complex<long double>> &, const CostModel &);
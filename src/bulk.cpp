@@ -0,0 +1,526 @@
+#include "../includes/bulk.hpp"
+#include "../includes/trace.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <charconv>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <limits>
+#include <stdexcept>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Число строк, разбираемых перед одним пакетным вычислением.
+static constexpr size_t BULK_BLOCK = 1024;
+// Наименьший размер части CSV, ради которой запускается отдельный поток.
+static constexpr size_t MIN_CHUNK_BYTES = 1 << 16;
+// Число значений, форматируемых одним потоком за раунд записи.
+static constexpr size_t TEXT_CHUNK = 1 << 16;
+
+// ============
+// |MappedFile|
+// ============
+
+MappedFile::MappedFile(const std::string &path) : address_(nullptr), size_(0)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        throw std::runtime_error("Cannot open " + path + ": " + std::strerror(errno));
+    }
+    struct stat info;
+    if (::fstat(fd, &info) != 0)
+    {
+        int error = errno;
+        ::close(fd);
+        throw std::runtime_error("Cannot stat " + path + ": " + std::strerror(error));
+    }
+    size_ = static_cast<size_t>(info.st_size);
+    if (size_ != 0)
+    {
+        address_ = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (address_ == MAP_FAILED)
+        {
+            int error = errno;
+            ::close(fd);
+            throw std::runtime_error("Cannot map " + path + ": " + std::strerror(error));
+        }
+        ::madvise(address_, size_, MADV_SEQUENTIAL);
+    }
+    // Отображение остаётся действительным после закрытия дескриптора.
+    ::close(fd);
+}
+
+MappedFile::~MappedFile()
+{
+    if (address_ != nullptr)
+    {
+        ::munmap(address_, size_);
+    }
+}
+
+const char *MappedFile::data() const
+{
+    return static_cast<const char *>(address_);
+}
+
+size_t MappedFile::size() const
+{
+    return size_;
+}
+
+// ================
+// |BulkEvaluator|
+// ================
+
+// Выполнение job(0..parts) в parts потоках; первое исключение передаётся вызывающему.
+template <typename Job>
+static void run_parallel(size_t parts, const Job &job)
+{
+    std::vector<std::exception_ptr> errors(parts);
+    auto guarded = [&](size_t part)
+    {
+        try
+        {
+            job(part);
+        }
+        catch (...)
+        {
+            errors[part] = std::current_exception();
+        }
+    };
+    std::vector<std::thread> workers;
+    for (size_t part = 1; part < parts; ++part)
+    {
+        workers.emplace_back(guarded, part);
+    }
+    if (parts != 0)
+    {
+        guarded(0);
+    }
+    for (std::thread &worker : workers)
+    {
+        worker.join();
+    }
+    for (const std::exception_ptr &error : errors)
+    {
+        if (error)
+        {
+            std::rethrow_exception(error);
+        }
+    }
+}
+
+// Перестановка байтов double из little-endian в порядок байтов машины (и обратно).
+static inline double little_endian(double value)
+{
+    if constexpr (std::endian::native == std::endian::big)
+    {
+        uint64_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        bits = __builtin_bswap64(bits);
+        std::memcpy(&value, &bits, sizeof(bits));
+    }
+    return value;
+}
+
+static inline bool is_blank(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+// Наибольшее k, при котором 10^k точно представимо в T (5^k < 2^digits).
+template <typename T>
+static constexpr int exact_power_limit()
+{
+    long double limit = 1;
+    for (int i = 0; i < std::numeric_limits<T>::digits; ++i)
+    {
+        limit *= 2;
+    }
+    int k = 0;
+    for (long double power = 5; power < limit; power *= 5)
+    {
+        ++k;
+    }
+    return k;
+}
+
+// Разбор десятичного числа. Если мантисса и 10^|e| точно представимы в T,
+// результат - одно умножение или деление, то есть правильно округлённое значение
+// (быстрый путь Клингера); иначе используется std::from_chars.
+template <typename T>
+static bool parse_decimal(const char *first, const char *last, T &value)
+{
+    static constexpr int POWER_LIMIT = exact_power_limit<T>();
+    static constexpr uint64_t MANTISSA_LIMIT =
+        std::numeric_limits<T>::digits >= 64 ? UINT64_MAX : (uint64_t(1) << std::numeric_limits<T>::digits);
+    static const std::vector<T> powers = []()
+    {
+        std::vector<T> table{T(1)};
+        for (int k = 1; k <= POWER_LIMIT; ++k)
+        {
+            table.push_back(table.back() * 10);
+        }
+        return table;
+    }();
+
+    const char *p = first;
+    bool negative = p < last && *p == '-';
+    p += negative;
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    bool exact = true;
+    bool seen_point = false;
+    const char *digits_begin = p;
+    for (; p < last && ((*p >= '0' && *p <= '9') || (*p == '.' && !seen_point)); ++p)
+    {
+        if (*p == '.')
+        {
+            seen_point = true;
+            continue;
+        }
+        if (mantissa == 0 && *p == '0')
+        {
+            exponent -= seen_point;
+            continue;
+        }
+        if (++digits > 19)
+        {
+            exact = false;
+            break;
+        }
+        mantissa = mantissa * 10 + static_cast<uint64_t>(*p - '0');
+        exponent -= seen_point;
+    }
+    if (exact && p - digits_begin > seen_point && p < last && (*p == 'e' || *p == 'E'))
+    {
+        int power = 0;
+        auto [ptr, ec] = std::from_chars(p + 1 + (p + 1 < last && p[1] == '+'), last, power);
+        exact = ec == std::errc() && ptr == last && power > -1000 && power < 1000;
+        exponent += power;
+        p = last;
+    }
+    if (exact && p == last && p - digits_begin > seen_point && mantissa <= MANTISSA_LIMIT &&
+        std::abs(exponent) <= POWER_LIMIT)
+    {
+        T magnitude = static_cast<T>(mantissa);
+        magnitude = exponent < 0 ? magnitude / powers[-exponent] : magnitude * powers[exponent];
+        value = negative ? -magnitude : magnitude;
+        return true;
+    }
+    auto [ptr, ec] = std::from_chars(first, last, value);
+    return ec == std::errc() && ptr == last;
+}
+
+template <typename T>
+bool BulkEvaluator<T>::parse_value(const char *first, const char *last, T &value)
+{
+    return parse_decimal(first, last, value);
+}
+
+template <typename T>
+BulkEvaluator<T>::BulkEvaluator(const Expression<T> &expr, const std::map<std::string, T> &params)
+    : compiled_(expr, CompiledExpression<T>::free_variables(expr)),
+      params_(params)
+{
+}
+
+template <typename T>
+const std::vector<std::string> &BulkEvaluator<T>::variables() const
+{
+    return compiled_.variables();
+}
+
+template <typename T>
+std::vector<int> BulkEvaluator<T>::bind(const std::vector<std::string> &names) const
+{
+    const std::vector<std::string> &variables = compiled_.variables();
+    std::vector<int> binding(names.size(), -1);
+    std::vector<bool> bound(variables.size(), false);
+    for (size_t column = 0; column < names.size(); ++column)
+    {
+        auto iter = std::lower_bound(variables.begin(), variables.end(), names[column]);
+        if (iter != variables.end() && *iter == names[column] && !bound[iter - variables.begin()])
+        {
+            binding[column] = static_cast<int>(iter - variables.begin());
+            bound[iter - variables.begin()] = true;
+        }
+    }
+    for (size_t v = 0; v < variables.size(); ++v)
+    {
+        if (!bound[v] && params_.count(variables[v]) == 0)
+        {
+            throw std::runtime_error("Variable " + variables[v] + " is neither a column nor a parameter");
+        }
+    }
+    return binding;
+}
+
+// Столбцы переменных для пакетного вычисления: столбцы блока или параметры с шагом 0.
+template <typename T>
+static void prepare_columns(const std::vector<std::string> &variables, const std::map<std::string, T> &params,
+                            const std::vector<int> &binding, std::vector<T> &block,
+                            std::vector<const T *> &columns, std::vector<size_t> &strides)
+{
+    block.assign(variables.size() * BULK_BLOCK, T(0));
+    columns.assign(variables.size(), nullptr);
+    strides.assign(variables.size(), 0);
+    for (int v : binding)
+    {
+        if (v >= 0)
+        {
+            columns[v] = block.data() + v * BULK_BLOCK;
+            strides[v] = 1;
+        }
+    }
+    for (size_t v = 0; v < variables.size(); ++v)
+    {
+        if (columns[v] == nullptr)
+        {
+            columns[v] = &params.at(variables[v]);
+        }
+    }
+}
+
+template <typename T>
+std::vector<T> BulkEvaluator<T>::eval_csv(const char *data, size_t size, size_t threads, char delimiter) const
+{
+    TRACE_SCOPE("bulk_csv");
+    const char *end = data + size;
+
+    // Заголовок: имена столбцов.
+    const char *header_end = static_cast<const char *>(std::memchr(data, '\n', size));
+    header_end = header_end ? header_end : end;
+    std::vector<std::string> names;
+    for (const char *field = data; field <= header_end;)
+    {
+        const char *stop = static_cast<const char *>(std::memchr(field, delimiter, header_end - field));
+        stop = stop ? stop : header_end;
+        const char *first = field;
+        const char *last = stop;
+        while (first < last && (is_blank(*first) || *first == '"'))
+            ++first;
+        while (last > first && (is_blank(last[-1]) || last[-1] == '"'))
+            --last;
+        names.emplace_back(first, last);
+        field = stop + 1;
+    }
+    std::vector<int> binding = bind(names);
+    const char *body = header_end < end ? header_end + 1 : end;
+
+    // Части тела, выровненные по началам строк.
+    size_t parts = std::max<size_t>(1, std::min(threads, static_cast<size_t>(end - body) / MIN_CHUNK_BYTES));
+    std::vector<const char *> bounds{body};
+    for (size_t part = 1; part < parts; ++part)
+    {
+        const char *bound = std::max(bounds.back(), body + (end - body) * part / parts);
+        const char *newline = static_cast<const char *>(std::memchr(bound, '\n', end - bound));
+        bounds.push_back(newline ? newline + 1 : end);
+    }
+    bounds.push_back(end);
+
+    // Перебор непустых строк части.
+    auto for_each_row = [&](size_t part, auto &&visit)
+    {
+        for (const char *line = bounds[part]; line < bounds[part + 1];)
+        {
+            const char *line_end = static_cast<const char *>(std::memchr(line, '\n', bounds[part + 1] - line));
+            line_end = line_end ? line_end : bounds[part + 1];
+            if (std::any_of(line, line_end, [](char c) { return !is_blank(c); }))
+            {
+                visit(line, line_end);
+            }
+            line = line_end + 1;
+        }
+    };
+
+    // Первый проход: число строк в частях и их смещения в результате.
+    std::vector<size_t> offsets(parts + 1, 0);
+    run_parallel(parts, [&](size_t part)
+                 {
+                     size_t rows = 0;
+                     for_each_row(part, [&](const char *, const char *) { ++rows; });
+                     offsets[part + 1] = rows;
+                 });
+    for (size_t part = 0; part < parts; ++part)
+    {
+        offsets[part + 1] += offsets[part];
+    }
+    std::vector<T> results(offsets.back());
+
+    // Второй проход: разбор блоками и пакетное вычисление.
+    const std::vector<std::string> &variables = compiled_.variables();
+    size_t last_used = 0;
+    for (size_t column = 0; column < binding.size(); ++column)
+    {
+        last_used = binding[column] >= 0 ? column + 1 : last_used;
+    }
+    run_parallel(parts, [&](size_t part)
+                 {
+                     std::vector<T> block;
+                     std::vector<const T *> columns;
+                     std::vector<size_t> strides;
+                     prepare_columns(variables, params_, binding, block, columns, strides);
+                     size_t row = offsets[part];
+                     size_t filled = 0;
+                     auto flush = [&]()
+                     {
+                         T *out = results.data() + row - filled;
+                         compiled_.eval_batch(filled, columns.data(), &out, strides.data());
+                         filled = 0;
+                     };
+
+                     for_each_row(part, [&](const char *line, const char *line_end)
+                                  {
+                                      const char *field = line;
+                                      for (size_t column = 0; column < last_used; ++column)
+                                      {
+                                          if (field > line_end)
+                                          {
+                                              throw std::runtime_error("Row " + std::to_string(row + 1) + " has only " +
+                                                                       std::to_string(column) + " columns");
+                                          }
+                                          const char *stop = static_cast<const char *>(
+                                              std::memchr(field, delimiter, line_end - field));
+                                          stop = stop ? stop : line_end;
+                                          int v = binding[column];
+                                          if (v >= 0)
+                                          {
+                                              const char *first = field;
+                                              const char *last = stop;
+                                              while (first < last && is_blank(*first))
+                                                  ++first;
+                                              while (last > first && is_blank(last[-1]))
+                                                  --last;
+                                              if (first < last && *first == '+')
+                                                  ++first;
+                                              T &value = block[v * BULK_BLOCK + filled];
+                                              if (!parse_decimal(first, last, value))
+                                              {
+                                                  throw std::runtime_error("Cannot parse '" + std::string(field, stop) +
+                                                                           "' in row " + std::to_string(row + 1) +
+                                                                           ", column " + names[column]);
+                                              }
+                                          }
+                                          field = stop + 1;
+                                      }
+                                      ++row;
+                                      if (++filled == BULK_BLOCK)
+                                      {
+                                          flush();
+                                      }
+                                  });
+                     flush();
+                 });
+    return results;
+}
+
+template <typename T>
+std::vector<T> BulkEvaluator<T>::eval_columns(const char *data, size_t size, const std::vector<std::string> &names,
+                                              size_t threads) const
+{
+    TRACE_SCOPE("bulk_columns");
+    size_t row_bytes = sizeof(double) * names.size();
+    if (names.empty() || size % row_bytes != 0)
+    {
+        throw std::runtime_error("Binary input of " + std::to_string(size) + " bytes does not hold " +
+                                 std::to_string(names.size()) + " double columns");
+    }
+    size_t rows = size / row_bytes;
+    std::vector<int> binding = bind(names);
+    std::vector<T> results(rows);
+
+    // Части по целому числу блоков строк.
+    size_t blocks = (rows + BULK_BLOCK - 1) / BULK_BLOCK;
+    size_t parts = std::max<size_t>(1, std::min(threads, blocks));
+    const std::vector<std::string> &variables = compiled_.variables();
+    run_parallel(parts, [&](size_t part)
+                 {
+                     std::vector<T> block;
+                     std::vector<const T *> columns;
+                     std::vector<size_t> strides;
+                     prepare_columns(variables, params_, binding, block, columns, strides);
+                     size_t begin = std::min(rows, blocks * part / parts * BULK_BLOCK);
+                     size_t finish = std::min(rows, blocks * (part + 1) / parts * BULK_BLOCK);
+                     for (size_t row = begin; row < finish; row += BULK_BLOCK)
+                     {
+                         size_t n = std::min(BULK_BLOCK, finish - row);
+                         for (size_t column = 0; column < binding.size(); ++column)
+                         {
+                             int v = binding[column];
+                             if (v < 0)
+                             {
+                                 continue;
+                             }
+                             const char *source = data + (column * rows + row) * sizeof(double);
+                             T *target = block.data() + v * BULK_BLOCK;
+                             for (size_t i = 0; i < n; ++i)
+                             {
+                                 double value;
+                                 std::memcpy(&value, source + i * sizeof(double), sizeof(double));
+                                 target[i] = little_endian(value);
+                             }
+                         }
+                         T *out = results.data() + row;
+                         compiled_.eval_batch(n, columns.data(), &out, strides.data());
+                     }
+                 });
+    return results;
+}
+
+template <typename T>
+void BulkEvaluator<T>::write_binary(std::ostream &out, const std::vector<T> &results)
+{
+    std::vector<double> buffer(BULK_BLOCK);
+    for (size_t begin = 0; begin < results.size(); begin += BULK_BLOCK)
+    {
+        size_t n = std::min(BULK_BLOCK, results.size() - begin);
+        for (size_t i = 0; i < n; ++i)
+        {
+            buffer[i] = little_endian(static_cast<double>(results[begin + i]));
+        }
+        out.write(reinterpret_cast<const char *>(buffer.data()), static_cast<std::streamsize>(n * sizeof(double)));
+    }
+}
+
+template <typename T>
+void BulkEvaluator<T>::write_text(std::ostream &out, const std::vector<T> &results, size_t threads)
+{
+    threads = std::max<size_t>(1, threads);
+    std::vector<std::string> buffers(threads);
+    for (size_t round = 0; round < results.size(); round += threads * TEXT_CHUNK)
+    {
+        size_t round_end = std::min(results.size(), round + threads * TEXT_CHUNK);
+        size_t parts = (round_end - round + TEXT_CHUNK - 1) / TEXT_CHUNK;
+        run_parallel(parts, [&](size_t part)
+                     {
+                         std::string &buffer = buffers[part];
+                         size_t begin = round + part * TEXT_CHUNK;
+                         size_t finish = std::min(round_end, begin + TEXT_CHUNK);
+                         // Кратчайшее представление, однозначно восстанавливающее значение.
+                         buffer.resize((finish - begin) * 48);
+                         char *cursor = buffer.data();
+                         for (size_t i = begin; i < finish; ++i)
+                         {
+                             cursor = std::to_chars(cursor, buffer.data() + buffer.size(), results[i]).ptr;
+                             *cursor++ = '\n';
+                         }
+                         buffer.resize(cursor - buffer.data());
+                     });
+        for (size_t part = 0; part < parts; ++part)
+        {
+            out.write(buffers[part].data(), static_cast<std::streamsize>(buffers[part].size()));
+        }
+    }
+}
+
+template class BulkEvaluator<long double>;
@@ -0,0 +1,262 @@
+#include "../includes/cache.hpp"
+#include "../includes/lexer.hpp"
+#include "../includes/parser.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <functional>
+#include <stdexcept>
+#include <unordered_set>
+
+// Оценка памяти, занимаемой узлами выражения (общие поддеревья учитываются один раз).
+template <typename T>
+static size_t expression_memory(const Expression<T> &expr)
+{
+    // Блок управления shared_ptr, созданного make_shared.
+    const size_t control = 2 * sizeof(void *);
+    size_t bytes = 0;
+    std::unordered_set<const ExpressionBase<T> *> visited;
+    std::vector<const Expression<T> *> stack{&expr};
+    while (!stack.empty())
+    {
+        const Expression<T> *current = stack.back();
+        stack.pop_back();
+        if (current->node() == nullptr || !visited.insert(current->node()).second)
+        {
+            continue;
+        }
+        bytes += control + sizeof(ExpressionBase<T>) + current->arity() * sizeof(Expression<T>);
+        if (current->kind() == NODE_SUM || current->kind() == NODE_PRODUCT)
+        {
+            // Вектор операндов и знаки слагаемых.
+            bytes += sizeof(std::vector<Expression<T>>) + current->arity();
+        }
+        for (size_t i = 0; i < current->arity(); ++i)
+        {
+            stack.push_back(&current->operand(i));
+        }
+    }
+    return bytes;
+}
+
+template <typename T>
+static size_t compiled_memory(const CompiledExpression<T> &compiled)
+{
+    size_t bytes = sizeof(CompiledExpression<T>) + compiled.program().size() * sizeof(Instruction) +
+                   compiled.constants().size() * sizeof(T) + compiled.output_slots().size() * sizeof(uint32_t);
+    for (const std::string &name : compiled.variables())
+    {
+        bytes += sizeof(std::string) + name.size();
+    }
+    return bytes;
+}
+
+// =======
+// |Entry|
+// =======
+
+template <typename T>
+ParseCache<T>::Entry::Entry(Expression<T> expression, size_t bytes)
+    : expression_(std::move(expression)),
+      variables_(CompiledExpression<T>::free_variables(expression_)),
+      bytes_(bytes)
+{
+    for (const std::string &name : variables_)
+    {
+        bytes_ += sizeof(std::string) + name.size();
+    }
+}
+
+template <typename T>
+const Expression<T> &ParseCache<T>::Entry::expression() const
+{
+    return expression_;
+}
+
+template <typename T>
+const std::vector<std::string> &ParseCache<T>::Entry::variables() const
+{
+    return variables_;
+}
+
+template <typename T>
+std::shared_ptr<const CompiledExpression<T>> ParseCache<T>::Entry::compiled() const
+{
+    std::call_once(once_, [this]
+                   {
+                       compiled_ = std::make_shared<const CompiledExpression<T>>(expression_, variables_);
+                       ready_.store(true, std::memory_order_release); });
+    return compiled_;
+}
+
+template <typename T>
+std::shared_ptr<const CompiledExpression<T>> ParseCache<T>::Entry::compiled_if_ready() const
+{
+    return ready_.load(std::memory_order_acquire) ? compiled_ : nullptr;
+}
+
+template <typename T>
+size_t ParseCache<T>::Entry::memory() const
+{
+    size_t bytes = sizeof(Entry) + bytes_;
+    if (auto compiled = compiled_if_ready())
+    {
+        bytes += compiled_memory(*compiled);
+    }
+    return bytes;
+}
+
+// ============
+// |ParseCache|
+// ============
+
+template <typename T>
+ParseCache<T>::ParseCache(const ParseCacheOptions &options)
+{
+    if (options.capacity == 0 || options.stripes == 0)
+    {
+        throw std::invalid_argument("Parse cache capacity and stripe count must be positive");
+    }
+    size_t stripes = std::min(options.stripes, options.capacity);
+    stripe_capacity_ = (options.capacity + stripes - 1) / stripes;
+    for (size_t i = 0; i < stripes; ++i)
+    {
+        stripes_.push_back(std::make_unique<Stripe>());
+    }
+}
+
+template <typename T>
+std::string ParseCache<T>::normalize(const std::string &source)
+{
+    // Пробелы нужны лексеру только между двумя именами или числами ("x y", "2 3").
+    auto word = [](char c)
+    { return std::isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '.'; };
+    std::string key;
+    key.reserve(source.size());
+    bool space = false;
+    for (char c : source)
+    {
+        if (c == ' ' || c == '\t')
+        {
+            space = true;
+            continue;
+        }
+        if (space && !key.empty() && word(key.back()) && word(c))
+        {
+            key.push_back(' ');
+        }
+        space = false;
+        key.push_back(c);
+    }
+    return key;
+}
+
+template <typename T>
+typename ParseCache<T>::Stripe &ParseCache<T>::stripe(const std::string &key) const
+{
+    return *stripes_[std::hash<std::string>{}(key) % stripes_.size()];
+}
+
+template <typename T>
+std::shared_ptr<const typename ParseCache<T>::Entry> ParseCache<T>::get(const std::string &source)
+{
+    std::string key = normalize(source);
+    Stripe &part = stripe(key);
+    {
+        std::lock_guard<std::mutex> lock(part.mutex);
+        auto found = part.index.find(key);
+        if (found != part.index.end())
+        {
+            ++part.hits;
+            part.order.splice(part.order.begin(), part.order, found->second);
+            return found->second->second;
+        }
+        ++part.misses;
+    }
+
+    // Разбор без блокировки; если то же выражение тем временем добавил другой поток,
+    // используется его запись.
+    Lexer lexer{key};
+    Parser<T> parser{lexer};
+    Expression<T> expr = parser.parseExpression();
+    // Ключ хранится и в списке, и в индексе.
+    size_t bytes = 2 * (sizeof(Item) + key.size()) + expression_memory(expr);
+    auto entry = std::make_shared<const Entry>(std::move(expr), bytes);
+
+    // Вытесненные записи удаляются после снятия блокировки.
+    std::vector<std::shared_ptr<const Entry>> evicted;
+    std::lock_guard<std::mutex> lock(part.mutex);
+    auto found = part.index.find(key);
+    if (found != part.index.end())
+    {
+        part.order.splice(part.order.begin(), part.order, found->second);
+        return found->second->second;
+    }
+    part.order.emplace_front(key, entry);
+    part.index.emplace(std::move(key), part.order.begin());
+    while (part.order.size() > stripe_capacity_)
+    {
+        part.index.erase(part.order.back().first);
+        evicted.push_back(std::move(part.order.back().second));
+        part.order.pop_back();
+        ++part.evictions;
+    }
+    return entry;
+}
+
+template <typename T>
+Expression<T> ParseCache<T>::parse(const std::string &source)
+{
+    return get(source)->expression();
+}
+
+template <typename T>
+std::shared_ptr<const CompiledExpression<T>> ParseCache<T>::compile(const std::string &source)
+{
+    return get(source)->compiled();
+}
+
+template <typename T>
+bool ParseCache<T>::contains(const std::string &source) const
+{
+    std::string key = normalize(source);
+    const Stripe &part = stripe(key);
+    std::lock_guard<std::mutex> lock(part.mutex);
+    return part.index.count(key) != 0;
+}
+
+template <typename T>
+void ParseCache<T>::clear()
+{
+    for (auto &part : stripes_)
+    {
+        std::list<Item> order;
+        std::lock_guard<std::mutex> lock(part->mutex);
+        part->index.clear();
+        order.swap(part->order);
+    }
+}
+
+template <typename T>
+ParseCacheStats ParseCache<T>::stats() const
+{
+    ParseCacheStats stats;
+    stats.memory = sizeof(*this) + stripes_.size() * sizeof(Stripe);
+    for (const auto &part : stripes_)
+    {
+        std::lock_guard<std::mutex> lock(part->mutex);
+        stats.hits += part->hits;
+        stats.misses += part->misses;
+        stats.evictions += part->evictions;
+        stats.entries += part->order.size();
+        for (const Item &item : part->order)
+        {
+            stats.memory += item.second->memory();
+        }
+    }
+    size_t requests = stats.hits + stats.misses;
+    stats.hit_rate = requests == 0 ? 0 : static_cast<double>(stats.hits) / requests;
+    return stats;
+}
+
+template class ParseCache<long double>;
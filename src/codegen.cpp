@@ -0,0 +1,330 @@
+#include "../includes/codegen.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+// Наибольшая вложенность операций, подставляемых в выражение без локальной константы.
+static constexpr size_t MAX_INLINE_DEPTH = 4;
+
+template <typename T>
+static const char *type_name();
+
+template <>
+const char *type_name<long double>()
+{
+    return "long double";
+}
+
+// Литерал, точно восстанавливающий значение.
+static std::string literal(long double value)
+{
+    if (std::isnan(value))
+    {
+        return "std::numeric_limits<long double>::quiet_NaN()";
+    }
+    if (std::isinf(value))
+    {
+        return value > 0 ? "std::numeric_limits<long double>::infinity()"
+                         : "(-std::numeric_limits<long double>::infinity())";
+    }
+    char buffer[64];
+    char *end = std::to_chars(buffer, buffer + sizeof(buffer), value).ptr;
+    std::string text(buffer, end);
+    if (text.find_first_of(".e") == std::string::npos)
+    {
+        text += ".0";
+    }
+    text += "L";
+    // Знак определяется по биту: у -0 он есть, хотя -0 < 0 ложно.
+    return std::signbit(value) ? "(" + text + ")" : text;
+}
+
+static bool is_identifier(const std::string &name)
+{
+    if (name.empty() || std::isdigit(static_cast<unsigned char>(name[0])))
+    {
+        return false;
+    }
+    for (char c : name)
+    {
+        if (!std::isalnum(static_cast<unsigned char>(c)) && c != '_')
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+template <typename T>
+CodeGenerator<T>::CodeGenerator(const std::vector<std::string> &variables) : variables_(variables)
+{
+}
+
+template <typename T>
+void CodeGenerator<T>::add(const std::string &name, const Expression<T> &expr)
+{
+    if (!is_identifier(name) || name == "evaluate_all" || name == "variables" || name == "variable_count")
+    {
+        throw std::invalid_argument("'" + name + "' cannot be used as a generated function name");
+    }
+    names_.push_back(name);
+    exprs_.push_back(expr);
+}
+
+template <typename T>
+void CodeGenerator<T>::add_with_gradient(const std::string &name, const Expression<T> &expr)
+{
+    add(name, expr);
+    std::vector<Expression<T>> gradient = expr.diff_all(variables_);
+    for (size_t i = 0; i < variables_.size(); ++i)
+    {
+        std::string suffix = variables_[i];
+        for (char &c : suffix)
+        {
+            c = std::isalnum(static_cast<unsigned char>(c)) ? c : '_';
+        }
+        add(name + "_d_" + suffix, gradient[i]);
+    }
+}
+
+template <typename T>
+const std::vector<std::string> &CodeGenerator<T>::variables() const
+{
+    return variables_;
+}
+
+template <typename T>
+const std::vector<std::string> &CodeGenerator<T>::names() const
+{
+    return names_;
+}
+
+template <typename T>
+void CodeGenerator<T>::emit_body(std::string &code, const CompiledExpression<T> &compiled,
+                                 std::vector<std::string> &results)
+{
+    const std::vector<Instruction> &program = compiled.program();
+    const std::vector<uint32_t> &outputs = compiled.output_slots();
+    const std::string type = type_name<T>();
+
+    // Число использований ячеек: многократно используемые становятся локальными константами.
+    std::vector<size_t> uses(program.size(), 0);
+    for (const Instruction &ins : program)
+    {
+        size_t operands = operand_count(ins.op);
+        if (operands >= 1)
+        {
+            ++uses[ins.lhs];
+        }
+        if (operands >= 2)
+        {
+            ++uses[ins.rhs];
+        }
+        if (operands >= 3)
+        {
+            ++uses[ins.addend];
+        }
+    }
+    for (uint32_t slot : outputs)
+    {
+        ++uses[slot];
+    }
+
+    std::vector<std::string> text(program.size());
+    std::vector<size_t> depth(program.size(), 0);
+    auto local = [&](size_t slot, const std::string &value, const std::string &name)
+    {
+        code += "    const " + type + " " + name + " = " + value + ";\n";
+        text[slot] = name;
+        depth[slot] = 0;
+    };
+
+    for (size_t slot = 0; slot < program.size(); ++slot)
+    {
+        const Instruction &ins = program[slot];
+        const std::string &a = text[ins.lhs];
+        std::string value;
+        switch (ins.op)
+        {
+        case OP_CONST:
+            text[slot] = literal(static_cast<long double>(compiled.constants()[ins.lhs]));
+            continue;
+        case OP_VAR:
+            text[slot] = "vars[" + std::to_string(ins.lhs) + "]";
+            continue;
+        case OP_NEG:
+            value = "(-" + a + ")";
+            break;
+        case OP_SIN:
+        case OP_SINCOS:
+            value = "std::sin(" + a + ")";
+            break;
+        case OP_COS:
+        case OP_SINCOS_COS:
+            value = "std::cos(" + a + ")";
+            break;
+        case OP_LN:
+            value = "std::log(" + a + ")";
+            break;
+        case OP_EXP:
+            value = "std::exp(" + a + ")";
+            break;
+        case OP_ADD:
+            value = "(" + a + " + " + text[ins.rhs] + ")";
+            break;
+        case OP_SUB:
+            value = "(" + a + " - " + text[ins.rhs] + ")";
+            break;
+        case OP_MUL:
+            value = "(" + a + " * " + text[ins.rhs] + ")";
+            break;
+        case OP_DIV:
+            value = "(" + a + " / " + text[ins.rhs] + ")";
+            break;
+        case OP_POW:
+            value = "std::pow(" + a + ", " + text[ins.rhs] + ")";
+            break;
+        case OP_FMA:
+            value = "std::fma(" + a + ", " + text[ins.rhs] + ", " + text[ins.addend] + ")";
+            break;
+        case OP_SQRT:
+            value = "std::sqrt(" + a + ")";
+            break;
+        case OP_RSQRT:
+            value = "(" + literal(1.0L) + " / std::sqrt(" + a + "))";
+            break;
+        case OP_POWI:
+        {
+            // Раскрытие степени двоичным методом, как в integer_power.
+            int n = static_cast<int>(ins.rhs);
+            unsigned int power = n < 0 ? -static_cast<unsigned int>(n) : static_cast<unsigned int>(n);
+            std::string base = a;
+            if (depth[ins.lhs] != 0)
+            {
+                base = "t" + std::to_string(slot) + "_b";
+                code += "    const " + type + " " + base + " = " + a + ";\n";
+            }
+            std::string result;
+            size_t step = 0;
+            while (power != 0)
+            {
+                if (power & 1U)
+                {
+                    if (result.empty())
+                    {
+                        result = base;
+                    }
+                    else
+                    {
+                        std::string name = "t" + std::to_string(slot) + "_" + std::to_string(step++);
+                        code += "    const " + type + " " + name + " = " + result + " * " + base + ";\n";
+                        result = name;
+                    }
+                }
+                power >>= 1;
+                if (power != 0)
+                {
+                    std::string name = "t" + std::to_string(slot) + "_" + std::to_string(step++);
+                    code += "    const " + type + " " + name + " = " + base + " * " + base + ";\n";
+                    base = name;
+                }
+            }
+            if (result.empty())
+            {
+                result = literal(1.0L);
+            }
+            value = n < 0 ? "(" + literal(1.0L) + " / " + result + ")" : result;
+            break;
+        }
+        }
+
+        size_t operand_depth = depth[ins.lhs];
+        if (operand_count(ins.op) >= 2)
+        {
+            operand_depth = std::max(operand_depth, depth[ins.rhs]);
+        }
+        if (operand_count(ins.op) >= 3)
+        {
+            operand_depth = std::max(operand_depth, depth[ins.addend]);
+        }
+        if (uses[slot] > 1 || operand_depth + 1 > MAX_INLINE_DEPTH)
+        {
+            local(slot, value, "t" + std::to_string(slot));
+        }
+        else
+        {
+            text[slot] = value;
+            depth[slot] = operand_depth + 1;
+        }
+    }
+
+    results.clear();
+    for (uint32_t slot : outputs)
+    {
+        results.push_back(text[slot]);
+    }
+}
+
+template <typename T>
+std::string CodeGenerator<T>::emit(const CodegenOptions &options) const
+{
+    if (!is_identifier(options.namespace_name))
+    {
+        throw std::invalid_argument("'" + options.namespace_name + "' cannot be used as a namespace name");
+    }
+    const std::string type = type_name<T>();
+    const std::string qualifier = options.header ? "inline " : "";
+
+    std::string code = "// Сгенерировано CodeGenerator, не редактировать.\n";
+    if (options.header)
+    {
+        code += "#pragma once\n";
+    }
+    code += "\n#include <cmath>\n#include <cstddef>\n#include <limits>\n\n";
+    code += "namespace " + options.namespace_name + "\n{\n";
+
+    code += qualifier + "constexpr std::size_t variable_count = " + std::to_string(variables_.size()) + ";\n";
+    code += qualifier + "constexpr const char *variables[] = {";
+    for (size_t i = 0; i < variables_.size(); ++i)
+    {
+        code += (i == 0 ? "\"" : ", \"") + variables_[i] + "\"";
+    }
+    code += variables_.empty() ? "nullptr};\n" : "};\n";
+
+    std::vector<std::string> results;
+    for (size_t k = 0; k < exprs_.size(); ++k)
+    {
+        CompiledExpression<T> compiled(exprs_[k], variables_);
+        code += "\n" + qualifier + type + " " + names_[k] + "(const " + type + " *vars [[maybe_unused]])\n{\n";
+        emit_body(code, compiled, results);
+        code += "    return " + results[0] + ";\n}\n";
+    }
+
+    if (exprs_.empty())
+    {
+        code += "} // namespace " + options.namespace_name + "\n";
+        return code;
+    }
+
+    // Все функции сразу: общие подвыражения функций и производных вычисляются однократно.
+    CompiledExpression<T> fused(exprs_, variables_);
+    code += "\n// Результаты в порядке:";
+    for (const std::string &name : names_)
+    {
+        code += " " + name;
+    }
+    code += ".\n" + qualifier + "void evaluate_all(const " + type + " *vars [[maybe_unused]], " + type + " *out)\n{\n";
+    emit_body(code, fused, results);
+    for (size_t k = 0; k < results.size(); ++k)
+    {
+        code += "    out[" + std::to_string(k) + "] = " + results[k] + ";\n";
+    }
+    code += "}\n} // namespace " + options.namespace_name + "\n";
+    return code;
+}
+
+template class CodeGenerator<long double>;
@@ -0,0 +1,842 @@
+#include "../includes/compiler.hpp"
+#include "../includes/trace.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <map>
+#include <set>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+
+// Число точек, обрабатываемых одной инструкцией в пакетном режиме.
+static constexpr size_t BATCH_BLOCK = 64;
+
+template <typename T>
+CompiledExpression<T>::CompiledExpression(const Expression<T> &expr, const std::vector<std::string> &variables,
+                                          const CompileOptions &options)
+    : variables_(variables)
+{
+    compile({expr});
+    fuse(options);
+}
+
+template <typename T>
+CompiledExpression<T>::CompiledExpression(const std::vector<Expression<T>> &exprs, const std::vector<std::string> &variables,
+                                          const CompileOptions &options)
+    : variables_(variables)
+{
+    compile(exprs);
+    fuse(options);
+}
+
+static OpCode opcode_of(NodeKind kind)
+{
+    switch (kind)
+    {
+    case NODE_NEGATE:
+        return OP_NEG;
+    case NODE_ADD:
+        return OP_ADD;
+    case NODE_SUB:
+        return OP_SUB;
+    case NODE_MULT:
+        return OP_MUL;
+    case NODE_DIV:
+        return OP_DIV;
+    case NODE_POW:
+        return OP_POW;
+    case NODE_SIN:
+        return OP_SIN;
+    case NODE_COS:
+        return OP_COS;
+    case NODE_LN:
+        return OP_LN;
+    case NODE_EXP:
+        return OP_EXP;
+    default:
+        throw std::runtime_error("Unexpected node kind " + std::to_string(kind));
+    }
+}
+
+template <typename T>
+void CompiledExpression<T>::compile(const std::vector<Expression<T>> &exprs)
+{
+    TRACE_SCOPE("compile");
+    // Номера аргументов по номерам переменных в SymbolTable.
+    std::unordered_map<uint32_t, uint32_t> variableIndex;
+    for (size_t i = 0; i < variables_.size(); ++i)
+    {
+        variableIndex.emplace(SymbolTable::intern(variables_[i]), static_cast<uint32_t>(i));
+    }
+
+    // Уже скомпилированные узлы (общие поддеревья компилируются один раз).
+    std::unordered_map<const ExpressionBase<T> *, uint32_t> compiled;
+    // Структурно совпадающие инструкции и константы.
+    std::map<std::tuple<uint8_t, uint32_t, uint32_t>, uint32_t> instructions;
+    // Ключ константы - значение и знаки частей: 0 и -0 равны, но не взаимозаменяемы.
+    std::map<std::tuple<long double, long double, bool, bool>, uint32_t> constantIndex;
+
+    auto emit = [&](OpCode op, uint32_t lhs, uint32_t rhs) -> uint32_t
+    {
+        auto key = std::make_tuple(static_cast<uint8_t>(op), lhs, rhs);
+        auto iter = instructions.find(key);
+        if (iter != instructions.end())
+        {
+            return iter->second;
+        }
+        uint32_t slot = static_cast<uint32_t>(program_.size());
+        program_.push_back(Instruction{op, lhs, rhs});
+        instructions.emplace(key, slot);
+        return slot;
+    };
+
+    // Вид степени для узла NODE_POW с константным показателем.
+    int power = 0;
+    auto power_kind = [](const Expression<T> &expr, int &n)
+    {
+        if (expr.kind() != NODE_POW || expr.operand(1).kind() != NODE_VALUE)
+        {
+            return POWER_GENERAL;
+        }
+        return classify_exponent(expr.operand(1).constant(), n);
+    };
+
+    // Листья хранятся в операндах без узлов и размещаются при обработке родителя.
+    auto leaf_slot = [&](const Expression<T> &expr) -> uint32_t
+    {
+        if (expr.kind() == NODE_VALUE)
+        {
+            T value = expr.constant();
+            long double re = std::real(value);
+            long double im = std::imag(value);
+            auto key = std::make_tuple(re, im, std::signbit(re), std::signbit(im));
+            auto iter = constantIndex.find(key);
+            uint32_t index;
+            if (value != value)
+            {
+                // NaN не сравнивается сам с собой и не объединяется.
+                index = static_cast<uint32_t>(constants_.size());
+                constants_.push_back(value);
+            }
+            else if (iter == constantIndex.end())
+            {
+                index = static_cast<uint32_t>(constants_.size());
+                constants_.push_back(value);
+                constantIndex.emplace(key, index);
+            }
+            else
+            {
+                index = iter->second;
+            }
+            return emit(OP_CONST, index, 0);
+        }
+        auto iter = variableIndex.find(expr.symbol());
+        if (iter == variableIndex.end())
+        {
+            throw std::runtime_error("Variable " + expr.variable() + " not present in compile variables!!!");
+        }
+        return emit(OP_VAR, iter->second, 0);
+    };
+    auto slot_of = [&](const Expression<T> &expr)
+    {
+        return expr.node() == nullptr ? leaf_slot(expr) : compiled.at(expr.node());
+    };
+
+    // Обход в обратном порядке с явным стеком: (узел, операнды уже размещены).
+    std::vector<std::pair<const Expression<T> *, bool>> stack;
+    for (const Expression<T> &root : exprs)
+    {
+        stack.emplace_back(&root, false);
+        while (!stack.empty())
+        {
+            auto [expr, ready] = stack.back();
+            stack.pop_back();
+            if (expr->node() == nullptr || compiled.count(expr->node()))
+            {
+                continue;
+            }
+
+            NodeKind kind = expr->kind();
+            uint32_t slot = 0;
+            if (!ready)
+            {
+                stack.emplace_back(expr, true);
+                // Константный показатель специальной степени не требует своей ячейки.
+                size_t operands = power_kind(*expr, power) == POWER_GENERAL ? expr->arity() : 1;
+                for (size_t i = operands; i-- > 0;)
+                {
+                    stack.emplace_back(&expr->operand(i), false);
+                }
+                continue;
+            }
+            else if (power_kind(*expr, power) != POWER_GENERAL)
+            {
+                uint32_t base = slot_of(expr->operand(0));
+                switch (power_kind(*expr, power))
+                {
+                case POWER_INTEGER:
+                    slot = emit(OP_POWI, base, static_cast<uint32_t>(power));
+                    break;
+                case POWER_SQRT:
+                    slot = emit(OP_SQRT, base, 0);
+                    break;
+                default:
+                    slot = emit(OP_RSQRT, base, 0);
+                    break;
+                }
+            }
+            else if (kind == NODE_SUM || kind == NODE_PRODUCT)
+            {
+                // n-арный узел раскладывается в сбалансированное дерево бинарных операций:
+                // независимые сложения и умножения идут параллельно, ошибка растёт как log(n).
+                std::vector<uint32_t> positive;
+                std::vector<uint32_t> negative;
+                for (size_t i = 0; i < expr->arity(); ++i)
+                {
+                    uint32_t term = slot_of(expr->operand(i));
+                    bool sign = kind == NODE_SUM && static_cast<const OpSum<T> *>(expr->node())->is_negated(i);
+                    (sign ? negative : positive).push_back(term);
+                }
+                OpCode op = kind == NODE_SUM ? OP_ADD : OP_MUL;
+                auto reduce = [&](std::vector<uint32_t> &slots)
+                {
+                    while (slots.size() > 1)
+                    {
+                        std::vector<uint32_t> next;
+                        for (size_t i = 0; i + 1 < slots.size(); i += 2)
+                        {
+                            next.push_back(emit(op, slots[i], slots[i + 1]));
+                        }
+                        if (slots.size() % 2 == 1)
+                        {
+                            next.push_back(slots.back());
+                        }
+                        slots.swap(next);
+                    }
+                    return slots[0];
+                };
+                if (negative.empty())
+                {
+                    slot = reduce(positive);
+                }
+                else if (positive.empty())
+                {
+                    slot = emit(OP_NEG, reduce(negative), 0);
+                }
+                else
+                {
+                    uint32_t lhs = reduce(positive);
+                    slot = emit(OP_SUB, lhs, reduce(negative));
+                }
+            }
+            else
+            {
+                uint32_t lhs = slot_of(expr->operand(0));
+                uint32_t rhs = expr->arity() > 1 ? slot_of(expr->operand(1)) : 0;
+                slot = emit(opcode_of(kind), lhs, rhs);
+            }
+            compiled.emplace(expr->node(), slot);
+        }
+        outputs_.push_back(slot_of(root));
+    }
+}
+
+template <typename T>
+void CompiledExpression<T>::fuse(const CompileOptions &options)
+{
+    TRACE_SCOPE("fuse");
+    if (!options.sincos && !options.fma)
+    {
+        return;
+    }
+    size_t size = program_.size();
+    std::vector<uint32_t> uses(size, 0);
+    for (const Instruction &ins : program_)
+    {
+        size_t operands = operand_count(ins.op);
+        // У OP_POWI второй операнд - показатель, а не ячейка.
+        if (operands >= 1)
+        {
+            ++uses[ins.lhs];
+        }
+        if (operands >= 2)
+        {
+            ++uses[ins.rhs];
+        }
+        if (operands >= 3)
+        {
+            ++uses[ins.addend];
+        }
+    }
+    for (uint32_t slot : outputs_)
+    {
+        ++uses[slot];
+    }
+
+    // sin и cos по ячейке аргумента (после объединения подвыражений каждая пара единственна).
+    std::unordered_map<uint32_t, uint32_t> sines;
+    std::unordered_map<uint32_t, uint32_t> cosines;
+    if (options.sincos)
+    {
+        for (uint32_t slot = 0; slot < size; ++slot)
+        {
+            if (program_[slot].op == OP_SIN)
+            {
+                sines.emplace(program_[slot].lhs, slot);
+            }
+            else if (program_[slot].op == OP_COS)
+            {
+                cosines.emplace(program_[slot].lhs, slot);
+            }
+        }
+    }
+
+    // Произведения, используемые только одним сложением, поглощаются им.
+    static constexpr uint32_t NONE = UINT32_MAX;
+    std::vector<uint32_t> product(size, NONE);
+    std::vector<bool> absorbed(size, false);
+    if (options.fma)
+    {
+        for (uint32_t slot = 0; slot < size; ++slot)
+        {
+            const Instruction &ins = program_[slot];
+            if (ins.op != OP_ADD)
+            {
+                continue;
+            }
+            for (uint32_t side : {ins.lhs, ins.rhs})
+            {
+                if (program_[side].op == OP_MUL && uses[side] == 1 && !absorbed[side])
+                {
+                    absorbed[side] = true;
+                    product[slot] = side;
+                    break;
+                }
+            }
+        }
+    }
+
+    std::vector<uint32_t> remap(size, NONE);
+    std::vector<Instruction> fused;
+    fused.reserve(size);
+    for (uint32_t slot = 0; slot < size; ++slot)
+    {
+        const Instruction &ins = program_[slot];
+        if (absorbed[slot])
+        {
+            continue;
+        }
+        if (ins.op == OP_SIN || ins.op == OP_COS)
+        {
+            auto sine = sines.find(ins.lhs);
+            auto cosine = cosines.find(ins.lhs);
+            if (sine != sines.end() && cosine != cosines.end())
+            {
+                // Пара размещается на месте первой из двух инструкций.
+                if (slot == std::min(sine->second, cosine->second))
+                {
+                    uint32_t target = static_cast<uint32_t>(fused.size());
+                    fused.push_back(Instruction{OP_SINCOS, remap[ins.lhs], 0});
+                    fused.push_back(Instruction{OP_SINCOS_COS, remap[ins.lhs], 0});
+                    remap[sine->second] = target;
+                    remap[cosine->second] = target + 1;
+                }
+                continue;
+            }
+        }
+
+        Instruction result = ins;
+        size_t operands = operand_count(ins.op);
+        if (operands >= 1)
+        {
+            result.lhs = remap[ins.lhs];
+        }
+        if (operands >= 2)
+        {
+            result.rhs = remap[ins.rhs];
+        }
+        if (product[slot] != NONE)
+        {
+            const Instruction &mul = program_[product[slot]];
+            uint32_t other = product[slot] == ins.lhs ? ins.rhs : ins.lhs;
+            result = Instruction{OP_FMA, remap[mul.lhs], remap[mul.rhs], remap[other]};
+        }
+        remap[slot] = static_cast<uint32_t>(fused.size());
+        fused.push_back(result);
+    }
+
+    for (uint32_t &slot : outputs_)
+    {
+        slot = remap[slot];
+    }
+    program_.swap(fused);
+}
+
+// sin и cos одного аргумента за один вызов.
+template <typename T>
+static inline void sincos_of(T x, T &sine, T &cosine)
+{
+    if constexpr (std::is_same_v<T, long double>)
+    {
+        ::sincosl(x, &sine, &cosine);
+    }
+    else if constexpr (std::is_same_v<T, double>)
+    {
+        ::sincos(x, &sine, &cosine);
+    }
+    else
+    {
+        sine = std::sin(x);
+        cosine = std::cos(x);
+    }
+}
+
+template <typename T>
+static inline T multiply_add(T a, T b, T c)
+{
+    if constexpr (std::is_floating_point_v<T>)
+    {
+        return std::fma(a, b, c);
+    }
+    else
+    {
+        return a * b + c;
+    }
+}
+
+template <typename T>
+static inline T apply(OpCode op, T lhs, T rhs)
+{
+    switch (op)
+    {
+    case OP_NEG:
+        return -lhs;
+    case OP_SIN:
+        return std::sin(lhs);
+    case OP_COS:
+        return std::cos(lhs);
+    case OP_LN:
+        return std::log(lhs);
+    case OP_EXP:
+        return std::exp(lhs);
+    case OP_ADD:
+        return lhs + rhs;
+    case OP_SUB:
+        return lhs - rhs;
+    case OP_MUL:
+        return lhs * rhs;
+    case OP_DIV:
+        return lhs / rhs;
+    case OP_POW:
+        return std::pow(lhs, rhs);
+    case OP_SQRT:
+        return std::sqrt(lhs);
+    case OP_RSQRT:
+        return T(1) / std::sqrt(lhs);
+    default:
+        return lhs;
+    }
+}
+
+// Рабочий буфер ячеек, свой у каждого потока.
+template <typename T>
+static T *registers(size_t size)
+{
+    thread_local std::vector<T> buffer;
+    if (buffer.size() < size)
+    {
+        buffer.resize(size);
+    }
+    return buffer.data();
+}
+
+template <typename T>
+T CompiledExpression<T>::eval(const T *vars) const
+{
+    T result;
+    if (outputs_.size() == 1)
+    {
+        eval(vars, &result);
+        return result;
+    }
+    std::vector<T> results(outputs_.size());
+    eval(vars, results.data());
+    return results[0];
+}
+
+// Флаги инструкции по значениям операндов и результату.
+template <typename T>
+static inline uint32_t instruction_flags(const Instruction &ins, const T &lhs, const T &rhs, const T &addend,
+                                         const T &result)
+{
+    T operands[3] = {lhs, rhs, addend};
+    switch (ins.op)
+    {
+    case OP_CONST:
+    case OP_VAR:
+    case OP_SINCOS_COS:
+        return EVAL_OK;
+    case OP_NEG:
+        return eval_flags(NODE_NEGATE, operands, 1, result);
+    case OP_SIN:
+    case OP_SINCOS:
+        return eval_flags(NODE_SIN, operands, 1, result);
+    case OP_COS:
+        return eval_flags(NODE_COS, operands, 1, result);
+    case OP_LN:
+        return eval_flags(NODE_LN, operands, 1, result);
+    case OP_EXP:
+        return eval_flags(NODE_EXP, operands, 1, result);
+    case OP_ADD:
+        return eval_flags(NODE_ADD, operands, 2, result);
+    case OP_SUB:
+        return eval_flags(NODE_SUB, operands, 2, result);
+    case OP_MUL:
+        return eval_flags(NODE_MULT, operands, 2, result);
+    case OP_DIV:
+        return eval_flags(NODE_DIV, operands, 2, result);
+    case OP_POW:
+        return eval_flags(NODE_POW, operands, 2, result);
+    case OP_FMA:
+        return eval_flags(NODE_SUM, operands, 3, result);
+    case OP_POWI:
+        operands[1] = T(static_cast<int>(ins.rhs));
+        return eval_flags(NODE_POW, operands, 2, result);
+    case OP_SQRT:
+        operands[1] = T(0.5L);
+        return eval_flags(NODE_POW, operands, 2, result);
+    case OP_RSQRT:
+        operands[1] = T(-0.5L);
+        return eval_flags(NODE_POW, operands, 2, result);
+    }
+    return EVAL_OK;
+}
+
+template <typename T>
+void CompiledExpression<T>::eval(const T *vars, T *results) const
+{
+    run<false>(vars, results, nullptr);
+}
+
+template <typename T>
+ProgramStatus CompiledExpression<T>::eval_checked(const T *vars, T *results) const noexcept
+{
+    ProgramStatus status;
+    // Буфер ячеек растёт при первом вызове в потоке; ошибка выделения - флаг, а не исключение.
+    try
+    {
+        run<true>(vars, results, &status);
+    }
+    catch (...)
+    {
+        if (status.flags == EVAL_OK)
+        {
+            status.error = EVAL_NO_MEMORY;
+            status.slot = 0;
+        }
+        status.flags |= EVAL_NO_MEMORY;
+        for (size_t k = 0; k < outputs_.size(); ++k)
+        {
+            results[k] = T(std::numeric_limits<long double>::quiet_NaN());
+        }
+    }
+    return status;
+}
+
+template <typename T>
+template <bool Checked>
+void CompiledExpression<T>::run(const T *vars, T *results, ProgramStatus *status) const
+{
+    T *regs = registers<T>(program_.size());
+    for (size_t slot = 0; slot < program_.size(); ++slot)
+    {
+        const Instruction &ins = program_[slot];
+        switch (ins.op)
+        {
+        case OP_CONST:
+            regs[slot] = constants_[ins.lhs];
+            break;
+        case OP_VAR:
+            regs[slot] = vars[ins.lhs];
+            break;
+        case OP_POWI:
+            regs[slot] = integer_power(regs[ins.lhs], static_cast<int>(ins.rhs));
+            break;
+        case OP_SINCOS:
+            sincos_of(regs[ins.lhs], regs[slot], regs[slot + 1]);
+            break;
+        case OP_SINCOS_COS:
+            break;
+        case OP_FMA:
+            regs[slot] = multiply_add(regs[ins.lhs], regs[ins.rhs], regs[ins.addend]);
+            break;
+        default:
+            regs[slot] = apply(ins.op, regs[ins.lhs], regs[ins.rhs]);
+            break;
+        }
+        if constexpr (Checked)
+        {
+            size_t count = operand_count(ins.op);
+            uint32_t flags = instruction_flags(ins, count > 0 ? regs[ins.lhs] : T(0), count > 1 ? regs[ins.rhs] : T(0),
+                                               count > 2 ? regs[ins.addend] : T(0), regs[slot]);
+            if (flags != EVAL_OK && status->flags == EVAL_OK)
+            {
+                status->error = static_cast<EvalFlag>(flags & -flags);
+                status->slot = static_cast<uint32_t>(slot);
+            }
+            status->flags |= flags;
+        }
+    }
+    for (size_t k = 0; k < outputs_.size(); ++k)
+    {
+        results[k] = regs[outputs_[k]];
+    }
+}
+
+// Выполнение одной инструкции над блоком из n точек; ветвление вынесено из цикла.
+template <typename T>
+static inline void apply_block(OpCode op, T *__restrict out, const T *__restrict lhs, const T *__restrict rhs, size_t n)
+{
+    switch (op)
+    {
+    case OP_NEG:
+        for (size_t i = 0; i < n; ++i)
+            out[i] = -lhs[i];
+        break;
+    case OP_SIN:
+        for (size_t i = 0; i < n; ++i)
+            out[i] = std::sin(lhs[i]);
+        break;
+    case OP_COS:
+        for (size_t i = 0; i < n; ++i)
+            out[i] = std::cos(lhs[i]);
+        break;
+    case OP_LN:
+        for (size_t i = 0; i < n; ++i)
+            out[i] = std::log(lhs[i]);
+        break;
+    case OP_EXP:
+        for (size_t i = 0; i < n; ++i)
+            out[i] = std::exp(lhs[i]);
+        break;
+    case OP_ADD:
+        for (size_t i = 0; i < n; ++i)
+            out[i] = lhs[i] + rhs[i];
+        break;
+    case OP_SUB:
+        for (size_t i = 0; i < n; ++i)
+            out[i] = lhs[i] - rhs[i];
+        break;
+    case OP_MUL:
+        for (size_t i = 0; i < n; ++i)
+            out[i] = lhs[i] * rhs[i];
+        break;
+    case OP_DIV:
+        for (size_t i = 0; i < n; ++i)
+            out[i] = lhs[i] / rhs[i];
+        break;
+    case OP_POW:
+        for (size_t i = 0; i < n; ++i)
+            out[i] = std::pow(lhs[i], rhs[i]);
+        break;
+    case OP_SQRT:
+        for (size_t i = 0; i < n; ++i)
+            out[i] = std::sqrt(lhs[i]);
+        break;
+    case OP_RSQRT:
+        for (size_t i = 0; i < n; ++i)
+            out[i] = T(1) / std::sqrt(lhs[i]);
+        break;
+    default:
+        break;
+    }
+}
+
+// Целая степень для блока точек: общая для всех точек цепочка умножений.
+template <typename T>
+static inline void power_block(T *__restrict out, const T *__restrict base, int n, size_t count)
+{
+    unsigned int power = n < 0 ? -static_cast<unsigned int>(n) : static_cast<unsigned int>(n);
+    for (size_t i = 0; i < count; ++i)
+        out[i] = T(1);
+    T square[BATCH_BLOCK];
+    std::copy(base, base + count, square);
+    while (power != 0)
+    {
+        if (power & 1U)
+        {
+            for (size_t i = 0; i < count; ++i)
+                out[i] *= square[i];
+        }
+        power >>= 1;
+        if (power != 0)
+        {
+            for (size_t i = 0; i < count; ++i)
+                square[i] *= square[i];
+        }
+    }
+    if (n < 0)
+    {
+        for (size_t i = 0; i < count; ++i)
+            out[i] = T(1) / out[i];
+    }
+}
+
+template <typename T>
+void CompiledExpression<T>::eval_batch(size_t count, const T *const *columns, T *const *results,
+                                       const size_t *strides, uint32_t *flags) const
+{
+    TRACE_SCOPE("eval_batch");
+    if (flags == nullptr)
+    {
+        run_batch<false>(count, columns, results, strides, nullptr);
+    }
+    else
+    {
+        std::fill(flags, flags + count, uint32_t(EVAL_OK));
+        run_batch<true>(count, columns, results, strides, flags);
+    }
+}
+
+template <typename T>
+template <bool Checked>
+void CompiledExpression<T>::run_batch(size_t count, const T *const *columns, T *const *results,
+                                      const size_t *strides, uint32_t *flags) const
+{
+    T *regs = registers<T>(program_.size() * BATCH_BLOCK);
+    for (size_t begin = 0; begin < count; begin += BATCH_BLOCK)
+    {
+        size_t n = std::min(BATCH_BLOCK, count - begin);
+        for (size_t slot = 0; slot < program_.size(); ++slot)
+        {
+            const Instruction &ins = program_[slot];
+            T *out = regs + slot * BATCH_BLOCK;
+            if (ins.op == OP_CONST)
+            {
+                std::fill(out, out + n, constants_[ins.lhs]);
+            }
+            else if (ins.op == OP_VAR)
+            {
+                size_t stride = strides ? strides[ins.lhs] : 1;
+                const T *column = columns[ins.lhs] + begin * stride;
+                if (stride == 1)
+                {
+                    std::copy(column, column + n, out);
+                }
+                else
+                {
+                    for (size_t i = 0; i < n; ++i)
+                        out[i] = column[i * stride];
+                }
+            }
+            else if (ins.op == OP_POWI)
+            {
+                power_block(out, regs + ins.lhs * BATCH_BLOCK, static_cast<int>(ins.rhs), n);
+            }
+            else if (ins.op == OP_SINCOS)
+            {
+                // cos записывается в ячейку следующей инструкции OP_SINCOS_COS.
+                const T *arg = regs + ins.lhs * BATCH_BLOCK;
+                for (size_t i = 0; i < n; ++i)
+                    sincos_of(arg[i], out[i], out[BATCH_BLOCK + i]);
+            }
+            else if (ins.op == OP_SINCOS_COS)
+            {
+            }
+            else if (ins.op == OP_FMA)
+            {
+                const T *a = regs + ins.lhs * BATCH_BLOCK;
+                const T *b = regs + ins.rhs * BATCH_BLOCK;
+                const T *c = regs + ins.addend * BATCH_BLOCK;
+                for (size_t i = 0; i < n; ++i)
+                    out[i] = multiply_add(a[i], b[i], c[i]);
+            }
+            else
+            {
+                apply_block(ins.op, out, regs + ins.lhs * BATCH_BLOCK, regs + ins.rhs * BATCH_BLOCK, n);
+            }
+            if constexpr (Checked)
+            {
+                // Проверка отдельным проходом по блоку, чтобы не мешать векторизации операции.
+                size_t operands = operand_count(ins.op);
+                const T *a = regs + ins.lhs * BATCH_BLOCK;
+                const T *b = operands > 1 ? regs + ins.rhs * BATCH_BLOCK : a;
+                const T *c = operands > 2 ? regs + ins.addend * BATCH_BLOCK : a;
+                for (size_t i = 0; i < n; ++i)
+                {
+                    flags[begin + i] |= instruction_flags(ins, operands > 0 ? a[i] : T(0), operands > 1 ? b[i] : T(0),
+                                                          operands > 2 ? c[i] : T(0), out[i]);
+                }
+            }
+        }
+        for (size_t k = 0; k < outputs_.size(); ++k)
+        {
+            const T *value = regs + outputs_[k] * BATCH_BLOCK;
+            std::copy(value, value + n, results[k] + begin);
+        }
+    }
+}
+
+template <typename T>
+const std::vector<std::string> &CompiledExpression<T>::variables() const
+{
+    return variables_;
+}
+
+template <typename T>
+size_t CompiledExpression<T>::outputs() const
+{
+    return outputs_.size();
+}
+
+template <typename T>
+const std::vector<uint32_t> &CompiledExpression<T>::output_slots() const
+{
+    return outputs_;
+}
+
+template <typename T>
+const std::vector<Instruction> &CompiledExpression<T>::program() const
+{
+    return program_;
+}
+
+template <typename T>
+const std::vector<T> &CompiledExpression<T>::constants() const
+{
+    return constants_;
+}
+
+template <typename T>
+std::vector<std::string> CompiledExpression<T>::free_variables(const Expression<T> &expr)
+{
+    std::set<std::string> names;
+    std::set<const ExpressionBase<T> *> visited;
+    std::vector<const Expression<T> *> stack{&expr};
+    while (!stack.empty())
+    {
+        const Expression<T> *current = stack.back();
+        stack.pop_back();
+        if (current->kind() == NODE_VARIABLE)
+        {
+            names.insert(current->variable());
+            continue;
+        }
+        if (current->node() == nullptr || !visited.insert(current->node()).second)
+        {
+            continue;
+        }
+        for (size_t i = 0; i < current->arity(); ++i)
+        {
+            stack.push_back(&current->operand(i));
+        }
+    }
+    return std::vector<std::string>(names.begin(), names.end());
+}
+
+template class CompiledExpression<long double>;
+template class CompiledExpression<std::complex<long double>>;
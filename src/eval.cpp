@@ -1,10 +1,35 @@
 #include "../includes/expression.hpp"
 #include "../includes/parser.hpp"
 #include "../includes/lexer.hpp"
-
+#include "../includes/integrator.hpp"
+#include "../includes/bulk.hpp"
+#include "../includes/codegen.hpp"
+#include "../includes/compiler.hpp"
+#include "../includes/rewriter.hpp"
+#include "../includes/cache.hpp"
+#include "../includes/trace.hpp"
+#include "../includes/alloc.hpp"
+#include "../includes/server.hpp"
+#include "../includes/analysis.hpp"
+
+#include <algorithm>
+#include <chrono>
 #include <iostream>
+#include <fstream>
 #include <cstring>
 #include <iomanip>
+#include <csignal>
+#include <thread>
+
+// Выделения памяти с момента begin для отчёта о замерах (в сборке make ALLOC=1).
+static void print_allocations(const AllocStats &begin)
+{
+    if (Allocations::counting())
+    {
+        AllocStats stats = Allocations::total() - begin;
+        std::cerr << " allocations: " << stats.allocations << " (" << stats.bytes << "B)";
+    }
+}
 
 int main(int argc, char *argv[])
 {
@@ -12,8 +37,38 @@ int main(int argc, char *argv[])
     std::string eval_expr;
     std::string diff_expr;
     std::string diff_by;
+    std::string integrate_expr;
+    long double integrate_from = 0;
+    long double integrate_to = 0;
+    IntegrationOptions integrate_options;
+    std::string bulk_expr;
+    std::string bulk_input;
+    std::string bulk_output;
+    std::vector<std::string> bulk_columns;
+    bool bulk_binary_output = false;
+    std::string emit_expr;
+    std::string emit_name = "f";
+    bool emit_gradient = false;
+    bool emit_source = false;
+    std::string rewrite_expr;
+    RewriteOptions rewrite_options;
+    std::string stats_expr;
+    std::string stream_input;
+    ParseCacheOptions cache_options;
+    ServerOptions server_options;
+    LoadOptions load_options;
+    std::string trace_output;
+    size_t threads = 1;
     bool is_eval = false;
     bool is_diff = false;
+    bool is_integrate = false;
+    bool is_bulk = false;
+    bool is_emit = false;
+    bool is_rewrite = false;
+    bool is_stats = false;
+    bool is_stream = false;
+    bool is_serve = false;
+    bool is_load = false;
     bool parsing_params = false;
 
     for (int i = 1; i < argc; ++i)
@@ -31,20 +86,174 @@ int main(int argc, char *argv[])
             diff_expr = argv[++i];
             is_diff = true;
         }
-        else if (is_diff && arg == "--by" && i + 1 < argc)
+        else if (arg == "--integrate" && i + 1 < argc)
+        {
+            integrate_expr = argv[++i];
+            is_integrate = true;
+            parsing_params = true;
+        }
+        else if (arg == "--bulk" && i + 1 < argc)
+        {
+            bulk_expr = argv[++i];
+            is_bulk = true;
+            parsing_params = true;
+        }
+        else if (arg == "--emit-cpp" && i + 1 < argc)
+        {
+            emit_expr = argv[++i];
+            is_emit = true;
+        }
+        else if (arg == "--rewrite" && i + 1 < argc)
+        {
+            rewrite_expr = argv[++i];
+            is_rewrite = true;
+        }
+        else if (arg == "--stats" && i + 1 < argc)
+        {
+            // Сведения о выражении (с --by - о его производной).
+            stats_expr = argv[++i];
+            is_stats = true;
+        }
+        else if (arg == "--trace" && i + 1 < argc)
+        {
+            // Запись трассировки этапов в формате Chrome trace event.
+            trace_output = argv[++i];
+            Trace::start();
+        }
+        else if (arg == "--stream")
+        {
+            is_stream = true;
+            parsing_params = true;
+        }
+        else if (arg == "--serve" && i + 1 < argc)
+        {
+            server_options.path = argv[++i];
+            is_serve = true;
+        }
+        else if (is_serve && arg == "--workers" && i + 1 < argc)
+        {
+            server_options.workers = std::stoul(argv[++i]);
+        }
+        else if (arg == "--load" && i + 1 < argc)
+        {
+            // Нагрузочный клиент сервера, запущенного с --serve.
+            load_options.path = argv[++i];
+            is_load = true;
+            parsing_params = true;
+        }
+        else if (is_load && arg == "--expr" && i + 1 < argc)
+        {
+            load_options.expression = argv[++i];
+        }
+        else if (is_load && arg == "--connections" && i + 1 < argc)
+        {
+            load_options.connections = std::stoul(argv[++i]);
+        }
+        else if (is_load && arg == "--requests" && i + 1 < argc)
+        {
+            load_options.requests = std::stoul(argv[++i]);
+        }
+        else if (is_load && arg == "--pipeline" && i + 1 < argc)
+        {
+            load_options.pipeline = std::stoul(argv[++i]);
+        }
+        else if (is_load && arg == "--batch" && i + 1 < argc)
+        {
+            load_options.batch = std::stoul(argv[++i]);
+        }
+        else if (is_stream && arg == "--input" && i + 1 < argc)
+        {
+            stream_input = argv[++i];
+        }
+        else if (is_stream && arg == "--cache" && i + 1 < argc)
+        {
+            cache_options.capacity = std::stoul(argv[++i]);
+        }
+        else if (is_serve && arg == "--cache" && i + 1 < argc)
+        {
+            server_options.cache.capacity = std::stoul(argv[++i]);
+        }
+        else if (is_rewrite && arg == "--safety" && i + 1 < argc)
+        {
+            std::string safety = argv[++i];
+            rewrite_options.safety = safety == "exact" ? SAFETY_EXACT : safety == "domain" ? SAFETY_DOMAIN : SAFETY_FINITE;
+        }
+        else if (is_rewrite && arg == "--samples" && i + 1 < argc)
+        {
+            rewrite_options.samples = std::stoul(argv[++i]);
+        }
+        else if (is_emit && arg == "--name" && i + 1 < argc)
+        {
+            emit_name = argv[++i];
+        }
+        else if (is_emit && arg == "--gradient")
+        {
+            emit_gradient = true;
+        }
+        else if (is_emit && arg == "--source")
+        {
+            emit_source = true;
+        }
+        else if (is_bulk && arg == "--input" && i + 1 < argc)
+        {
+            bulk_input = argv[++i];
+        }
+        else if ((is_bulk || is_emit) && arg == "--output" && i + 1 < argc)
+        {
+            bulk_output = argv[++i];
+        }
+        else if (is_bulk && arg == "--columns" && i + 1 < argc)
+        {
+            // Имена столбцов двоичного входа через запятую.
+            std::string list = argv[++i];
+            for (size_t begin = 0, comma; begin <= list.size(); begin = comma + 1)
+            {
+                comma = std::min(list.find(',', begin), list.size());
+                bulk_columns.push_back(list.substr(begin, comma - begin));
+            }
+        }
+        else if (is_bulk && arg == "--binary-output")
+        {
+            bulk_binary_output = true;
+        }
+        else if ((is_diff || is_integrate || is_stats) && arg == "--by" && i + 1 < argc)
         {
             diff_by = argv[++i];
         }
+        else if (is_integrate && arg == "--from" && i + 1 < argc)
+        {
+            integrate_from = std::stold(argv[++i]);
+        }
+        else if (is_integrate && arg == "--to" && i + 1 < argc)
+        {
+            integrate_to = std::stold(argv[++i]);
+        }
+        else if (is_integrate && arg == "--tol" && i + 1 < argc)
+        {
+            integrate_options.abs_tolerance = std::stold(argv[++i]);
+            integrate_options.rel_tolerance = integrate_options.abs_tolerance;
+        }
+        else if ((is_integrate || is_bulk) && arg == "--threads" && i + 1 < argc)
+        {
+            threads = std::stoul(argv[++i]);
+            integrate_options.threads = threads;
+        }
         else if (parsing_params && arg.find('=') != std::string::npos)
         {
             size_t pos = arg.find('=');
             std::string key = arg.substr(0, pos);
-            int value = std::stold(arg.substr(pos + 1));
+            long double value = 0;
+            if (!BulkEvaluator<long double>::parse_value(arg.data() + pos + 1, arg.data() + arg.size(), value))
+            {
+                std::cerr << "Error: invalid value for " << key << ": " << arg.substr(pos + 1) << std::endl;
+                return 1;
+            }
             params[key] = value;
         }
     }
 
-    if (!is_eval && !is_diff)
+    if (!is_eval && !is_diff && !is_integrate && !is_bulk && !is_emit && !is_rewrite && !is_stream && !is_serve &&
+        !is_load && !is_stats)
     {
         std::cerr << "Error: You cannot use both --eval and --diff flags at the same time." << std::endl;
         return 1;
@@ -64,6 +273,262 @@ int main(int argc, char *argv[])
         Expression expr = parser.parseExpression();
         std::cout << expr.diff(diff_by).to_string() << std::endl;
     }
+    else if (is_integrate)
+    {
+        if (diff_by.empty())
+        {
+            std::cerr << "Error: --integrate requires --by VARIABLE" << std::endl;
+            return 1;
+        }
+        Lexer lexer{integrate_expr};
+        Parser<long double> parser{lexer};
+        Expression expr = parser.parseExpression();
+        AllocStats alloc_begin = Allocations::total();
+        IntegrationResult result;
+        // Переменные подынтегрального выражения, кроме --by, должны иметь значения.
+        try
+        {
+            Integrator<long double> integrator{expr, diff_by, params};
+            result = integrator.integrate(integrate_from, integrate_to, integrate_options);
+        }
+        catch (const std::exception &error)
+        {
+            std::cerr << "Error: " << error.what() << std::endl;
+            return 1;
+        }
+        std::cout << std::setprecision(18) << result.value << std::endl;
+        std::cerr << "error: " << result.error
+                  << " converged: " << (result.converged ? "yes" : "no")
+                  << " evaluations: " << result.evaluations
+                  << " panels: " << result.panels
+                  << " time: " << result.seconds << "s";
+        print_allocations(alloc_begin);
+        std::cerr << std::endl;
+    }
+    else if (is_bulk)
+    {
+        // Входной файл: CSV с заголовком или сырые столбцы double при заданном --columns.
+        Lexer lexer{bulk_expr};
+        Parser<long double> parser{lexer};
+        Expression expr = parser.parseExpression();
+        BulkEvaluator<long double> evaluator{expr, params};
+
+        AllocStats alloc_begin = Allocations::total();
+        auto start = std::chrono::steady_clock::now();
+        MappedFile input{bulk_input};
+        std::vector<long double> results =
+            bulk_columns.empty() ? evaluator.eval_csv(input.data(), input.size(), threads)
+                                 : evaluator.eval_columns(input.data(), input.size(), bulk_columns, threads);
+        double eval_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        std::ofstream file;
+        if (!bulk_output.empty())
+        {
+            file.open(bulk_output, std::ios::binary);
+            if (!file)
+            {
+                std::cerr << "Error: cannot open " << bulk_output << std::endl;
+                return 1;
+            }
+        }
+        std::ostream &out = bulk_output.empty() ? std::cout : file;
+        if (bulk_binary_output)
+        {
+            BulkEvaluator<long double>::write_binary(out, results);
+        }
+        else
+        {
+            BulkEvaluator<long double>::write_text(out, results, threads);
+        }
+        out.flush();
+        std::cerr << "rows: " << results.size() << " eval time: " << eval_seconds << "s";
+        print_allocations(alloc_begin);
+        std::cerr << std::endl;
+    }
+    else if (is_emit)
+    {
+        // Функция по свободным переменным выражения (в лексикографическом порядке).
+        Lexer lexer{emit_expr};
+        Parser<long double> parser{lexer};
+        Expression expr = parser.parseExpression();
+        CodeGenerator<long double> generator{CompiledExpression<long double>::free_variables(expr)};
+        if (emit_gradient)
+        {
+            generator.add_with_gradient(emit_name, expr);
+        }
+        else
+        {
+            generator.add(emit_name, expr);
+        }
+        CodegenOptions options;
+        options.header = !emit_source;
+        std::string code = generator.emit(options);
+        if (bulk_output.empty())
+        {
+            std::cout << code;
+        }
+        else
+        {
+            std::ofstream file(bulk_output);
+            file << code;
+            if (!file)
+            {
+                std::cerr << "Error: cannot write " << bulk_output << std::endl;
+                return 1;
+            }
+        }
+    }
+
+    else if (is_rewrite)
+    {
+        Lexer lexer{rewrite_expr};
+        Parser<long double> parser{lexer};
+        Expression expr = parser.parseExpression();
+        RewriteReport report;
+        std::cout << Rewriter<long double>(rewrite_options).rewrite(expr, &report).to_string() << std::endl;
+        std::cerr << "cost: " << report.cost_before << " -> " << report.cost_after
+                  << " estimated speedup: " << report.estimated_speedup;
+        if (rewrite_options.samples > 0)
+        {
+            std::cerr << " measured speedup: " << report.measured_speedup;
+        }
+        for (const auto &[rule, count] : report.rules)
+        {
+            std::cerr << " " << rule << ": " << count;
+        }
+        std::cerr << std::endl;
+    }
+    else if (is_stats)
+    {
+        Lexer lexer{stats_expr};
+        Parser<long double> parser{lexer};
+        Expression expr = parser.parseExpression();
+        if (!diff_by.empty())
+        {
+            expr = expr.diff(diff_by);
+        }
+        ExpressionStats stats = analyze(expr);
+        std::cout << "nodes: " << stats.tree_nodes << " unique: " << stats.unique_nodes
+                  << " sharing: " << stats.sharing << " depth: " << stats.depth << std::endl;
+        std::cout << "memory: " << stats.bytes << "B in " << stats.heap_nodes << " nodes" << std::endl;
+        std::cout << "cost: tree " << stats.tree_cost << " dag " << stats.dag_cost << std::endl;
+        std::cout << "operations:";
+        for (size_t kind = 0; kind < NODE_KINDS; ++kind)
+        {
+            if (stats.operations[kind] != 0)
+            {
+                std::cout << " " << node_kind_name(static_cast<NodeKind>(kind)) << ": " << stats.operations[kind];
+            }
+        }
+        std::cout << std::endl;
+        std::cout << "variables:";
+        for (const std::string &name : stats.variables)
+        {
+            std::cout << " " << name;
+        }
+        std::cout << std::endl;
+    }
+    else if (is_stream)
+    {
+        // По выражению в строке (из файла или стандартного ввода); повторяющиеся
+        // выражения берутся из кэша вместе со скомпилированной программой.
+        ParseCache<long double> cache{cache_options};
+        std::ifstream file;
+        if (!stream_input.empty())
+        {
+            file.open(stream_input);
+            if (!file)
+            {
+                std::cerr << "Error: cannot open " << stream_input << std::endl;
+                return 1;
+            }
+        }
+        std::istream &in = stream_input.empty() ? std::cin : file;
+        std::vector<long double> values;
+        std::string line;
+        AllocStats alloc_begin = Allocations::total();
+        auto start = std::chrono::steady_clock::now();
+        while (std::getline(in, line))
+        {
+            if (line.find_first_not_of(" \t\r") == std::string::npos)
+            {
+                continue;
+            }
+            auto compiled = cache.compile(line);
+            values.clear();
+            for (const std::string &name : compiled->variables())
+            {
+                auto found = params.find(name);
+                if (found == params.end())
+                {
+                    std::cerr << "Error: no value for variable " << name << std::endl;
+                    return 1;
+                }
+                values.push_back(found->second);
+            }
+            std::cout << compiled->eval(values.data()) << '\n';
+        }
+        std::cout.flush();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        ParseCacheStats stats = cache.stats();
+        std::cerr << "hits: " << stats.hits << " misses: " << stats.misses
+                  << " hit rate: " << stats.hit_rate << " evictions: " << stats.evictions
+                  << " entries: " << stats.entries << " memory: " << stats.memory << "B"
+                  << " time: " << seconds << "s";
+        print_allocations(alloc_begin);
+        std::cerr << std::endl;
+    }
+    else if (is_serve)
+    {
+        // Работа до SIGINT или SIGTERM; сигналы принимает отдельный поток, чтобы сервер
+        // завершился штатно и удалил файл сокета.
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGINT);
+        sigaddset(&signals, SIGTERM);
+        pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+        EvalServer server{server_options};
+        std::thread waiter([&]
+                           {
+                               int signal = 0;
+                               sigwait(&signals, &signal);
+                               server.stop();
+                           });
+        std::cerr << "listening on " << server_options.path << std::endl;
+        server.run();
+        // Поток ожидания сигнала завершается, если сервер остановлен иначе.
+        pthread_kill(waiter.native_handle(), SIGTERM);
+        waiter.join();
+
+        ServerStats stats = server.stats();
+        std::cerr << "connections: " << stats.connections << " requests: " << stats.requests
+                  << " errors: " << stats.errors << " cache hits: " << stats.cache.hits
+                  << " misses: " << stats.cache.misses << std::endl;
+    }
+    else if (is_load)
+    {
+        load_options.params = params;
+        LoadReport report = run_load(load_options);
+        std::cout << "requests: " << report.requests << " points: " << report.points
+                  << " time: " << report.seconds << "s"
+                  << " throughput: " << report.requests_per_second << " req/s "
+                  << report.points_per_second << " points/s" << std::endl;
+        std::cout << "latency us: mean " << report.latency_mean << " p50 " << report.latency_p50
+                  << " p99 " << report.latency_p99 << " max " << report.latency_max << std::endl;
+    }
+
+    if (!trace_output.empty())
+    {
+        Trace::stop();
+        std::ofstream file(trace_output);
+        Trace::write_chrome(file);
+        if (!file)
+        {
+            std::cerr << "Error: cannot write " << trace_output << std::endl;
+            return 1;
+        }
+    }
 
     return 0;
 }
@@ -1,34 +1,420 @@
+#include <algorithm>
+#include <deque>
+#include <iterator>
+#include <limits>
+#include <mutex>
+#include <numeric>
+#include <shared_mutex>
 #include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
 #include "../includes/expression.hpp"
+#include "../includes/trace.hpp"
+
+// Проверка, что выражение - константа с заданным значением.
+template <typename T>
+static bool is_constant(const Expression<T> &expr, T value)
+{
+    return expr.kind() == NODE_VALUE && expr.constant() == value;
+}
+
+// ============
+// |Expression|
+// ============
+
+// ==============
+// |SymbolTable|
+// ==============
+
+// Имена хранятся в deque: ссылки на элементы не меняются при добавлении новых.
+static std::shared_mutex symbols_mutex;
+static std::unordered_map<std::string, uint32_t> symbol_ids;
+static std::deque<std::string> symbol_names;
+
+uint32_t SymbolTable::intern(const std::string &name)
+{
+    {
+        std::shared_lock lock(symbols_mutex);
+        auto iter = symbol_ids.find(name);
+        if (iter != symbol_ids.end())
+        {
+            return iter->second;
+        }
+    }
+    std::unique_lock lock(symbols_mutex);
+    auto [iter, inserted] = symbol_ids.emplace(name, static_cast<uint32_t>(symbol_names.size()));
+    if (inserted)
+    {
+        symbol_names.push_back(name);
+    }
+    return iter->second;
+}
+
+bool SymbolTable::find(const std::string &name, uint32_t &symbol)
+{
+    std::shared_lock lock(symbols_mutex);
+    auto iter = symbol_ids.find(name);
+    if (iter == symbol_ids.end())
+    {
+        return false;
+    }
+    symbol = iter->second;
+    return true;
+}
+
+void SymbolTable::find(const std::string *const *names, size_t count, uint32_t *symbols)
+{
+    std::shared_lock lock(symbols_mutex);
+    for (size_t i = 0; i < count; ++i)
+    {
+        auto iter = symbol_ids.find(*names[i]);
+        symbols[i] = iter == symbol_ids.end() ? UINT32_MAX : iter->second;
+    }
+}
+
+const std::string &SymbolTable::name(uint32_t symbol)
+{
+    std::shared_lock lock(symbols_mutex);
+    return symbol_names.at(symbol);
+}
+
+size_t SymbolTable::size()
+{
+    std::shared_lock lock(symbols_mutex);
+    return symbol_names.size();
+}
 
 // ============
 // |Expression|
 // ============
 
 template <typename T>
-Expression<T>::Expression(std::shared_ptr<ExpressionBase<T>> base_) : base(base_)
+Expression<T>::Expression() : base(), storage(STORAGE_NODE)
+{
+}
+
+template <typename T>
+Expression<T>::Expression(std::shared_ptr<ExpressionBase<T>> base_) : base(std::move(base_)), storage(STORAGE_NODE)
+{
+    if (base)
+    {
+        base->update_variable_mask();
+    }
+}
+
+template <typename T>
+Expression<T>::Expression(T value) : storage(STORAGE_VALUE)
+{
+    static_assert(std::is_trivially_copyable_v<T>, "constants are stored in Expression as bytes");
+    std::memcpy(number, &value, sizeof(T));
+}
+
+template <typename T>
+T Expression<T>::stored_value() const
 {
+    T value;
+    std::memcpy(&value, number, sizeof(T));
+    return value;
+}
+
+template <typename T>
+Expression<T>::Expression(const std::string &variable)
+    : symbol_id(SymbolTable::intern(variable)), storage(STORAGE_VARIABLE)
+{
+}
+
+template <typename T>
+Expression<T>::Expression(const Expression<T> &other)
+{
+    construct(other);
+}
+
+template <typename T>
+Expression<T>::Expression(Expression<T> &&other) noexcept
+{
+    construct(std::move(other));
 }
 
 template <typename T>
-Expression<T>::Expression(T number) : base(std::make_shared<Value<T>>(number))
+void Expression<T>::construct(const Expression<T> &other)
 {
+    storage = other.storage;
+    switch (storage)
+    {
+    case STORAGE_NODE:
+        new (&base) std::shared_ptr<ExpressionBase<T>>(other.base);
+        break;
+    case STORAGE_VALUE:
+        std::memcpy(number, other.number, sizeof(T));
+        break;
+    case STORAGE_VARIABLE:
+        symbol_id = other.symbol_id;
+        break;
+    }
 }
 
 template <typename T>
-Expression<T>::Expression(const std::string &variable) : base(std::make_shared<Variable<T>>(variable))
+void Expression<T>::construct(Expression<T> &&other)
 {
+    storage = other.storage;
+    switch (storage)
+    {
+    case STORAGE_NODE:
+        new (&base) std::shared_ptr<ExpressionBase<T>>(std::move(other.base));
+        break;
+    case STORAGE_VALUE:
+        std::memcpy(number, other.number, sizeof(T));
+        break;
+    case STORAGE_VARIABLE:
+        symbol_id = other.symbol_id;
+        break;
+    }
 }
 
 template <typename T>
-Expression<T>::Expression(const Expression<T> &other) : base(other.base)
+void Expression<T>::clear()
 {
+    if (storage == STORAGE_NODE)
+    {
+        if (base && base.use_count() == 1)
+        {
+            destroy(std::move(base));
+        }
+        base.~shared_ptr();
+    }
+    new (&base) std::shared_ptr<ExpressionBase<T>>();
+    storage = STORAGE_NODE;
 }
 
 template <typename T>
 Expression<T> Expression<T>::diff(const std::string &by) const
 {
-    return Expression<T>(base->diff(by));
+    TRACE_SCOPE("diff");
+    // Производные операндов находятся раньше производной узла; для общих
+    // поддеревьев производная строится один раз.
+    // Поддеревья без переменной by получают общий ноль без обхода.
+    Expression<T> zero(T(0));
+    uint32_t symbol = 0;
+    if (!SymbolTable::find(by, symbol))
+    {
+        return zero;
+    }
+    uint64_t bit = ExpressionBase<T>::variable_bit(symbol);
+    std::unordered_map<const ExpressionBase<T> *, Expression<T>> derived;
+    std::vector<std::pair<const Expression<T> *, bool>> stack{{this, false}};
+    std::vector<Expression<T>> derivatives;
+    while (!stack.empty())
+    {
+        auto [expr, ready] = stack.back();
+        const ExpressionBase<T> *node = expr->node();
+        if (node == nullptr)
+        {
+            stack.pop_back();
+            bool by_variable = expr->kind() == NODE_VARIABLE && expr->symbol() == symbol;
+            derivatives.push_back(by_variable ? Expression<T>(T(1)) : zero);
+            continue;
+        }
+        size_t arity = node->arity();
+        if (!ready)
+        {
+            auto iter = derived.find(node);
+            if (iter != derived.end())
+            {
+                stack.pop_back();
+                derivatives.push_back(iter->second);
+                continue;
+            }
+            if ((node->variable_mask() & bit) == 0)
+            {
+                stack.pop_back();
+                derivatives.push_back(zero);
+                continue;
+            }
+            stack.back().second = true;
+            for (size_t i = arity; i-- > 0;)
+            {
+                stack.emplace_back(&node->operand(i), false);
+            }
+            continue;
+        }
+        stack.pop_back();
+        Expression<T> derivative = node->derive(derivatives.data() + derivatives.size() - arity, by);
+        derivatives.resize(derivatives.size() - arity);
+        derived.emplace(node, derivative);
+        derivatives.push_back(std::move(derivative));
+    }
+    return derivatives.back();
+}
+
+// Производные узла по переменным, от которых он зависит (номера по возрастанию).
+template <typename T>
+struct Gradient
+{
+    std::vector<uint32_t> variables;
+    std::vector<Expression<T>> derivatives;
+};
+
+// Градиент выражения за один обход. Переменным (по номерам SymbolTable) присваиваются
+// номера в ids; если fixed, учитываются только переменные, уже имеющие номер. Результат -
+// производные по переменным с номерами 0..names.size() (общий ноль для отсутствующих).
+template <typename T>
+static std::vector<Expression<T>> gradient(const Expression<T> &root, std::unordered_map<uint32_t, uint32_t> &ids,
+                                           std::vector<std::string> &names, bool fixed)
+{
+    Expression<T> zero(T(0));
+    Expression<T> one(T(1));
+    // Градиент листа строится на месте: у переменной единственная производная 1.
+    auto leaf = [&](const Expression<T> &expr, Gradient<T> &result)
+    {
+        result.variables.clear();
+        result.derivatives.clear();
+        if (expr.kind() != NODE_VARIABLE)
+        {
+            return;
+        }
+        auto iter = ids.find(expr.symbol());
+        if (iter == ids.end() && !fixed)
+        {
+            iter = ids.emplace(expr.symbol(), static_cast<uint32_t>(names.size())).first;
+            names.push_back(expr.variable());
+        }
+        if (iter != ids.end())
+        {
+            result.variables.push_back(iter->second);
+            result.derivatives.push_back(one);
+        }
+    };
+
+    std::unordered_map<const ExpressionBase<T> *, Gradient<T>> memo;
+    std::vector<std::pair<const Expression<T> *, bool>> stack{{&root, false}};
+    std::vector<Expression<T>> derivatives;
+    std::vector<Gradient<T>> leaves;
+    std::vector<const Gradient<T> *> operands;
+    // Пары (переменная, операнд, позиция в его градиенте) и выборка для одной переменной.
+    std::vector<std::tuple<uint32_t, uint32_t, uint32_t>> entries;
+    std::vector<uint32_t> indices;
+    while (!stack.empty())
+    {
+        auto [current, ready] = stack.back();
+        const ExpressionBase<T> *node = current->node();
+        if (node == nullptr || memo.count(node) != 0)
+        {
+            stack.pop_back();
+            continue;
+        }
+        size_t arity = node->arity();
+        if (!ready)
+        {
+            stack.back().second = true;
+            for (size_t i = arity; i-- > 0;)
+            {
+                stack.emplace_back(&node->operand(i), false);
+            }
+            continue;
+        }
+        stack.pop_back();
+        Gradient<T> &result = memo[node];
+
+        // Переменные операндов, упорядоченные по переменной: для каждой переменной
+        // перебираются только зависящие от неё операнды, поэтому работа узла
+        // пропорциональна числу ненулевых производных операндов, а не числу переменных,
+        // умноженному на число операндов.
+        leaves.resize(arity);
+        operands.resize(arity);
+        entries.clear();
+        for (size_t i = 0; i < arity; ++i)
+        {
+            const Expression<T> &operand = node->operand(i);
+            if (operand.node() == nullptr)
+            {
+                leaf(operand, leaves[i]);
+                operands[i] = &leaves[i];
+            }
+            else
+            {
+                operands[i] = &memo.at(operand.node());
+            }
+            const std::vector<uint32_t> &variables = operands[i]->variables;
+            for (size_t k = 0; k < variables.size(); ++k)
+            {
+                entries.emplace_back(variables[k], static_cast<uint32_t>(i), static_cast<uint32_t>(k));
+            }
+        }
+        std::sort(entries.begin(), entries.end());
+
+        for (size_t begin = 0; begin < entries.size();)
+        {
+            uint32_t variable = std::get<0>(entries[begin]);
+            indices.clear();
+            derivatives.clear();
+            size_t end = begin;
+            for (; end < entries.size() && std::get<0>(entries[end]) == variable; ++end)
+            {
+                uint32_t i = std::get<1>(entries[end]);
+                indices.push_back(i);
+                derivatives.push_back(operands[i]->derivatives[std::get<2>(entries[end])]);
+            }
+            result.variables.push_back(variable);
+            result.derivatives.push_back(
+                node->derive_sparse(indices.data(), derivatives.data(), indices.size(), names[variable]));
+            begin = end;
+        }
+    }
+
+    Gradient<T> root_leaf;
+    if (root.node() == nullptr)
+    {
+        leaf(root, root_leaf);
+    }
+    const Gradient<T> &top = root.node() == nullptr ? root_leaf : memo.at(root.node());
+    std::vector<Expression<T>> derivatives_by_id(names.size(), zero);
+    for (size_t i = 0; i < top.variables.size(); ++i)
+    {
+        derivatives_by_id[top.variables[i]] = top.derivatives[i];
+    }
+    return derivatives_by_id;
+}
+
+template <typename T>
+std::map<std::string, Expression<T>> Expression<T>::diff_all() const
+{
+    TRACE_SCOPE("diff_all");
+    std::unordered_map<uint32_t, uint32_t> ids;
+    std::vector<std::string> names;
+    std::vector<Expression<T>> derivatives = gradient(*this, ids, names, false);
+    std::map<std::string, Expression<T>> result;
+    for (size_t i = 0; i < names.size(); ++i)
+    {
+        result.emplace(names[i], derivatives[i]);
+    }
+    return result;
+}
+
+template <typename T>
+std::vector<Expression<T>> Expression<T>::diff_all(const std::vector<std::string> &variables) const
+{
+    TRACE_SCOPE("diff_all");
+    std::unordered_map<uint32_t, uint32_t> ids;
+    std::vector<std::string> names;
+    std::vector<uint32_t> positions;
+    for (const std::string &name : variables)
+    {
+        auto [iter, inserted] = ids.emplace(SymbolTable::intern(name), static_cast<uint32_t>(names.size()));
+        if (inserted)
+        {
+            names.push_back(name);
+        }
+        positions.push_back(iter->second);
+    }
+    std::vector<Expression<T>> derivatives = gradient(*this, ids, names, true);
+    std::vector<Expression<T>> result;
+    result.reserve(variables.size());
+    for (uint32_t position : positions)
+    {
+        result.push_back(derivatives[position]);
+    }
+    return result;
 }
 
 template <typename T>
@@ -37,12 +423,27 @@ Expression<T> Expression<T>::operator-() const
     return Expression<T>(std::make_shared<Negate<T>>(*this));
 }
 
+template <typename T>
+Expression<T> &Expression<T>::operator=(const Expression<T> &other)
+{
+    if (this != &other)
+    {
+        // other может быть частью текущего дерева: старое значение удаляется последним.
+        Expression<T> old(std::move(*this));
+        clear();
+        construct(other);
+    }
+    return *this;
+}
+
 template <typename T>
 Expression<T> &Expression<T>::operator=(Expression<T> &&other)
 {
     if (this != &other)
     {
-        base = std::move(other.base); // Перемещаем базовый указатель
+        Expression<T> old(std::move(*this));
+        clear();
+        construct(std::move(other));
     }
     return *this;
 }
@@ -158,304 +559,1046 @@ Expression<T> Expression<T>::ExprExp() const
 //     return Expression<T>(std::make_shared<Variable>(std::string(name)));
 // }
 
+// Стеки обхода в eval и try_eval, свои у каждого потока: после первого вызова
+// вычисление не выделяет память. Вызов забирает стеки на время обхода и возвращает
+// их при выходе, поэтому вложенный вызов получает пустые стеки и не портит внешние.
+//
+// Контекст разбирается один раз за вызов в массив значений по номерам переменных
+// (bind), поэтому лист переменной не обращается к SymbolTable и не ищет имя в map.
 template <typename T>
-T Expression<T>::eval(std::map<std::string, T> context) const
+class EvalStacks
 {
-    return base->eval(context);
-}
+public:
+    EvalStacks()
+    {
+        swap(cached());
+        nodes.clear();
+        values.clear();
+    }
+    ~EvalStacks()
+    {
+        swap(cached());
+    }
 
-template <typename T>
-std::string Expression<T>::to_string() const
-{
-    // throw std::runtime_error(base->to_string());
+    EvalStacks(const EvalStacks &) = delete;
+    EvalStacks &operator=(const EvalStacks &) = delete;
 
-    return base->to_string();
-}
+    void bind(const std::map<std::string, T> &context)
+    {
+        // Отметка текущего вызова; при переполнении старые отметки стираются.
+        if (++generation == 0)
+        {
+            std::fill(stamps.begin(), stamps.end(), 0);
+            generation = 1;
+        }
+        names.clear();
+        for (const auto &entry : context)
+        {
+            names.push_back(&entry.first);
+        }
+        symbols.resize(names.size());
+        SymbolTable::find(names.data(), names.size(), symbols.data());
+        size_t i = 0;
+        for (const auto &entry : context)
+        {
+            uint32_t symbol = symbols[i++];
+            if (symbol == UINT32_MAX)
+            {
+                continue;
+            }
+            if (symbol >= stamps.size())
+            {
+                stamps.resize(symbol + 1, 0);
+                bound.resize(symbol + 1);
+            }
+            stamps[symbol] = generation;
+            bound[symbol] = entry.second;
+        }
+    }
 
-template class Expression<long double>;
-template class Expression<std::complex<long double>>;
+    // Значение переменной из последнего bind (nullptr - переменной нет в контексте).
+    const T *lookup(uint32_t symbol) const
+    {
+        return symbol < stamps.size() && stamps[symbol] == generation ? &bound[symbol] : nullptr;
+    }
 
-// =============
-// |class Value|
-// =============
+    std::vector<std::pair<const Expression<T> *, bool>> nodes;
+    std::vector<T> values;
+
+private:
+    std::vector<const std::string *> names;
+    std::vector<uint32_t> symbols;
+    std::vector<T> bound;
+    std::vector<uint32_t> stamps;
+    uint32_t generation = 0;
+
+    void swap(EvalStacks &other) noexcept
+    {
+        std::swap(nodes, other.nodes);
+        std::swap(values, other.values);
+        std::swap(names, other.names);
+        std::swap(symbols, other.symbols);
+        std::swap(bound, other.bound);
+        std::swap(stamps, other.stamps);
+        std::swap(generation, other.generation);
+    }
+
+    struct Cached
+    {
+    };
+    explicit EvalStacks(Cached)
+    {
+    }
+    static EvalStacks &cached()
+    {
+        thread_local EvalStacks buffers{Cached{}};
+        return buffers;
+    }
+};
 
 template <typename T>
-Value<T>::Value(T number)
+T Expression<T>::eval(const std::map<std::string, T> &context) const
 {
-    value = number;
+    TRACE_SCOPE("eval");
+    // Обход в обратном порядке с явным стеком: операнды узла вычисляются раньше него,
+    // их значения лежат на вершине стека values.
+    EvalStacks<T> stacks;
+    stacks.bind(context);
+    auto &stack = stacks.nodes;
+    auto &values = stacks.values;
+    stack.emplace_back(this, false);
+    while (!stack.empty())
+    {
+        auto [expr, ready] = stack.back();
+        const ExpressionBase<T> *node = expr->node();
+        if (node == nullptr)
+        {
+            stack.pop_back();
+            if (expr->storage == STORAGE_VALUE)
+            {
+                values.push_back(expr->stored_value());
+                continue;
+            }
+            const T *value = stacks.lookup(expr->symbol_id);
+            if (value == nullptr)
+            {
+                throw std::runtime_error("Variable " + SymbolTable::name(expr->symbol_id) +
+                                         " not present in eval context!!!");
+            }
+            values.push_back(*value);
+            continue;
+        }
+        size_t arity = node->arity();
+        if (!ready)
+        {
+            stack.back().second = true;
+            for (size_t i = arity; i-- > 0;)
+            {
+                stack.emplace_back(&node->operand(i), false);
+            }
+            continue;
+        }
+        stack.pop_back();
+        T value = node->apply(values.data() + values.size() - arity, context);
+        values.resize(values.size() - arity);
+        values.push_back(value);
+    }
+    return values.back();
 }
 
 template <typename T>
-Expression<T> Value<T>::diff(const std::string &by [[maybe_unused]])
+EvalResult<T> Expression<T>::try_eval(const std::map<std::string, T> &context) const noexcept
 {
-    return Expression<T>((long double)0);
+    TRACE_SCOPE("try_eval");
+    // Тот же обход, что в eval; после каждого узла проверяются операнды и результат.
+    EvalResult<T> result;
+    auto report = [&result](uint32_t flags, const Expression<T> *expr)
+    {
+        if (flags != EVAL_OK && result.flags == EVAL_OK)
+        {
+            result.error = static_cast<EvalFlag>(flags & -flags);
+            result.node = expr;
+        }
+        result.flags |= flags;
+    };
+    // Рост стеков и разбор контекста могут бросить исключение; вместо него - флаг.
+    try
+    {
+        EvalStacks<T> stacks;
+        stacks.bind(context);
+        auto &stack = stacks.nodes;
+        auto &values = stacks.values;
+        stack.emplace_back(this, false);
+        while (!stack.empty())
+        {
+            auto [expr, ready] = stack.back();
+            const ExpressionBase<T> *node = expr->node();
+            if (node == nullptr)
+            {
+                stack.pop_back();
+                if (expr->storage == STORAGE_VALUE)
+                {
+                    values.push_back(expr->stored_value());
+                    continue;
+                }
+                const T *value = stacks.lookup(expr->symbol_id);
+                if (value == nullptr)
+                {
+                    report(EVAL_MISSING_VARIABLE, expr);
+                    values.push_back(T(std::numeric_limits<long double>::quiet_NaN()));
+                    continue;
+                }
+                values.push_back(*value);
+                continue;
+            }
+            size_t arity = node->arity();
+            if (!ready)
+            {
+                stack.back().second = true;
+                for (size_t i = arity; i-- > 0;)
+                {
+                    stack.emplace_back(&node->operand(i), false);
+                }
+                continue;
+            }
+            stack.pop_back();
+            const T *operands = values.data() + values.size() - arity;
+            T value = node->apply(operands, context);
+            report(eval_flags(node->kind(), operands, arity, value), expr);
+            values.resize(values.size() - arity);
+            values.push_back(value);
+        }
+        result.value = values.back();
+    }
+    catch (...)
+    {
+        report(EVAL_NO_MEMORY, this);
+        result.value = T(std::numeric_limits<long double>::quiet_NaN());
+    }
+    return result;
 }
 
 template <typename T>
-T Value<T>::eval(std::map<std::string, T> context) const
+std::string Expression<T>::to_string() const
 {
-
-    (void)context;
-    return value;
+    TRACE_SCOPE("to_string");
+    // Части текста узла чередуются с текстом операндов и дописываются в одну строку.
+    std::vector<std::pair<const Expression<T> *, size_t>> stack{{this, 0}};
+    std::string str;
+    while (!stack.empty())
+    {
+        auto &[expr, part] = stack.back();
+        const ExpressionBase<T> *node = expr->node();
+        if (node == nullptr)
+        {
+            if (expr->storage == STORAGE_VALUE)
+            {
+                std::ostringstream oss;
+                oss << expr->stored_value();
+                str += oss.str();
+            }
+            else
+            {
+                str += SymbolTable::name(expr->symbol_id);
+            }
+            stack.pop_back();
+            continue;
+        }
+        str += node->format(part);
+        if (part < node->arity())
+        {
+            const Expression<T> *next = &node->operand(part);
+            ++part;
+            stack.emplace_back(next, 0);
+        }
+        else
+        {
+            stack.pop_back();
+        }
+    }
+    return str;
 }
 
 template <typename T>
-std::string Value<T>::to_string() const
+std::shared_ptr<ExpressionBase<T>> Expression<T>::release()
 {
-    std::ostringstream oss;
-    oss << value;
-    return oss.str();
+    if (storage != STORAGE_NODE)
+    {
+        return nullptr;
+    }
+    return std::move(base);
 }
 
-template class Value<long double>;
-template class Value<std::complex<long double>>;
-
-// =============
-// |class Negate|
-// =============
-
 template <typename T>
-Negate<T>::Negate(const Expression<T> &expr_) : expr(expr_)
+void Expression<T>::destroy(std::shared_ptr<ExpressionBase<T>> &&node)
 {
+    // Узел, на который больше нет ссылок, отдаёт операнды в список до своего удаления,
+    // поэтому деструкторы узлов не вызывают друг друга по цепочке.
+    std::vector<std::shared_ptr<ExpressionBase<T>>> pending;
+    pending.push_back(std::move(node));
+    while (!pending.empty())
+    {
+        std::shared_ptr<ExpressionBase<T>> current = std::move(pending.back());
+        pending.pop_back();
+        if (current && current.use_count() == 1)
+        {
+            current->release_operands(pending);
+        }
+    }
 }
 
 template <typename T>
-Expression<T> Negate<T>::diff(const std::string &by)
+Expression<T>::~Expression()
 {
-    return -expr.diff(by);
+    if (storage == STORAGE_NODE)
+    {
+        if (base && base.use_count() == 1)
+        {
+            destroy(std::move(base));
+        }
+        base.~shared_ptr();
+    }
 }
 
 template <typename T>
-T Negate<T>::eval(std::map<std::string, T> context) const
+Expression<T> Expression<T>::ExprSum(std::vector<Expression<T>> terms, std::vector<bool> negated, bool compensated)
 {
-    T value = expr.eval(context);
-    return -value;
+    if (terms.empty())
+    {
+        return Expression<T>(T(0));
+    }
+    negated.resize(terms.size(), false);
+    return Expression<T>(std::make_shared<OpSum<T>>(std::move(terms), std::move(negated), compensated));
 }
 
 template <typename T>
-std::string Negate<T>::to_string() const
+Expression<T> Expression<T>::ExprProduct(std::vector<Expression<T>> factors)
 {
-    return std::string("-(") + expr.to_string() +
-           std::string(")");
+    if (factors.empty())
+    {
+        return Expression<T>(T(1));
+    }
+    return Expression<T>(std::make_shared<OpProduct<T>>(std::move(factors)));
 }
 
-template class Negate<long double>;
-template class Negate<std::complex<long double>>;
-
-// ================
-// |class Variable|
-// ================
-
 template <typename T>
-Variable<T>::Variable(std::string name_) : name(name_)
+Expression<T> Expression<T>::flatten(bool compensated) const
 {
+    TRACE_SCOPE("flatten");
+    // Обход в обратном порядке: операнды узла преобразуются раньше него.
+    std::unordered_map<const ExpressionBase<T> *, Expression<T>> flattened;
+    std::vector<std::pair<const Expression<T> *, bool>> stack{{this, false}};
+    while (!stack.empty())
+    {
+        auto [expr, ready] = stack.back();
+        const ExpressionBase<T> *node = expr->node();
+        if (node == nullptr || flattened.count(node))
+        {
+            stack.pop_back();
+            continue;
+        }
+        if (!ready && expr->arity() != 0)
+        {
+            stack.back().second = true;
+            for (size_t i = expr->arity(); i-- > 0;)
+            {
+                stack.emplace_back(&expr->operand(i), false);
+            }
+            continue;
+        }
+        stack.pop_back();
+
+        NodeKind kind = expr->kind();
+        std::vector<Expression<T>> operands;
+        for (size_t i = 0; i < expr->arity(); ++i)
+        {
+            const Expression<T> &operand = expr->operand(i);
+            operands.push_back(operand.node() == nullptr ? operand : flattened.at(operand.node()));
+        }
+
+        Expression<T> result = *expr;
+        if (kind == NODE_ADD || kind == NODE_SUB || kind == NODE_SUM)
+        {
+            // Слагаемые вложенных сумм переносятся в одну сумму с учётом знаков.
+            std::vector<Expression<T>> terms;
+            std::vector<bool> negated;
+            for (size_t i = 0; i < operands.size(); ++i)
+            {
+                bool sign = kind == NODE_SUB ? i == 1
+                                             : kind == NODE_SUM && static_cast<const OpSum<T> *>(node)->is_negated(i);
+                if (operands[i].kind() == NODE_SUM)
+                {
+                    const OpSum<T> *inner = static_cast<const OpSum<T> *>(operands[i].node());
+                    for (size_t j = 0; j < inner->arity(); ++j)
+                    {
+                        terms.push_back(inner->operand(j));
+                        negated.push_back(inner->is_negated(j) != sign);
+                    }
+                }
+                else
+                {
+                    terms.push_back(operands[i]);
+                    negated.push_back(sign);
+                }
+            }
+            result = ExprSum(std::move(terms), std::move(negated), compensated);
+        }
+        else if (kind == NODE_MULT || kind == NODE_PRODUCT)
+        {
+            std::vector<Expression<T>> factors;
+            for (const Expression<T> &factor : operands)
+            {
+                if (factor.kind() == NODE_PRODUCT)
+                {
+                    for (size_t j = 0; j < factor.arity(); ++j)
+                    {
+                        factors.push_back(factor.operand(j));
+                    }
+                }
+                else
+                {
+                    factors.push_back(factor);
+                }
+            }
+            result = ExprProduct(std::move(factors));
+        }
+        else
+        {
+            for (size_t i = 0; i < operands.size(); ++i)
+            {
+                if (operands[i].node() != expr->operand(i).node())
+                {
+                    result = node->rebuild(operands.data());
+                    break;
+                }
+            }
+        }
+        flattened.emplace(node, std::move(result));
+    }
+    return node() == nullptr ? *this : flattened.at(node());
 }
 
 template <typename T>
-Expression<T> Variable<T>::diff(const std::string &by)
+NodeKind Expression<T>::kind() const
 {
-    if (by == name)
+    switch (storage)
     {
-        return Expression<T>(T(1));
+    case STORAGE_VALUE:
+        return NODE_VALUE;
+    case STORAGE_VARIABLE:
+        return NODE_VARIABLE;
+    default:
+        return base->kind();
     }
-    return Expression<T>(T(0));
 }
 
 template <typename T>
-T Variable<T>::eval(const std::map<std::string, T> context) const
+size_t Expression<T>::arity() const
+{
+    return storage == STORAGE_NODE ? base->arity() : 0;
+}
+
+template <typename T>
+const Expression<T> &Expression<T>::operand(size_t index) const
 {
-    auto iter = context.find(name);
-    if (iter == context.end())
+    if (storage != STORAGE_NODE)
     {
-        throw std::runtime_error("Variable " + name + " not present in eval context!!!");
+        throw std::out_of_range(storage == STORAGE_VALUE ? "Value has no operands" : "Variable has no operands");
     }
-    return iter->second;
+    return base->operand(index);
 }
 
 template <typename T>
-std::string Variable<T>::to_string() const
+T Expression<T>::constant() const
 {
-    return name;
+    if (storage != STORAGE_VALUE)
+    {
+        throw std::runtime_error("Expression " + to_string() + " is not a constant");
+    }
+    return stored_value();
 }
 
-template class Variable<long double>;
-// template class Variable<std::complex<long double>>;
-
-// ====================
-// |class OpAdd|
-// ====================
-
 template <typename T>
-OpAdd<T>::OpAdd(const Expression<T> &left_, const Expression<T> &right_) : left(left_),
-                                                                           right(right_)
+const std::string &Expression<T>::variable() const
 {
+    return SymbolTable::name(symbol());
 }
 
 template <typename T>
-Expression<T> OpAdd<T>::diff(const std::string &by)
+uint32_t Expression<T>::symbol() const
 {
-    return left.diff(by) + right.diff(by);
+    if (storage != STORAGE_VARIABLE)
+    {
+        throw std::runtime_error("Expression " + to_string() + " is not a variable");
+    }
+    return symbol_id;
 }
 
 template <typename T>
-T OpAdd<T>::eval(std::map<std::string, T> context) const
+uint64_t Expression<T>::variable_mask() const
 {
-    T value_left = left.eval(context);
-    T value_right = right.eval(context);
-
-    return value_left + value_right;
+    switch (storage)
+    {
+    case STORAGE_VALUE:
+        return 0;
+    case STORAGE_VARIABLE:
+        return ExpressionBase<T>::variable_bit(symbol_id);
+    default:
+        return base->variable_mask();
+    }
 }
 
 template <typename T>
-std::string OpAdd<T>::to_string() const
+const ExpressionBase<T> *Expression<T>::node() const
 {
-    return std::string("(") + left.to_string() +
-           std::string(" + ") + right.to_string() +
-           std::string(")");
+    return storage == STORAGE_NODE ? base.get() : nullptr;
 }
 
-template class OpAdd<long double>;
-template class OpAdd<std::complex<long double>>;
+template class Expression<long double>;
+template class Expression<std::complex<long double>>;
 
-// =====================
-// |class OpMult|
-// =====================
+// ====================
+// |class ExpressionBase|
+// ====================
 
 template <typename T>
-OpMult<T>::OpMult(const Expression<T> &left_, const Expression<T> &right_) : left(left_),
-                                                                             right(right_)
+T ExpressionBase<T>::eval(const std::map<std::string, T> &context) const
 {
+    std::vector<T> operands(arity());
+    for (size_t i = 0; i < arity(); ++i)
+    {
+        operands[i] = operand(i).eval(context);
+    }
+    return apply(operands.data(), context);
 }
 
 template <typename T>
-Expression<T> OpMult<T>::diff(const std::string &by)
+Expression<T> ExpressionBase<T>::diff(const std::string &by)
 {
-    return left.diff(by) * right + left * right.diff(by);
+    std::vector<Expression<T>> derivatives(arity());
+    for (size_t i = 0; i < arity(); ++i)
+    {
+        derivatives[i] = operand(i).diff(by);
+    }
+    return derive(derivatives.data(), by);
 }
 
 template <typename T>
-T OpMult<T>::eval(std::map<std::string, T> context) const
+Expression<T> ExpressionBase<T>::derive_sparse(const uint32_t *indices, const Expression<T> *derivatives, size_t count,
+                                               const std::string &by) const
 {
-    T value_left = left.eval(context);
-    T value_right = right.eval(context);
-
-    return value_left * value_right;
+    std::vector<Expression<T>> all(arity(), Expression<T>(T(0)));
+    for (size_t k = 0; k < count; ++k)
+    {
+        all[indices[k]] = derivatives[k];
+    }
+    return derive(all.data(), by);
 }
 
 template <typename T>
-std::string OpMult<T>::to_string() const
+std::string ExpressionBase<T>::to_string() const
 {
-    return std::string("(") + left.to_string() +
-           std::string(" * ") + right.to_string() +
-           std::string(")");
+    std::string str = format(0);
+    for (size_t i = 0; i < arity(); ++i)
+    {
+        str += operand(i).to_string();
+        str += format(i + 1);
+    }
+    return str;
 }
 
-template class OpMult<long double>;
-template class OpMult<std::complex<long double>>;
-
-// =====================
-// |class OpSub|
-// =====================
-
 template <typename T>
-OpSub<T>::OpSub(const Expression<T> &left_, const Expression<T> &right_) : left(left_),
-                                                                           right(right_)
+void ExpressionBase<T>::release_operands(std::vector<std::shared_ptr<ExpressionBase<T>>> &nodes)
 {
+    // Узел удаляется, поэтому его операнды можно изменять.
+    for (size_t i = 0; i < arity(); ++i)
+    {
+        nodes.push_back(const_cast<Expression<T> &>(operand(i)).release());
+    }
 }
 
 template <typename T>
-Expression<T> OpSub<T>::diff(const std::string &by)
+uint64_t ExpressionBase<T>::variable_mask() const
 {
-    return left.diff(by) - right.diff(by);
+    return mask;
 }
 
 template <typename T>
-T OpSub<T>::eval(std::map<std::string, T> context) const
+uint64_t ExpressionBase<T>::variable_bit(uint32_t symbol)
 {
-    T value_left = left.eval(context);
-    T value_right = right.eval(context);
-
-    return value_left - value_right;
+    // Номера выдаются подряд, поэтому первые 64 переменные получают разные биты.
+    return uint64_t(1) << (symbol % 64);
 }
 
 template <typename T>
-std::string OpSub<T>::to_string() const
+void ExpressionBase<T>::update_variable_mask()
 {
-    return std::string("(") + left.to_string() +
-           std::string(" - ") + right.to_string() +
-           std::string(")");
+    mask = 0;
+    for (size_t i = 0; i < arity(); ++i)
+    {
+        mask |= operand(i).variable_mask();
+    }
 }
 
-template class OpSub<long double>;
-template class OpSub<std::complex<long double>>;
+template class ExpressionBase<long double>;
+template class ExpressionBase<std::complex<long double>>;
 
-// =====================
-// |class OpDiv|
-// =====================
+// =============
+// |class Negate|
+// =============
 
 template <typename T>
-OpDiv<T>::OpDiv(const Expression<T> &left_, const Expression<T> &right_) : left(left_),
-                                                                           right(right_)
+Negate<T>::Negate(const Expression<T> &expr_) : expr(expr_)
 {
 }
 
 template <typename T>
-Expression<T> OpDiv<T>::diff(const std::string &by)
+Expression<T> Negate<T>::derive(const Expression<T> *derivatives, const std::string &by [[maybe_unused]]) const
 {
-    return (left.diff(by) * right - left * right.diff(by)) / (right ^ Expression<T>(2));
+    if (is_constant(derivatives[0], T(0)))
+    {
+        return derivatives[0];
+    }
+    return -derivatives[0];
 }
 
 template <typename T>
-T OpDiv<T>::eval(std::map<std::string, T> context) const
+T Negate<T>::apply(const T *operands, const std::map<std::string, T> &context [[maybe_unused]]) const
 {
-    T value_left = left.eval(context);
-    T value_right = right.eval(context);
-
-    return value_left / value_right;
+    T value = operands[0];
+    return -value;
 }
 
 template <typename T>
-std::string OpDiv<T>::to_string() const
+std::string Negate<T>::format(size_t part) const
 {
-    return std::string("(") + left.to_string() +
-           std::string(" / ") + right.to_string() +
-           std::string(")");
+    static const char *parts[] = {"-(", ")"};
+    return parts[part];
 }
 
-template class OpDiv<long double>;
-template class OpDiv<std::complex<long double>>;
-
-// =====================
-// |class OpPow|
-// =====================
-
 template <typename T>
-OpPow<T>::OpPow(const Expression<T> &left_, const Expression<T> &right_) : left(left_),
-                                                                           right(right_)
+NodeKind Negate<T>::kind() const
 {
+    return NODE_NEGATE;
 }
 
 template <typename T>
-Expression<T> OpPow<T>::diff(const std::string &by)
+size_t Negate<T>::arity() const
 {
-    return (left ^ right) * (left.ExprLn() * right.diff(by) + left.diff(by) * right / left);
+    return 1;
 }
 
 template <typename T>
-T OpPow<T>::eval(std::map<std::string, T> context) const
+const Expression<T> &Negate<T>::operand(size_t index) const
 {
-    T value_left = left.eval(context);
-    T value_right = right.eval(context);
-
+    if (index != 0)
+    {
+        throw std::out_of_range("Negate has a single operand");
+    }
+    return expr;
+}
+
+template <typename T>
+Expression<T> Negate<T>::rebuild(const Expression<T> *operands) const
+{
+    return -operands[0];
+}
+
+template class Negate<long double>;
+template class Negate<std::complex<long double>>;
+
+// ====================
+// |class OpAdd|
+// ====================
+
+template <typename T>
+OpAdd<T>::OpAdd(const Expression<T> &left_, const Expression<T> &right_) : left(left_),
+                                                                           right(right_)
+{
+}
+
+template <typename T>
+Expression<T> OpAdd<T>::derive(const Expression<T> *derivatives, const std::string &by [[maybe_unused]]) const
+{
+    if (is_constant(derivatives[0], T(0)))
+    {
+        return derivatives[1];
+    }
+    if (is_constant(derivatives[1], T(0)))
+    {
+        return derivatives[0];
+    }
+    return derivatives[0] + derivatives[1];
+}
+
+template <typename T>
+T OpAdd<T>::apply(const T *operands, const std::map<std::string, T> &context [[maybe_unused]]) const
+{
+    T value_left = operands[0];
+    T value_right = operands[1];
+
+    return value_left + value_right;
+}
+
+template <typename T>
+std::string OpAdd<T>::format(size_t part) const
+{
+    static const char *parts[] = {"(", " + ", ")"};
+    return parts[part];
+}
+
+template <typename T>
+NodeKind OpAdd<T>::kind() const
+{
+    return NODE_ADD;
+}
+
+template <typename T>
+size_t OpAdd<T>::arity() const
+{
+    return 2;
+}
+
+template <typename T>
+const Expression<T> &OpAdd<T>::operand(size_t index) const
+{
+    if (index > 1)
+    {
+        throw std::out_of_range("OpAdd has two operands");
+    }
+    return index == 0 ? left : right;
+}
+
+template <typename T>
+Expression<T> OpAdd<T>::rebuild(const Expression<T> *operands) const
+{
+    return operands[0] + operands[1];
+}
+
+template class OpAdd<long double>;
+template class OpAdd<std::complex<long double>>;
+
+// =====================
+// |class OpMult|
+// =====================
+
+template <typename T>
+OpMult<T>::OpMult(const Expression<T> &left_, const Expression<T> &right_) : left(left_),
+                                                                             right(right_)
+{
+}
+
+template <typename T>
+Expression<T> OpMult<T>::derive(const Expression<T> *derivatives, const std::string &by [[maybe_unused]]) const
+{
+    // Сомножитель с нулевой производной даёт одностороннее правило.
+    if (is_constant(derivatives[0], T(0)))
+    {
+        return is_constant(derivatives[1], T(1)) ? left : left * derivatives[1];
+    }
+    if (is_constant(derivatives[1], T(0)))
+    {
+        return is_constant(derivatives[0], T(1)) ? right : derivatives[0] * right;
+    }
+    return derivatives[0] * right + left * derivatives[1];
+}
+
+template <typename T>
+T OpMult<T>::apply(const T *operands, const std::map<std::string, T> &context [[maybe_unused]]) const
+{
+    T value_left = operands[0];
+    T value_right = operands[1];
+
+    return value_left * value_right;
+}
+
+template <typename T>
+std::string OpMult<T>::format(size_t part) const
+{
+    static const char *parts[] = {"(", " * ", ")"};
+    return parts[part];
+}
+
+template <typename T>
+NodeKind OpMult<T>::kind() const
+{
+    return NODE_MULT;
+}
+
+template <typename T>
+size_t OpMult<T>::arity() const
+{
+    return 2;
+}
+
+template <typename T>
+const Expression<T> &OpMult<T>::operand(size_t index) const
+{
+    if (index > 1)
+    {
+        throw std::out_of_range("OpMult has two operands");
+    }
+    return index == 0 ? left : right;
+}
+
+template <typename T>
+Expression<T> OpMult<T>::rebuild(const Expression<T> *operands) const
+{
+    return operands[0] * operands[1];
+}
+
+template class OpMult<long double>;
+template class OpMult<std::complex<long double>>;
+
+// =====================
+// |class OpSub|
+// =====================
+
+template <typename T>
+OpSub<T>::OpSub(const Expression<T> &left_, const Expression<T> &right_) : left(left_),
+                                                                           right(right_)
+{
+}
+
+template <typename T>
+Expression<T> OpSub<T>::derive(const Expression<T> *derivatives, const std::string &by [[maybe_unused]]) const
+{
+    if (is_constant(derivatives[1], T(0)))
+    {
+        return derivatives[0];
+    }
+    if (is_constant(derivatives[0], T(0)))
+    {
+        return -derivatives[1];
+    }
+    return derivatives[0] - derivatives[1];
+}
+
+template <typename T>
+T OpSub<T>::apply(const T *operands, const std::map<std::string, T> &context [[maybe_unused]]) const
+{
+    T value_left = operands[0];
+    T value_right = operands[1];
+
+    return value_left - value_right;
+}
+
+template <typename T>
+std::string OpSub<T>::format(size_t part) const
+{
+    static const char *parts[] = {"(", " - ", ")"};
+    return parts[part];
+}
+
+template <typename T>
+NodeKind OpSub<T>::kind() const
+{
+    return NODE_SUB;
+}
+
+template <typename T>
+size_t OpSub<T>::arity() const
+{
+    return 2;
+}
+
+template <typename T>
+const Expression<T> &OpSub<T>::operand(size_t index) const
+{
+    if (index > 1)
+    {
+        throw std::out_of_range("OpSub has two operands");
+    }
+    return index == 0 ? left : right;
+}
+
+template <typename T>
+Expression<T> OpSub<T>::rebuild(const Expression<T> *operands) const
+{
+    return operands[0] - operands[1];
+}
+
+template class OpSub<long double>;
+template class OpSub<std::complex<long double>>;
+
+// =====================
+// |class OpDiv|
+// =====================
+
+template <typename T>
+OpDiv<T>::OpDiv(const Expression<T> &left_, const Expression<T> &right_) : left(left_),
+                                                                           right(right_)
+{
+}
+
+template <typename T>
+Expression<T> OpDiv<T>::derive(const Expression<T> *derivatives, const std::string &by [[maybe_unused]]) const
+{
+    // Знаменатель без переменной: (l / r)' = l' / r.
+    if (is_constant(derivatives[1], T(0)))
+    {
+        return derivatives[0] / right;
+    }
+    if (is_constant(derivatives[0], T(0)))
+    {
+        return -(left * derivatives[1]) / (right ^ Expression<T>(2));
+    }
+    return (derivatives[0] * right - left * derivatives[1]) / (right ^ Expression<T>(2));
+}
+
+template <typename T>
+T OpDiv<T>::apply(const T *operands, const std::map<std::string, T> &context [[maybe_unused]]) const
+{
+    T value_left = operands[0];
+    T value_right = operands[1];
+
+    return value_left / value_right;
+}
+
+template <typename T>
+std::string OpDiv<T>::format(size_t part) const
+{
+    static const char *parts[] = {"(", " / ", ")"};
+    return parts[part];
+}
+
+template <typename T>
+NodeKind OpDiv<T>::kind() const
+{
+    return NODE_DIV;
+}
+
+template <typename T>
+size_t OpDiv<T>::arity() const
+{
+    return 2;
+}
+
+template <typename T>
+const Expression<T> &OpDiv<T>::operand(size_t index) const
+{
+    if (index > 1)
+    {
+        throw std::out_of_range("OpDiv has two operands");
+    }
+    return index == 0 ? left : right;
+}
+
+template <typename T>
+Expression<T> OpDiv<T>::rebuild(const Expression<T> *operands) const
+{
+    return operands[0] / operands[1];
+}
+
+template class OpDiv<long double>;
+template class OpDiv<std::complex<long double>>;
+
+// =====================
+// |class OpPow|
+// =====================
+
+template <typename T>
+OpPow<T>::OpPow(const Expression<T> &left_, const Expression<T> &right_) : left(left_),
+                                                                           right(right_),
+                                                                           power_kind(POWER_GENERAL),
+                                                                           power_integer(0)
+{
+    if (right.kind() == NODE_VALUE)
+    {
+        power_kind = classify_exponent(right.constant(), power_integer);
+    }
+}
+
+template <typename T>
+Expression<T> OpPow<T>::derive(const Expression<T> *derivatives, const std::string &by [[maybe_unused]]) const
+{
+    if (right.kind() == NODE_VALUE)
+    {
+        // (l ^ n)' = n * l ^ (n - 1) * l' - определено и для отрицательного основания.
+        T exponent = right.constant();
+        if (exponent == T(0))
+        {
+            return Expression<T>(T(0));
+        }
+        if (exponent == T(1))
+        {
+            return derivatives[0];
+        }
+        Expression<T> power = exponent == T(2) ? left : (left ^ Expression<T>(exponent - T(1)));
+        // Единичная производная основания (l - сама переменная) не добавляет множитель.
+        return is_constant(derivatives[0], T(1)) ? right * power : right * power * derivatives[0];
+    }
+    if (left.kind() == NODE_VALUE)
+    {
+        // (c ^ r)' = c ^ r * ln(c) * r'.
+        return (left ^ right) * left.ExprLn() * derivatives[1];
+    }
+    if (is_constant(derivatives[1], T(0)))
+    {
+        return (left ^ right) * (derivatives[0] * right / left);
+    }
+    if (is_constant(derivatives[0], T(0)))
+    {
+        return (left ^ right) * left.ExprLn() * derivatives[1];
+    }
+    return (left ^ right) * (left.ExprLn() * derivatives[1] + derivatives[0] * right / left);
+}
+
+template <typename T>
+T OpPow<T>::apply(const T *operands, const std::map<std::string, T> &context [[maybe_unused]]) const
+{
+    T value_left = operands[0];
+
+    switch (power_kind)
+    {
+    case POWER_INTEGER:
+        return integer_power(value_left, power_integer);
+    case POWER_SQRT:
+        return std::sqrt(value_left);
+    case POWER_RSQRT:
+        return T(1) / std::sqrt(value_left);
+    default:
+        break;
+    }
+
+    T value_right = operands[1];
+
     return std::pow(value_left, value_right);
 }
 
 template <typename T>
-std::string OpPow<T>::to_string() const
+std::string OpPow<T>::format(size_t part) const
+{
+    static const char *parts[] = {"(", " ^ ", ")"};
+    return parts[part];
+}
+
+template <typename T>
+NodeKind OpPow<T>::kind() const
+{
+    return NODE_POW;
+}
+
+template <typename T>
+size_t OpPow<T>::arity() const
 {
-    return std::string("(") + left.to_string() +
-           std::string(" ^ ") + right.to_string() +
-           std::string(")");
+    return 2;
+}
+
+template <typename T>
+const Expression<T> &OpPow<T>::operand(size_t index) const
+{
+    if (index > 1)
+    {
+        throw std::out_of_range("OpPow has two operands");
+    }
+    return index == 0 ? left : right;
+}
+
+template <typename T>
+Expression<T> OpPow<T>::rebuild(const Expression<T> *operands) const
+{
+    return operands[0] ^ operands[1];
 }
 
 template class OpPow<long double>;
@@ -471,24 +1614,52 @@ SinFunc<T>::SinFunc(const Expression<T> &arg_) : arg(arg_)
 }
 
 template <typename T>
-Expression<T> SinFunc<T>::diff(const std::string &by)
+Expression<T> SinFunc<T>::derive(const Expression<T> *derivatives, const std::string &by [[maybe_unused]]) const
 {
-    return arg.diff(by) * arg.ExprCos();
+    return derivatives[0] * arg.ExprCos();
 }
 
 template <typename T>
-T SinFunc<T>::eval(std::map<std::string, T> context) const
+T SinFunc<T>::apply(const T *operands, const std::map<std::string, T> &context [[maybe_unused]]) const
 {
-    T value_arg = arg.eval(context);
+    T value_arg = operands[0];
 
     return std::sin(value_arg);
 }
 
 template <typename T>
-std::string SinFunc<T>::to_string() const
+std::string SinFunc<T>::format(size_t part) const
+{
+    static const char *parts[] = {"sin(", ")"};
+    return parts[part];
+}
+
+template <typename T>
+NodeKind SinFunc<T>::kind() const
+{
+    return NODE_SIN;
+}
+
+template <typename T>
+size_t SinFunc<T>::arity() const
 {
-    return std::string("sin(") + arg.to_string() +
-           std::string(")");
+    return 1;
+}
+
+template <typename T>
+const Expression<T> &SinFunc<T>::operand(size_t index) const
+{
+    if (index != 0)
+    {
+        throw std::out_of_range("SinFunc has a single operand");
+    }
+    return arg;
+}
+
+template <typename T>
+Expression<T> SinFunc<T>::rebuild(const Expression<T> *operands) const
+{
+    return operands[0].ExprSin();
 }
 
 template class SinFunc<long double>;
@@ -504,24 +1675,52 @@ CosFunc<T>::CosFunc(const Expression<T> &arg_) : arg(arg_)
 }
 
 template <typename T>
-Expression<T> CosFunc<T>::diff(const std::string &by)
+Expression<T> CosFunc<T>::derive(const Expression<T> *derivatives, const std::string &by [[maybe_unused]]) const
 {
-    return -arg.diff(by) * arg.ExprSin();
+    return -derivatives[0] * arg.ExprSin();
 }
 
 template <typename T>
-T CosFunc<T>::eval(std::map<std::string, T> context) const
+T CosFunc<T>::apply(const T *operands, const std::map<std::string, T> &context [[maybe_unused]]) const
 {
-    T value_arg = arg.eval(context);
+    T value_arg = operands[0];
 
     return std::cos(value_arg);
 }
 
 template <typename T>
-std::string CosFunc<T>::to_string() const
+std::string CosFunc<T>::format(size_t part) const
+{
+    static const char *parts[] = {"cos(", ")"};
+    return parts[part];
+}
+
+template <typename T>
+NodeKind CosFunc<T>::kind() const
+{
+    return NODE_COS;
+}
+
+template <typename T>
+size_t CosFunc<T>::arity() const
+{
+    return 1;
+}
+
+template <typename T>
+const Expression<T> &CosFunc<T>::operand(size_t index) const
+{
+    if (index != 0)
+    {
+        throw std::out_of_range("CosFunc has a single operand");
+    }
+    return arg;
+}
+
+template <typename T>
+Expression<T> CosFunc<T>::rebuild(const Expression<T> *operands) const
 {
-    return std::string("cos(") + arg.to_string() +
-           std::string(")");
+    return operands[0].ExprCos();
 }
 
 template class CosFunc<long double>;
@@ -537,15 +1736,15 @@ LnFunc<T>::LnFunc(const Expression<T> &arg_) : arg(arg_)
 }
 
 template <typename T>
-Expression<T> LnFunc<T>::diff(const std::string &by)
+Expression<T> LnFunc<T>::derive(const Expression<T> *derivatives, const std::string &by [[maybe_unused]]) const
 {
-    return arg.diff(by) / arg;
+    return derivatives[0] / arg;
 }
 
 template <typename T>
-T LnFunc<T>::eval(std::map<std::string, T> context) const
+T LnFunc<T>::apply(const T *operands, const std::map<std::string, T> &context [[maybe_unused]]) const
 {
-    T arg_value = arg.eval(context);
+    T arg_value = operands[0];
     // if (std::is_same<T, std::complex<typename T::value_type>>::value) {
     //     if (std::real(arg_value) <= 0.0L) {
     //         throw std::runtime_error(
@@ -568,10 +1767,38 @@ T LnFunc<T>::eval(std::map<std::string, T> context) const
 // }
 
 template <typename T>
-std::string LnFunc<T>::to_string() const
+std::string LnFunc<T>::format(size_t part) const
+{
+    static const char *parts[] = {"ln(", ")"};
+    return parts[part];
+}
+
+template <typename T>
+NodeKind LnFunc<T>::kind() const
+{
+    return NODE_LN;
+}
+
+template <typename T>
+size_t LnFunc<T>::arity() const
 {
-    return std::string("ln(") + arg.to_string() +
-           std::string(")");
+    return 1;
+}
+
+template <typename T>
+const Expression<T> &LnFunc<T>::operand(size_t index) const
+{
+    if (index != 0)
+    {
+        throw std::out_of_range("LnFunc has a single operand");
+    }
+    return arg;
+}
+
+template <typename T>
+Expression<T> LnFunc<T>::rebuild(const Expression<T> *operands) const
+{
+    return operands[0].ExprLn();
 }
 
 template class LnFunc<long double>;
@@ -587,25 +1814,298 @@ ExpFunc<T>::ExpFunc(const Expression<T> &arg_) : arg(arg_)
 }
 
 template <typename T>
-Expression<T> ExpFunc<T>::diff(const std::string &by)
+Expression<T> ExpFunc<T>::derive(const Expression<T> *derivatives, const std::string &by [[maybe_unused]]) const
 {
-    return arg * arg.diff(by);
+    return arg.ExprExp() * derivatives[0];
 }
 
 template <typename T>
-T ExpFunc<T>::eval(std::map<std::string, T> context) const
+T ExpFunc<T>::apply(const T *operands, const std::map<std::string, T> &context [[maybe_unused]]) const
 {
-    T value_arg = arg.eval(context);
+    T value_arg = operands[0];
 
     return std::exp(value_arg);
 }
 
 template <typename T>
-std::string ExpFunc<T>::to_string() const
+std::string ExpFunc<T>::format(size_t part) const
+{
+    static const char *parts[] = {"exp(", ")"};
+    return parts[part];
+}
+
+template <typename T>
+NodeKind ExpFunc<T>::kind() const
 {
-    return std::string("sin(") + arg.to_string() +
-           std::string(")");
+    return NODE_EXP;
+}
+
+template <typename T>
+size_t ExpFunc<T>::arity() const
+{
+    return 1;
+}
+
+template <typename T>
+const Expression<T> &ExpFunc<T>::operand(size_t index) const
+{
+    if (index != 0)
+    {
+        throw std::out_of_range("ExpFunc has a single operand");
+    }
+    return arg;
+}
+
+template <typename T>
+Expression<T> ExpFunc<T>::rebuild(const Expression<T> *operands) const
+{
+    return operands[0].ExprExp();
 }
 
 template class ExpFunc<long double>;
 template class ExpFunc<std::complex<long double>>;
+
+
+// =====================
+// |class OpSum|
+// =====================
+
+template <typename T>
+OpSum<T>::OpSum(std::vector<Expression<T>> terms_, std::vector<bool> negated_, bool compensated_)
+    : terms(std::move(terms_)), negated(std::move(negated_)), compensated(compensated_)
+{
+    for (bool sign : negated)
+    {
+        signs.push_back(sign ? T(-1) : T(1));
+    }
+}
+
+template <typename T>
+T OpSum<T>::apply(const T *operands, const std::map<std::string, T> &context [[maybe_unused]]) const
+{
+    size_t count = terms.size();
+    const T *sign = signs.data();
+    if (compensated)
+    {
+        // Суммирование по Кэхэну: ошибка округления не растёт с числом слагаемых.
+        T sum = T(0);
+        T correction = T(0);
+        for (size_t i = 0; i < count; ++i)
+        {
+            T term = sign[i] * operands[i] - correction;
+            T next = sum + term;
+            correction = (next - sum) - term;
+            sum = next;
+        }
+        return sum;
+    }
+
+    // Четыре независимых накопителя вместо одной последовательной цепочки сложений.
+    T acc[4] = {T(0), T(0), T(0), T(0)};
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        acc[0] += sign[i] * operands[i];
+        acc[1] += sign[i + 1] * operands[i + 1];
+        acc[2] += sign[i + 2] * operands[i + 2];
+        acc[3] += sign[i + 3] * operands[i + 3];
+    }
+    for (; i < count; ++i)
+    {
+        acc[0] += sign[i] * operands[i];
+    }
+    return (acc[0] + acc[1]) + (acc[2] + acc[3]);
+}
+
+template <typename T>
+Expression<T> OpSum<T>::derive(const Expression<T> *derivatives, const std::string &by) const
+{
+    std::vector<uint32_t> indices(terms.size());
+    std::iota(indices.begin(), indices.end(), 0);
+    return derive_sparse(indices.data(), derivatives, indices.size(), by);
+}
+
+template <typename T>
+Expression<T> OpSum<T>::derive_sparse(const uint32_t *indices, const Expression<T> *derivatives, size_t count,
+                                      const std::string &by [[maybe_unused]]) const
+{
+    // Сумма производных слагаемых, зависящих от переменной; остальные равны нулю.
+    std::vector<Expression<T>> terms_;
+    std::vector<bool> negated_;
+    for (size_t k = 0; k < count; ++k)
+    {
+        if (!is_constant(derivatives[k], T(0)))
+        {
+            terms_.push_back(derivatives[k]);
+            negated_.push_back(negated[indices[k]]);
+        }
+    }
+    if (terms_.empty())
+    {
+        return Expression<T>(T(0));
+    }
+    if (terms_.size() == 1 && !negated_[0])
+    {
+        return terms_[0];
+    }
+    return Expression<T>::ExprSum(std::move(terms_), std::move(negated_), compensated);
+}
+
+template <typename T>
+std::string OpSum<T>::format(size_t part) const
+{
+    if (part == 0)
+    {
+        return negated[0] ? "(-" : "(";
+    }
+    if (part == terms.size())
+    {
+        return ")";
+    }
+    return negated[part] ? " - " : " + ";
+}
+
+template <typename T>
+NodeKind OpSum<T>::kind() const
+{
+    return NODE_SUM;
+}
+
+template <typename T>
+size_t OpSum<T>::arity() const
+{
+    return terms.size();
+}
+
+template <typename T>
+const Expression<T> &OpSum<T>::operand(size_t index) const
+{
+    return terms.at(index);
+}
+
+template <typename T>
+Expression<T> OpSum<T>::rebuild(const Expression<T> *operands) const
+{
+    return Expression<T>::ExprSum(std::vector<Expression<T>>(operands, operands + terms.size()), negated, compensated);
+}
+
+template <typename T>
+bool OpSum<T>::is_negated(size_t index) const
+{
+    return negated.at(index);
+}
+
+template <typename T>
+bool OpSum<T>::is_compensated() const
+{
+    return compensated;
+}
+
+template class OpSum<long double>;
+template class OpSum<std::complex<long double>>;
+
+// =====================
+// |class OpProduct|
+// =====================
+
+template <typename T>
+OpProduct<T>::OpProduct(std::vector<Expression<T>> factors_) : factors(std::move(factors_))
+{
+}
+
+template <typename T>
+T OpProduct<T>::apply(const T *operands, const std::map<std::string, T> &context [[maybe_unused]]) const
+{
+    size_t count = factors.size();
+    T acc[4] = {T(1), T(1), T(1), T(1)};
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        acc[0] *= operands[i];
+        acc[1] *= operands[i + 1];
+        acc[2] *= operands[i + 2];
+        acc[3] *= operands[i + 3];
+    }
+    for (; i < count; ++i)
+    {
+        acc[0] *= operands[i];
+    }
+    return (acc[0] * acc[1]) * (acc[2] * acc[3]);
+}
+
+template <typename T>
+Expression<T> OpProduct<T>::derive(const Expression<T> *derivatives, const std::string &by [[maybe_unused]]) const
+{
+    // Правило произведения сразу для всех множителей: сумма по множителям с ненулевой
+    // производной, в каждом слагаемом остальные множители берутся без изменений.
+    std::vector<Expression<T>> terms;
+    for (size_t i = 0; i < factors.size(); ++i)
+    {
+        if (is_constant(derivatives[i], T(0)))
+        {
+            continue;
+        }
+        std::vector<Expression<T>> term;
+        for (size_t j = 0; j < factors.size(); ++j)
+        {
+            if (j != i)
+            {
+                term.push_back(factors[j]);
+            }
+        }
+        if (!is_constant(derivatives[i], T(1)))
+        {
+            term.push_back(derivatives[i]);
+        }
+        if (term.empty())
+        {
+            terms.push_back(Expression<T>(T(1)));
+        }
+        else
+        {
+            terms.push_back(term.size() == 1 ? term[0] : Expression<T>::ExprProduct(std::move(term)));
+        }
+    }
+    if (terms.empty())
+    {
+        return Expression<T>(T(0));
+    }
+    return terms.size() == 1 ? terms[0] : Expression<T>::ExprSum(std::move(terms));
+}
+
+template <typename T>
+std::string OpProduct<T>::format(size_t part) const
+{
+    if (part == 0)
+    {
+        return "(";
+    }
+    return part == factors.size() ? ")" : " * ";
+}
+
+template <typename T>
+NodeKind OpProduct<T>::kind() const
+{
+    return NODE_PRODUCT;
+}
+
+template <typename T>
+size_t OpProduct<T>::arity() const
+{
+    return factors.size();
+}
+
+template <typename T>
+const Expression<T> &OpProduct<T>::operand(size_t index) const
+{
+    return factors.at(index);
+}
+
+template <typename T>
+Expression<T> OpProduct<T>::rebuild(const Expression<T> *operands) const
+{
+    return Expression<T>::ExprProduct(std::vector<Expression<T>>(operands, operands + factors.size()));
+}
+
+template class OpProduct<long double>;
+template class OpProduct<std::complex<long double>>;
@@ -0,0 +1,381 @@
+#include "../includes/incremental.hpp"
+#include "../includes/trace.hpp"
+
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+
+template <typename T>
+IncrementalParser<T>::IncrementalParser(const std::string &source)
+{
+    reset(source);
+}
+
+template <typename T>
+void IncrementalParser<T>::reset(const std::string &source)
+{
+    text_ = source;
+    items_.clear();
+    lex_error_.clear();
+    parsed_ = false;
+    stats_ = {};
+    std::vector<Item> fresh;
+    lex(0, 0, 0, fresh);
+    items_ = std::move(fresh);
+    eof_.column = text_.size();
+}
+
+template <typename T>
+void IncrementalParser<T>::edit(size_t offset, size_t deleted, const std::string &inserted)
+{
+    if (offset > text_.size() || deleted > text_.size() - offset)
+    {
+        throw std::out_of_range("Edit " + std::to_string(offset) + "+" + std::to_string(deleted) +
+                                " is outside of the text of length " + std::to_string(text_.size()));
+    }
+    TRACE_SCOPE("relex");
+    text_.replace(offset, deleted, inserted);
+    parsed_ = false;
+    stats_ = {};
+    // Лексема, начатая до правки, могла измениться: продолжиться вставленным текстом,
+    // или (имя функции перед пробелами) потерять либо получить скобку. Более ранние
+    // лексемы от текста после своего конца не зависят.
+    auto first_after = std::lower_bound(items_.begin(), items_.end(), offset,
+                                        [](const Item &item, size_t position)
+                                        { return item.token.column < position; });
+    size_t kept = first_after == items_.begin() ? 0 : static_cast<size_t>(first_after - items_.begin()) - 1;
+    size_t restart = first_after == items_.begin() ? 0 : items_[kept].token.column;
+
+    // Совпасть могут только лексемы, начинающиеся после удалённого текста; если прежний
+    // текст не был прочитан до конца, его конец перечитывается полностью.
+    size_t resume = items_.size();
+    if (lex_error_.empty())
+    {
+        resume = static_cast<size_t>(std::lower_bound(items_.begin() + kept, items_.end(), offset + deleted,
+                                                      [](const Item &item, size_t position)
+                                                      { return item.token.column < position; }) -
+                                     items_.begin());
+    }
+    lex_error_.clear();
+    long long shift = static_cast<long long>(inserted.size()) - static_cast<long long>(deleted);
+    std::vector<Item> fresh;
+    size_t tail = lex(restart, resume, shift, fresh);
+
+    for (size_t i = tail; i < items_.size(); ++i)
+    {
+        items_[i].token.column = static_cast<size_t>(static_cast<long long>(items_[i].token.column) + shift);
+    }
+    items_.erase(items_.begin() + kept, items_.begin() + tail);
+    items_.insert(items_.begin() + kept, std::make_move_iterator(fresh.begin()), std::make_move_iterator(fresh.end()));
+    stats_.kept = items_.size() - fresh.size();
+
+    // Скобки, закрывающиеся не раньше перечитанных лексем, содержат правку.
+    for (size_t i = 0; i < kept; ++i)
+    {
+        if (items_[i].group && i + items_[i].span >= kept)
+        {
+            items_[i].group.reset();
+            items_[i].built.reset();
+        }
+        if (items_[i].term && i + items_[i].term_span > kept)
+        {
+            items_[i].term.reset();
+        }
+    }
+    eof_.column = text_.size();
+}
+
+template <typename T>
+size_t IncrementalParser<T>::lex(size_t offset, size_t resume, long long shift, std::vector<Item> &fresh)
+{
+    Lexer lexer{text_, offset};
+    try
+    {
+        while (true)
+        {
+            Token token = lexer.getNextToken();
+            if (token.type == TOK_EOF)
+            {
+                return items_.size();
+            }
+            // Дальше текст совпадает с прежним, и лексемы с этого места те же.
+            long long column = static_cast<long long>(token.column);
+            while (resume < items_.size() && static_cast<long long>(items_[resume].token.column) + shift < column)
+            {
+                ++resume;
+            }
+            if (resume < items_.size() && static_cast<long long>(items_[resume].token.column) + shift == column)
+            {
+                return resume;
+            }
+            fresh.push_back(Item{std::move(token), nullptr, nullptr, 0, nullptr, 0});
+            ++stats_.relexed;
+        }
+    }
+    catch (const std::runtime_error &error)
+    {
+        // Ошибка сообщается при разборе, когда парсер доходит до этого места.
+        lex_error_ = error.what();
+        return items_.size();
+    }
+}
+
+template <typename T>
+const Token &IncrementalParser<T>::token(size_t index) const
+{
+    return index < items_.size() ? items_[index].token : eof_;
+}
+
+template <typename T>
+bool IncrementalParser<T>::continues(TokenType chain, TokenType next)
+{
+    // Закрывающая скобка передаёт цепочку наружу, где её может продолжить операция.
+    return next == TOK_BRACKET_RIGHT || (chain == TOK_PLUS && (next == TOK_PLUS || next == TOK_SUB)) ||
+           (chain == TOK_MULTIPLY && next == TOK_MULTIPLY);
+}
+
+template <typename T>
+bool IncrementalParser<T>::closes_term(bool first, TokenType next)
+{
+    // За '+' или '-' слагаемое сворачивается всегда, перед концом уровня - если оно
+    // правый операнд суммы; первое слагаемое скобки остаётся её содержимым.
+    return next == TOK_PLUS || next == TOK_SUB || (!first && Parser<T>::precedence(next) == 0);
+}
+
+template <typename T>
+size_t IncrementalParser<T>::reach(size_t index)
+{
+    if (index >= items_.size() && !lex_error_.empty())
+    {
+        throw std::runtime_error(lex_error_);
+    }
+    ++stats_.parsed_tokens;
+    return index;
+}
+
+template <typename T>
+void IncrementalParser<T>::unexpected(size_t index) const
+{
+    const Token &current = token(index);
+    throw std::runtime_error(
+        "Got unexpected token \"" + current.lexeme +
+        "\" of type " + std::to_string(current.type));
+}
+
+template <typename T>
+Expression<T> IncrementalParser<T>::parse()
+{
+    if (parsed_)
+    {
+        return result_;
+    }
+    TRACE_SCOPE("parse");
+    stats_.reused_groups = 0;
+    stats_.reused_terms = 0;
+    stats_.parsed_groups = 0;
+    stats_.parsed_tokens = 0;
+
+    // Шаги Parser<T>::parseExpr над номерами лексем.
+    std::vector<Operand> operands;
+    std::vector<size_t> operations;
+    std::vector<size_t> groups;
+    // Текущее слагаемое верхнего уровня и каждой открытой скобки.
+    struct Term
+    {
+        size_t start;
+        // Число операций '*', '/', '^' слагаемого на стеке (0 - нечего запоминать).
+        size_t operations;
+        bool first;
+    };
+    std::vector<Term> terms{{0, 0, true}};
+
+    // Слагаемое из нескольких множителей перед '+', '-' (или не первое слагаемое перед
+    // концом уровня) в любом случае сворачивается в узел: это делается сразу, а узел
+    // запоминается у первой лексемы слагаемого.
+    auto finish_term = [&](size_t index)
+    {
+        Term &term = terms.back();
+        if (term.operations == 0)
+        {
+            return;
+        }
+        size_t bottom = groups.empty() ? 0 : groups.back();
+        while (operations.size() > bottom && Parser<T>::precedence(token(operations.back()).type) >= 2)
+        {
+            Parser<T>::reduce(operands, token(operations.back()).type);
+            operations.pop_back();
+        }
+        Parser<T>::build(operands.back());
+        items_[term.start].term = std::make_shared<const Operand>(operands.back());
+        items_[term.start].term_span = index - term.start;
+        term.operations = 0;
+    };
+
+    size_t index = reach(0);
+    while (true)
+    {
+        TokenType type = token(index).type;
+        Term &term = terms.back();
+        const Item *item = index < items_.size() ? &items_[index] : nullptr;
+        if (item != nullptr && item->term && index == term.start &&
+            closes_term(term.first, token(index + item->term_span).type))
+        {
+            // Слагаемое не менялось и стоит там же, где было свёрнуто.
+            operands.push_back(*item->term);
+            ++stats_.reused_terms;
+            index = reach(index + item->term_span);
+        }
+        else if (type == TOK_BRACKET_LEFT || type == TOK_FUNCTION)
+        {
+            Item &group = items_[index];
+            if (!group.group)
+            {
+                operations.push_back(index);
+                groups.push_back(operations.size());
+                terms.push_back({index + 1, 0, true});
+                index = reach(index + 1);
+                continue;
+            }
+            // Содержимое не менялось: результат прошлого разбора, переход за скобку.
+            // Цепочку, которую следующая операция не продолжит, разбор всё равно
+            // свернёт в узел: берётся узел, построенный в прошлый раз.
+            size_t after = index + group.span + 1;
+            if (group.group->chain != TOK_EOF && !continues(group.group->chain, token(after).type))
+            {
+                if (!group.built)
+                {
+                    Operand built = *group.group;
+                    Parser<T>::build(built);
+                    group.built = std::make_shared<const Operand>(std::move(built));
+                }
+                operands.push_back(*group.built);
+            }
+            else
+            {
+                operands.push_back(*group.group);
+            }
+            ++stats_.reused_groups;
+            index = reach(after);
+        }
+        else if (type == TOK_VALUE)
+        {
+            operands.push_back(Operand{{Expression<T>(std::stold(token(index).lexeme))}, {}, TOK_EOF});
+            index = reach(index + 1);
+        }
+        else if (type == TOK_VARIABLE)
+        {
+            operands.push_back(Operand{{Expression<T>(token(index).lexeme)}, {}, TOK_EOF});
+            index = reach(index + 1);
+        }
+        else
+        {
+            unexpected(index);
+        }
+
+        while (!groups.empty() && token(index).type == TOK_BRACKET_RIGHT)
+        {
+            if (!terms.back().first)
+            {
+                finish_term(index);
+            }
+            terms.pop_back();
+            while (operations.size() > groups.back())
+            {
+                Parser<T>::reduce(operands, token(operations.back()).type);
+                operations.pop_back();
+            }
+            groups.pop_back();
+            size_t open = operations.back();
+            operations.pop_back();
+            Parser<T>::close(token(open), operands.back());
+            items_[open].group = std::make_shared<const Operand>(operands.back());
+            items_[open].built.reset();
+            items_[open].span = index - open;
+            ++stats_.parsed_groups;
+            index = reach(index + 1);
+        }
+
+        TokenType next = token(index).type;
+        int current = Parser<T>::precedence(next);
+        if (current == 0)
+        {
+            break;
+        }
+        if (current == 1)
+        {
+            finish_term(index);
+        }
+        size_t bottom = groups.empty() ? 0 : groups.back();
+        while (operations.size() > bottom)
+        {
+            TokenType operation = token(operations.back()).type;
+            int top = Parser<T>::precedence(operation);
+            if (top < current || (top == current && next == TOK_POW))
+            {
+                break;
+            }
+            Parser<T>::reduce(operands, operation);
+            operations.pop_back();
+        }
+        operations.push_back(index);
+        index = reach(index + 1);
+        if (current == 1)
+        {
+            terms.back() = {index, 0, false};
+        }
+        else
+        {
+            ++terms.back().operations;
+        }
+    }
+
+    if (!groups.empty())
+    {
+        // Незакрытая скобка.
+        unexpected(index);
+    }
+    if (!terms.back().first)
+    {
+        finish_term(index);
+    }
+    while (!operations.empty())
+    {
+        Parser<T>::reduce(operands, token(operations.back()).type);
+        operations.pop_back();
+    }
+    Expression<T> result = Parser<T>::build(operands.back());
+    if (token(index).type != TOK_EOF)
+    {
+        unexpected(index);
+    }
+
+    result_ = result;
+    parsed_ = true;
+    return result_;
+}
+
+template <typename T>
+const std::string &IncrementalParser<T>::text() const
+{
+    return text_;
+}
+
+template <typename T>
+std::vector<Token> IncrementalParser<T>::tokens() const
+{
+    std::vector<Token> tokens;
+    tokens.reserve(items_.size());
+    for (const Item &item : items_)
+    {
+        tokens.push_back(item.token);
+    }
+    return tokens;
+}
+
+template <typename T>
+IncrementalStats IncrementalParser<T>::stats() const
+{
+    return stats_;
+}
+
+template class IncrementalParser<long double>;
@@ -0,0 +1,225 @@
+#include "../includes/integrator.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <queue>
+#include <thread>
+
+// Узлы и веса правила Кронрода (15 точек) и вложенного правила Гаусса (7 точек).
+static constexpr long double KRONROD_NODES[8] = {
+    0.991455371120812639206854697526329L, 0.949107912342758524526189684047851L,
+    0.864864423359769072789712788640926L, 0.741531185599394439863864773280788L,
+    0.586087235467691130294144845693013L, 0.405845151377397166906606412076961L,
+    0.207784955007898467600689403773245L, 0.000000000000000000000000000000000L};
+static constexpr long double KRONROD_WEIGHTS[8] = {
+    0.022935322010529224963732008058970L, 0.063092092629978553290700663189204L,
+    0.104790010322250183839876322541518L, 0.140653259715525918745189590510238L,
+    0.169004726639267902826583426598550L, 0.190350578064785409913256402421014L,
+    0.204432940075298892414161999234649L, 0.209482141084727828012999174891714L};
+static constexpr long double GAUSS_WEIGHTS[4] = {
+    0.129484966168869693270611432679082L, 0.279705391489276667901467771423780L,
+    0.381830050505118944950369775488975L, 0.417959183673469387755102040816327L};
+
+static constexpr size_t NODES_PER_PANEL = 15;
+
+namespace
+{
+// Панель интегрирования с оценками интеграла и погрешности.
+struct Panel
+{
+    long double a;
+    long double b;
+    long double value;
+    long double error;
+
+    bool operator<(const Panel &other) const
+    {
+        return error < other.error;
+    }
+};
+}
+
+template <typename T>
+std::vector<std::string> Integrator<T>::variables_of(const std::string &by,
+                                                     const std::map<std::string, T> &params)
+{
+    std::vector<std::string> variables{by};
+    for (const auto &[name, value] : params)
+    {
+        if (name != by)
+        {
+            variables.push_back(name);
+        }
+    }
+    return variables;
+}
+
+template <typename T>
+Integrator<T>::Integrator(const Expression<T> &expr, const std::string &by,
+                          const std::map<std::string, T> &params)
+    : compiled_(expr, variables_of(by, params))
+{
+    params_.push_back(T(0));
+    for (const auto &[name, value] : params)
+    {
+        if (name != by)
+        {
+            params_.push_back(value);
+        }
+    }
+}
+
+// Вычисление правила Гаусса-Кронрода для панелей [begin, end) по значениям в узлах.
+static void apply_rule(Panel *begin, Panel *end, const long double *values)
+{
+    for (Panel *panel = begin; panel != end; ++panel, values += NODES_PER_PANEL)
+    {
+        long double half = (panel->b - panel->a) / 2;
+        // values[0..6] и values[7..13] - симметричные узлы, values[14] - центр.
+        long double center = values[14];
+        long double kronrod = KRONROD_WEIGHTS[7] * center;
+        long double gauss = GAUSS_WEIGHTS[3] * center;
+        for (size_t j = 0; j < 7; ++j)
+        {
+            long double pair = values[j] + values[7 + j];
+            kronrod += KRONROD_WEIGHTS[j] * pair;
+            if (j % 2 == 1)
+            {
+                gauss += GAUSS_WEIGHTS[j / 2] * pair;
+            }
+        }
+        long double mean = kronrod / 2;
+        long double asc = KRONROD_WEIGHTS[7] * std::fabs(center - mean);
+        for (size_t j = 0; j < 7; ++j)
+        {
+            asc += KRONROD_WEIGHTS[j] * (std::fabs(values[j] - mean) + std::fabs(values[7 + j] - mean));
+        }
+
+        // Оценка погрешности в форме QUADPACK.
+        long double error = std::fabs((kronrod - gauss) * half);
+        asc *= std::fabs(half);
+        if (asc != 0 && error != 0)
+        {
+            error = asc * std::min(1.0L, std::pow(200 * error / asc, 1.5L));
+        }
+        panel->value = kronrod * half;
+        panel->error = error;
+    }
+}
+
+template <typename T>
+IntegrationResult Integrator<T>::integrate(T a, T b, const IntegrationOptions &options) const
+{
+    auto start = std::chrono::steady_clock::now();
+    IntegrationResult result;
+
+    // Вычисление панелей [begin, end) одним пакетным вызовом.
+    auto evaluate = [this](Panel *begin, Panel *end)
+    {
+        size_t count = static_cast<size_t>(end - begin) * NODES_PER_PANEL;
+        std::vector<T> nodes(count);
+        std::vector<T> values(count);
+        for (Panel *panel = begin; panel != end; ++panel)
+        {
+            T *x = nodes.data() + (panel - begin) * NODES_PER_PANEL;
+            long double center = (panel->a + panel->b) / 2;
+            long double half = (panel->b - panel->a) / 2;
+            for (size_t j = 0; j < 7; ++j)
+            {
+                x[j] = center - half * KRONROD_NODES[j];
+                x[7 + j] = center + half * KRONROD_NODES[j];
+            }
+            x[14] = center;
+        }
+
+        std::vector<const T *> columns(params_.size());
+        std::vector<size_t> strides(params_.size(), 0);
+        columns[0] = nodes.data();
+        strides[0] = 1;
+        for (size_t v = 1; v < params_.size(); ++v)
+        {
+            columns[v] = &params_[v];
+        }
+        T *out = values.data();
+        compiled_.eval_batch(count, columns.data(), &out, strides.data());
+        apply_rule(begin, end, values.data());
+    };
+
+    // Вычисление панелей раунда, при необходимости в нескольких потоках.
+    auto evaluate_parallel = [&](std::vector<Panel> &panels)
+    {
+        size_t threads = std::max<size_t>(1, std::min(options.threads, panels.size()));
+        if (threads == 1)
+        {
+            evaluate(panels.data(), panels.data() + panels.size());
+        }
+        else
+        {
+            std::vector<std::thread> workers;
+            size_t chunk = (panels.size() + threads - 1) / threads;
+            for (size_t begin = chunk; begin < panels.size(); begin += chunk)
+            {
+                size_t end = std::min(panels.size(), begin + chunk);
+                workers.emplace_back(evaluate, panels.data() + begin, panels.data() + end);
+            }
+            evaluate(panels.data(), panels.data() + chunk);
+            for (std::thread &worker : workers)
+            {
+                worker.join();
+            }
+        }
+        result.evaluations += panels.size() * NODES_PER_PANEL;
+    };
+
+    std::vector<Panel> fresh{Panel{a, b, 0, 0}};
+    evaluate_parallel(fresh);
+    std::priority_queue<Panel> queue(fresh.begin(), fresh.end());
+    long double total = fresh[0].value;
+    long double error = fresh[0].error;
+
+    size_t per_round = std::max<size_t>(1, options.panels_per_round);
+    while (error > std::max(options.abs_tolerance, options.rel_tolerance * std::fabs(total)) &&
+           result.evaluations + 2 * NODES_PER_PANEL <= options.max_evaluations)
+    {
+        // Делим пополам панели с наибольшей погрешностью.
+        fresh.clear();
+        while (!queue.empty() && fresh.size() < 2 * per_round &&
+               result.evaluations + (fresh.size() + 2) * NODES_PER_PANEL <= options.max_evaluations)
+        {
+            Panel worst = queue.top();
+            queue.pop();
+            total -= worst.value;
+            error -= worst.error;
+            long double middle = (worst.a + worst.b) / 2;
+            fresh.push_back(Panel{worst.a, middle, 0, 0});
+            fresh.push_back(Panel{middle, worst.b, 0, 0});
+        }
+        evaluate_parallel(fresh);
+        for (const Panel &panel : fresh)
+        {
+            total += panel.value;
+            error += panel.error;
+            queue.push(panel);
+        }
+        ++result.rounds;
+    }
+
+    // Итоговые суммы пересчитываются заново, чтобы не накапливать ошибку вычитаний.
+    result.panels = queue.size();
+    total = 0;
+    error = 0;
+    while (!queue.empty())
+    {
+        total += queue.top().value;
+        error += queue.top().error;
+        queue.pop();
+    }
+    result.value = total;
+    result.error = error;
+    result.converged = error <= std::max(options.abs_tolerance, options.rel_tolerance * std::fabs(total));
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return result;
+}
+
+template class Integrator<long double>;
@@ -1,4 +1,5 @@
 #include "../includes/lexer.hpp"
+#include <algorithm>
 #include <stdexcept>
 
 Lexer::Lexer(const std::string& input) :
@@ -6,15 +7,30 @@ Lexer::Lexer(const std::string& input) :
     pos_    (),
     end_    (),
     column_ (0)
+#ifndef EXPR_NO_TRACE
+    , trace_("lex")
+#endif
 {
     pos_ = input_.c_str();
     end_ = pos_ + input_.size();
 }
 
+Lexer::Lexer(const std::string& input, size_t offset) : Lexer(input)
+{
+    pos_ += std::min(offset, input_.size());
+}
+
+size_t Lexer::position() const
+{
+    return static_cast<size_t>(pos_ - input_.c_str());
+}
+
 Token Lexer::getNextToken()
 {
+    TRACE_BATCH_SCOPE(trace_);
     // Пропускаем пробельные символы до начала лексемы.
     skipSpaceSequence();
+    column_ = position();
 
     // Обрабатываем разбираемой конце строки.
     if (pos_ >= end_)
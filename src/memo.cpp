@@ -0,0 +1,493 @@
+#include "../includes/memo.hpp"
+#include "../includes/trace.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+
+// Перемешивание битов хеша (splitmix64).
+static uint64_t mix(uint64_t h)
+{
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    return h ^ (h >> 31);
+}
+
+// Биты значения, округлённого до double: у long double в объекте есть байты
+// выравнивания с произвольным содержимым. Совпадение хешей проверяется точным сравнением.
+static uint64_t value_bits(long double value)
+{
+    double rounded = static_cast<double>(value);
+    uint64_t bits;
+    std::memcpy(&bits, &rounded, sizeof(bits));
+    return bits;
+}
+
+static uint64_t value_bits(const std::complex<long double> &value)
+{
+    return value_bits(value.real()) ^ mix(value_bits(value.imag()));
+}
+
+static bool same_value(long double a, long double b)
+{
+    return a == b ? std::signbit(a) == std::signbit(b) : a != a && b != b;
+}
+
+static bool same_value(const std::complex<long double> &a, const std::complex<long double> &b)
+{
+    return same_value(a.real(), b.real()) && same_value(a.imag(), b.imag());
+}
+
+static size_t round_capacity(size_t capacity)
+{
+    size_t rounded = 1;
+    while (rounded < capacity)
+    {
+        rounded <<= 1;
+    }
+    return rounded;
+}
+
+// =======
+// |Table|
+// =======
+
+template <typename T>
+MemoEvaluator<T>::Table::Table(size_t capacity, size_t width, size_t probes, MemoEviction eviction)
+    : mask_(round_capacity(capacity) - 1),
+      width_(width),
+      probes_(std::clamp<size_t>(probes, 1, mask_ + 1)),
+      eviction_(eviction),
+      hashes_(mask_ + 1, 0),
+      stamps_(mask_ + 1, 0),
+      keys_((mask_ + 1) * width),
+      values_(mask_ + 1)
+{
+}
+
+template <typename T>
+bool MemoEvaluator<T>::Table::same(const T *a, const T *b, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (!same_value(a[i], b[i]))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+template <typename T>
+bool MemoEvaluator<T>::Table::find(const T *key, uint64_t hash, T &value)
+{
+    for (size_t probe = 0; probe < probes_; ++probe)
+    {
+        size_t slot = (hash + probe) & mask_;
+        if (hashes_[slot] == 0)
+        {
+            // Записи не удаляются, поэтому свободная ячейка завершает цепочку.
+            break;
+        }
+        if (hashes_[slot] == hash && same(keys_.data() + slot * width_, key, width_))
+        {
+            if (eviction_ == MEMO_EVICT_LRU)
+            {
+                stamps_[slot] = ++clock_;
+            }
+            value = values_[slot];
+            ++hits;
+            return true;
+        }
+    }
+    ++misses;
+    return false;
+}
+
+template <typename T>
+void MemoEvaluator<T>::Table::insert(const T *key, uint64_t hash, const T &value)
+{
+    size_t victim = hash & mask_;
+    bool empty = false;
+    for (size_t probe = 0; probe < probes_; ++probe)
+    {
+        size_t slot = (hash + probe) & mask_;
+        if (hashes_[slot] == 0)
+        {
+            victim = slot;
+            empty = true;
+            break;
+        }
+        if (stamps_[slot] < stamps_[victim])
+        {
+            victim = slot;
+        }
+    }
+    if (empty)
+    {
+        ++entries_;
+    }
+    else if (eviction_ == MEMO_EVICT_NONE)
+    {
+        return;
+    }
+    else
+    {
+        ++evictions;
+    }
+    hashes_[victim] = hash;
+    stamps_[victim] = ++clock_;
+    std::copy(key, key + width_, keys_.data() + victim * width_);
+    values_[victim] = value;
+}
+
+template <typename T>
+void MemoEvaluator<T>::Table::clear()
+{
+    std::fill(hashes_.begin(), hashes_.end(), 0);
+    std::fill(stamps_.begin(), stamps_.end(), 0);
+    clock_ = 0;
+    entries_ = 0;
+    hits = 0;
+    misses = 0;
+    evictions = 0;
+}
+
+template <typename T>
+size_t MemoEvaluator<T>::Table::entries() const
+{
+    return entries_;
+}
+
+template <typename T>
+size_t MemoEvaluator<T>::Table::memory() const
+{
+    return hashes_.size() * 2 * sizeof(uint64_t) + (keys_.size() + values_.size()) * sizeof(T);
+}
+
+// ===============
+// |MemoEvaluator|
+// ===============
+
+template <typename T>
+MemoEvaluator<T>::MemoEvaluator(const Expression<T> &source, const MemoOptions &options)
+    : expression_(source), table_(options.capacity, 0, options.probes, options.eviction)
+{
+    TRACE_SCOPE("memo build");
+    // Шаги ссылаются на узлы своей копии выражения: исходное может быть временным.
+    const Expression<T> &expr = expression_;
+
+    // Узлы в куче в обратном порядке обхода без повторений; begin - номер первого узла,
+    // добавленного при обходе поддерева узла.
+    std::vector<const Expression<T> *> order;
+    std::vector<uint32_t> begins;
+    std::unordered_map<const ExpressionBase<T> *, uint32_t> index;
+    std::vector<uint32_t> symbols;
+    auto note_leaf = [&](const Expression<T> &leaf)
+    {
+        if (leaf.kind() == NODE_VARIABLE)
+        {
+            symbols.push_back(leaf.symbol());
+        }
+    };
+
+    if (expr.node() == nullptr)
+    {
+        note_leaf(expr);
+    }
+    else
+    {
+        std::vector<std::pair<const Expression<T> *, uint32_t>> stack{{&expr, UINT32_MAX}};
+        while (!stack.empty())
+        {
+            auto [current, begin] = stack.back();
+            if (index.count(current->node()) != 0)
+            {
+                stack.pop_back();
+                continue;
+            }
+            if (begin == UINT32_MAX)
+            {
+                stack.back().second = static_cast<uint32_t>(order.size());
+                for (size_t i = current->arity(); i-- > 0;)
+                {
+                    const Expression<T> &operand = current->operand(i);
+                    if (operand.node() == nullptr)
+                    {
+                        note_leaf(operand);
+                    }
+                    else if (index.count(operand.node()) == 0)
+                    {
+                        stack.emplace_back(&operand, UINT32_MAX);
+                    }
+                }
+                continue;
+            }
+            stack.pop_back();
+            index.emplace(current->node(), static_cast<uint32_t>(order.size()));
+            order.push_back(current);
+            begins.push_back(begin);
+        }
+    }
+
+    // Переменные в лексикографическом порядке занимают первые ячейки.
+    std::sort(symbols.begin(), symbols.end());
+    symbols.erase(std::unique(symbols.begin(), symbols.end()), symbols.end());
+    std::vector<std::pair<std::string, uint32_t>> names;
+    for (uint32_t symbol : symbols)
+    {
+        names.emplace_back(SymbolTable::name(symbol), symbol);
+    }
+    std::sort(names.begin(), names.end());
+    std::unordered_map<uint32_t, uint32_t> variable_slot;
+    for (const auto &[name, symbol] : names)
+    {
+        variable_slot.emplace(symbol, static_cast<uint32_t>(variables_.size()));
+        variables_.push_back(name);
+    }
+    const uint32_t step_base = static_cast<uint32_t>(variables_.size());
+    slots_.resize(step_base + order.size());
+
+    // Ячейка значения операнда; константы добавляются в конец.
+    auto slot_of = [&](const Expression<T> &operand) -> uint32_t
+    {
+        if (operand.node() != nullptr)
+        {
+            return step_base + index.at(operand.node());
+        }
+        if (operand.kind() == NODE_VARIABLE)
+        {
+            return variable_slot.at(operand.symbol());
+        }
+        slots_.push_back(operand.constant());
+        return static_cast<uint32_t>(slots_.size() - 1);
+    };
+
+    // Для поддеревьев: переменные (номера ячеек по возрастанию), стоимость и последний
+    // шаг, использующий значение.
+    std::vector<std::vector<uint32_t>> step_variables(order.size());
+    std::vector<long double> costs(order.size());
+    std::vector<uint32_t> last_use(order.size());
+    size_t max_arity = 0;
+    for (uint32_t i = 0; i < order.size(); ++i)
+    {
+        const Expression<T> &current = *order[i];
+        size_t arity = current.arity();
+        steps_.push_back({current.node(), static_cast<uint32_t>(operands_.size()), static_cast<uint32_t>(arity),
+                          NO_SUBTREE});
+        max_arity = std::max(max_arity, arity);
+        costs[i] = operation_cost(current, options.costs);
+        last_use[i] = i;
+        for (size_t j = 0; j < arity; ++j)
+        {
+            uint32_t slot = slot_of(current.operand(j));
+            operands_.push_back(slot);
+            std::vector<uint32_t> merged;
+            if (slot < step_base)
+            {
+                merged.push_back(slot);
+            }
+            else if (slot < step_base + order.size())
+            {
+                costs[i] += costs[slot - step_base];
+                last_use[slot - step_base] = i;
+                merged = step_variables[slot - step_base];
+            }
+            std::vector<uint32_t> &own = step_variables[i];
+            size_t middle = own.size();
+            own.insert(own.end(), merged.begin(), merged.end());
+            std::inplace_merge(own.begin(), own.begin() + middle, own.end());
+            own.erase(std::unique(own.begin(), own.end()), own.end());
+        }
+    }
+    result_ = expr.node() != nullptr ? step_base + static_cast<uint32_t>(order.size() - 1) : slot_of(expr);
+
+    if (options.subtrees)
+    {
+        size_t max_width = 0;
+        for (uint32_t i = 0; i < order.size(); ++i)
+        {
+            NodeKind kind = order[i]->kind();
+            bool function = kind == NODE_SIN || kind == NODE_COS || kind == NODE_LN || kind == NODE_EXP ||
+                            kind == NODE_POW;
+            if (!function || costs[i] < options.subtree_cost || step_variables[i].size() == variables_.size())
+            {
+                continue;
+            }
+            // Пропустить поддерево можно, если его шаги не нужны другим узлам.
+            bool own = true;
+            for (uint32_t j = begins[i]; j < i && own; ++j)
+            {
+                own = last_use[j] <= i;
+            }
+            if (own)
+            {
+                subtrees_.push_back({begins[i], i, step_variables[i],
+                                     Table(options.subtree_capacity, step_variables[i].size(), options.probes,
+                                           options.eviction)});
+                max_width = std::max(max_width, step_variables[i].size());
+            }
+        }
+        std::sort(subtrees_.begin(), subtrees_.end(), [](const Subtree &a, const Subtree &b)
+                  { return a.begin != b.begin ? a.begin < b.begin : a.end > b.end; });
+        for (uint32_t i = 0; i < subtrees_.size(); ++i)
+        {
+            steps_[subtrees_[i].end].subtree = i;
+        }
+        key_.resize(max_width);
+    }
+    arguments_.resize(max_arity);
+}
+
+template <typename T>
+uint64_t MemoEvaluator<T>::hash(const T *values, size_t count)
+{
+    uint64_t h = 0x9e3779b97f4a7c15ULL;
+    for (size_t i = 0; i < count; ++i)
+    {
+        h = mix(h ^ value_bits(values[i]));
+    }
+    return h != 0 ? h : 1;
+}
+
+template <typename T>
+uint64_t MemoEvaluator<T>::subtree_key(const Subtree &subtree)
+{
+    for (size_t i = 0; i < subtree.keys.size(); ++i)
+    {
+        key_[i] = slots_[subtree.keys[i]];
+    }
+    return hash(key_.data(), subtree.keys.size());
+}
+
+template <typename T>
+T MemoEvaluator<T>::compute()
+{
+    static const std::map<std::string, T> empty;
+    T *values = slots_.data() + variables_.size();
+    size_t next = 0;
+    for (uint32_t i = 0; i < steps_.size();)
+    {
+        // Поддеревья, начинающиеся с этого шага: при найденном значении их шаги пропускаются.
+        bool skipped = false;
+        for (; next < subtrees_.size() && subtrees_[next].begin == i; ++next)
+        {
+            Subtree &subtree = subtrees_[next];
+            if (subtree.table.find(key_.data(), subtree_key(subtree), values[subtree.end]))
+            {
+                i = subtree.end + 1;
+                while (next < subtrees_.size() && subtrees_[next].begin < i)
+                {
+                    ++next;
+                }
+                skipped = true;
+                break;
+            }
+        }
+        if (skipped)
+        {
+            continue;
+        }
+
+        const Step &step = steps_[i];
+        for (uint32_t j = 0; j < step.arity; ++j)
+        {
+            arguments_[j] = slots_[operands_[step.first + j]];
+        }
+        values[i] = step.node->apply(arguments_.data(), empty);
+        if (step.subtree != NO_SUBTREE)
+        {
+            Subtree &subtree = subtrees_[step.subtree];
+            subtree.table.insert(key_.data(), subtree_key(subtree), values[i]);
+        }
+        ++i;
+    }
+    return slots_[result_];
+}
+
+template <typename T>
+T MemoEvaluator<T>::evaluate()
+{
+    uint64_t key = hash(slots_.data(), variables_.size());
+    T result = T(0);
+    if (table_.find(slots_.data(), key, result))
+    {
+        return result;
+    }
+    result = compute();
+    table_.insert(slots_.data(), key, result);
+    return result;
+}
+
+template <typename T>
+T MemoEvaluator<T>::eval(const T *values)
+{
+    std::copy(values, values + variables_.size(), slots_.begin());
+    return evaluate();
+}
+
+template <typename T>
+T MemoEvaluator<T>::eval(const std::map<std::string, T> &context)
+{
+    for (size_t i = 0; i < variables_.size(); ++i)
+    {
+        auto iter = context.find(variables_[i]);
+        if (iter == context.end())
+        {
+            throw std::runtime_error("Variable " + variables_[i] + " not present in eval context!!!");
+        }
+        slots_[i] = iter->second;
+    }
+    return evaluate();
+}
+
+template <typename T>
+const std::vector<std::string> &MemoEvaluator<T>::variables() const
+{
+    return variables_;
+}
+
+template <typename T>
+MemoStats MemoEvaluator<T>::stats() const
+{
+    MemoStats stats;
+    stats.hits = table_.hits;
+    stats.misses = table_.misses;
+    stats.evictions = table_.evictions;
+    stats.entries = table_.entries();
+    stats.memory = table_.memory();
+    stats.subtrees = subtrees_.size();
+    for (const Subtree &subtree : subtrees_)
+    {
+        stats.subtree_hits += subtree.table.hits;
+        stats.subtree_misses += subtree.table.misses;
+        stats.memory += subtree.table.memory();
+    }
+    if (stats.hits + stats.misses > 0)
+    {
+        stats.hit_rate = static_cast<double>(stats.hits) / static_cast<double>(stats.hits + stats.misses);
+    }
+    if (stats.subtree_hits + stats.subtree_misses > 0)
+    {
+        stats.subtree_hit_rate = static_cast<double>(stats.subtree_hits) /
+                                 static_cast<double>(stats.subtree_hits + stats.subtree_misses);
+    }
+    return stats;
+}
+
+template <typename T>
+void MemoEvaluator<T>::clear()
+{
+    table_.clear();
+    for (Subtree &subtree : subtrees_)
+    {
+        subtree.table.clear();
+    }
+}
+
+template class MemoEvaluator<long double>;
+template class MemoEvaluator<std::complex<long double>>;
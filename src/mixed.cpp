@@ -0,0 +1,357 @@
+#include "../includes/mixed.hpp"
+#include "../includes/vecmath.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <limits>
+
+// Число точек, обрабатываемых одной инструкцией в пакетном режиме.
+static constexpr size_t MIXED_BLOCK = 64;
+// Единица округления double.
+static constexpr double UNIT_ROUNDOFF = DBL_EPSILON / 2;
+// Ulp значения не больше ULP_RELATIVE * |значение|.
+static constexpr double ULP_RELATIVE = DBL_EPSILON;
+static constexpr double INF = std::numeric_limits<double>::infinity();
+
+MixedPrecisionExpression::MixedPrecisionExpression(const Expression<long double> &expr,
+                                                   const std::vector<std::string> &variables,
+                                                   long double tolerance)
+    : compiled_(expr, variables),
+      tolerance_(tolerance),
+      evaluations_(0),
+      fallbacks_(0)
+{
+    for (long double constant : compiled_.constants())
+    {
+        double rounded = static_cast<double>(constant);
+        constants_.push_back(rounded);
+        constant_errors_.push_back(static_cast<double>(std::fabs(constant - rounded)));
+    }
+}
+
+// Значение и граница абсолютной погрешности одной инструкции для count точек.
+// a, b - значения операндов, ea, eb - их границы погрешности, n - целый показатель.
+// Значения sin, cos, exp, ln и pow уже вычислены в v векторными функциями VecMath.
+template <OpCode op>
+static inline void step(double *__restrict v, double *__restrict e,
+                        const double *a, const double *ea, const double *b, const double *eb,
+                        int n, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        double value;
+        double error;
+        if constexpr (op == OP_NEG)
+        {
+            value = -a[i];
+            error = ea[i];
+        }
+        else if constexpr (op == OP_ADD || op == OP_SUB)
+        {
+            value = op == OP_ADD ? a[i] + b[i] : a[i] - b[i];
+            error = ea[i] + eb[i] + UNIT_ROUNDOFF * std::fabs(value);
+        }
+        else if constexpr (op == OP_MUL)
+        {
+            value = a[i] * b[i];
+            error = std::fabs(a[i]) * eb[i] + std::fabs(b[i]) * ea[i] + ea[i] * eb[i] +
+                    UNIT_ROUNDOFF * std::fabs(value);
+        }
+        else if constexpr (op == OP_DIV)
+        {
+            value = a[i] / b[i];
+            double margin = std::fabs(b[i]) - eb[i];
+            error = margin > 0 ? (ea[i] + std::fabs(value) * eb[i]) / margin + UNIT_ROUNDOFF * std::fabs(value)
+                               : INF;
+        }
+        else if constexpr (op == OP_SIN || op == OP_COS)
+        {
+            value = v[i];
+            // |sin'| <= 1, и значение по модулю не больше 1.
+            error = std::min(ea[i], 2.0) +
+                    (op == OP_SIN ? VecMath::SIN_ULP : VecMath::COS_ULP) * ULP_RELATIVE * std::fabs(value);
+        }
+        else if constexpr (op == OP_EXP)
+        {
+            value = v[i];
+            error = std::fabs(value) * (std::expm1(ea[i]) + VecMath::EXP_ULP * ULP_RELATIVE);
+        }
+        else if constexpr (op == OP_LN)
+        {
+            value = v[i];
+            double ratio = ea[i] / std::fabs(a[i]);
+            error = ratio < 1 ? -std::log1p(-ratio) + VecMath::LN_ULP * ULP_RELATIVE * std::fabs(value) : INF;
+        }
+        else if constexpr (op == OP_SQRT)
+        {
+            value = std::sqrt(a[i]);
+            double low = a[i] - ea[i];
+            double bound = low > 0 ? ea[i] / (std::sqrt(low) + value) : std::sqrt(ea[i]);
+            error = bound + UNIT_ROUNDOFF * value;
+        }
+        else if constexpr (op == OP_RSQRT)
+        {
+            value = 1 / std::sqrt(a[i]);
+            double ratio = ea[i] / a[i];
+            error = ratio < 1 ? value * (1 / std::sqrt(1 - ratio) - 1 + 2 * UNIT_ROUNDOFF) : INF;
+        }
+        else if constexpr (op == OP_POWI)
+        {
+            value = integer_power(a[i], n);
+            double magnitude = std::fabs(value);
+            // Двоичный метод делает не более 2 * log2|n| + 2 округлений.
+            double rounding = (2 * std::log2(std::fabs(static_cast<double>(n)) + 1) + 2) * UNIT_ROUNDOFF * magnitude;
+            if (n >= 0)
+            {
+                error = std::pow(std::fabs(a[i]) + ea[i], n) - magnitude + rounding;
+            }
+            else
+            {
+                double low = std::fabs(a[i]) - ea[i];
+                error = low > 0 ? std::pow(low, n) - magnitude + rounding : INF;
+            }
+        }
+        else if constexpr (op == OP_POW)
+        {
+            value = v[i];
+            // a ^ b = exp(b * ln|a|): граница погрешности показателя через погрешность ln|a|.
+            double ratio = ea[i] / std::fabs(a[i]);
+            double log_error = ratio < 1 ? -std::log1p(-ratio) : INF;
+            double exponent_error = std::fabs(b[i]) * log_error +
+                                    std::fabs(std::log(std::fabs(a[i]))) * eb[i] + log_error * eb[i];
+            error = a[i] == 0 && ea[i] == 0 && eb[i] == 0
+                        ? 0
+                        : std::fabs(value) * (std::expm1(exponent_error) + VecMath::POW_ULP * ULP_RELATIVE);
+        }
+        if (!std::isfinite(value))
+        {
+            error = INF;
+        }
+        v[i] = value;
+        e[i] = error;
+    }
+}
+
+// Выполнение инструкции над count точками; регистры - массивы по MIXED_BLOCK значений.
+static void run(const Instruction &ins, double *values, double *errors, size_t width, size_t slot, size_t count)
+{
+    double *v = values + slot * width;
+    double *e = errors + slot * width;
+    const double *a = values + ins.lhs * width;
+    const double *ea = errors + ins.lhs * width;
+    // Для унарных операций и целой степени rhs не является номером ячейки.
+    bool binary = operand_count(ins.op) >= 2;
+    const double *b = binary ? values + ins.rhs * width : a;
+    const double *eb = binary ? errors + ins.rhs * width : ea;
+    int n = static_cast<int>(ins.rhs);
+    switch (ins.op)
+    {
+    case OP_NEG:
+        step<OP_NEG>(v, e, a, ea, b, eb, n, count);
+        break;
+    case OP_ADD:
+        step<OP_ADD>(v, e, a, ea, b, eb, n, count);
+        break;
+    case OP_SUB:
+        step<OP_SUB>(v, e, a, ea, b, eb, n, count);
+        break;
+    case OP_MUL:
+        step<OP_MUL>(v, e, a, ea, b, eb, n, count);
+        break;
+    case OP_DIV:
+        step<OP_DIV>(v, e, a, ea, b, eb, n, count);
+        break;
+    case OP_SIN:
+    case OP_SINCOS:
+        VecMath::sin(a, v, count);
+        step<OP_SIN>(v, e, a, ea, b, eb, n, count);
+        break;
+    case OP_COS:
+    case OP_SINCOS_COS:
+        VecMath::cos(a, v, count);
+        step<OP_COS>(v, e, a, ea, b, eb, n, count);
+        break;
+    case OP_EXP:
+        VecMath::exp(a, v, count);
+        step<OP_EXP>(v, e, a, ea, b, eb, n, count);
+        break;
+    case OP_LN:
+        VecMath::ln(a, v, count);
+        step<OP_LN>(v, e, a, ea, b, eb, n, count);
+        break;
+    case OP_SQRT:
+        step<OP_SQRT>(v, e, a, ea, b, eb, n, count);
+        break;
+    case OP_RSQRT:
+        step<OP_RSQRT>(v, e, a, ea, b, eb, n, count);
+        break;
+    case OP_POWI:
+        step<OP_POWI>(v, e, a, ea, b, eb, n, count);
+        break;
+    case OP_POW:
+        VecMath::pow(a, b, v, count);
+        step<OP_POW>(v, e, a, ea, b, eb, n, count);
+        break;
+    case OP_FMA:
+    {
+        // Произведение и сумма с одним округлением.
+        const double *c = values + ins.addend * width;
+        const double *ec = errors + ins.addend * width;
+        for (size_t i = 0; i < count; ++i)
+        {
+            double value = std::fma(a[i], b[i], c[i]);
+            e[i] = std::isfinite(value) ? std::fabs(a[i]) * eb[i] + std::fabs(b[i]) * ea[i] + ea[i] * eb[i] + ec[i] +
+                                              UNIT_ROUNDOFF * std::fabs(value)
+                                        : INF;
+            v[i] = value;
+        }
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+// Рабочий буфер значений и погрешностей, свой у каждого потока.
+static double *mixed_registers(size_t size)
+{
+    thread_local std::vector<double> buffer;
+    if (buffer.size() < 2 * size)
+    {
+        buffer.resize(2 * size);
+    }
+    return buffer.data();
+}
+
+double MixedPrecisionExpression::eval_double(const long double *vars, double &error_bound) const
+{
+    const std::vector<Instruction> &program = compiled_.program();
+    double *values = mixed_registers(program.size());
+    double *errors = values + program.size();
+    for (size_t slot = 0; slot < program.size(); ++slot)
+    {
+        const Instruction &ins = program[slot];
+        if (ins.op == OP_CONST)
+        {
+            values[slot] = constants_[ins.lhs];
+            errors[slot] = constant_errors_[ins.lhs];
+        }
+        else if (ins.op == OP_VAR)
+        {
+            values[slot] = static_cast<double>(vars[ins.lhs]);
+            errors[slot] = static_cast<double>(std::fabs(vars[ins.lhs] - values[slot]));
+        }
+        else
+        {
+            run(ins, values, errors, 1, slot, 1);
+        }
+    }
+    uint32_t out = compiled_.output_slots()[0];
+    error_bound = errors[out];
+    return values[out];
+}
+
+long double MixedPrecisionExpression::eval(const long double *vars)
+{
+    double error = 0;
+    double value = eval_double(vars, error);
+    evaluations_.fetch_add(1, std::memory_order_relaxed);
+    if (error <= tolerance_ * std::fabs(value))
+    {
+        return value;
+    }
+    fallbacks_.fetch_add(1, std::memory_order_relaxed);
+    return compiled_.eval(vars);
+}
+
+void MixedPrecisionExpression::eval_batch(size_t count, const long double *const *columns, long double *results,
+                                          const size_t *strides)
+{
+    const std::vector<Instruction> &program = compiled_.program();
+    uint32_t out = compiled_.output_slots()[0];
+    double *values = mixed_registers(program.size() * MIXED_BLOCK);
+    double *errors = values + program.size() * MIXED_BLOCK;
+    std::vector<long double> point(compiled_.variables().size());
+    size_t fallbacks = 0;
+
+    for (size_t begin = 0; begin < count; begin += MIXED_BLOCK)
+    {
+        size_t n = std::min(MIXED_BLOCK, count - begin);
+        for (size_t slot = 0; slot < program.size(); ++slot)
+        {
+            const Instruction &ins = program[slot];
+            double *v = values + slot * MIXED_BLOCK;
+            double *e = errors + slot * MIXED_BLOCK;
+            if (ins.op == OP_CONST)
+            {
+                std::fill(v, v + n, constants_[ins.lhs]);
+                std::fill(e, e + n, constant_errors_[ins.lhs]);
+            }
+            else if (ins.op == OP_VAR)
+            {
+                size_t stride = strides ? strides[ins.lhs] : 1;
+                const long double *column = columns[ins.lhs] + begin * stride;
+                for (size_t i = 0; i < n; ++i)
+                {
+                    v[i] = static_cast<double>(column[i * stride]);
+                    e[i] = static_cast<double>(std::fabs(column[i * stride] - v[i]));
+                }
+            }
+            else
+            {
+                run(ins, values, errors, MIXED_BLOCK, slot, n);
+            }
+        }
+
+        const double *v = values + out * MIXED_BLOCK;
+        const double *e = errors + out * MIXED_BLOCK;
+        for (size_t i = 0; i < n; ++i)
+        {
+            if (e[i] <= tolerance_ * std::fabs(v[i]))
+            {
+                results[begin + i] = v[i];
+                continue;
+            }
+            // Пересчёт точки в long double.
+            for (size_t k = 0; k < point.size(); ++k)
+            {
+                size_t stride = strides ? strides[k] : 1;
+                point[k] = columns[k][(begin + i) * stride];
+            }
+            results[begin + i] = compiled_.eval(point.data());
+            ++fallbacks;
+        }
+    }
+    evaluations_.fetch_add(count, std::memory_order_relaxed);
+    fallbacks_.fetch_add(fallbacks, std::memory_order_relaxed);
+}
+
+const std::vector<std::string> &MixedPrecisionExpression::variables() const
+{
+    return compiled_.variables();
+}
+
+long double MixedPrecisionExpression::tolerance() const
+{
+    return tolerance_;
+}
+
+void MixedPrecisionExpression::set_tolerance(long double tolerance)
+{
+    tolerance_ = tolerance;
+}
+
+MixedPrecisionStats MixedPrecisionExpression::stats() const
+{
+    MixedPrecisionStats result;
+    result.evaluations = evaluations_.load(std::memory_order_relaxed);
+    result.fallbacks = fallbacks_.load(std::memory_order_relaxed);
+    return result;
+}
+
+void MixedPrecisionExpression::reset_stats()
+{
+    evaluations_.store(0, std::memory_order_relaxed);
+    fallbacks_.store(0, std::memory_order_relaxed);
+}
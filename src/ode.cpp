@@ -0,0 +1,521 @@
+#include "../includes/ode.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <thread>
+
+// Ограничения на изменение шага за одну попытку и коэффициент запаса.
+static constexpr long double SAFETY = 0.9L;
+static constexpr long double MIN_FACTOR = 0.2L;
+static constexpr long double MAX_FACTOR = 5.0L;
+
+// ---------------------------------------------------------------- Построение
+
+template <typename T>
+size_t OdeSystem<T>::dimension_of(const std::vector<Expression<T>> &rhs, const std::vector<std::string> &state)
+{
+    if (rhs.size() != state.size())
+    {
+        throw std::invalid_argument("ODE system has " + std::to_string(rhs.size()) + " right-hand sides for " +
+                                    std::to_string(state.size()) + " state variables");
+    }
+    return state.size();
+}
+
+template <typename T>
+std::vector<std::string> OdeSystem<T>::variables_of(const std::vector<std::string> &state, const std::string &time,
+                                                    const std::map<std::string, T> &params)
+{
+    std::vector<std::string> variables(state);
+    variables.push_back(time);
+    for (const auto &[name, value] : params)
+    {
+        variables.push_back(name);
+    }
+    return variables;
+}
+
+template <typename T>
+std::vector<Expression<T>> OdeSystem<T>::jacobian_of(const std::vector<Expression<T>> &rhs,
+                                                     const std::vector<std::string> &state, const std::string &time)
+{
+    // Выходы: df_i/dy_j по строкам, затем df_i/dt.
+    std::vector<std::string> variables(state);
+    variables.push_back(time);
+    std::vector<Expression<T>> outputs;
+    std::vector<Expression<T>> time_derivatives;
+    outputs.reserve(rhs.size() * (state.size() + 1));
+    for (const Expression<T> &f : rhs)
+    {
+        std::vector<Expression<T>> gradient = f.diff_all(variables);
+        outputs.insert(outputs.end(), gradient.begin(), gradient.end() - 1);
+        time_derivatives.push_back(gradient.back());
+    }
+    outputs.insert(outputs.end(), time_derivatives.begin(), time_derivatives.end());
+    return outputs;
+}
+
+template <typename T>
+OdeSystem<T>::OdeSystem(const std::vector<Expression<T>> &rhs, const std::vector<std::string> &state,
+                        const std::string &time, const std::map<std::string, T> &params)
+    : dimension_(dimension_of(rhs, state)),
+      rhs_(rhs, variables_of(state, time, params)),
+      expressions_(rhs),
+      state_(state),
+      time_(time),
+      variables_(variables_of(state, time, params))
+{
+    for (const auto &[name, value] : params)
+    {
+        params_.push_back(value);
+    }
+}
+
+template <typename T>
+size_t OdeSystem<T>::dimension() const
+{
+    return dimension_;
+}
+
+// ---------------------------------------------------------------- Вычисление
+
+// Рабочий вектор аргументов [y, t, параметры], свой у каждого потока.
+template <typename T>
+static T *arguments(size_t dimension, T t, const std::vector<T> &params, const T *y)
+{
+    thread_local std::vector<T> buffer;
+    buffer.resize(dimension + 1 + params.size());
+    std::copy(y, y + dimension, buffer.begin());
+    buffer[dimension] = t;
+    std::copy(params.begin(), params.end(), buffer.begin() + dimension + 1);
+    return buffer.data();
+}
+
+template <typename T>
+void OdeSystem<T>::rhs(const T *y, T t, T *dydt) const
+{
+    rhs_.eval(arguments(dimension_, t, params_, y), dydt);
+}
+
+template <typename T>
+void OdeSystem<T>::jacobian(const T *y, T t, T *dfdy, T *dfdt) const
+{
+    thread_local std::vector<T> results;
+    results.resize(dimension_ * (dimension_ + 1));
+    std::call_once(jacobian_once_, [this]
+                   { jacobian_ = std::make_unique<const CompiledExpression<T>>(jacobian_of(expressions_, state_, time_),
+                                                                                variables_); });
+    jacobian_->eval(arguments(dimension_, t, params_, y), results.data());
+    std::copy(results.begin(), results.begin() + dimension_ * dimension_, dfdy);
+    std::copy(results.begin() + dimension_ * dimension_, results.end(), dfdt);
+}
+
+// Среднеквадратичная норма ошибки, взвешенной допусками.
+template <typename T>
+static T error_norm(const std::vector<T> &error, const std::vector<T> &y, const std::vector<T> &next,
+                    const OdeOptions &options)
+{
+    T sum = 0;
+    for (size_t i = 0; i < error.size(); ++i)
+    {
+        T scale = options.abs_tolerance + options.rel_tolerance * std::max(std::fabs(y[i]), std::fabs(next[i]));
+        T ratio = error[i] / scale;
+        sum += ratio * ratio;
+    }
+    return error.empty() ? T(0) : std::sqrt(sum / static_cast<T>(error.size()));
+}
+
+// Начальный шаг по масштабу решения и производной (упрощённый алгоритм Хайрера).
+template <typename T>
+static T initial_step(const std::vector<T> &y, const std::vector<T> &f, T span, int order, const OdeOptions &options)
+{
+    if (options.initial_step > 0)
+    {
+        return std::min<T>(options.initial_step, span);
+    }
+    T d0 = 0;
+    T d1 = 0;
+    for (size_t i = 0; i < y.size(); ++i)
+    {
+        T scale = options.abs_tolerance + options.rel_tolerance * std::fabs(y[i]);
+        d0 = std::max(d0, std::fabs(y[i]) / scale);
+        d1 = std::max(d1, std::fabs(f[i]) / scale);
+    }
+    T h = d0 < 1e-5L || d1 < 1e-5L ? T(1e-6L) : T(0.01L) * d0 / d1;
+    // Ограничение шага, при котором ошибка первого шага порядка допуска.
+    if (d1 > 0)
+    {
+        h = std::min(h, std::pow(T(0.01L) / d1, T(1) / static_cast<T>(order + 1)));
+    }
+    return std::min(h, span);
+}
+
+// Новый шаг по норме ошибки для метода порядка order.
+template <typename T>
+static T step_factor(T error, int order)
+{
+    if (error == 0)
+    {
+        return MAX_FACTOR;
+    }
+    T factor = SAFETY * std::pow(error, T(-1) / static_cast<T>(order + 1));
+    return std::clamp<T>(factor, MIN_FACTOR, MAX_FACTOR);
+}
+
+// ---------------------------------------------------------------- Дорман-Принс 5(4)
+
+// Коэффициенты метода: узлы, матрица Бутчера и разность весов 5-го и 4-го порядков.
+static constexpr long double DP_C[7] = {0, 1.0L / 5, 3.0L / 10, 4.0L / 5, 8.0L / 9, 1, 1};
+static constexpr long double DP_A[7][6] = {
+    {},
+    {1.0L / 5},
+    {3.0L / 40, 9.0L / 40},
+    {44.0L / 45, -56.0L / 15, 32.0L / 9},
+    {19372.0L / 6561, -25360.0L / 2187, 64448.0L / 6561, -212.0L / 729},
+    {9017.0L / 3168, -355.0L / 33, 46732.0L / 5247, 49.0L / 176, -5103.0L / 18656},
+    {35.0L / 384, 0, 500.0L / 1113, 125.0L / 192, -2187.0L / 6784, 11.0L / 84}};
+static constexpr long double DP_E[7] = {71.0L / 57600, 0, -71.0L / 16695, 71.0L / 1920,
+                                        -17253.0L / 339200, 22.0L / 525, -1.0L / 40};
+
+template <typename T>
+OdeResult OdeSystem<T>::integrate_rk45(const std::vector<T> &y0, T t0, T t1, const OdeOptions &options) const
+{
+    size_t n = dimension_;
+    OdeResult result;
+    std::vector<T> y(y0);
+    std::vector<T> next(n);
+    std::vector<T> stage(n);
+    std::vector<T> error(n);
+    std::vector<std::vector<T>> k(7, std::vector<T>(n));
+
+    T t = t0;
+    T direction = t1 >= t0 ? T(1) : T(-1);
+    rhs(y.data(), t, k[0].data());
+    ++result.evaluations;
+    T h = initial_step(y, k[0], std::fabs(t1 - t0), 4, options);
+
+    while (direction * (t1 - t) > 0 && result.steps + result.rejected < options.max_steps)
+    {
+        h = std::min(h, std::fabs(t1 - t));
+        T signed_h = direction * h;
+
+        for (size_t s = 1; s < 7; ++s)
+        {
+            for (size_t i = 0; i < n; ++i)
+            {
+                T sum = 0;
+                for (size_t j = 0; j < s; ++j)
+                {
+                    sum += DP_A[s][j] * k[j][i];
+                }
+                stage[i] = y[i] + signed_h * sum;
+            }
+            rhs(stage.data(), t + DP_C[s] * signed_h, k[s].data());
+        }
+        result.evaluations += 6;
+        // Последняя стадия вычисляется в точке решения 5-го порядка.
+        next.swap(stage);
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            T sum = 0;
+            for (size_t j = 0; j < 7; ++j)
+            {
+                sum += DP_E[j] * k[j][i];
+            }
+            error[i] = signed_h * sum;
+        }
+        T norm = error_norm(error, y, next, options);
+        if (!std::isfinite(norm))
+        {
+            // Переполнение в стадиях: шаг уменьшается без оценки.
+            ++result.rejected;
+            h *= MIN_FACTOR;
+            continue;
+        }
+        if (norm <= 1)
+        {
+            t = h == std::fabs(t1 - t) ? t1 : t + signed_h;
+            y.swap(next);
+            // FSAL: последняя стадия шага - первая стадия следующего.
+            k[0].swap(k[6]);
+            ++result.steps;
+            if (options.record_steps)
+            {
+                result.times.push_back(t);
+                result.states.emplace_back(y.begin(), y.end());
+            }
+        }
+        else
+        {
+            ++result.rejected;
+        }
+        h *= step_factor(norm, 4);
+        if (h <= std::fabs(t) * std::numeric_limits<T>::epsilon())
+        {
+            break;
+        }
+    }
+
+    result.t = t;
+    result.y.assign(y.begin(), y.end());
+    result.success = t == t1;
+    return result;
+}
+
+// ---------------------------------------------------------------- Розенброк 2(3)
+
+// LU-разложение с выбором ведущего элемента по столбцу; false для вырожденной матрицы.
+template <typename T>
+static bool lu_decompose(size_t n, std::vector<T> &matrix, std::vector<size_t> &pivots)
+{
+    for (size_t col = 0; col < n; ++col)
+    {
+        size_t pivot = col;
+        for (size_t row = col + 1; row < n; ++row)
+        {
+            if (std::fabs(matrix[row * n + col]) > std::fabs(matrix[pivot * n + col]))
+            {
+                pivot = row;
+            }
+        }
+        pivots[col] = pivot;
+        if (matrix[pivot * n + col] == 0)
+        {
+            return false;
+        }
+        if (pivot != col)
+        {
+            std::swap_ranges(matrix.begin() + pivot * n, matrix.begin() + (pivot + 1) * n, matrix.begin() + col * n);
+        }
+        for (size_t row = col + 1; row < n; ++row)
+        {
+            T factor = matrix[row * n + col] / matrix[col * n + col];
+            matrix[row * n + col] = factor;
+            for (size_t j = col + 1; j < n; ++j)
+            {
+                matrix[row * n + j] -= factor * matrix[col * n + j];
+            }
+        }
+    }
+    return true;
+}
+
+// Решение LU x = b на месте.
+template <typename T>
+static void lu_solve(size_t n, const std::vector<T> &matrix, const std::vector<size_t> &pivots, std::vector<T> &b)
+{
+    for (size_t i = 0; i < n; ++i)
+    {
+        std::swap(b[i], b[pivots[i]]);
+        for (size_t j = 0; j < i; ++j)
+        {
+            b[i] -= matrix[i * n + j] * b[j];
+        }
+    }
+    for (size_t i = n; i-- > 0;)
+    {
+        for (size_t j = i + 1; j < n; ++j)
+        {
+            b[i] -= matrix[i * n + j] * b[j];
+        }
+        b[i] /= matrix[i * n + i];
+    }
+}
+
+// Линейно-неявный метод Шампайна-Райхельта (ode23s): одна LU-факторизация
+// матрицы W = I - h d J на шаг, решение 2-го порядка и оценка ошибки 3-го.
+template <typename T>
+OdeResult OdeSystem<T>::integrate_rosenbrock(const std::vector<T> &y0, T t0, T t1, const OdeOptions &options) const
+{
+    const T d = 1 / (2 + std::sqrt(T(2)));
+    const T e32 = 6 + std::sqrt(T(2));
+
+    size_t n = dimension_;
+    OdeResult result;
+    std::vector<T> y(y0);
+    std::vector<T> next(n);
+    std::vector<T> stage(n);
+    std::vector<T> error(n);
+    std::vector<T> f0(n), f1(n), f2(n);
+    std::vector<T> k1(n), k2(n), k3(n);
+    std::vector<T> dfdy(n * n), dfdt(n);
+    std::vector<T> w(n * n);
+    std::vector<size_t> pivots(n);
+
+    T t = t0;
+    T direction = t1 >= t0 ? T(1) : T(-1);
+    rhs(y.data(), t, f0.data());
+    ++result.evaluations;
+    T h = initial_step(y, f0, std::fabs(t1 - t0), 2, options);
+    bool fresh_jacobian = false;
+
+    while (direction * (t1 - t) > 0 && result.steps + result.rejected < options.max_steps)
+    {
+        h = std::min(h, std::fabs(t1 - t));
+        T signed_h = direction * h;
+        if (!fresh_jacobian)
+        {
+            jacobian(y.data(), t, dfdy.data(), dfdt.data());
+            ++result.jacobians;
+            fresh_jacobian = true;
+        }
+
+        // W = I - h d J.
+        for (size_t i = 0; i < n * n; ++i)
+        {
+            w[i] = -signed_h * d * dfdy[i];
+        }
+        for (size_t i = 0; i < n; ++i)
+        {
+            w[i * n + i] += 1;
+        }
+        if (!lu_decompose(n, w, pivots))
+        {
+            ++result.rejected;
+            h *= MIN_FACTOR;
+            continue;
+        }
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            k1[i] = f0[i] + signed_h * d * dfdt[i];
+        }
+        lu_solve(n, w, pivots, k1);
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            stage[i] = y[i] + signed_h * k1[i] / 2;
+        }
+        rhs(stage.data(), t + signed_h / 2, f1.data());
+        for (size_t i = 0; i < n; ++i)
+        {
+            k2[i] = f1[i] - k1[i];
+        }
+        lu_solve(n, w, pivots, k2);
+        for (size_t i = 0; i < n; ++i)
+        {
+            k2[i] += k1[i];
+            next[i] = y[i] + signed_h * k2[i];
+        }
+
+        rhs(next.data(), t + signed_h, f2.data());
+        for (size_t i = 0; i < n; ++i)
+        {
+            k3[i] = f2[i] - e32 * (k2[i] - f1[i]) - 2 * (k1[i] - f0[i]) + signed_h * d * dfdt[i];
+        }
+        lu_solve(n, w, pivots, k3);
+        result.evaluations += 2;
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            error[i] = signed_h / 6 * (k1[i] - 2 * k2[i] + k3[i]);
+        }
+        T norm = error_norm(error, y, next, options);
+        if (!std::isfinite(norm))
+        {
+            ++result.rejected;
+            h *= MIN_FACTOR;
+            continue;
+        }
+        if (norm <= 1)
+        {
+            t = h == std::fabs(t1 - t) ? t1 : t + signed_h;
+            y.swap(next);
+            // f(t + h, y_new) уже вычислена на третьей стадии.
+            f0.swap(f2);
+            fresh_jacobian = false;
+            ++result.steps;
+            if (options.record_steps)
+            {
+                result.times.push_back(t);
+                result.states.emplace_back(y.begin(), y.end());
+            }
+        }
+        else
+        {
+            // При отказе якобиан в той же точке переиспользуется.
+            ++result.rejected;
+        }
+        h *= step_factor(norm, 2);
+        if (h <= std::fabs(t) * std::numeric_limits<T>::epsilon())
+        {
+            break;
+        }
+    }
+
+    result.t = t;
+    result.y.assign(y.begin(), y.end());
+    result.success = t == t1;
+    return result;
+}
+
+// ---------------------------------------------------------------- Интегрирование
+
+template <typename T>
+OdeResult OdeSystem<T>::integrate(const std::vector<T> &y0, T t0, T t1, const OdeOptions &options) const
+{
+    if (y0.size() != dimension_)
+    {
+        throw std::invalid_argument("Initial state has " + std::to_string(y0.size()) +
+                                    " components, expected " + std::to_string(dimension_));
+    }
+    auto start = std::chrono::steady_clock::now();
+    OdeResult result;
+    switch (options.method)
+    {
+    case ODE_RK45:
+        result = integrate_rk45(y0, t0, t1, options);
+        break;
+    case ODE_ROSENBROCK:
+        result = integrate_rosenbrock(y0, t0, t1, options);
+        break;
+    default:
+        throw std::invalid_argument("Unknown ODE method");
+    }
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return result;
+}
+
+template <typename T>
+std::vector<OdeResult> OdeSystem<T>::integrate_many(const std::vector<std::vector<T>> &y0s, T t0, T t1,
+                                                    const OdeOptions &options) const
+{
+    for (const std::vector<T> &y0 : y0s)
+    {
+        if (y0.size() != dimension_)
+        {
+            throw std::invalid_argument("Initial state has " + std::to_string(y0.size()) +
+                                        " components, expected " + std::to_string(dimension_));
+        }
+    }
+    std::vector<OdeResult> results(y0s.size());
+    // Задачи раздаются динамически: время интегрирования сильно зависит от начальных условий.
+    std::atomic<size_t> next{0};
+    auto worker = [&]()
+    {
+        for (size_t i = next.fetch_add(1); i < y0s.size(); i = next.fetch_add(1))
+        {
+            results[i] = integrate(y0s[i], t0, t1, options);
+        }
+    };
+
+    size_t threads = std::max<size_t>(1, std::min(options.threads, y0s.size()));
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < threads; ++i)
+    {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for (std::thread &thread : workers)
+    {
+        thread.join();
+    }
+    return results;
+}
+
+template class OdeSystem<long double>;
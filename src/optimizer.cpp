@@ -0,0 +1,279 @@
+#include "../includes/optimizer.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <deque>
+#include <limits>
+#include <stdexcept>
+
+// Параметр условия Армихо достаточного убывания.
+static constexpr long double ARMIJO = 1e-4L;
+
+template <typename T>
+std::vector<Expression<T>> Optimizer<T>::outputs_of(const Expression<T> &objective,
+                                                    const std::vector<std::string> &variables)
+{
+    std::vector<Expression<T>> outputs{objective};
+    std::vector<Expression<T>> gradient = objective.diff_all(variables);
+    outputs.insert(outputs.end(), gradient.begin(), gradient.end());
+    return outputs;
+}
+
+template <typename T>
+Optimizer<T>::Optimizer(const Expression<T> &objective, const std::vector<std::string> &variables)
+    : variables_(variables),
+      compiled_(outputs_of(objective, variables), variables)
+{
+}
+
+template <typename T>
+T Optimizer<T>::evaluate(const T *x, T *gradient) const
+{
+    thread_local std::vector<T> results;
+    results.resize(variables_.size() + 1);
+    compiled_.eval(x, results.data());
+    std::copy(results.begin() + 1, results.end(), gradient);
+    return results[0];
+}
+
+template <typename T>
+const std::vector<std::string> &Optimizer<T>::variables() const
+{
+    return variables_;
+}
+
+template <typename T>
+static T dot(const std::vector<T> &a, const std::vector<T> &b)
+{
+    T sum = 0;
+    for (size_t i = 0; i < a.size(); ++i)
+    {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+template <typename T>
+OptimizationResult Optimizer<T>::minimize(std::vector<T> x, const OptimizationOptions &options) const
+{
+    using clock = std::chrono::steady_clock;
+    auto start = clock::now();
+    size_t n = variables_.size();
+    if (x.size() != n)
+    {
+        throw std::invalid_argument("Initial point has " + std::to_string(x.size()) +
+                                    " coordinates, expected " + std::to_string(n));
+    }
+
+    for (const auto *bound : {&options.lower, &options.upper})
+    {
+        if (!bound->empty() && bound->size() != n)
+        {
+            throw std::invalid_argument("Bound has " + std::to_string(bound->size()) + " coordinates, expected " +
+                                        std::to_string(n));
+        }
+    }
+
+    std::vector<T> lower(n, -std::numeric_limits<T>::infinity());
+    std::vector<T> upper(n, std::numeric_limits<T>::infinity());
+    if (!options.lower.empty())
+    {
+        std::copy_n(options.lower.begin(), n, lower.begin());
+    }
+    if (!options.upper.empty())
+    {
+        std::copy_n(options.upper.begin(), n, upper.begin());
+    }
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (!(lower[i] <= upper[i]))
+        {
+            throw std::invalid_argument("Empty bounds for variable " + variables_[i]);
+        }
+    }
+    auto project = [&](std::vector<T> &point)
+    {
+        for (size_t i = 0; i < n; ++i)
+        {
+            point[i] = std::clamp(point[i], lower[i], upper[i]);
+        }
+    };
+
+    OptimizationResult result;
+    project(x);
+    std::vector<T> gradient(n);
+    T value = evaluate(x.data(), gradient.data());
+    result.evaluations = 1;
+
+    // Пары s = x' - x, y = g' - g последних итераций и 1 / (s, y).
+    std::deque<std::vector<T>> history_s;
+    std::deque<std::vector<T>> history_y;
+    std::deque<T> history_rho;
+
+    std::vector<T> direction(n);
+    std::vector<T> candidate(n);
+    std::vector<T> candidate_gradient(n);
+    std::vector<bool> is_free(n);
+    std::vector<T> alphas;
+
+    for (size_t iteration = 0; iteration < options.max_iterations; ++iteration)
+    {
+        auto iteration_start = clock::now();
+        size_t evaluations_before = result.evaluations;
+
+        // Проекция градиента: переменные на границе с градиентом наружу фиксируются.
+        T gradient_norm = 0;
+        for (size_t i = 0; i < n; ++i)
+        {
+            is_free[i] = !((x[i] <= lower[i] && gradient[i] > 0) || (x[i] >= upper[i] && gradient[i] < 0));
+            if (is_free[i])
+            {
+                gradient_norm = std::max(gradient_norm, std::fabs(gradient[i]));
+            }
+        }
+        result.gradient_norm = gradient_norm;
+        if (gradient_norm <= options.gradient_tolerance)
+        {
+            result.converged = true;
+            break;
+        }
+
+        // Направление -H g двухпроходной рекурсией L-BFGS по свободным переменным.
+        for (size_t i = 0; i < n; ++i)
+        {
+            direction[i] = is_free[i] ? gradient[i] : 0;
+        }
+        alphas.assign(history_s.size(), 0);
+        for (size_t k = history_s.size(); k-- > 0;)
+        {
+            alphas[k] = history_rho[k] * dot(history_s[k], direction);
+            for (size_t i = 0; i < n; ++i)
+            {
+                direction[i] -= alphas[k] * history_y[k][i];
+            }
+        }
+        if (!history_s.empty())
+        {
+            const std::vector<T> &s = history_s.back();
+            const std::vector<T> &y = history_y.back();
+            T scale = dot(s, y) / dot(y, y);
+            for (T &component : direction)
+            {
+                component *= scale;
+            }
+        }
+        for (size_t k = 0; k < history_s.size(); ++k)
+        {
+            T beta = history_rho[k] * dot(history_y[k], direction);
+            for (size_t i = 0; i < n; ++i)
+            {
+                direction[i] += (alphas[k] - beta) * history_s[k][i];
+            }
+        }
+        for (size_t i = 0; i < n; ++i)
+        {
+            direction[i] = is_free[i] ? -direction[i] : 0;
+        }
+
+        // Если направление не является направлением спуска, память сбрасывается.
+        if (dot(direction, gradient) >= 0)
+        {
+            history_s.clear();
+            history_y.clear();
+            history_rho.clear();
+            for (size_t i = 0; i < n; ++i)
+            {
+                direction[i] = is_free[i] ? -gradient[i] : 0;
+            }
+        }
+
+        // Линейный поиск с возвратом по проекции луча на брус.
+        T step = history_s.empty() ? std::min(T(1), T(1) / gradient_norm) : T(1);
+        T candidate_value = value;
+        bool accepted = false;
+        for (size_t trial = 0; trial < options.max_line_search; ++trial)
+        {
+            for (size_t i = 0; i < n; ++i)
+            {
+                candidate[i] = x[i] + step * direction[i];
+            }
+            project(candidate);
+            candidate_value = evaluate(candidate.data(), candidate_gradient.data());
+            ++result.evaluations;
+
+            T decrease = 0;
+            for (size_t i = 0; i < n; ++i)
+            {
+                decrease += gradient[i] * (candidate[i] - x[i]);
+            }
+            if (std::isfinite(candidate_value) && candidate_value <= value + ARMIJO * decrease)
+            {
+                accepted = true;
+                break;
+            }
+            step /= 2;
+        }
+
+        IterationInfo info;
+        info.step = step;
+        if (!accepted)
+        {
+            // Неудачный шаг тоже итерация: history и iterations совпадают по длине.
+            ++result.iterations;
+            info.value = value;
+            info.gradient_norm = gradient_norm;
+            info.evaluations = result.evaluations - evaluations_before;
+            info.seconds = std::chrono::duration<double>(clock::now() - iteration_start).count();
+            result.history.push_back(info);
+            break;
+        }
+
+        // Обновление памяти при положительной кривизне.
+        std::vector<T> s(n);
+        std::vector<T> y(n);
+        for (size_t i = 0; i < n; ++i)
+        {
+            s[i] = candidate[i] - x[i];
+            y[i] = candidate_gradient[i] - gradient[i];
+        }
+        T curvature = dot(s, y);
+        if (curvature > std::numeric_limits<T>::epsilon() * dot(y, y))
+        {
+            history_s.push_back(std::move(s));
+            history_y.push_back(std::move(y));
+            history_rho.push_back(1 / curvature);
+            if (history_s.size() > options.memory)
+            {
+                history_s.pop_front();
+                history_y.pop_front();
+                history_rho.pop_front();
+            }
+        }
+
+        T change = std::fabs(value - candidate_value);
+        x.swap(candidate);
+        gradient.swap(candidate_gradient);
+        value = candidate_value;
+        ++result.iterations;
+
+        info.value = value;
+        info.gradient_norm = gradient_norm;
+        info.evaluations = result.evaluations - evaluations_before;
+        info.seconds = std::chrono::duration<double>(clock::now() - iteration_start).count();
+        result.history.push_back(info);
+
+        if (change <= options.value_tolerance * std::max(T(1), std::fabs(value)))
+        {
+            result.converged = true;
+            break;
+        }
+    }
+
+    result.x.assign(x.begin(), x.end());
+    result.value = value;
+    result.seconds = std::chrono::duration<double>(clock::now() - start).count();
+    return result;
+}
+
+template class Optimizer<long double>;
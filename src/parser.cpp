@@ -1,6 +1,8 @@
 #include "../includes/parser.hpp"
+#include "../includes/trace.hpp"
 
 #include <stdexcept>
+#include <vector>
 
 template <typename T>
 Parser<T>::Parser(Lexer &lexer) : lexer_(lexer),
@@ -52,6 +54,7 @@ bool Parser<T>::match(TokenType type)
 template <typename T>
 Expression<T> Parser<T>::parseExpression()
 {
+    TRACE_SCOPE("parse");
     Expression<T> expr = parseExpr();
 
     expect({TOK_EOF});
@@ -60,127 +63,186 @@ Expression<T> Parser<T>::parseExpression()
 }
 
 template <typename T>
-Expression<T> Parser<T>::parseExpr()
+int Parser<T>::precedence(TokenType type)
 {
-#ifndef NDEBUG
-    std::cout << "Expr" << std::endl;
-#endif
-    Expression<T> expr = parseTerm();
-
-    while (currentToken_.type == TOK_PLUS || currentToken_.type == TOK_SUB)
+    switch (type)
     {
-        // Считываем символ '+' или '-' в обязательном порядке.
-        advance();
-        Token curToken = currentToken_;
-        // Считываем следующее слагаемое в выражении.
-        Expression<T> term = parseTerm();
-
-        // Обновляем выражение для суммы или вычитание.
-        if (curToken.type == TOK_SUB)
-            expr -= term;
-        else
-            expr += term;
+    case TOK_PLUS:
+    case TOK_SUB:
+        return 1;
+    case TOK_MULTIPLY:
+    case TOK_DIV:
+        return 2;
+    case TOK_POW:
+        return 3;
+    default:
+        return 0;
     }
-
-    return expr;
 }
 
 template <typename T>
-Expression<T> Parser<T>::parseTerm()
+Expression<T> Parser<T>::build(Operand &operand)
 {
-#ifndef NDEBUG
-    std::cout << "Term" << std::endl;
-#endif
-    Expression<T> term = parsePower();
-
-    while (currentToken_.type == TOK_MULTIPLY || currentToken_.type == TOK_DIV)
+    if (operand.chain == TOK_PLUS)
     {
-        // Считываем символ '*' или '/' в обязательном порядке.
-        advance();
+        operand.terms = {Expression<T>::ExprSum(std::move(operand.terms), std::move(operand.negated))};
+    }
+    else if (operand.chain == TOK_MULTIPLY)
+    {
+        operand.terms = {Expression<T>::ExprProduct(std::move(operand.terms))};
+    }
+    operand.negated.clear();
+    operand.chain = TOK_EOF;
+    return operand.terms[0];
+}
 
-        Token curToken = currentToken_;
-        // Считываем следующий множитель в выражении.
-        Expression<T> power = parsePower();
+template <typename T>
+void Parser<T>::reduce(std::vector<Operand> &operands, TokenType operation)
+{
+    Expression<T> right = build(operands.back());
+    operands.pop_back();
+    Operand &left = operands.back();
 
-        // Обновляем выражение для произведения и деление.
-        if (curToken.type == TOK_DIV)
-            term /= power;
-        else
-            term *= power;
+    // Цепочки '+'/'-' и '*' накапливаются в одном n-арном узле.
+    TokenType chain = operation == TOK_SUB ? TOK_PLUS : operation;
+    if (chain == TOK_PLUS || chain == TOK_MULTIPLY)
+    {
+        if (left.chain != chain)
+        {
+            Expression<T> first = build(left);
+            left.terms = {first};
+            left.negated = {false};
+            left.chain = chain;
+        }
+        left.terms.push_back(right);
+        left.negated.push_back(operation == TOK_SUB);
+        return;
     }
 
-    return term;
+    // Обновляем выражение для деления или степени.
+    Expression<T> result = build(left);
+    if (operation == TOK_DIV)
+        result /= right;
+    else
+        result ^= right;
+    left.terms = {result};
 }
 
 template <typename T>
-Expression<T> Parser<T>::parsePower()
+void Parser<T>::close(const Token &group, Operand &operand)
 {
-#ifndef NDEBUG
-    std::cout << "Power" << std::endl;
-#endif
-    Expression<T> power = parseFactor();
-
-    if (match(TOK_POW))
+    // Содержимое скобки остаётся операндом: цепочка '+' или '*' в ней может
+    // продолжиться снаружи.
+    if (group.type == TOK_FUNCTION)
     {
-        Expression<T> expon = parsePower();
-        power ^= expon;
+        Expression<T> arg = build(operand);
+        if (group.lexeme == "sin(")
+        {
+            arg = arg.ExprSin();
+        }
+        else if (group.lexeme == "cos(")
+        {
+            arg = arg.ExprCos();
+        }
+        else if (group.lexeme == "ln(")
+        {
+            arg = arg.ExprLn();
+        }
+        else if (group.lexeme == "exp(")
+        {
+            arg = arg.ExprExp();
+        }
+        operand.terms = {arg};
     }
-
-    return power;
 }
 
 template <typename T>
-Expression<T> Parser<T>::parseFactor()
+Expression<T> Parser<T>::parseExpr()
 {
 #ifndef NDEBUG
-    std::cout << "Factor" << std::endl;
+    std::cout << "Expr" << std::endl;
 #endif
-    Expression<T> expr;
-    if (match(TOK_BRACKET_LEFT))
-    {
-
-        expr = parseExpr();
-
-        expect({TOK_BRACKET_RIGHT});
-    }
-    else if (match(TOK_FUNCTION))
+    // Разбор по приоритетам операций с явными стеками операндов и операций,
+    // поэтому глубина вложенности выражения не ограничена размером стека вызовов.
+    // В стеке операций, кроме бинарных операций, лежат открывающие скобки и функции.
+    std::vector<Operand> operands;
+    std::vector<Token> operations;
+    // Стек операций на момент открытия каждой скобки.
+    std::vector<size_t> groups;
+
+    while (true)
     {
-        Token curToken = previousToken_;
-        Expression<T> expr_ = parseExpr();
-        if (curToken.lexeme == "sin(")
+        // Ожидаем операнд: скобку, функцию, число или переменную.
+        if (match(TOK_BRACKET_LEFT) || match(TOK_FUNCTION))
         {
-            expr = expr_.ExprSin();
+            operations.push_back(previousToken_);
+            groups.push_back(operations.size());
+            continue;
         }
-        else if (curToken.lexeme == "cos(")
+        if (match(TOK_VALUE))
         {
-            expr = expr_.ExprCos();
+            operands.push_back(Operand{{Expression<T>(std::stold(previousToken_.lexeme))}, {}, TOK_EOF});
         }
-        else if (curToken.lexeme == "ln(")
+        else if (match(TOK_VARIABLE))
         {
-            expr = expr_.ExprLn();
+            operands.push_back(Operand{{Expression<T>(previousToken_.lexeme)}, {}, TOK_EOF});
         }
-        else if (curToken.lexeme == "exp(")
+        else
         {
-            expr = expr_.ExprExp();
+            throw std::runtime_error(
+                "Got unexpected token \"" + currentToken_.lexeme +
+                "\" of type " + std::to_string(currentToken_.type));
         }
-        expect({TOK_BRACKET_RIGHT});
-    }
-    else if (match(TOK_VALUE))
-    {
-        expr = Expression<T>(std::stold(previousToken_.lexeme));
+
+        // После операнда закрываем скобки и функции.
+        while (!groups.empty() && currentToken_.type == TOK_BRACKET_RIGHT)
+        {
+            while (operations.size() > groups.back())
+            {
+                reduce(operands, operations.back().type);
+                operations.pop_back();
+            }
+            groups.pop_back();
+            Token group = operations.back();
+            operations.pop_back();
+            advance();
+            close(group, operands.back());
+        }
+
+        // Бинарная операция или конец выражения.
+        int current = precedence(currentToken_.type);
+        if (current == 0)
+        {
+            break;
+        }
+        size_t bottom = groups.empty() ? 0 : groups.back();
+        while (operations.size() > bottom)
+        {
+            int top = precedence(operations.back().type);
+            // '^' правоассоциативна, остальные операции левоассоциативны.
+            if (top < current || (top == current && currentToken_.type == TOK_POW))
+            {
+                break;
+            }
+            reduce(operands, operations.back().type);
+            operations.pop_back();
+        }
+        operations.push_back(currentToken_);
+        advance();
     }
-    else if (match(TOK_VARIABLE))
+
+    if (!groups.empty())
     {
-        expr = Expression<T>(previousToken_.lexeme);
+        // Незакрытая скобка.
+        expect({TOK_BRACKET_RIGHT});
     }
-    else
+    while (!operations.empty())
     {
-        throw std::runtime_error(
-            "Got unexpected token \"" + currentToken_.lexeme +
-            "\" of type " + std::to_string(currentToken_.type));
+        reduce(operands, operations.back().type);
+        operations.pop_back();
     }
 
-    return expr;
+    return build(operands.back());
 }
 
 template class Parser<long double>;
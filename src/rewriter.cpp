@@ -0,0 +1,887 @@
+#include "../includes/rewriter.hpp"
+#include "../includes/trace.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <random>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+// Наибольшее число правил, последовательно применяемых к одному узлу.
+static constexpr size_t MAX_REWRITES_PER_NODE = 8;
+// Число повторов измерения времени (берётся наименьшее время).
+static constexpr size_t MEASURE_REPEATS = 5;
+
+// ---------------------------------------------------------------------------
+// Структурные номера и стоимость узлов
+// ---------------------------------------------------------------------------
+
+// Структурно одинаковые поддеревья получают один номер, как общие подвыражения при
+// компиляции. Таблица хранит сами узлы, поэтому их адреса не переиспользуются;
+// листья номеруются по значению без записи в таблицу.
+template <typename T>
+class Structure
+{
+public:
+    struct Info
+    {
+        Expression<T> expr;
+        uint32_t id;
+        // Стоимость дерева без учёта общих поддеревьев (для сравнения вариантов узла).
+        long double cost;
+    };
+
+    explicit Structure(const CostModel &costs) : costs_(costs)
+    {
+    }
+
+    Info info(const Expression<T> &root);
+
+    uint32_t id(const Expression<T> &expr)
+    {
+        return info(expr).id;
+    }
+
+    // Стоимость с учётом общих поддеревьев: каждый структурный номер считается один раз.
+    long double dag_cost(const Expression<T> &root);
+
+    long double operation_cost(const Expression<T> &expr) const;
+
+private:
+    const CostModel &costs_;
+    std::unordered_map<const ExpressionBase<T> *, Info> nodes_;
+    std::unordered_map<std::string, uint32_t> keys_;
+    std::vector<long double> operation_costs_;
+
+    uint32_t intern(std::string key, long double cost);
+    // Номер листа (листья хранятся в выражении и не имеют узла).
+    uint32_t leaf_id(const Expression<T> &leaf);
+};
+
+template <typename T>
+uint32_t Structure<T>::intern(std::string key, long double cost)
+{
+    uint32_t next = static_cast<uint32_t>(keys_.size());
+    uint32_t id = keys_.emplace(std::move(key), next).first->second;
+    if (id == next)
+    {
+        operation_costs_.push_back(cost);
+    }
+    return id;
+}
+
+template <typename T>
+uint32_t Structure<T>::leaf_id(const Expression<T> &leaf)
+{
+    std::string key(1, static_cast<char>(leaf.kind()));
+    if (leaf.kind() == NODE_VARIABLE)
+    {
+        uint32_t symbol = leaf.symbol();
+        key.append(reinterpret_cast<const char *>(&symbol), sizeof(symbol));
+        return intern(std::move(key), 0);
+    }
+    T value = leaf.constant();
+    char buffer[96];
+    int length = std::snprintf(buffer, sizeof(buffer), "%La|%La", static_cast<long double>(std::real(value)),
+                               static_cast<long double>(std::imag(value)));
+    key.append(buffer, static_cast<size_t>(length));
+    if (value != value)
+    {
+        // NaN не совпадает ни с чем, в том числе с собой.
+        key += std::to_string(keys_.size());
+    }
+    return intern(std::move(key), 0);
+}
+
+template <typename T>
+typename Structure<T>::Info Structure<T>::info(const Expression<T> &root)
+{
+    if (root.node() == nullptr)
+    {
+        return Info{root, leaf_id(root), 0};
+    }
+    auto found = nodes_.find(root.node());
+    if (found != nodes_.end())
+    {
+        return found->second;
+    }
+
+    std::vector<std::pair<const Expression<T> *, bool>> stack{{&root, false}};
+    while (!stack.empty())
+    {
+        auto [expr, ready] = stack.back();
+        if (expr->node() == nullptr || nodes_.count(expr->node()))
+        {
+            stack.pop_back();
+            continue;
+        }
+        if (!ready)
+        {
+            stack.back().second = true;
+            for (size_t i = expr->arity(); i-- > 0;)
+            {
+                stack.emplace_back(&expr->operand(i), false);
+            }
+            continue;
+        }
+        stack.pop_back();
+
+        // Ключ: вид узла, его собственные данные и номера операндов.
+        NodeKind kind = expr->kind();
+        std::string key(1, static_cast<char>(kind));
+        if (kind == NODE_SUM)
+        {
+            const OpSum<T> *sum = static_cast<const OpSum<T> *>(expr->node());
+            key += sum->is_compensated() ? 'c' : 's';
+            for (size_t i = 0; i < sum->arity(); ++i)
+            {
+                key += sum->is_negated(i) ? '-' : '+';
+            }
+        }
+
+        long double operation = operation_cost(*expr);
+        long double cost = operation;
+        for (size_t i = 0; i < expr->arity(); ++i)
+        {
+            const Expression<T> &operand = expr->operand(i);
+            uint32_t id = operand.node() == nullptr ? leaf_id(operand) : nodes_.at(operand.node()).id;
+            key.append(reinterpret_cast<const char *>(&id), sizeof(id));
+            cost += operand.node() == nullptr ? 0 : nodes_.at(operand.node()).cost;
+        }
+        nodes_.emplace(expr->node(), Info{*expr, intern(std::move(key), operation), cost});
+    }
+    return nodes_.at(root.node());
+}
+
+template <typename T>
+long double Structure<T>::dag_cost(const Expression<T> &root)
+{
+    info(root);
+    long double total = 0;
+    std::unordered_set<uint32_t> counted;
+    std::unordered_set<const ExpressionBase<T> *> visited;
+    std::vector<const Expression<T> *> stack{&root};
+    while (!stack.empty())
+    {
+        const Expression<T> *expr = stack.back();
+        stack.pop_back();
+        // Листья ничего не стоят.
+        if (expr->node() == nullptr || !visited.insert(expr->node()).second)
+        {
+            continue;
+        }
+        uint32_t id = nodes_.at(expr->node()).id;
+        if (counted.insert(id).second)
+        {
+            total += operation_costs_[id];
+        }
+        for (size_t i = 0; i < expr->arity(); ++i)
+        {
+            stack.push_back(&expr->operand(i));
+        }
+    }
+    return total;
+}
+
+template <typename T>
+long double operation_cost(const Expression<T> &expr, const CostModel &costs)
+{
+    switch (expr.kind())
+    {
+    case NODE_VALUE:
+    case NODE_VARIABLE:
+        return 0;
+    case NODE_NEGATE:
+    case NODE_ADD:
+    case NODE_SUB:
+        return costs.add;
+    case NODE_MULT:
+        return costs.multiply;
+    case NODE_DIV:
+        return costs.divide;
+    case NODE_SUM:
+    {
+        // Суммирование по Кэхэну - четыре сложения на слагаемое.
+        bool compensated = static_cast<const OpSum<T> *>(expr.node())->is_compensated();
+        return (expr.arity() - 1) * costs.add * (compensated ? 4 : 1);
+    }
+    case NODE_PRODUCT:
+        return (expr.arity() - 1) * costs.multiply;
+    case NODE_SIN:
+    case NODE_COS:
+    case NODE_LN:
+    case NODE_EXP:
+        return costs.transcendental;
+    case NODE_POW:
+    {
+        int n = 0;
+        if (expr.operand(1).kind() != NODE_VALUE)
+        {
+            return costs.power;
+        }
+        switch (classify_exponent(expr.operand(1).constant(), n))
+        {
+        case POWER_INTEGER:
+        {
+            // Двоичный метод: возведения в квадрат и умножения на основание.
+            unsigned int power = n < 0 ? -static_cast<unsigned int>(n) : static_cast<unsigned int>(n);
+            long double multiplies = 0;
+            for (unsigned int rest = power; rest > 1; rest >>= 1)
+            {
+                multiplies += 1 + (rest & 1U);
+            }
+            return multiplies * costs.multiply + (n < 0 ? costs.divide : 0);
+        }
+        case POWER_SQRT:
+            return costs.sqrt;
+        case POWER_RSQRT:
+            return costs.sqrt + costs.divide;
+        default:
+            return costs.power;
+        }
+    }
+    }
+    return 0;
+}
+
+template long double operation_cost(const Expression<long double> &, const CostModel &);
+template long double operation_cost(const Expression<std::complex<long double>> &, const CostModel &);
+
+template <typename T>
+long double Structure<T>::operation_cost(const Expression<T> &expr) const
+{
+    return ::operation_cost(expr, costs_);
+}
+
+// ---------------------------------------------------------------------------
+// Правила
+// ---------------------------------------------------------------------------
+
+// Преобразование дерева снизу вверх: visit(исходный узел, узел с преобразованными операндами).
+template <typename T, typename Visit>
+static Expression<T> transform(const Expression<T> &root, Visit &&visit)
+{
+    std::unordered_map<const ExpressionBase<T> *, Expression<T>> done;
+    std::vector<std::pair<const Expression<T> *, bool>> stack{{&root, false}};
+    while (!stack.empty())
+    {
+        auto [expr, ready] = stack.back();
+        const ExpressionBase<T> *node = expr->node();
+        if (node == nullptr || done.count(node))
+        {
+            stack.pop_back();
+            continue;
+        }
+        if (!ready)
+        {
+            stack.back().second = true;
+            for (size_t i = expr->arity(); i-- > 0;)
+            {
+                stack.emplace_back(&expr->operand(i), false);
+            }
+            continue;
+        }
+        stack.pop_back();
+
+        std::vector<Expression<T>> operands;
+        bool changed = false;
+        for (size_t i = 0; i < expr->arity(); ++i)
+        {
+            const Expression<T> &operand = expr->operand(i);
+            operands.push_back(operand.node() == nullptr ? operand : done.at(operand.node()));
+            changed = changed || operands.back().node() != operand.node();
+        }
+        Expression<T> rebuilt = changed ? node->rebuild(operands.data()) : *expr;
+        done.emplace(node, visit(*expr, rebuilt));
+    }
+    return root.node() == nullptr ? root : done.at(root.node());
+}
+
+template <typename T>
+static bool is_value(const Expression<T> &expr, T value)
+{
+    return expr.kind() == NODE_VALUE && expr.constant() == value;
+}
+
+// Слагаемые суммы со знаками (суммы по Кэхэну не переписываются).
+template <typename T>
+static bool terms_of(const Expression<T> &expr, std::vector<Expression<T>> &terms, std::vector<bool> &negated)
+{
+    NodeKind kind = expr.kind();
+    if (kind == NODE_ADD || kind == NODE_SUB)
+    {
+        terms = {expr.operand(0), expr.operand(1)};
+        negated = {false, kind == NODE_SUB};
+        return true;
+    }
+    if (kind == NODE_SUM && !static_cast<const OpSum<T> *>(expr.node())->is_compensated())
+    {
+        const OpSum<T> *sum = static_cast<const OpSum<T> *>(expr.node());
+        terms.clear();
+        negated.clear();
+        for (size_t i = 0; i < sum->arity(); ++i)
+        {
+            terms.push_back(sum->operand(i));
+            negated.push_back(sum->is_negated(i));
+        }
+        return true;
+    }
+    return false;
+}
+
+template <typename T>
+static bool factors_of(const Expression<T> &expr, std::vector<Expression<T>> &factors)
+{
+    if (expr.kind() != NODE_MULT && expr.kind() != NODE_PRODUCT)
+    {
+        return false;
+    }
+    factors.clear();
+    for (size_t i = 0; i < expr.arity(); ++i)
+    {
+        factors.push_back(expr.operand(i));
+    }
+    return true;
+}
+
+template <typename T>
+static Expression<T> sum_of(std::vector<Expression<T>> terms, std::vector<bool> negated)
+{
+    if (terms.size() == 1)
+    {
+        return negated[0] ? -terms[0] : terms[0];
+    }
+    if (terms.size() == 2 && !negated[0])
+    {
+        return negated[1] ? terms[0] - terms[1] : terms[0] + terms[1];
+    }
+    return Expression<T>::ExprSum(std::move(terms), std::move(negated));
+}
+
+template <typename T>
+static Expression<T> product_of(std::vector<Expression<T>> factors)
+{
+    if (factors.size() == 1)
+    {
+        return factors[0];
+    }
+    if (factors.size() == 2)
+    {
+        return factors[0] * factors[1];
+    }
+    return Expression<T>::ExprProduct(std::move(factors));
+}
+
+template <typename T>
+class RewritePass
+{
+public:
+    RewritePass(const RewriteOptions &options, RewriteReport &report)
+        : structure(options.costs), options_(options), report_(report)
+    {
+    }
+
+    Expression<T> run(const Expression<T> &expr);
+
+    Structure<T> structure;
+
+private:
+    using Rule = bool (RewritePass::*)(const Expression<T> &, Expression<T> &);
+    struct RuleEntry
+    {
+        const char *name;
+        RewriteSafety safety;
+        Rule rule;
+    };
+
+    const RewriteOptions &options_;
+    RewriteReport &report_;
+
+    Expression<T> simplify(const Expression<T> &expr);
+    Expression<T> share_reciprocals(const Expression<T> &expr);
+
+    bool constant_reciprocal(const Expression<T> &expr, Expression<T> &result);
+    bool merge_exponentials(const Expression<T> &expr, Expression<T> &result);
+    bool merge_logarithms(const Expression<T> &expr, Expression<T> &result);
+    bool split_divisions(const Expression<T> &expr, Expression<T> &result);
+    bool common_denominators(const Expression<T> &expr, Expression<T> &result);
+    bool pythagorean(const Expression<T> &expr, Expression<T> &result);
+
+    // Аргумент x квадрата f(x) ^ 2 или f(x) * f(x).
+    bool square_argument(const Expression<T> &expr, NodeKind function, Expression<T> &argument);
+};
+
+template <typename T>
+Expression<T> RewritePass<T>::run(const Expression<T> &expr)
+{
+    Expression<T> result = transform(expr, [this](const Expression<T> &, const Expression<T> &rebuilt)
+                                     { return simplify(rebuilt); });
+    if (options_.safety >= SAFETY_FINITE)
+    {
+        Expression<T> shared = share_reciprocals(result);
+        if (structure.dag_cost(shared) < structure.dag_cost(result))
+        {
+            result = shared;
+        }
+        else
+        {
+            report_.rules.erase("shared-reciprocal");
+        }
+    }
+    return result;
+}
+
+template <typename T>
+Expression<T> RewritePass<T>::simplify(const Expression<T> &expr)
+{
+    static const RuleEntry rules[] = {
+        {"constant-reciprocal", SAFETY_EXACT, &RewritePass::constant_reciprocal},
+        {"exp-product", SAFETY_FINITE, &RewritePass::merge_exponentials},
+        {"log-sum", SAFETY_DOMAIN, &RewritePass::merge_logarithms},
+        {"division-chain", SAFETY_FINITE, &RewritePass::split_divisions},
+        {"common-denominator", SAFETY_FINITE, &RewritePass::common_denominators},
+        {"pythagorean", SAFETY_FINITE, &RewritePass::pythagorean},
+    };
+
+    Expression<T> current = expr;
+    for (size_t round = 0; round < MAX_REWRITES_PER_NODE; ++round)
+    {
+        bool changed = false;
+        for (const RuleEntry &entry : rules)
+        {
+            Expression<T> candidate;
+            if (entry.safety > options_.safety || !(this->*entry.rule)(current, candidate))
+            {
+                continue;
+            }
+            if (structure.info(candidate).cost < structure.info(current).cost)
+            {
+                current = candidate;
+                ++report_.rules[entry.name];
+                changed = true;
+                break;
+            }
+        }
+        if (!changed)
+        {
+            break;
+        }
+    }
+    return current;
+}
+
+template <typename T>
+bool RewritePass<T>::constant_reciprocal(const Expression<T> &expr, Expression<T> &result)
+{
+    if (expr.kind() != NODE_DIV || expr.operand(1).kind() != NODE_VALUE)
+    {
+        return false;
+    }
+    T divisor = expr.operand(1).constant();
+    T reciprocal = T(1) / divisor;
+    if (!std::isfinite(divisor) || !std::isfinite(reciprocal) || divisor == 0)
+    {
+        return false;
+    }
+    // Для степени двойки 1 / c представимо точно, и x * (1 / c) совпадает с x / c.
+    int exponent = 0;
+    bool exact = std::frexp(std::fabs(divisor), &exponent) == T(0.5) && std::isnormal(divisor) &&
+                 std::isnormal(reciprocal);
+    if (!exact && options_.safety < SAFETY_FINITE)
+    {
+        return false;
+    }
+    result = expr.operand(0) * Expression<T>(reciprocal);
+    return true;
+}
+
+template <typename T>
+bool RewritePass<T>::merge_exponentials(const Expression<T> &expr, Expression<T> &result)
+{
+    if (expr.kind() == NODE_DIV)
+    {
+        if (expr.operand(0).kind() != NODE_EXP || expr.operand(1).kind() != NODE_EXP)
+        {
+            return false;
+        }
+        result = (expr.operand(0).operand(0) - expr.operand(1).operand(0)).ExprExp();
+        return true;
+    }
+
+    std::vector<Expression<T>> factors;
+    if (!factors_of(expr, factors))
+    {
+        return false;
+    }
+    std::vector<Expression<T>> rest;
+    std::vector<Expression<T>> arguments;
+    for (const Expression<T> &factor : factors)
+    {
+        if (factor.kind() == NODE_EXP)
+        {
+            arguments.push_back(factor.operand(0));
+        }
+        else
+        {
+            rest.push_back(factor);
+        }
+    }
+    if (arguments.size() < 2)
+    {
+        return false;
+    }
+    std::vector<bool> negated(arguments.size(), false);
+    rest.push_back(sum_of(std::move(arguments), std::move(negated)).ExprExp());
+    result = product_of(std::move(rest));
+    return true;
+}
+
+template <typename T>
+bool RewritePass<T>::merge_logarithms(const Expression<T> &expr, Expression<T> &result)
+{
+    std::vector<Expression<T>> terms;
+    std::vector<bool> negated;
+    if (!terms_of(expr, terms, negated))
+    {
+        return false;
+    }
+    std::vector<Expression<T>> rest;
+    std::vector<bool> rest_negated;
+    std::vector<Expression<T>> numerator;
+    std::vector<Expression<T>> denominator;
+    for (size_t i = 0; i < terms.size(); ++i)
+    {
+        if (terms[i].kind() == NODE_LN)
+        {
+            (negated[i] ? denominator : numerator).push_back(terms[i].operand(0));
+        }
+        else
+        {
+            rest.push_back(terms[i]);
+            rest_negated.push_back(negated[i]);
+        }
+    }
+    if (numerator.size() + denominator.size() < 2)
+    {
+        return false;
+    }
+    // ln(a) + ln(b) - ln(c) = ln(a * b / c); одни вычитаемые: -ln(c * d).
+    if (numerator.empty())
+    {
+        rest.push_back(product_of(std::move(denominator)).ExprLn());
+        rest_negated.push_back(true);
+    }
+    else
+    {
+        Expression<T> argument = product_of(std::move(numerator));
+        if (!denominator.empty())
+        {
+            argument = argument / product_of(std::move(denominator));
+        }
+        rest.push_back(argument.ExprLn());
+        rest_negated.push_back(false);
+    }
+    result = sum_of(std::move(rest), std::move(rest_negated));
+    return true;
+}
+
+template <typename T>
+bool RewritePass<T>::split_divisions(const Expression<T> &expr, Expression<T> &result)
+{
+    if (expr.kind() != NODE_DIV)
+    {
+        return false;
+    }
+    const Expression<T> &numerator = expr.operand(0);
+    const Expression<T> &denominator = expr.operand(1);
+    if (numerator.kind() == NODE_DIV)
+    {
+        result = numerator.operand(0) / (numerator.operand(1) * denominator);
+        return true;
+    }
+    if (denominator.kind() == NODE_DIV)
+    {
+        result = (numerator * denominator.operand(1)) / denominator.operand(0);
+        return true;
+    }
+    return false;
+}
+
+template <typename T>
+bool RewritePass<T>::common_denominators(const Expression<T> &expr, Expression<T> &result)
+{
+    std::vector<Expression<T>> terms;
+    std::vector<bool> negated;
+    if (!terms_of(expr, terms, negated))
+    {
+        return false;
+    }
+    // Слагаемые-дроби по структурному номеру знаменателя.
+    std::unordered_map<uint32_t, std::vector<size_t>> groups;
+    bool repeated = false;
+    for (size_t i = 0; i < terms.size(); ++i)
+    {
+        if (terms[i].kind() == NODE_DIV)
+        {
+            std::vector<size_t> &group = groups[structure.id(terms[i].operand(1))];
+            group.push_back(i);
+            repeated = repeated || group.size() > 1;
+        }
+    }
+    if (!repeated)
+    {
+        return false;
+    }
+
+    std::vector<Expression<T>> rest;
+    std::vector<bool> rest_negated;
+    for (size_t i = 0; i < terms.size(); ++i)
+    {
+        const std::vector<size_t> *group =
+            terms[i].kind() == NODE_DIV ? &groups.at(structure.id(terms[i].operand(1))) : nullptr;
+        if (group == nullptr || group->size() < 2)
+        {
+            rest.push_back(terms[i]);
+            rest_negated.push_back(negated[i]);
+        }
+        else if (group->front() == i)
+        {
+            // a / d - b / d = (a - b) / d на месте первой дроби.
+            std::vector<Expression<T>> numerators;
+            std::vector<bool> signs;
+            for (size_t j : *group)
+            {
+                numerators.push_back(terms[j].operand(0));
+                signs.push_back(negated[j]);
+            }
+            rest.push_back(sum_of(std::move(numerators), std::move(signs)) / terms[i].operand(1));
+            rest_negated.push_back(false);
+        }
+    }
+    result = sum_of(std::move(rest), std::move(rest_negated));
+    return true;
+}
+
+template <typename T>
+bool RewritePass<T>::square_argument(const Expression<T> &expr, NodeKind function, Expression<T> &argument)
+{
+    if (expr.kind() == NODE_POW && is_value(expr.operand(1), T(2)) && expr.operand(0).kind() == function)
+    {
+        argument = expr.operand(0).operand(0);
+        return true;
+    }
+    bool product = expr.kind() == NODE_MULT || (expr.kind() == NODE_PRODUCT && expr.arity() == 2);
+    if (product && expr.operand(0).kind() == function &&
+        structure.id(expr.operand(0)) == structure.id(expr.operand(1)))
+    {
+        argument = expr.operand(0).operand(0);
+        return true;
+    }
+    return false;
+}
+
+template <typename T>
+bool RewritePass<T>::pythagorean(const Expression<T> &expr, Expression<T> &result)
+{
+    std::vector<Expression<T>> terms;
+    std::vector<bool> negated;
+    if (!terms_of(expr, terms, negated))
+    {
+        return false;
+    }
+    std::vector<bool> used(terms.size(), false);
+    T constant = 0;
+    for (size_t i = 0; i < terms.size(); ++i)
+    {
+        Expression<T> sine;
+        if (used[i] || !square_argument(terms[i], NODE_SIN, sine))
+        {
+            continue;
+        }
+        for (size_t j = 0; j < terms.size(); ++j)
+        {
+            Expression<T> cosine;
+            if (!used[j] && negated[j] == negated[i] && square_argument(terms[j], NODE_COS, cosine) &&
+                structure.id(sine) == structure.id(cosine))
+            {
+                used[i] = used[j] = true;
+                constant += negated[i] ? T(-1) : T(1);
+                break;
+            }
+        }
+    }
+    if (std::find(used.begin(), used.end(), true) == used.end())
+    {
+        return false;
+    }
+
+    std::vector<Expression<T>> rest;
+    std::vector<bool> rest_negated;
+    for (size_t i = 0; i < terms.size(); ++i)
+    {
+        if (!used[i])
+        {
+            rest.push_back(terms[i]);
+            rest_negated.push_back(negated[i]);
+        }
+    }
+    if (constant != T(0))
+    {
+        rest.push_back(Expression<T>(constant));
+        rest_negated.push_back(false);
+    }
+    result = rest.empty() ? Expression<T>(T(0)) : sum_of(std::move(rest), std::move(rest_negated));
+    return true;
+}
+
+template <typename T>
+Expression<T> RewritePass<T>::share_reciprocals(const Expression<T> &expr)
+{
+    // Различные деления на каждый неконстантный знаменатель.
+    std::unordered_map<uint32_t, std::unordered_set<uint32_t>> divisions;
+    std::unordered_map<uint32_t, Expression<T>> denominators;
+    std::unordered_set<const ExpressionBase<T> *> visited;
+    std::vector<const Expression<T> *> stack{&expr};
+    while (!stack.empty())
+    {
+        const Expression<T> *current = stack.back();
+        stack.pop_back();
+        if (current->node() == nullptr || !visited.insert(current->node()).second)
+        {
+            continue;
+        }
+        if (current->kind() == NODE_DIV && current->operand(1).kind() != NODE_VALUE)
+        {
+            uint32_t denominator = structure.id(current->operand(1));
+            divisions[denominator].insert(structure.id(*current));
+            denominators.emplace(denominator, current->operand(1));
+        }
+        for (size_t i = 0; i < current->arity(); ++i)
+        {
+            stack.push_back(&current->operand(i));
+        }
+    }
+
+    // k делений заменяются одним делением и k умножениями.
+    const CostModel &costs = options_.costs;
+    std::unordered_map<uint32_t, Expression<T>> reciprocals;
+    for (const auto &[denominator, group] : divisions)
+    {
+        long double count = static_cast<long double>(group.size());
+        if (group.size() > 1 && count * costs.divide > costs.divide + count * costs.multiply)
+        {
+            reciprocals.emplace(denominator, Expression<T>(T(1)) / denominators.at(denominator));
+        }
+    }
+    if (reciprocals.empty())
+    {
+        return expr;
+    }
+
+    size_t &applied = report_.rules["shared-reciprocal"];
+    return transform(expr, [&](const Expression<T> &original, const Expression<T> &rebuilt)
+                     {
+                         if (original.kind() != NODE_DIV)
+                         {
+                             return rebuilt;
+                         }
+                         auto found = reciprocals.find(structure.id(original.operand(1)));
+                         if (found == reciprocals.end())
+                         {
+                             return rebuilt;
+                         }
+                         ++applied;
+                         return rebuilt.operand(0) * found->second;
+                     });
+}
+
+// ---------------------------------------------------------------------------
+// Rewriter
+// ---------------------------------------------------------------------------
+
+template <typename T>
+Rewriter<T>::Rewriter(const RewriteOptions &options) : options_(options)
+{
+}
+
+template <typename T>
+Expression<T> Rewriter<T>::rewrite(const Expression<T> &expr, RewriteReport *report) const
+{
+    TRACE_SCOPE("rewrite");
+    RewriteReport local;
+    RewriteReport &out = report != nullptr ? *report : local;
+    out = RewriteReport{};
+
+    RewritePass<T> pass(options_, out);
+    Expression<T> result = pass.run(expr);
+    out.cost_before = pass.structure.dag_cost(expr);
+    out.cost_after = pass.structure.dag_cost(result);
+    if (out.cost_after >= out.cost_before)
+    {
+        // Правила улучшали поддеревья, но не выражение с учётом общих подвыражений.
+        result = expr;
+        out.cost_after = out.cost_before;
+        out.rules.clear();
+    }
+    out.estimated_speedup = out.cost_after > 0     ? static_cast<double>(out.cost_before / out.cost_after)
+                            : out.cost_before > 0 ? std::numeric_limits<double>::infinity()
+                                                  : 1.0;
+
+    if (options_.samples > 0)
+    {
+        // Пакетное вычисление обеих программ в одних и тех же случайных точках.
+        std::vector<std::string> variables = CompiledExpression<T>::free_variables(expr);
+        CompiledExpression<T> before(expr, variables);
+        CompiledExpression<T> after(result, variables);
+        std::mt19937_64 random(42);
+        std::uniform_real_distribution<long double> distribution(options_.sample_low, options_.sample_high);
+        std::vector<std::vector<T>> columns(variables.size(), std::vector<T>(options_.samples));
+        std::vector<const T *> pointers;
+        for (std::vector<T> &column : columns)
+        {
+            for (T &value : column)
+            {
+                value = T(distribution(random));
+            }
+            pointers.push_back(column.data());
+        }
+        std::vector<T> values(options_.samples);
+        T *results = values.data();
+
+        auto measure = [&](const CompiledExpression<T> &compiled)
+        {
+            double best = std::numeric_limits<double>::infinity();
+            for (size_t repeat = 0; repeat < MEASURE_REPEATS; ++repeat)
+            {
+                auto start = std::chrono::steady_clock::now();
+                compiled.eval_batch(options_.samples, pointers.data(), &results);
+                best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+            }
+            return best;
+        };
+        out.seconds_before = measure(before);
+        out.seconds_after = measure(after);
+        out.measured_speedup = out.seconds_after > 0 ? out.seconds_before / out.seconds_after : 0;
+    }
+    return result;
+}
+
+template <typename T>
+long double Rewriter<T>::cost(const Expression<T> &expr) const
+{
+    Structure<T> structure(options_.costs);
+    return structure.dag_cost(expr);
+}
+
+template <typename T>
+const RewriteOptions &Rewriter<T>::options() const
+{
+    return options_;
+}
+
+template class Rewriter<long double>;
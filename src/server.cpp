@@ -0,0 +1,998 @@
+#include "../includes/server.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Размер блока чтения из сокета и наибольшее число событий за один вызов epoll_wait.
+static constexpr size_t READ_CHUNK = 64 * 1024;
+static constexpr int MAX_EVENTS = 64;
+// Неотправленные ответы соединения, после которых его запросы не читаются, пока клиент
+// не заберёт ответы.
+static constexpr size_t MAX_PENDING_OUTPUT = 4 * SERVER_MAX_FRAME;
+
+static std::runtime_error system_error(const std::string &what)
+{
+    return std::runtime_error(what + ": " + std::strerror(errno));
+}
+
+static sockaddr_un socket_address(const std::string &path)
+{
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(address.sun_path))
+    {
+        throw std::invalid_argument("Invalid socket path '" + path + "'");
+    }
+    std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    return address;
+}
+
+// Запись всех байтов в блокирующий сокет.
+static void write_all(int fd, const char *data, size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t written = ::send(fd, data, size, MSG_NOSIGNAL);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            throw system_error("Cannot write to socket");
+        }
+        data += written;
+        size -= static_cast<size_t>(written);
+    }
+}
+
+// =======
+// |Кадры|
+// =======
+
+template <typename V>
+static void put(std::string &out, V value)
+{
+    char bytes[sizeof(V)];
+    std::memcpy(bytes, &value, sizeof(V));
+    out.append(bytes, sizeof(V));
+}
+
+template <typename V>
+static V get(const char *data)
+{
+    V value;
+    std::memcpy(&value, data, sizeof(V));
+    return value;
+}
+
+static void put_frame(std::string &out, uint8_t code, uint32_t id, const std::string &payload)
+{
+    put<uint32_t>(out, static_cast<uint32_t>(SERVER_HEADER_SIZE + payload.size()));
+    put<uint8_t>(out, code);
+    put<uint32_t>(out, id);
+    out += payload;
+}
+
+// Последовательное чтение данных запроса или ответа.
+class FrameReader
+{
+public:
+    FrameReader(const char *data, size_t size) : data_(data), size_(size)
+    {
+    }
+
+    template <typename V>
+    V next()
+    {
+        require(sizeof(V));
+        V value = get<V>(data_ + position_);
+        position_ += sizeof(V);
+        return value;
+    }
+
+    std::string text(size_t size)
+    {
+        require(size);
+        std::string value(data_ + position_, size);
+        position_ += size;
+        return value;
+    }
+
+    std::string rest()
+    {
+        return text(remaining());
+    }
+
+    const char *current() const
+    {
+        return data_ + position_;
+    }
+
+    size_t remaining() const
+    {
+        return size_ - position_;
+    }
+
+private:
+    const char *data_;
+    size_t size_;
+    size_t position_ = 0;
+
+    void require(size_t size) const
+    {
+        if (remaining() < size)
+        {
+            throw std::runtime_error("Truncated message");
+        }
+    }
+};
+
+// ============
+// |EvalServer|
+// ============
+
+using ServerEntry = ParseCache<long double>::Entry;
+
+struct EvalServer::Connection
+{
+    int fd;
+    bool closed = false;
+    // Принятые, но ещё не разобранные на кадры байты и неотправленные байты ответов
+    // (только главный поток).
+    std::string input;
+    std::string sending;
+    // События, на которые соединение подписано в epoll.
+    uint32_t events = EPOLLIN;
+
+    // Кадры запросов, ждущие выполнения, и готовые ответы.
+    std::mutex mutex;
+    std::vector<std::string> frames;
+    std::string output;
+    // Соединение в очереди или выполняется потоком пула.
+    bool scheduled = false;
+
+    // Описатели выражений; используются только потоком, выполняющим запросы соединения.
+    std::unordered_map<uint64_t, std::shared_ptr<const ServerEntry>> handles;
+    uint64_t next_handle = 1;
+
+    explicit Connection(int fd) : fd(fd)
+    {
+    }
+};
+
+struct EvalServer::State
+{
+    ParseCache<long double> cache;
+    int listen_fd = -1;
+    int epoll_fd = -1;
+    int event_fd = -1;
+    std::atomic<bool> stopping{false};
+
+    // Очередь соединений с запросами для пула.
+    std::mutex queue_mutex;
+    std::condition_variable queue_ready;
+    std::deque<std::shared_ptr<Connection>> queue;
+    std::vector<std::thread> workers;
+
+    // Соединения с готовыми ответами для главного потока.
+    std::mutex done_mutex;
+    std::vector<std::shared_ptr<Connection>> done;
+
+    std::unordered_map<int, std::shared_ptr<Connection>> connections;
+
+    std::atomic<size_t> accepted{0};
+    std::atomic<size_t> requests{0};
+    std::atomic<size_t> errors{0};
+
+    explicit State(const ParseCacheOptions &options) : cache(options)
+    {
+    }
+
+    void wake() const
+    {
+        uint64_t one = 1;
+        ssize_t written = ::write(event_fd, &one, sizeof(one));
+        (void)written;
+    }
+
+    void schedule(const std::shared_ptr<Connection> &connection)
+    {
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            queue.push_back(connection);
+        }
+        queue_ready.notify_one();
+    }
+
+    void accept_connections();
+    // Чтение запросов; false - соединение закрыто клиентом или нарушен протокол.
+    bool receive(Connection &connection, const std::shared_ptr<Connection> &shared);
+    // Отправка готовых ответов; false - ошибка записи.
+    bool flush(Connection &connection);
+    void close(Connection &connection);
+
+    void work();
+    void execute(Connection &connection, const std::string &frame, std::string &out);
+    std::string handle_reply(Connection &connection, std::shared_ptr<const ServerEntry> entry);
+    const ServerEntry &find(const Connection &connection, uint64_t handle) const;
+};
+
+EvalServer::EvalServer(const ServerOptions &options)
+    : options_(options), state_(std::make_unique<State>(options.cache))
+{
+    sockaddr_un address = socket_address(options_.path);
+    State &state = *state_;
+    state.listen_fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (state.listen_fd < 0)
+    {
+        throw system_error("Cannot create socket");
+    }
+    ::unlink(options_.path.c_str());
+    if (::bind(state.listen_fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0 ||
+        ::listen(state.listen_fd, SOMAXCONN) < 0)
+    {
+        int error = errno;
+        ::close(state.listen_fd);
+        errno = error;
+        throw system_error("Cannot listen on " + options_.path);
+    }
+
+    state.epoll_fd = ::epoll_create1(EPOLL_CLOEXEC);
+    state.event_fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (state.epoll_fd < 0 || state.event_fd < 0)
+    {
+        int error = errno;
+        ::close(state.listen_fd);
+        ::close(state.epoll_fd);
+        ::close(state.event_fd);
+        errno = error;
+        throw system_error("Cannot create epoll");
+    }
+    for (int fd : {state.listen_fd, state.event_fd})
+    {
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        ::epoll_ctl(state.epoll_fd, EPOLL_CTL_ADD, fd, &event);
+    }
+}
+
+EvalServer::~EvalServer()
+{
+    State &state = *state_;
+    for (auto &[fd, connection] : state.connections)
+    {
+        ::close(fd);
+    }
+    ::close(state.listen_fd);
+    ::close(state.epoll_fd);
+    ::close(state.event_fd);
+    ::unlink(options_.path.c_str());
+}
+
+void EvalServer::run()
+{
+    State &state = *state_;
+    size_t workers = options_.workers > 0 ? options_.workers : std::max(1u, std::thread::hardware_concurrency());
+    for (size_t i = 0; i < workers; ++i)
+    {
+        state.workers.emplace_back([&state] { state.work(); });
+    }
+
+    epoll_event events[MAX_EVENTS];
+    while (!state.stopping.load())
+    {
+        int count = ::epoll_wait(state.epoll_fd, events, MAX_EVENTS, -1);
+        if (count < 0 && errno != EINTR)
+        {
+            state.stopping = true;
+            break;
+        }
+        for (int i = 0; i < count; ++i)
+        {
+            int fd = events[i].data.fd;
+            if (fd == state.listen_fd)
+            {
+                state.accept_connections();
+                continue;
+            }
+            if (fd == state.event_fd)
+            {
+                uint64_t value;
+                ssize_t received = ::read(state.event_fd, &value, sizeof(value));
+                (void)received;
+                std::vector<std::shared_ptr<Connection>> done;
+                {
+                    std::lock_guard<std::mutex> lock(state.done_mutex);
+                    done.swap(state.done);
+                }
+                for (const auto &connection : done)
+                {
+                    if (!connection->closed && !state.flush(*connection))
+                    {
+                        state.close(*connection);
+                    }
+                }
+                continue;
+            }
+
+            auto found = state.connections.find(fd);
+            if (found == state.connections.end())
+            {
+                continue;
+            }
+            std::shared_ptr<Connection> connection = found->second;
+            bool alive = true;
+            if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+            {
+                alive = state.receive(*connection, connection);
+            }
+            if (alive && (events[i].events & EPOLLOUT))
+            {
+                alive = state.flush(*connection);
+            }
+            if (!alive)
+            {
+                state.close(*connection);
+            }
+        }
+    }
+
+    state.queue_ready.notify_all();
+    for (std::thread &worker : state.workers)
+    {
+        worker.join();
+    }
+    state.workers.clear();
+}
+
+void EvalServer::stop()
+{
+    state_->stopping = true;
+    state_->queue_ready.notify_all();
+    state_->wake();
+}
+
+ServerStats EvalServer::stats() const
+{
+    ServerStats stats;
+    stats.connections = state_->accepted.load();
+    stats.requests = state_->requests.load();
+    stats.errors = state_->errors.load();
+    stats.cache = state_->cache.stats();
+    return stats;
+}
+
+void EvalServer::State::accept_connections()
+{
+    for (;;)
+    {
+        int fd = ::accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+        {
+            // EAGAIN - очередь пуста; прочие ошибки относятся к отдельному соединению.
+            return;
+        }
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        if (::epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0)
+        {
+            ::close(fd);
+            continue;
+        }
+        connections[fd] = std::make_shared<Connection>(fd);
+        ++accepted;
+    }
+}
+
+bool EvalServer::State::receive(Connection &connection, const std::shared_ptr<Connection> &shared)
+{
+    bool open = true;
+    char chunk[READ_CHUNK];
+    for (;;)
+    {
+        ssize_t received = ::recv(connection.fd, chunk, sizeof(chunk), 0);
+        if (received > 0)
+        {
+            connection.input.append(chunk, static_cast<size_t>(received));
+            // Остаток дочитывается при следующем событии: буфер не больше кадра с запасом.
+            if (connection.input.size() > SERVER_MAX_FRAME + READ_CHUNK)
+            {
+                break;
+            }
+            continue;
+        }
+        if (received < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        open = received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+        break;
+    }
+    if (!open)
+    {
+        return false;
+    }
+
+    std::vector<std::string> frames;
+    size_t position = 0;
+    while (connection.input.size() - position >= sizeof(uint32_t))
+    {
+        uint32_t size = get<uint32_t>(connection.input.data() + position);
+        if (size < SERVER_HEADER_SIZE || size > SERVER_MAX_FRAME)
+        {
+            return false;
+        }
+        if (connection.input.size() - position - sizeof(uint32_t) < size)
+        {
+            break;
+        }
+        frames.emplace_back(connection.input, position + sizeof(uint32_t), size);
+        position += sizeof(uint32_t) + size;
+    }
+    connection.input.erase(0, position);
+    if (frames.empty())
+    {
+        return true;
+    }
+
+    bool idle;
+    {
+        std::lock_guard<std::mutex> lock(connection.mutex);
+        for (std::string &frame : frames)
+        {
+            connection.frames.push_back(std::move(frame));
+        }
+        idle = !connection.scheduled;
+        connection.scheduled = true;
+    }
+    if (idle)
+    {
+        schedule(shared);
+    }
+    return true;
+}
+
+bool EvalServer::State::flush(Connection &connection)
+{
+    {
+        std::lock_guard<std::mutex> lock(connection.mutex);
+        if (connection.sending.empty())
+        {
+            connection.sending.swap(connection.output);
+        }
+        else
+        {
+            connection.sending += connection.output;
+            connection.output.clear();
+        }
+    }
+    size_t position = 0;
+    while (position < connection.sending.size())
+    {
+        ssize_t written = ::send(connection.fd, connection.sending.data() + position,
+                                 connection.sending.size() - position, MSG_NOSIGNAL);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                break;
+            }
+            return false;
+        }
+        position += static_cast<size_t>(written);
+    }
+    connection.sending.erase(0, position);
+
+    // Ожидание готовности к записи, пока остаются неотправленные байты; при большом
+    // долге ответов запросы не читаются (ответы следующих добавятся при выполнении).
+    uint32_t events = 0;
+    if (connection.sending.size() <= MAX_PENDING_OUTPUT)
+    {
+        events |= EPOLLIN;
+    }
+    if (!connection.sending.empty())
+    {
+        events |= EPOLLOUT;
+    }
+    if (events != connection.events)
+    {
+        epoll_event event{};
+        event.events = events;
+        event.data.fd = connection.fd;
+        ::epoll_ctl(epoll_fd, EPOLL_CTL_MOD, connection.fd, &event);
+        connection.events = events;
+    }
+    return true;
+}
+
+void EvalServer::State::close(Connection &connection)
+{
+    // Поток пула может ещё выполнять запросы соединения: объект живёт, пока на него есть
+    // ссылки, а ответы закрытому соединению отбрасываются.
+    ::epoll_ctl(epoll_fd, EPOLL_CTL_DEL, connection.fd, nullptr);
+    ::close(connection.fd);
+    connection.closed = true;
+    connections.erase(connection.fd);
+}
+
+void EvalServer::State::work()
+{
+    std::vector<std::string> frames;
+    std::string out;
+    for (;;)
+    {
+        std::shared_ptr<Connection> connection;
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            queue_ready.wait(lock, [this] { return stopping.load() || !queue.empty(); });
+            if (stopping.load())
+            {
+                return;
+            }
+            connection = std::move(queue.front());
+            queue.pop_front();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(connection->mutex);
+            frames.swap(connection->frames);
+        }
+        for (const std::string &frame : frames)
+        {
+            execute(*connection, frame, out);
+        }
+        frames.clear();
+
+        // Запросы, пришедшие за время выполнения, ставятся в конец очереди, чтобы одно
+        // соединение не занимало поток.
+        bool more;
+        {
+            std::lock_guard<std::mutex> lock(connection->mutex);
+            connection->output += out;
+            more = !connection->frames.empty();
+            connection->scheduled = more;
+        }
+        out.clear();
+        if (more)
+        {
+            schedule(connection);
+        }
+        {
+            std::lock_guard<std::mutex> lock(done_mutex);
+            done.push_back(std::move(connection));
+        }
+        wake();
+    }
+}
+
+const ServerEntry &EvalServer::State::find(const Connection &connection, uint64_t handle) const
+{
+    auto found = connection.handles.find(handle);
+    if (found == connection.handles.end())
+    {
+        throw std::invalid_argument("Unknown handle " + std::to_string(handle));
+    }
+    return *found->second;
+}
+
+std::string EvalServer::State::handle_reply(Connection &connection, std::shared_ptr<const ServerEntry> entry)
+{
+    uint64_t handle = connection.next_handle++;
+    std::string reply;
+    put<uint64_t>(reply, handle);
+    put<uint32_t>(reply, static_cast<uint32_t>(entry->variables().size()));
+    for (const std::string &name : entry->variables())
+    {
+        put<uint32_t>(reply, static_cast<uint32_t>(name.size()));
+        reply += name;
+    }
+    connection.handles.emplace(handle, std::move(entry));
+    return reply;
+}
+
+void EvalServer::State::execute(Connection &connection, const std::string &frame, std::string &out)
+{
+    // Буферы значений потока: запросы вычисления не выделяют память после первых.
+    thread_local std::vector<long double> values;
+    thread_local std::vector<long double> results;
+    thread_local std::vector<const long double *> columns;
+    thread_local std::vector<size_t> strides;
+
+    FrameReader request(frame.data(), frame.size());
+    uint8_t op = request.next<uint8_t>();
+    uint32_t id = request.next<uint32_t>();
+    ++requests;
+
+    std::string reply;
+    uint8_t status = SERVER_OK;
+    try
+    {
+        switch (op)
+        {
+        case SERVER_PARSE:
+            reply = handle_reply(connection, cache.get(request.rest()));
+            break;
+        case SERVER_DIFF:
+        {
+            const ServerEntry &entry = find(connection, request.next<uint64_t>());
+            Expression<long double> derivative = entry.expression().diff(request.rest());
+            reply = handle_reply(connection, std::make_shared<const ServerEntry>(derivative, 0));
+            break;
+        }
+        case SERVER_EVAL:
+        {
+            const ServerEntry &entry = find(connection, request.next<uint64_t>());
+            size_t count = entry.variables().size();
+            if (request.remaining() != count * sizeof(double))
+            {
+                throw std::invalid_argument("Expected " + std::to_string(count) + " values");
+            }
+            values.resize(count);
+            for (size_t i = 0; i < count; ++i)
+            {
+                values[i] = request.next<double>();
+            }
+            put<double>(reply, static_cast<double>(entry.compiled()->eval(values.data())));
+            break;
+        }
+        case SERVER_BATCH:
+        {
+            const ServerEntry &entry = find(connection, request.next<uint64_t>());
+            size_t points = request.next<uint32_t>();
+            size_t count = entry.variables().size();
+            // Ответ должен поместиться в кадр; без переменных данные запроса не ограничивают points.
+            if (points > (SERVER_MAX_FRAME - SERVER_HEADER_SIZE) / sizeof(double))
+            {
+                throw std::invalid_argument("Too many points: " + std::to_string(points));
+            }
+            if (request.remaining() != points * count * sizeof(double))
+            {
+                throw std::invalid_argument("Expected " + std::to_string(points) + " points of " +
+                                            std::to_string(count) + " values");
+            }
+            // Значения остаются по точкам подряд: столбец переменной - шаг count.
+            values.resize(points * count);
+            for (size_t i = 0; i < values.size(); ++i)
+            {
+                values[i] = get<double>(request.current() + i * sizeof(double));
+            }
+            columns.resize(count);
+            strides.assign(count, count);
+            for (size_t v = 0; v < count; ++v)
+            {
+                columns[v] = values.data() + v;
+            }
+            results.resize(points);
+            long double *output = results.data();
+            entry.compiled()->eval_batch(points, columns.data(), &output, strides.data());
+            reply.reserve(points * sizeof(double));
+            for (long double result : results)
+            {
+                put<double>(reply, static_cast<double>(result));
+            }
+            break;
+        }
+        case SERVER_PRINT:
+            reply = find(connection, request.next<uint64_t>()).expression().to_string();
+            break;
+        case SERVER_RELEASE:
+        {
+            uint64_t handle = request.next<uint64_t>();
+            find(connection, handle);
+            connection.handles.erase(handle);
+            break;
+        }
+        default:
+            throw std::invalid_argument("Unknown operation " + std::to_string(op));
+        }
+    }
+    catch (const std::exception &error)
+    {
+        status = SERVER_ERROR;
+        reply = error.what();
+        ++errors;
+    }
+    put_frame(out, status, id, reply);
+}
+
+// ============
+// |EvalClient|
+// ============
+
+EvalClient::EvalClient(const std::string &path)
+{
+    sockaddr_un address = socket_address(path);
+    fd_ = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd_ < 0)
+    {
+        throw system_error("Cannot create socket");
+    }
+    if (::connect(fd_, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0)
+    {
+        int error = errno;
+        ::close(fd_);
+        errno = error;
+        throw system_error("Cannot connect to " + path);
+    }
+}
+
+EvalClient::~EvalClient()
+{
+    ::close(fd_);
+}
+
+uint32_t EvalClient::send(ServerOp op, const std::string &payload)
+{
+    uint32_t id = next_id_++;
+    std::string frame;
+    frame.reserve(sizeof(uint32_t) + SERVER_HEADER_SIZE + payload.size());
+    put_frame(frame, op, id, payload);
+    write_all(fd_, frame.data(), frame.size());
+    return id;
+}
+
+ServerResponse EvalClient::receive()
+{
+    char chunk[READ_CHUNK];
+    for (;;)
+    {
+        if (buffer_.size() >= sizeof(uint32_t))
+        {
+            uint32_t size = get<uint32_t>(buffer_.data());
+            if (size < SERVER_HEADER_SIZE || size > SERVER_MAX_FRAME)
+            {
+                throw std::runtime_error("Malformed response frame");
+            }
+            if (buffer_.size() - sizeof(uint32_t) >= size)
+            {
+                FrameReader reader(buffer_.data() + sizeof(uint32_t), size);
+                ServerResponse response;
+                response.status = static_cast<ServerStatus>(reader.next<uint8_t>());
+                response.id = reader.next<uint32_t>();
+                response.payload = reader.rest();
+                buffer_.erase(0, sizeof(uint32_t) + size);
+                return response;
+            }
+        }
+        ssize_t received = ::recv(fd_, chunk, sizeof(chunk), 0);
+        if (received < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (received <= 0)
+        {
+            throw received == 0 ? std::runtime_error("Server closed the connection")
+                                : system_error("Cannot read from socket");
+        }
+        buffer_.append(chunk, static_cast<size_t>(received));
+    }
+}
+
+ServerResponse EvalClient::call(ServerOp op, const std::string &payload)
+{
+    send(op, payload);
+    ServerResponse response = receive();
+    if (response.status != SERVER_OK)
+    {
+        throw std::runtime_error(response.payload);
+    }
+    return response;
+}
+
+static ServerHandle read_handle(const std::string &payload)
+{
+    FrameReader reader(payload.data(), payload.size());
+    ServerHandle result;
+    result.handle = reader.next<uint64_t>();
+    uint32_t count = reader.next<uint32_t>();
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        result.variables.push_back(reader.text(reader.next<uint32_t>()));
+    }
+    return result;
+}
+
+ServerHandle EvalClient::parse(const std::string &source)
+{
+    return read_handle(call(SERVER_PARSE, source).payload);
+}
+
+ServerHandle EvalClient::diff(uint64_t handle, const std::string &by)
+{
+    return read_handle(call(SERVER_DIFF, handle_payload(handle) + by).payload);
+}
+
+double EvalClient::eval(uint64_t handle, const std::vector<double> &values)
+{
+    ServerResponse response = call(SERVER_EVAL, eval_payload(handle, values));
+    if (response.payload.size() != sizeof(double))
+    {
+        throw std::runtime_error("Malformed eval response");
+    }
+    return get<double>(response.payload.data());
+}
+
+std::vector<double> EvalClient::eval_batch(uint64_t handle, size_t count, const std::vector<double> &values)
+{
+    ServerResponse response = call(SERVER_BATCH, batch_payload(handle, count, values));
+    if (response.payload.size() != count * sizeof(double))
+    {
+        throw std::runtime_error("Malformed batch response");
+    }
+    std::vector<double> results(count);
+    std::memcpy(results.data(), response.payload.data(), response.payload.size());
+    return results;
+}
+
+std::string EvalClient::print(uint64_t handle)
+{
+    return call(SERVER_PRINT, handle_payload(handle)).payload;
+}
+
+void EvalClient::release(uint64_t handle)
+{
+    call(SERVER_RELEASE, handle_payload(handle));
+}
+
+std::string EvalClient::handle_payload(uint64_t handle)
+{
+    std::string payload;
+    put<uint64_t>(payload, handle);
+    return payload;
+}
+
+std::string EvalClient::eval_payload(uint64_t handle, const std::vector<double> &values)
+{
+    std::string payload = handle_payload(handle);
+    payload.append(reinterpret_cast<const char *>(values.data()), values.size() * sizeof(double));
+    return payload;
+}
+
+std::string EvalClient::batch_payload(uint64_t handle, size_t count, const std::vector<double> &values)
+{
+    // Число значений в точке известно серверу по описателю; он же проверяет размер.
+    std::string payload = handle_payload(handle);
+    put<uint32_t>(payload, static_cast<uint32_t>(count));
+    payload.append(reinterpret_cast<const char *>(values.data()), values.size() * sizeof(double));
+    return payload;
+}
+
+// ==========
+// |run_load|
+// ==========
+
+LoadReport run_load(const LoadOptions &options)
+{
+    size_t pipeline = std::max<size_t>(1, options.pipeline);
+    size_t batch = std::max<size_t>(1, options.batch);
+    std::vector<std::vector<double>> latencies(options.connections);
+    std::vector<std::exception_ptr> errors(options.connections);
+
+    auto run_connection = [&](size_t index)
+    {
+        using Clock = std::chrono::steady_clock;
+        EvalClient client(options.path);
+        ServerHandle parsed = client.parse(options.expression);
+        std::vector<double> point;
+        for (const std::string &name : parsed.variables)
+        {
+            auto found = options.params.find(name);
+            point.push_back(found == options.params.end() ? 1.0 : static_cast<double>(found->second));
+        }
+        ServerOp op = batch > 1 ? SERVER_BATCH : SERVER_EVAL;
+        std::string payload;
+        if (batch > 1)
+        {
+            std::vector<double> values;
+            for (size_t i = 0; i < batch; ++i)
+            {
+                values.insert(values.end(), point.begin(), point.end());
+            }
+            payload = EvalClient::batch_payload(parsed.handle, batch, values);
+        }
+        else
+        {
+            payload = EvalClient::eval_payload(parsed.handle, point);
+        }
+
+        std::vector<Clock::time_point> sent(pipeline);
+        std::vector<double> &latency = latencies[index];
+        latency.reserve(options.requests);
+        size_t issued = 0;
+        while (latency.size() < options.requests)
+        {
+            while (issued < options.requests && issued - latency.size() < pipeline)
+            {
+                sent[issued % pipeline] = Clock::now();
+                client.send(op, payload);
+                ++issued;
+            }
+            ServerResponse response = client.receive();
+            latency.push_back(
+                std::chrono::duration<double, std::micro>(Clock::now() - sent[latency.size() % pipeline]).count());
+            if (response.status != SERVER_OK)
+            {
+                throw std::runtime_error(response.payload);
+            }
+        }
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < options.connections; ++i)
+    {
+        threads.emplace_back([&, i]
+                             {
+                                 try
+                                 {
+                                     run_connection(i);
+                                 }
+                                 catch (...)
+                                 {
+                                     errors[i] = std::current_exception();
+                                 }
+                             });
+    }
+    for (std::thread &thread : threads)
+    {
+        thread.join();
+    }
+    for (const std::exception_ptr &error : errors)
+    {
+        if (error)
+        {
+            std::rethrow_exception(error);
+        }
+    }
+
+    LoadReport report;
+    report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::vector<double> all;
+    for (const std::vector<double> &latency : latencies)
+    {
+        all.insert(all.end(), latency.begin(), latency.end());
+    }
+    report.requests = all.size();
+    report.points = all.size() * batch;
+    if (!all.empty())
+    {
+        std::sort(all.begin(), all.end());
+        double sum = 0;
+        for (double value : all)
+        {
+            sum += value;
+        }
+        report.latency_mean = sum / static_cast<double>(all.size());
+        report.latency_p50 = all[all.size() / 2];
+        report.latency_p99 = all[std::min(all.size() - 1, all.size() * 99 / 100)];
+        report.latency_max = all.back();
+    }
+    if (report.seconds > 0)
+    {
+        report.requests_per_second = static_cast<double>(report.requests) / report.seconds;
+        report.points_per_second = static_cast<double>(report.points) / report.seconds;
+    }
+    return report;
+}
@@ -0,0 +1,525 @@
+#include "../includes/taylor.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <stdexcept>
+
+// Правила распространения рядов. Ряд порядка k задаётся count = k + 1 коэффициентами
+// (a[n] - коэффициент при t^n); каждое правило - рекуррентная формула за O(k^2)
+// операций, out не должен совпадать с входными рядами.
+
+template <typename T>
+static void taylor_multiply(const T *a, const T *b, T *out, size_t count)
+{
+    for (size_t n = 0; n < count; ++n)
+    {
+        T sum = 0;
+        for (size_t j = 0; j <= n; ++j)
+        {
+            sum += a[j] * b[n - j];
+        }
+        out[n] = sum;
+    }
+}
+
+template <typename T>
+static void taylor_divide(const T *a, const T *b, T *out, size_t count)
+{
+    // a = out * b: out[n] = (a[n] - sum_{j<n} out[j] b[n-j]) / b[0].
+    for (size_t n = 0; n < count; ++n)
+    {
+        T sum = a[n];
+        for (size_t j = 0; j < n; ++j)
+        {
+            sum -= out[j] * b[n - j];
+        }
+        out[n] = sum / b[0];
+    }
+}
+
+template <typename T>
+static void taylor_exp(const T *a, T *out, size_t count)
+{
+    // out' = a' out.
+    out[0] = std::exp(a[0]);
+    for (size_t n = 1; n < count; ++n)
+    {
+        T sum = 0;
+        for (size_t j = 1; j <= n; ++j)
+        {
+            sum += T(j) * a[j] * out[n - j];
+        }
+        out[n] = sum / T(n);
+    }
+}
+
+template <typename T>
+static void taylor_ln(const T *a, T *out, size_t count)
+{
+    // a out' = a'.
+    out[0] = std::log(a[0]);
+    for (size_t n = 1; n < count; ++n)
+    {
+        T sum = 0;
+        for (size_t j = 1; j < n; ++j)
+        {
+            sum += T(j) * out[j] * a[n - j];
+        }
+        out[n] = (a[n] - sum / T(n)) / a[0];
+    }
+}
+
+template <typename T>
+static void taylor_sincos(const T *a, T *sin_out, T *cos_out, size_t count)
+{
+    // sin' = a' cos, cos' = -a' sin.
+    sin_out[0] = std::sin(a[0]);
+    cos_out[0] = std::cos(a[0]);
+    for (size_t n = 1; n < count; ++n)
+    {
+        T s = 0;
+        T c = 0;
+        for (size_t j = 1; j <= n; ++j)
+        {
+            T term = T(j) * a[j];
+            s += term * cos_out[n - j];
+            c += term * sin_out[n - j];
+        }
+        sin_out[n] = s / T(n);
+        cos_out[n] = -c / T(n);
+    }
+}
+
+template <typename T>
+static void taylor_sqrt(const T *a, T *out, size_t count)
+{
+    // out * out = a.
+    out[0] = std::sqrt(a[0]);
+    for (size_t n = 1; n < count; ++n)
+    {
+        T sum = a[n];
+        for (size_t j = 1; j < n; ++j)
+        {
+            sum -= out[j] * out[n - j];
+        }
+        out[n] = sum / (T(2) * out[0]);
+    }
+}
+
+template <typename T>
+static void taylor_power(const T *a, const T &p, T *out, size_t count)
+{
+    // a out' = p a' out.
+    out[0] = std::pow(a[0], p);
+    for (size_t n = 1; n < count; ++n)
+    {
+        T sum = 0;
+        for (size_t j = 1; j <= n; ++j)
+        {
+            sum += (p * T(j) - T(n - j)) * a[j] * out[n - j];
+        }
+        out[n] = sum / (T(n) * a[0]);
+    }
+}
+
+template <typename T>
+static void taylor_integer_power(const T *a, int n, T *out, size_t count, T *scratch)
+{
+    T *base = scratch;
+    T *product = scratch + count;
+    std::fill(out, out + count, T(0));
+    out[0] = 1;
+    if (n < 0)
+    {
+        // Основание 1 / a.
+        taylor_divide(out, a, base, count);
+    }
+    else
+    {
+        std::copy(a, a + count, base);
+    }
+    for (unsigned power = n < 0 ? -static_cast<unsigned>(n) : n; power != 0; power >>= 1)
+    {
+        if (power & 1)
+        {
+            taylor_multiply(out, base, product, count);
+            std::copy(product, product + count, out);
+        }
+        if (power > 1)
+        {
+            taylor_multiply(base, base, product, count);
+            std::copy(product, product + count, base);
+        }
+    }
+}
+
+// ========
+// |Taylor|
+// ========
+
+template <typename T>
+Taylor<T>::Taylor(size_t order, const T &value) : c(order + 1, T(0))
+{
+    c[0] = value;
+}
+
+template <typename T>
+Taylor<T> Taylor<T>::variable(const T &value, size_t order)
+{
+    Taylor<T> result(order, value);
+    if (order > 0)
+    {
+        result.c[1] = 1;
+    }
+    return result;
+}
+
+template <typename T>
+size_t Taylor<T>::order() const
+{
+    return c.size() - 1;
+}
+
+template <typename T>
+const T &Taylor<T>::operator[](size_t n) const
+{
+    return c[n];
+}
+
+template <typename T>
+T &Taylor<T>::operator[](size_t n)
+{
+    return c[n];
+}
+
+template <typename T>
+const std::vector<T> &Taylor<T>::coefficients() const
+{
+    return c;
+}
+
+template <typename T>
+T Taylor<T>::derivative(size_t n) const
+{
+    T factorial = 1;
+    for (size_t i = 2; i <= n; ++i)
+    {
+        factorial *= T(i);
+    }
+    return c[n] * factorial;
+}
+
+template <typename T>
+std::vector<T> Taylor<T>::derivatives() const
+{
+    std::vector<T> result(c.size());
+    T factorial = 1;
+    for (size_t n = 0; n < c.size(); ++n)
+    {
+        if (n > 1)
+        {
+            factorial *= T(n);
+        }
+        result[n] = c[n] * factorial;
+    }
+    return result;
+}
+
+// Ряды разных порядков усекаются до меньшего.
+template <typename T>
+static size_t common_order(const Taylor<T> &a, const Taylor<T> &b)
+{
+    return std::min(a.order(), b.order());
+}
+
+template <typename T>
+Taylor<T> Taylor<T>::operator-() const
+{
+    Taylor<T> result(order());
+    for (size_t n = 0; n < c.size(); ++n)
+    {
+        result.c[n] = -c[n];
+    }
+    return result;
+}
+
+template <typename T>
+Taylor<T> Taylor<T>::operator+(const Taylor<T> &other) const
+{
+    Taylor<T> result(common_order(*this, other));
+    for (size_t n = 0; n < result.c.size(); ++n)
+    {
+        result.c[n] = c[n] + other.c[n];
+    }
+    return result;
+}
+
+template <typename T>
+Taylor<T> Taylor<T>::operator-(const Taylor<T> &other) const
+{
+    Taylor<T> result(common_order(*this, other));
+    for (size_t n = 0; n < result.c.size(); ++n)
+    {
+        result.c[n] = c[n] - other.c[n];
+    }
+    return result;
+}
+
+template <typename T>
+Taylor<T> Taylor<T>::operator*(const Taylor<T> &other) const
+{
+    Taylor<T> result(common_order(*this, other));
+    taylor_multiply(c.data(), other.c.data(), result.c.data(), result.c.size());
+    return result;
+}
+
+template <typename T>
+Taylor<T> Taylor<T>::operator/(const Taylor<T> &other) const
+{
+    Taylor<T> result(common_order(*this, other));
+    taylor_divide(c.data(), other.c.data(), result.c.data(), result.c.size());
+    return result;
+}
+
+template <typename T>
+Taylor<T> sin(const Taylor<T> &a)
+{
+    Taylor<T> s(a.order());
+    Taylor<T> c(a.order());
+    taylor_sincos(&a[0], &s[0], &c[0], a.order() + 1);
+    return s;
+}
+
+template <typename T>
+Taylor<T> cos(const Taylor<T> &a)
+{
+    Taylor<T> s(a.order());
+    Taylor<T> c(a.order());
+    taylor_sincos(&a[0], &s[0], &c[0], a.order() + 1);
+    return c;
+}
+
+template <typename T>
+Taylor<T> ln(const Taylor<T> &a)
+{
+    Taylor<T> result(a.order());
+    taylor_ln(&a[0], &result[0], a.order() + 1);
+    return result;
+}
+
+template <typename T>
+Taylor<T> exp(const Taylor<T> &a)
+{
+    Taylor<T> result(a.order());
+    taylor_exp(&a[0], &result[0], a.order() + 1);
+    return result;
+}
+
+template <typename T>
+Taylor<T> sqrt(const Taylor<T> &a)
+{
+    Taylor<T> result(a.order());
+    taylor_sqrt(&a[0], &result[0], a.order() + 1);
+    return result;
+}
+
+template <typename T>
+Taylor<T> pow(const Taylor<T> &a, int n)
+{
+    Taylor<T> result(a.order());
+    std::vector<T> scratch(2 * (a.order() + 1));
+    taylor_integer_power(&a[0], n, &result[0], a.order() + 1, scratch.data());
+    return result;
+}
+
+template <typename T>
+Taylor<T> pow(const Taylor<T> &a, const T &p)
+{
+    Taylor<T> result(a.order());
+    taylor_power(&a[0], p, &result[0], a.order() + 1);
+    return result;
+}
+
+template <typename T>
+Taylor<T> pow(const Taylor<T> &a, const Taylor<T> &b)
+{
+    // a ^ b = exp(b ln a).
+    return exp(b * ln(a));
+}
+
+// =================
+// |TaylorEvaluator|
+// =================
+
+// Рабочий буфер рядов, свой у каждого потока.
+template <typename T>
+static T *series_registers(size_t size)
+{
+    thread_local std::vector<T> buffer;
+    if (buffer.size() < size)
+    {
+        buffer.resize(size);
+    }
+    return buffer.data();
+}
+
+template <typename T>
+TaylorEvaluator<T>::TaylorEvaluator(const Expression<T> &expr, const std::vector<std::string> &variables,
+                                    size_t order)
+    : compiled_(expr, variables), order_(order)
+{
+}
+
+template <typename T>
+void TaylorEvaluator<T>::coefficients(const T *point, const T *direction, T *out) const
+{
+    const std::vector<Instruction> &program = compiled_.program();
+    const size_t count = order_ + 1;
+    // Ряд ячейки slot - regs[slot * count ..]; после ячеек - рабочая память на 3 ряда.
+    T *regs = series_registers<T>((program.size() + 3) * count);
+    T *scratch = regs + program.size() * count;
+    for (size_t slot = 0; slot < program.size(); ++slot)
+    {
+        const Instruction &ins = program[slot];
+        T *r = regs + slot * count;
+        const T *a = regs + ins.lhs * count;
+        const T *b = regs + ins.rhs * count;
+        switch (ins.op)
+        {
+        case OP_CONST:
+        case OP_VAR:
+            std::fill(r, r + count, T(0));
+            r[0] = ins.op == OP_CONST ? compiled_.constants()[ins.lhs] : point[ins.lhs];
+            if (ins.op == OP_VAR && count > 1)
+            {
+                r[1] = direction[ins.lhs];
+            }
+            break;
+        case OP_NEG:
+            for (size_t n = 0; n < count; ++n)
+                r[n] = -a[n];
+            break;
+        case OP_ADD:
+            for (size_t n = 0; n < count; ++n)
+                r[n] = a[n] + b[n];
+            break;
+        case OP_SUB:
+            for (size_t n = 0; n < count; ++n)
+                r[n] = a[n] - b[n];
+            break;
+        case OP_MUL:
+            taylor_multiply(a, b, r, count);
+            break;
+        case OP_DIV:
+            taylor_divide(a, b, r, count);
+            break;
+        case OP_FMA:
+            taylor_multiply(a, b, r, count);
+            for (size_t n = 0; n < count; ++n)
+                r[n] += regs[ins.addend * count + n];
+            break;
+        case OP_SIN:
+            taylor_sincos(a, r, scratch, count);
+            break;
+        case OP_COS:
+            taylor_sincos(a, scratch, r, count);
+            break;
+        case OP_SINCOS:
+            // Ряд косинуса записывается в следующую ячейку (OP_SINCOS_COS).
+            taylor_sincos(a, r, r + count, count);
+            break;
+        case OP_SINCOS_COS:
+            break;
+        case OP_LN:
+            taylor_ln(a, r, count);
+            break;
+        case OP_EXP:
+            taylor_exp(a, r, count);
+            break;
+        case OP_SQRT:
+            taylor_sqrt(a, r, count);
+            break;
+        case OP_RSQRT:
+            taylor_power(a, T(-0.5L), r, count);
+            break;
+        case OP_POWI:
+            taylor_integer_power(a, static_cast<int>(ins.rhs), r, count, scratch);
+            break;
+        case OP_POW:
+            if (program[ins.rhs].op == OP_CONST)
+            {
+                taylor_power(a, b[0], r, count);
+            }
+            else
+            {
+                // a ^ b = exp(b ln a).
+                taylor_ln(a, scratch, count);
+                taylor_multiply(b, scratch, scratch + count, count);
+                taylor_exp(scratch + count, r, count);
+            }
+            break;
+        }
+    }
+    std::copy(regs + compiled_.output_slots()[0] * count, regs + (compiled_.output_slots()[0] + 1) * count, out);
+}
+
+template <typename T>
+void TaylorEvaluator<T>::derivatives(const T *point, size_t variable, T *out) const
+{
+    if (variable >= compiled_.variables().size())
+    {
+        throw std::invalid_argument("Variable index out of range");
+    }
+    std::vector<T> direction(compiled_.variables().size(), T(0));
+    direction[variable] = 1;
+    coefficients(point, direction.data(), out);
+    T factorial = 1;
+    for (size_t n = 2; n <= order_; ++n)
+    {
+        factorial *= T(n);
+        out[n] *= factorial;
+    }
+}
+
+template <typename T>
+std::vector<T> TaylorEvaluator<T>::derivatives(const T *point, size_t variable) const
+{
+    std::vector<T> result(order_ + 1);
+    derivatives(point, variable, result.data());
+    return result;
+}
+
+template <typename T>
+size_t TaylorEvaluator<T>::order() const
+{
+    return order_;
+}
+
+template <typename T>
+const std::vector<std::string> &TaylorEvaluator<T>::variables() const
+{
+    return compiled_.variables();
+}
+
+template class Taylor<long double>;
+template Taylor<long double> sin(const Taylor<long double> &);
+template Taylor<long double> cos(const Taylor<long double> &);
+template Taylor<long double> ln(const Taylor<long double> &);
+template Taylor<long double> exp(const Taylor<long double> &);
+template Taylor<long double> sqrt(const Taylor<long double> &);
+template Taylor<long double> pow(const Taylor<long double> &, int);
+template Taylor<long double> pow(const Taylor<long double> &, const long double &);
+template Taylor<long double> pow(const Taylor<long double> &, const Taylor<long double> &);
+template class TaylorEvaluator<long double>;
+
+template class Taylor<std::complex<long double>>;
+template Taylor<std::complex<long double>> sin(const Taylor<std::complex<long double>> &);
+template Taylor<std::complex<long double>> cos(const Taylor<std::complex<long double>> &);
+template Taylor<std::complex<long double>> ln(const Taylor<std::complex<long double>> &);
+template Taylor<std::complex<long double>> exp(const Taylor<std::complex<long double>> &);
+template Taylor<std::complex<long double>> sqrt(const Taylor<std::complex<long double>> &);
+template Taylor<std::complex<long double>> pow(const Taylor<std::complex<long double>> &, int);
+template Taylor<std::complex<long double>> pow(const Taylor<std::complex<long double>> &, const std::complex<long double> &);
+template Taylor<std::complex<long double>> pow(const Taylor<std::complex<long double>> &, const Taylor<std::complex<long double>> &);
+template class TaylorEvaluator<std::complex<long double>>;
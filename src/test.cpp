@@ -3,8 +3,36 @@
 #include "../includes/lexer.hpp"
 #include "../includes/parser.hpp"
 #include "../includes/TestSystem.hpp"
+#include "../includes/compiler.hpp"
+#include "../includes/integrator.hpp"
+#include "../includes/mixed.hpp"
+#include "../includes/optimizer.hpp"
+#include "../includes/ode.hpp"
+#include "../includes/bulk.hpp"
+#include "../includes/codegen.hpp"
+#include "../includes/rewriter.hpp"
+#include "../includes/cache.hpp"
+#include "../includes/taylor.hpp"
+#include "../includes/trace.hpp"
+#include "../includes/alloc.hpp"
+#include "../includes/vecmath.hpp"
+#include "../includes/server.hpp"
+#include "../includes/incremental.hpp"
+#include "../includes/analysis.hpp"
+#include "../includes/memo.hpp"
+#include <cfloat>
+#include <cmath>
 #include <iostream>
 #include <iomanip>
+#include <new>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <regex>
+#include <set>
+#include <sstream>
+#include <thread>
+#include <unistd.h>
 
 using namespace TestSystem;
 
@@ -21,6 +49,43 @@ bool test_constructor()
     return (expr1.eval(context) == 0 && expr2.eval(context) == 0 && expr.eval(context) == 1);
 }
 
+bool test_inline_leaves()
+{
+    // Листья хранятся в самом объекте, имена переменных - номерами из общей таблицы.
+    Expression<long double> x("x");
+    Expression<long double> y("y");
+    Expression<long double> c(2.5L);
+    uint32_t symbol = 0;
+    bool symbols = SymbolTable::find("x", symbol) && symbol == x.symbol() &&
+                   Expression<long double>("x").symbol() == symbol && y.symbol() != symbol &&
+                   SymbolTable::name(symbol) == "x" && SymbolTable::intern("x") == symbol;
+    bool leaves = x.node() == nullptr && c.node() == nullptr && x.kind() == NODE_VARIABLE &&
+                  c.kind() == NODE_VALUE && c.constant() == 2.5L && x.variable() == "x" &&
+                  x.variable_mask() == ExpressionBase<long double>::variable_bit(symbol) &&
+                  sizeof(Expression<long double>) <= 3 * sizeof(void *);
+
+    // Копирование и присваивание между листьями и внутренними узлами.
+    Expression<long double> expr = x * c + y;
+    Expression<long double> copy = expr;
+    copy = x;
+    Expression<long double> moved = std::move(expr);
+    expr = c;
+    std::map<std::string, long double> context = {{"x", 2}, {"y", 3}};
+    bool values = moved.eval(context) == 8 && copy.eval(context) == 2 && expr.eval(context) == 2.5L &&
+                  moved.operand(0).operand(1).constant() == 2.5L && moved.node() != nullptr;
+
+    // Производные и компиляция выражений, состоящих из одного листа.
+    auto gradient = x.diff_all({"x", "y", "x"});
+    CompiledExpression<long double> compiled(c + x, {"x"});
+    long double point = 4;
+    bool derivatives = x.diff("x").eval(context) == 1 && x.diff("y").eval(context) == 0 &&
+                       x.diff("unknown").eval(context) == 0 && c.diff("x").eval(context) == 0 &&
+                       gradient[0].eval(context) == 1 && gradient[1].eval(context) == 0 &&
+                       gradient[2].eval(context) == 1 && compiled.eval(&point) == 6.5L &&
+                       moved.diff("x").eval(context) == 2.5L;
+    return symbols && leaves && values && derivatives;
+}
+
 bool test_operations()
 {
     Expression<long double> expr1(5);
@@ -69,6 +134,15 @@ bool test_parser()
     return (std::abs(expr.eval(context) - (5 * std::sin(4) * 4 + 3 * log(2))) < 1e-14);
 }
 
+bool test_parser_sub_div()
+{
+    Lexer lexer{"8 / 2 / 2 - x - 1"};
+    Parser<long double> parser{lexer};
+    Expression expr = parser.parseExpression();
+
+    return expr.eval({{"x", 1}}) == 0;
+}
+
 bool test_diff()
 {
     Lexer lexer{"(x + y) * sin(x + 2) * 2 ^ x + 3 * ln(x)"};
@@ -86,7 +160,188 @@ bool test_diff()
     Expression expr_diff = expr.diff("x");
     // sin(x + 2) * 2 ^ x + (x + y) * (cos(x + 2) * 2 ^ x + sin(x + 2) * 2 ^ x * ln(2)) + 3 / x)
 
-    return (std::abs(expr_diff.eval(context) - (std::sin(4) * 4 + 5 * (std::cos(4) * 4 + std::sin(4) * 4 * std::log(2)) + 3.0 / 2)) < 1e-14);
+    // Производная экспоненты: exp(x * y)' = exp(x * y) * y.
+    Lexer exp_lexer{"exp(x * y)"};
+    Parser<long double> exp_parser{exp_lexer};
+    Expression exp_diff = exp_parser.parseExpression().diff("x");
+
+    return (std::abs(expr_diff.eval(context) - (std::sin(4) * 4 + 5 * (std::cos(4) * 4 + std::sin(4) * 4 * std::log(2)) + 3.0 / 2)) < 1e-14) &&
+           std::abs(exp_diff.eval(context) / (std::exp(6.0L) * 3) - 1) < 1e-15;
+}
+
+bool test_constant_power()
+{
+    Lexer lexer{"x ^ 3 + x ^ 0.5 + 1 / x ^ 2"};
+    Parser<long double> parser{lexer};
+    Expression expr = parser.parseExpression();
+    Expression expr_diff = expr.diff("x");
+
+    // Производная степени с константным показателем не содержит ln(x) и определена при x < 0.
+    Lexer cube_lexer{"x ^ 3"};
+    Parser<long double> cube_parser{cube_lexer};
+    Expression cube_diff = cube_parser.parseExpression().diff("x");
+    // Производная переменной (единица) не добавляется множителем.
+    Lexer scaled_lexer{"y * x ^ 3"};
+    Parser<long double> scaled_parser{scaled_lexer};
+    Expression scaled_diff = scaled_parser.parseExpression().diff("x");
+
+    CompiledExpression<long double> compiled(expr, {"x"});
+    long double x = 4;
+    return expr.eval({{"x", 4}}) == 64 + 2 + 1.0L / 16 &&
+           compiled.eval(&x) == 64 + 2 + 1.0L / 16 &&
+           std::abs(expr_diff.eval({{"x", 4}}) - (48 + 0.25L - 2.0L / 64)) < 1e-15 &&
+           cube_diff.eval({{"x", -2}}) == 12 && scaled_diff.to_string() == "(y * (3 * (x ^ 2)))";
+}
+
+bool test_deep_expressions()
+{
+    const size_t depth = 100000;
+
+    // Длинная сумма: левая цепочка глубины depth.
+    std::string sum = "x";
+    for (size_t i = 1; i < depth; ++i)
+    {
+        sum += " + x";
+    }
+    Lexer sum_lexer{sum};
+    Parser<long double> sum_parser{sum_lexer};
+    Expression sum_expr = sum_parser.parseExpression();
+    Expression sum_diff = sum_expr.diff("x");
+
+    // Правая цепочка степеней и вложенные скобки.
+    std::string tower = "x";
+    std::string brackets = "x";
+    for (size_t i = 1; i < depth; ++i)
+    {
+        tower += " ^ x";
+    }
+    brackets = std::string(depth, '(') + brackets + std::string(depth, ')');
+    Lexer tower_lexer{tower};
+    Parser<long double> tower_parser{tower_lexer};
+    Expression tower_expr = tower_parser.parseExpression();
+    Lexer brackets_lexer{brackets};
+    Parser<long double> brackets_parser{brackets_lexer};
+    Expression brackets_expr = brackets_parser.parseExpression();
+
+    std::map<std::string, long double> context = {{"x", 1}};
+    return sum_expr.eval(context) == depth &&
+           sum_diff.eval(context) == depth &&
+           sum_expr.to_string().size() > 3 * depth &&
+           tower_expr.eval(context) == 1 &&
+           tower_expr.to_string().size() > 4 * depth &&
+           brackets_expr.eval({{"x", 5}}) == 5;
+}
+
+bool test_nary()
+{
+    Expression<long double> x("x"), y("y");
+    Expression<long double> chain = ((x * y) * x.ExprSin() * Expression<long double>(3) + y) - x - x;
+    Expression<long double> flat = chain.flatten();
+
+    // Производная n-арного произведения по правилу для всех множителей сразу.
+    std::map<std::string, long double> context = {{"x", 1}, {"y", 2}};
+    long double expected_diff = 2 * 3 * (std::sin(1.0L) + std::cos(1.0L)) - 2;
+    bool structure = flat.kind() == NODE_SUM && flat.arity() == 4 && flat.operand(0).kind() == NODE_PRODUCT &&
+                     flat.operand(0).arity() == 4;
+    bool values = std::abs(flat.eval(context) - chain.eval(context)) < 1e-15 &&
+                  std::abs(flat.diff("x").eval(context) - expected_diff) < 1e-15;
+
+    // Суммирование по Кэхэну не теряет малые слагаемые.
+    std::vector<Expression<long double>> terms{Expression<long double>(1)};
+    for (size_t i = 0; i < 10000; ++i)
+    {
+        terms.push_back(Expression<long double>(3e-20L));
+    }
+    Expression<long double> sum = Expression<long double>::ExprSum(terms, {}, true);
+    bool compensated = std::abs(sum.eval({}) - (1 + 3e-16L)) < 1e-18L;
+
+    Lexer lexer{"x * y * 3 - x + y - 2"};
+    Parser<long double> parser{lexer};
+    Expression parsed = parser.parseExpression();
+    CompiledExpression<long double> compiled(parsed, {"x", "y"});
+    long double point[2] = {1, 2};
+    bool parser_nary = parsed.kind() == NODE_SUM && parsed.arity() == 4 && compiled.eval(point) == 5;
+
+    return structure && values && compensated && parser_nary;
+}
+
+bool test_mixed_precision()
+{
+    // Хорошо обусловленное выражение считается в double без пересчёта.
+    Lexer lexer{"sin(x) * x + exp(x / 4) + x ^ 2"};
+    Parser<long double> parser{lexer};
+    MixedPrecisionExpression good(parser.parseExpression(), {"x"}, 1e-12L);
+    std::vector<long double> xs;
+    for (size_t i = 0; i < 1000; ++i)
+    {
+        xs.push_back(0.5L + i * 0.01L);
+    }
+    std::vector<long double> out(xs.size());
+    const long double *columns[1] = {xs.data()};
+    good.eval_batch(xs.size(), columns, out.data());
+    bool accurate = true;
+    for (size_t i = 0; i < xs.size(); ++i)
+    {
+        long double x = xs[i];
+        long double expected = std::sin(x) * x + std::exp(x / 4) + x * x;
+        accurate = accurate && std::abs(out[i] - expected) <= 1e-12L * std::abs(expected);
+    }
+
+    // Вычитание близких чисел: double теряет результат, и точка пересчитывается.
+    Lexer bad_lexer{"(x + 1) - x"};
+    Parser<long double> bad_parser{bad_lexer};
+    MixedPrecisionExpression bad(bad_parser.parseExpression(), {"x"}, 1e-12L);
+    long double x = 1e17L;
+
+    return accurate && good.stats().evaluations == 1000 && good.stats().fallbacks == 0 &&
+           bad.eval(&x) == 1 && bad.stats().fallbacks == 1;
+}
+
+bool test_optimizer()
+{
+    Lexer lexer{"(1 - x) ^ 2 + 100 * (y - x ^ 2) ^ 2"};
+    Parser<long double> parser{lexer};
+    Optimizer<long double> optimizer(parser.parseExpression(), {"x", "y"});
+
+    OptimizationResult unbounded = optimizer.minimize({-1.2L, 1});
+
+    // С ограничением x <= 0.5 минимум находится на границе: (0.5, 0.25).
+    OptimizationOptions options;
+    options.lower = {-2, -2};
+    options.upper = {0.5L, 2};
+    OptimizationResult bounded = optimizer.minimize({-1.2L, 1}, options);
+
+    // Границы не той длины и пустой отрезок отвергаются.
+    size_t rejected = 0;
+    for (auto [lower, upper] : {std::pair<std::vector<long double>, std::vector<long double>>{{-2}, {}},
+                                {{}, {0.5L, 2, 3}},
+                                {{1, -2}, {0.5L, 2}}})
+    {
+        OptimizationOptions invalid;
+        invalid.lower = lower;
+        invalid.upper = upper;
+        try
+        {
+            optimizer.minimize({-1.2L, 1}, invalid);
+        }
+        catch (const std::invalid_argument &)
+        {
+            ++rejected;
+        }
+    }
+
+    // Неудачный линейный поиск (ln(0) не конечен) учитывается как итерация.
+    Lexer log_lexer{"ln(x)"};
+    Parser<long double> log_parser{log_lexer};
+    OptimizationOptions short_search;
+    short_search.max_line_search = 1;
+    OptimizationResult stalled = Optimizer<long double>(log_parser.parseExpression(), {"x"}).minimize({1}, short_search);
+
+    return rejected == 3 && !stalled.converged && stalled.iterations == 1 && stalled.history.size() == stalled.iterations &&
+           unbounded.converged && std::abs(unbounded.x[0] - 1) < 1e-8 && std::abs(unbounded.x[1] - 1) < 1e-8 &&
+           unbounded.history.size() == unbounded.iterations && unbounded.evaluations > unbounded.iterations &&
+           bounded.converged && bounded.x[0] == 0.5L && std::abs(bounded.x[1] - 0.25L) < 1e-8 &&
+           bounded.history.size() == bounded.iterations;
 }
 
 bool compare_complex(const std::complex<long double> &c1, const std::complex<long double> &c2, long double epsilon = 1e-9)
@@ -119,15 +374,1331 @@ bool test_complex()
     return (compare_complex(expr1.eval(context), ans));
 }
 
-int main()
+bool test_compiled()
+{
+    Lexer lexer{"(x + y) * sin(x + 2) * 2 ^ x + 3 * ln(x)"};
+    Parser<long double> parser{lexer};
+    Expression expr = parser.parseExpression();
+
+    CompiledExpression<long double> compiled(expr, {"x", "y"});
+    long double xs[3] = {1, 2, 3};
+    long double y = 3;
+    long double out[3];
+    const long double *columns[2] = {xs, &y};
+    size_t strides[2] = {1, 0};
+    long double *results = out;
+    compiled.eval_batch(3, columns, &results, strides);
+
+    for (size_t i = 0; i < 3; ++i)
+    {
+        long double point[2] = {xs[i], y};
+        long double expected = expr.eval({{"x", xs[i]}, {"y", y}});
+        if (compiled.eval(point) != expected || out[i] != expected)
+        {
+            return false;
+        }
+    }
+
+    // 0 и -0 - разные константы программы: 1 / (x * -0) при x = 1 равно -inf.
+    Expression<long double> x("x");
+    Expression<long double> zeros = x * Expression<long double>(0) + Expression<long double>(1) / (x * Expression<long double>(-0.0L));
+    CompiledExpression<long double> signed_zeros(zeros, {"x"});
+    long double one = 1;
+    return signed_zeros.eval(&one) == -std::numeric_limits<long double>::infinity();
+}
+
+bool test_fusion()
+{
+    Lexer lexer{"(x + y) * sin(x + 2) * 2 ^ x + 3 * ln(x)"};
+    Parser<long double> parser{lexer};
+    Expression expr_diff = parser.parseExpression().diff("x");
+
+    CompileOptions plain;
+    plain.sincos = false;
+    CompileOptions fma;
+    fma.fma = true;
+    CompiledExpression<long double> reference(expr_diff, {"x", "y"}, plain);
+    CompiledExpression<long double> fused(expr_diff, {"x", "y"});
+    CompiledExpression<long double> contracted(expr_diff, {"x", "y"}, fma);
+
+    auto contains = [](const CompiledExpression<long double> &compiled, OpCode op)
+    {
+        for (const Instruction &ins : compiled.program())
+        {
+            if (ins.op == op)
+            {
+                return true;
+            }
+        }
+        return false;
+    };
+    if (contains(reference, OP_SINCOS) || !contains(fused, OP_SINCOS) || contains(fused, OP_FMA) ||
+        !contains(contracted, OP_FMA) || contracted.program().size() >= fused.program().size())
+    {
+        return false;
+    }
+
+    long double xs[100];
+    long double y = 3;
+    long double out[2][100];
+    for (size_t i = 0; i < 100; ++i)
+    {
+        xs[i] = 0.1L + 0.05L * i;
+    }
+    const long double *columns[2] = {xs, &y};
+    size_t strides[2] = {1, 0};
+    long double *fused_results = out[0];
+    long double *contracted_results = out[1];
+    fused.eval_batch(100, columns, &fused_results, strides);
+    contracted.eval_batch(100, columns, &contracted_results, strides);
+
+    for (size_t i = 0; i < 100; ++i)
+    {
+        long double point[2] = {xs[i], y};
+        long double expected = reference.eval(point);
+        long double tolerance = 1e-15L * std::max(1.0L, std::abs(expected));
+        if (std::abs(fused.eval(point) - expected) > tolerance || std::abs(out[0][i] - expected) > tolerance ||
+            std::abs(contracted.eval(point) - expected) > tolerance || std::abs(out[1][i] - expected) > tolerance)
+        {
+            return false;
+        }
+    }
+
+    // Показатель OP_POWI хранится в rhs и не является номером ячейки.
+    Expression<long double> x("x");
+    Expression<long double> powers = (x ^ Expression<long double>(-2)) * x + (x ^ Expression<long double>(3)).ExprSin();
+    CompiledExpression<long double> power_program(powers, {"x"}, fma);
+    CodeGenerator<long double> generator{{"x"}};
+    generator.add("powers", powers);
+    long double at = 1.5;
+    return contains(power_program, OP_POWI) &&
+           std::abs(power_program.eval(&at) - powers.eval({{"x", at}})) < 1e-15L &&
+           generator.emit().find("powers") != std::string::npos;
+}
+
+bool test_parse_cache()
+{
+    ParseCacheOptions options;
+    options.capacity = 4;
+    options.stripes = 2;
+    ParseCache<long double> cache{options};
+
+    // Тексты, отличающиеся только пробелами, дают одну запись и общее дерево.
+    auto first = cache.get("sin(x) * 2 + y");
+    auto second = cache.get("  sin (x)*2+y\t");
+    std::map<std::string, long double> context = {{"x", 1}, {"y", 3}};
+    bool shared = first == second && first->expression().node() == second->expression().node() &&
+                  first->compiled_if_ready() == nullptr && cache.compile("sin(x)*2 + y") == first->compiled() &&
+                  first->variables() == std::vector<std::string>{"x", "y"} &&
+                  std::abs(first->expression().eval(context) - (2 * std::sin(1.0L) + 3)) < 1e-15L &&
+                  ParseCache<long double>::normalize("x  y + 2 3") == "x y+2 3";
+
+    // Ошибка разбора не попадает в кэш.
+    bool error = false;
+    try
+    {
+        cache.get("x + $");
+    }
+    catch (const std::runtime_error &)
+    {
+        error = !cache.contains("x + $");
+    }
+
+    // Вытеснение: в кэше не больше capacity записей, выражение остаётся у владельцев.
+    for (int i = 0; i < 10; ++i)
+    {
+        cache.parse("x + " + std::to_string(i));
+    }
+    ParseCacheStats stats = cache.stats();
+    bool bounded = stats.entries <= 4 && stats.evictions >= 7 && stats.hits == 2 && stats.misses == 12 &&
+                   stats.memory > 0 && first->expression().eval(context) == second->expression().eval(context);
+
+    // Одновременные обращения из нескольких потоков к небольшому набору выражений.
+    ParseCache<long double> shared_cache;
+    std::vector<std::thread> workers;
+    std::vector<int> correct(4, 1);
+    for (size_t t = 0; t < correct.size(); ++t)
+    {
+        workers.emplace_back([&, t]
+                             {
+                                 for (int i = 0; i < 2000; ++i)
+                                 {
+                                     long double x = i % 50;
+                                     auto compiled = shared_cache.compile("x * " + std::to_string(i % 50) + " + 1");
+                                     if (compiled->eval(&x) != x * x + 1)
+                                     {
+                                         correct[t] = 0;
+                                     }
+                                 } });
+    }
+    for (auto &worker : workers)
+    {
+        worker.join();
+    }
+    ParseCacheStats concurrent = shared_cache.stats();
+    bool threads = std::count(correct.begin(), correct.end(), 1) == 4 && concurrent.entries == 50 &&
+                   concurrent.hits + concurrent.misses == 8000 && concurrent.hit_rate > 0.95;
+    return shared && error && bounded && threads;
+}
+
+// Запись дерева по узлам в прямом порядке: вид, число операндов, значение листа.
+static std::string structure(const Expression<long double> &expr)
+{
+    std::ostringstream out;
+    std::vector<const Expression<long double> *> stack{&expr};
+    while (!stack.empty())
+    {
+        const Expression<long double> *current = stack.back();
+        stack.pop_back();
+        out << current->kind() << ':' << current->arity();
+        if (current->kind() == NODE_VALUE)
+        {
+            out << '=' << current->constant();
+        }
+        else if (current->kind() == NODE_VARIABLE)
+        {
+            out << '=' << current->variable();
+        }
+        out << ' ';
+        for (size_t i = current->arity(); i-- > 0;)
+        {
+            stack.push_back(&current->operand(i));
+        }
+    }
+    return out.str() + expr.to_string();
+}
+
+// Результат разбора как строка: структура дерева или текст ошибки.
+template <typename Parse>
+static std::string parse_result(Parse parse)
+{
+    try
+    {
+        return structure(parse());
+    }
+    catch (const std::exception &error)
+    {
+        return std::string("error: ") + error.what();
+    }
+}
+
+bool test_incremental()
+{
+    auto full = [](const std::string &text)
+    {
+        return parse_result([&]
+                            {
+                                Lexer lexer{text};
+                                Parser<long double> parser{lexer};
+                                return parser.parseExpression();
+                            });
+    };
+
+    // Формула из многих слагаемых: правка внутри одной скобки разбирает заново только
+    // её и верхний уровень, где остальные слагаемые берутся готовыми.
+    std::string source;
+    for (int i = 0; i < 40; ++i)
+    {
+        source += (i > 0 ? " + " : "") + std::string("sin(x * ") + std::to_string(i + 1) + " + y) * (x - " +
+                  std::to_string(i) + ")";
+    }
+    IncrementalParser<long double> parser{source};
+    bool initial = parse_result([&] { return parser.parse(); }) == full(source);
+    size_t offset = source.find("(x - 20)") + 5;
+    parser.edit(offset, 2, "7 * y");
+    bool edited = parse_result([&] { return parser.parse(); }) == full(parser.text());
+    IncrementalStats stats = parser.stats();
+    bool reused = stats.relexed <= 4 && stats.parsed_groups == 1 && stats.reused_groups == 1 &&
+                  stats.reused_terms == 39 && stats.parsed_tokens < 100 && parser.text().find("(x - 7 * y)") != std::string::npos;
+
+    // Правки, меняющие лексемы на границе: продолжение числа и имени, имя функции
+    // перед скобкой и скобка, отделённая пробелами.
+    IncrementalParser<long double> boundary{"sin  x + 12 * ab"};
+    bool boundaries = true;
+    auto compare = [&]
+    {
+        boundaries = boundaries && parse_result([&] { return boundary.parse(); }) == full(boundary.text());
+    };
+    auto check = [&](size_t at, size_t erase, const std::string &insert)
+    {
+        boundary.edit(at, erase, insert);
+        compare();
+    };
+    compare();
+    check(16, 0, "c");
+    check(10, 0, ".5");
+    check(5, 1, "(x)");
+    check(3, 2, "");
+    check(0, 3, "cos");
+    check(3, 0, " ");
+    check(0, 0, "(");
+    check(boundary.text().size(), 0, ")");
+
+    // Цепочки '+' и '*' из скобок продолжаются снаружи: "(a*b)*c" - одно произведение.
+    boundary.reset("(x + a * b) * c");
+    compare();
+    check(0, 1, "");
+    check(0, 0, "(");
+    check(1, 4, "");
+    boundary.reset("( (a + b)) + c");
+    compare();
+    check(1, 1, "");
+    check(boundary.text().size(), 0, " + d");
+
+    // Случайные правки: результат или текст ошибки совпадают с полным разбором.
+    const char *pieces[] = {"x", "y", "1", "20", ".5", " ", "+", "-", "*", "/", "^", "(", ")", "sin(", "ln (",
+                            "exp", "$"};
+    IncrementalParser<long double> random{"(x + 1) * sin(y ^ 2) - 3 / (x * y)"};
+    uint64_t state = 12345;
+    auto next = [&state](uint64_t bound)
+    {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        return (state >> 33) % bound;
+    };
+    bool randomized = true;
+    for (int step = 0; step < 500 && randomized; ++step)
+    {
+        std::string text = random.text();
+        size_t at = next(text.size() + 1);
+        size_t erase = text.size() > 60 ? next(std::min<size_t>(6, text.size() - at) + 1)
+                                         : next(std::min<size_t>(2, text.size() - at) + 1);
+        random.edit(at, erase, pieces[next(std::size(pieces))]);
+        randomized = parse_result([&] { return random.parse(); }) == full(random.text());
+        if (step % 50 == 49)
+        {
+            random.reset("ln(x + 2) * (y - 1) ^ 2 + exp(x / (y + 3))");
+        }
+    }
+
+    // Правки, сохраняющие правильность: замена операнда или операции другим.
+    const char *operands[] = {"x", "y", "2", "(x + y)", "(x * y + 1)", "sin(x) * y", "(a - b) * c", "z ^ 2"};
+    const char *operations[] = {"+", "-", "*", "/", "^"};
+    IncrementalParser<long double> valid{source.substr(0, source.find(" + sin(x * 11"))};
+    size_t parsed = 0;
+    for (int step = 0; step < 500 && randomized; ++step)
+    {
+        std::vector<Token> tokens = valid.tokens();
+        const Token &target = tokens[next(tokens.size())];
+        if (target.type == TOK_VARIABLE || target.type == TOK_VALUE)
+        {
+            valid.edit(target.column, target.lexeme.size(), operands[next(std::size(operands))]);
+        }
+        else if (target.type == TOK_PLUS || target.type == TOK_SUB || target.type == TOK_MULTIPLY ||
+                 target.type == TOK_DIV || target.type == TOK_POW)
+        {
+            valid.edit(target.column, 1, operations[next(std::size(operations))]);
+        }
+        std::string expected = full(valid.text());
+        randomized = parse_result([&] { return valid.parse(); }) == expected;
+        parsed += expected.rfind("error", 0) != 0;
+    }
+    randomized = randomized && parsed == 500;
+
+    bool bounds = false;
+    try
+    {
+        random.edit(random.text().size() + 1, 0, "x");
+    }
+    catch (const std::out_of_range &)
+    {
+        bounds = true;
+    }
+    return initial && edited && reused && boundaries && randomized && bounds;
+}
+
+bool test_analysis()
+{
+    // Листья создаются заранее: имена переменных заносятся в SymbolTable с выделением памяти.
+    Expression<long double> x("x");
+    Expression<long double> y("y");
+    Expression<long double> two(2);
+
+    // Общее поддерево e входит в s дважды.
+    AllocScope build;
+    Expression<long double> e = x.ExprSin() + y * two;
+    Expression<long double> s = e * e;
+    uint64_t allocated = build.stats().bytes;
+
+    ExpressionStats stats = analyze(s);
+    bool counts = stats.tree_nodes == 13 && stats.unique_nodes == 7 && stats.heap_nodes == 4 &&
+                  stats.depth == 4 && std::abs(stats.sharing - 13.0 / 7) < 1e-12 &&
+                  stats.operations[NODE_MULT] == 2 && stats.operations[NODE_ADD] == 1 &&
+                  stats.operations[NODE_SIN] == 1 && stats.operations[NODE_VARIABLE] == 2 &&
+                  stats.operations[NODE_VALUE] == 1 && stats.variables == std::vector<std::string>{"x", "y"};
+    bool memory = Allocations::counting() && stats.bytes == allocated;
+    bool cost = stats.dag_cost == 53 && stats.tree_cost == 105;
+
+    CostModel expensive;
+    expensive.transcendental = 100;
+    bool table = analyze(s, expensive).dag_cost == 103;
+
+    // Лист без узлов в куче и n-арная сумма.
+    ExpressionStats leaf = analyze(two);
+    Expression<long double> sum = Expression<long double>::ExprSum({x, y, e}, {false, true, false});
+    ExpressionStats nary = analyze(sum);
+    bool leaves = leaf.tree_nodes == 1 && leaf.unique_nodes == 1 && leaf.depth == 1 && leaf.bytes == 0 &&
+                  leaf.variables.empty() && nary.operations[NODE_SUM] == 1 && nary.tree_nodes == 9 &&
+                  nary.dag_cost == 2 + 52 && nary.bytes > stats.bytes - 2 * sizeof(OpMult<long double>);
+
+    // Повторное возведение в квадрат: дерево экспоненциально, граф линеен.
+    Expression<long double> square = x + y;
+    for (size_t i = 0; i < 80; ++i)
+    {
+        square = square * square;
+    }
+    ExpressionStats pathological = analyze(square);
+    bool saturated = pathological.tree_nodes == SIZE_MAX && pathological.unique_nodes == 83 &&
+                     pathological.depth == 82 && pathological.dag_cost == 81 &&
+                     pathological.tree_cost > 1e24L;
+
+    // Производная: общие поддеревья разделяются, свободные переменные сохраняются.
+    Lexer lexer{"sin(x * y) * exp(x) / (x + z)"};
+    Parser<long double> parser{lexer};
+    ExpressionStats derivative = analyze(parser.parseExpression().diff("x"));
+    bool diff = derivative.tree_nodes >= derivative.unique_nodes && derivative.tree_cost >= derivative.dag_cost &&
+                derivative.variables == std::vector<std::string>{"x", "y", "z"};
+
+    Expression<std::complex<long double>> z("z");
+    ExpressionStats complex = analyze(z.ExprExp() * z);
+    bool other = complex.unique_nodes == 4 && complex.dag_cost == 51 && std::string(node_kind_name(NODE_POW)) == "pow";
+
+    return counts && memory && cost && table && leaves && saturated && diff && other;
+}
+
+bool test_memo()
+{
+    Lexer lexer{"sin(x * y) * exp(z) + ln(x + 2) / (y ^ 2) - cos(z) ^ 3"};
+    Parser<long double> parser{lexer};
+    Expression expr = parser.parseExpression();
+    std::vector<std::map<std::string, long double>> points;
+    for (size_t i = 0; i < 100; ++i)
+    {
+        points.push_back({{"x", 0.1L * i}, {"y", 1 + 0.01L * i}, {"z", 0.5L * (i % 3)}});
+    }
+
+    // Повторяющиеся точки: промах только при первом вычислении, результат тот же во всех битах.
+    MemoEvaluator<long double> memo{expr};
+    bool exact = memo.variables() == std::vector<std::string>{"x", "y", "z"};
+    for (size_t i = 0; i < 1000; ++i)
+    {
+        const auto &point = points[i % 10];
+        exact = exact && memo.eval(point) == expr.eval(point);
+    }
+    MemoStats repeated = memo.stats();
+    bool hits = repeated.hits == 990 && repeated.misses == 10 && repeated.entries == 10 &&
+                repeated.evictions == 0 && std::abs(repeated.hit_rate - 0.99) < 1e-12 && repeated.subtrees == 0;
+
+    // Вычисление не выделяет память ни при попадании, ни при промахе.
+    long double values[3] = {0.25, 1.5, 2};
+    memo.eval(values);
+    AllocScope hot;
+    long double sum = 0;
+    for (size_t i = 0; i < 100; ++i)
+    {
+        values[0] = 0.25L + (i % 20);
+        sum += memo.eval(values);
+    }
+    bool no_allocations = hot.allocations() == 0 && std::isfinite(sum);
+
+    // Маленькая таблица: вытеснение по LRU и FIFO, без вытеснения таблица не меняется.
+    bool evicted = true;
+    for (MemoEviction eviction : {MEMO_EVICT_LRU, MEMO_EVICT_FIFO, MEMO_EVICT_NONE})
+    {
+        MemoOptions options;
+        options.capacity = 4;
+        options.probes = 2;
+        options.eviction = eviction;
+        MemoEvaluator<long double> small{expr, options};
+        for (size_t i = 0; i < 300; ++i)
+        {
+            const auto &point = points[i % 100];
+            evicted = evicted && small.eval(point) == expr.eval(point);
+        }
+        MemoStats stats = small.stats();
+        evicted = evicted && stats.entries <= 4 && stats.hits + stats.misses == 300 &&
+                  (eviction == MEMO_EVICT_NONE ? stats.evictions == 0 : stats.evictions > 0);
+    }
+
+    // Поддеревья по части переменных: exp(z), cos(z), cos(z) ^ 3 повторяются при новых x и y.
+    MemoOptions subtree_options;
+    subtree_options.subtrees = true;
+    MemoEvaluator<long double> parts{expr, subtree_options};
+    bool subtrees = true;
+    for (const auto &point : points)
+    {
+        subtrees = subtrees && parts.eval(point) == expr.eval(point);
+    }
+    MemoStats part_stats = parts.stats();
+    subtrees = subtrees && part_stats.subtrees == 5 && part_stats.misses == 100 &&
+               part_stats.subtree_hits == 2 * 97 && part_stats.subtree_hit_rate > 0.35;
+    parts.clear();
+    subtrees = subtrees && parts.stats().subtree_hits == 0 && parts.stats().entries == 0;
+
+    // Ключи сравниваются точно: 0 и -0 различаются.
+    Lexer inverse_lexer{"1 / x"};
+    Parser<long double> inverse_parser{inverse_lexer};
+    MemoEvaluator<long double> inverse{inverse_parser.parseExpression()};
+    long double zero = 0;
+    long double negative_zero = -0.0L;
+    bool signed_zero = inverse.eval(&zero) > 0 && inverse.eval(&negative_zero) < 0 && inverse.stats().misses == 2;
+
+    bool missing = false;
+    try
+    {
+        memo.eval(std::map<std::string, long double>{{"x", 1}});
+    }
+    catch (const std::runtime_error &)
+    {
+        missing = true;
+    }
+
+    Expression<std::complex<long double>> z("z");
+    MemoEvaluator<std::complex<long double>> complex{z.ExprExp() * z};
+    std::complex<long double> point(0.5, 1);
+    bool other = complex.eval(&point) == complex.eval(&point) && complex.stats().hits == 1;
+
+    return exact && hits && no_allocations && evicted && subtrees && signed_zero && missing && other;
+}
+
+bool test_taylor()
+{
+    // Производные до 5-го порядка по x совпадают с повторным символьным дифференцированием.
+    Lexer lexer{"x ^ 3 * sin(x * y) + exp(2 * x) / (1 + x ^ 2) + ln(x) * y + x ^ y + x ^ 0.5 - cos(x) ^ 2"};
+    Parser<long double> parser{lexer};
+    Expression expr = parser.parseExpression();
+    const size_t order = 5;
+    TaylorEvaluator<long double> evaluator{expr, {"x", "y"}, order};
+    long double point[] = {0.7L, 1.3L};
+    std::vector<long double> derivatives = evaluator.derivatives(point, 0);
+    std::map<std::string, long double> context = {{"x", 0.7L}, {"y", 1.3L}};
+    bool symbolic = true;
+    Expression<long double> current = expr;
+    for (size_t n = 0; n <= order; ++n)
+    {
+        long double expected = current.eval(context);
+        symbolic = symbolic && std::abs(derivatives[n] - expected) <= 1e-13L * std::max(1.0L, std::abs(expected));
+        current = current.diff("x");
+    }
+
+    // Известные ряды 10-го порядка, в том числе целая степень в нуле.
+    auto series = [](const std::string &text, long double x)
+    {
+        Lexer lexer{text};
+        Parser<long double> parser{lexer};
+        return TaylorEvaluator<long double>{parser.parseExpression(), {"x"}, 10}.derivatives(&x, 0);
+    };
+    std::vector<long double> exponent = series("exp(2 * x)", 0.3L);
+    std::vector<long double> geometric = series("1 / (1 - x)", 0);
+    std::vector<long double> cube = series("x ^ 3", 0);
+    bool known = true;
+    long double factorial = 1;
+    for (size_t n = 0; n <= 10; ++n)
+    {
+        factorial *= n > 1 ? n : 1;
+        known = known && std::abs(exponent[n] - std::ldexp(std::exp(0.6L), n)) < 1e-15L * std::ldexp(2, n) &&
+                geometric[n] == factorial && cube[n] == (n == 3 ? 6 : 0);
+    }
+
+    // Арифметика рядов и производная по направлению: x * y при x = 1 + t, y = 2 + t.
+    Taylor<long double> t = Taylor<long double>::variable(0, 7);
+    std::vector<long double> sine = sin(t).derivatives();
+    Taylor<long double> ratio = exp(t) / (Taylor<long double>(7, 1) + t);
+    long double direction[] = {1, 1};
+    long double at[] = {1, 2};
+    long double product[3];
+    for (size_t n = 0; n < sine.size(); ++n)
+    {
+        long double expected = n % 2 == 0 ? 0 : n % 4 == 1 ? 1 : -1;
+        known = known && std::abs(sine[n] - expected) < 1e-18L;
+    }
+    Lexer product_lexer{"x * y"};
+    Parser<long double> product_parser{product_lexer};
+    TaylorEvaluator<long double>{product_parser.parseExpression(), {"x", "y"}, 2}.coefficients(at, direction, product);
+    bool arithmetic = ratio[0] == 1 && ratio[1] == 0 &&
+                      std::abs(ratio[2] - 0.5L) < 1e-18L && product[0] == 2 && product[1] == 3 && product[2] == 1 &&
+                      std::abs(pow(Taylor<long double>::variable(2, 3), 0.5L).derivative(1) - 0.5L / std::sqrt(2.0L)) <
+                          1e-18L;
+    return symbolic && known && arithmetic;
+}
+
+bool test_checked_eval()
+{
+    Lexer lexer{"ln(x) + y / z + x ^ 0.5"};
+    Parser<long double> parser{lexer};
+    Expression expr = parser.parseExpression();
+
+    // Ошибки дерева: первая по порядку вычисления - логарифм, флаги всех операций объединяются.
+    EvalResult<long double> bad = expr.try_eval({{"x", -1}, {"y", 1}, {"z", 0}});
+    EvalResult<long double> good = expr.try_eval({{"x", 4}, {"y", 1}, {"z", 2}});
+    // node указывает внутрь дерева, поэтому выражения должны жить дольше результата.
+    Expression<long double> shifted = Expression<long double>("w") + Expression<long double>(1);
+    Expression<long double> vanishing = Expression<long double>("x").ExprExp() * Expression<long double>(0);
+    EvalResult<long double> missing = shifted.try_eval({});
+    EvalResult<long double> overflow = vanishing.try_eval({{"x", 20000}});
+    bool tree = bad.flags == (EVAL_LOG_DOMAIN | EVAL_DIVISION_BY_ZERO | EVAL_POW_DOMAIN) &&
+                bad.error == EVAL_LOG_DOMAIN && bad.node->kind() == NODE_LN && std::isnan(bad.value) &&
+                good.ok() && good.value == expr.eval({{"x", 4}, {"y", 1}, {"z", 2}}) &&
+                missing.flags == EVAL_MISSING_VARIABLE && missing.node->variable() == "w" && std::isnan(missing.value) &&
+                overflow.flags == EVAL_OVERFLOW && overflow.node->kind() == NODE_EXP;
+
+    // Программа: номер инструкции первой ошибки и флаги по строкам пакета.
+    CompiledExpression<long double> compiled(expr, {"x", "y", "z"});
+    long double point[] = {-1, 1, 1};
+    long double value = 0;
+    ProgramStatus status = compiled.eval_checked(point, &value);
+    std::vector<long double> xs = {4, -1, 4, 0};
+    std::vector<long double> ys = {1, 1, 1, 1};
+    std::vector<long double> zs = {2, 2, 0, 2};
+    const long double *columns[] = {xs.data(), ys.data(), zs.data()};
+    std::vector<long double> checked(4), unchecked(4);
+    long double *checked_out[] = {checked.data()};
+    long double *unchecked_out[] = {unchecked.data()};
+    std::vector<uint32_t> flags(4);
+    compiled.eval_batch(4, columns, checked_out, nullptr, flags.data());
+    compiled.eval_batch(4, columns, unchecked_out);
+    bool program = status.flags == (EVAL_LOG_DOMAIN | EVAL_POW_DOMAIN) && status.error == EVAL_LOG_DOMAIN &&
+                   compiled.program()[status.slot].op == OP_LN &&
+                   flags == std::vector<uint32_t>{EVAL_OK, EVAL_LOG_DOMAIN | EVAL_POW_DOMAIN, EVAL_DIVISION_BY_ZERO, EVAL_LOG_DOMAIN} &&
+                   checked[0] == unchecked[0] && checked[2] == unchecked[2];
+    return tree && program;
+}
+
+bool test_trace()
+{
+    auto run = []
+    {
+        Lexer lexer{"sin(x) * y + x ^ 2"};
+        Parser<long double> parser{lexer};
+        Expression expr = parser.parseExpression();
+        expr.diff("x").to_string();
+        CompiledExpression<long double> compiled(expr, {"x", "y"});
+        return expr.eval({{"x", 1}, {"y", 2}}) == compiled.eval(std::vector<long double>{1, 2}.data());
+    };
+
+    // Без записи события не появляются.
+    Trace::stop();
+    Trace::clear();
+    bool idle = run() && Trace::size() == 0;
+
+    Trace::start();
+    bool recorded = run();
+    std::thread worker([&recorded, &run]
+                       { recorded = run() && recorded; });
+    worker.join();
+    Trace::stop();
+    run();
+    std::ostringstream json;
+    Trace::write_chrome(json);
+    std::string text = json.str();
+    Trace::clear();
+
+    // Буфер завершившегося потока достаётся следующему: их число не растёт.
+    size_t buffers = Trace::buffers();
+    Trace::start();
+    for (int i = 0; i < 4; ++i)
+    {
+        std::thread([&run] { run(); }).join();
+    }
+    Trace::stop();
+    bool reused = Trace::buffers() == buffers;
+    Trace::clear();
+
+#ifdef EXPR_NO_TRACE
+    return idle && recorded && reused && text.find("\"ph\":\"X\"") == std::string::npos;
+#else
+    bool phases = true;
+    for (const char *name : {"lex", "parse", "diff", "to_string", "eval", "compile"})
+    {
+        phases = phases && text.find(std::string("{\"name\":\"") + name + "\"") != std::string::npos;
+    }
+    // События обоих потоков (разные tid); у пачки лексем есть счётчик.
+    std::regex event("\"ph\":\"X\"[^}]*\"tid\":([0-9]+)");
+    std::set<std::string> threads;
+    size_t events = 0;
+    for (std::sregex_iterator it(text.begin(), text.end(), event), end; it != end; ++it)
+    {
+        threads.insert((*it)[1]);
+        ++events;
+    }
+    return idle && recorded && reused && phases && events == 2 * 7 && threads.size() == 2 &&
+           text.rfind("{\"traceEvents\":[", 0) == 0 &&
+           std::regex_search(text, std::regex("\"name\":\"lex\",[^}]*\"args\":\\{\"count\":11\\}"));
+#endif
+}
+
+bool test_rewrite()
+{
+    Lexer lexer{"exp(x) * exp(y) + ln(x) + ln(y) + x / y / z + sin(x) ^ 2 + cos(x) ^ 2 + y / 4"};
+    Parser<long double> parser{lexer};
+    Expression expr = parser.parseExpression();
+    std::vector<std::map<std::string, long double>> points = {
+        {{"x", 0.5}, {"y", 1.5}, {"z", 2}}, {{"x", 1.25}, {"y", 0.75}, {"z", 3}}, {{"x", 2}, {"y", 2}, {"z", 0.5}}};
+
+    RewriteOptions options;
+    options.safety = SAFETY_DOMAIN;
+    options.samples = 1000;
+    RewriteReport report;
+    Expression rewritten = Rewriter<long double>(options).rewrite(expr, &report);
+    for (const char *rule : {"constant-reciprocal", "exp-product", "log-sum", "division-chain", "pythagorean"})
+    {
+        if (report.rules.count(rule) == 0)
+        {
+            return false;
+        }
+    }
+    for (const auto &point : points)
+    {
+        long double expected = expr.eval(point);
+        if (std::abs(rewritten.eval(point) - expected) > 1e-15L * std::abs(expected))
+        {
+            return false;
+        }
+    }
+    bool cheaper = report.cost_after < report.cost_before && report.estimated_speedup > 2 &&
+                   report.measured_speedup > 0;
+
+    // По умолчанию логарифмы не объединяются; в точном режиме меняется только деление на 4.
+    RewriteReport finite;
+    Rewriter<long double>().rewrite(expr, &finite);
+    RewriteOptions exact_options;
+    exact_options.safety = SAFETY_EXACT;
+    RewriteReport exact_report;
+    Expression exact = Rewriter<long double>(exact_options).rewrite(expr, &exact_report);
+    bool safety = finite.rules.count("log-sum") == 0 && finite.rules.count("pythagorean") == 1 &&
+                  exact_report.rules.size() == 1 && exact_report.rules.count("constant-reciprocal") == 1 &&
+                  exact.eval(points[1]) == expr.eval(points[1]);
+
+    // Общий знаменатель у слагаемых и общее 1 / d для делений в разных местах.
+    Lexer shared_lexer{"x / (y + 1) - z / (y + 1) + sin(x / (z + 2)) * exp(y / (z + 2))"};
+    Parser<long double> shared_parser{shared_lexer};
+    Expression shared = shared_parser.parseExpression();
+    RewriteReport shared_report;
+    Expression shared_rewritten = Rewriter<long double>().rewrite(shared, &shared_report);
+    long double expected = shared.eval(points[0]);
+    bool denominators = shared_report.rules.count("common-denominator") == 1 &&
+                        shared_report.rules.count("shared-reciprocal") == 1 &&
+                        std::abs(shared_rewritten.eval(points[0]) - expected) < 1e-15L * std::abs(expected);
+
+    return cheaper && safety && denominators;
+}
+
+bool test_allocations()
+{
+    Lexer lexer{"sin(x) * y + ln(x + 2) / (y ^ 2) - exp(x * y)"};
+    Parser<long double> parser{lexer};
+    Expression expr = parser.parseExpression();
+    std::map<std::string, long double> context{{"x", 0.5}, {"y", 1.5}};
+
+    // Построение производной выделяет память: учёт действительно включён.
+    AllocScope build;
+    Expression derivative = expr.diff("x");
+    bool counted = Allocations::counting() && build.allocations() > 0;
+
+    CompiledExpression<long double> compiled({expr, derivative}, {"x", "y"});
+    long double point[2] = {0.5, 1.5};
+    long double values[2];
+    long double xs[100];
+    long double ys[100];
+    long double column[100];
+    for (size_t i = 0; i < 100; ++i)
+    {
+        xs[i] = 0.01L * i;
+        ys[i] = 1.5;
+    }
+    const long double *columns[2] = {xs, ys};
+    long double *results[2] = {column, column};
+    size_t strides[2] = {1, 1};
+
+    // Рабочие буферы потока заполняются при первом вызове.
+    long double expected = expr.eval(context) + derivative.eval(context);
+    compiled.eval(point, values);
+    compiled.eval_batch(100, columns, results, strides);
+
+    // Вычисление дерева, скомпилированной программы и пачки не выделяет память.
+    AllocScope hot;
+    long double tree = 0;
+    long double program = 0;
+    for (size_t i = 0; i < 100; ++i)
+    {
+        tree += expr.eval(context) + derivative.eval(context);
+        tree += expr.try_eval(context).value;
+        compiled.eval(point, values);
+        program += values[0] + values[1];
+        compiled.eval_batch(100, columns, results, strides);
+    }
+    bool zero = hot.allocations() == 0;
+
+    // Нехватка памяти: как у стандартного operator new, обработчик set_new_handler
+    // вызывается, пока установлен, и только затем бросается std::bad_alloc.
+    static int handler_calls;
+    handler_calls = 0;
+    std::set_new_handler([] {
+        if (++handler_calls == 2)
+        {
+            std::set_new_handler(nullptr);
+        }
+    });
+    bool thrown = false;
+    try
+    {
+        ::operator delete(::operator new(size_t(1) << 62));
+    }
+    catch (const std::bad_alloc &)
+    {
+        thrown = true;
+    }
+    bool handled = thrown && handler_calls == 2 &&
+                   ::operator new(size_t(1) << 62, std::nothrow) == nullptr;
+
+    return counted && zero && handled && std::abs(tree - 100 * (expected + expr.eval(context))) < 1e-12L &&
+           std::abs(program - 100 * expected) < 1e-12L;
+}
+
+// Ошибка в ulp значения double относительно точного (long double) ответа.
+static double ulp_error(double value, long double exact)
+{
+    double rounded = static_cast<double>(exact);
+    if (std::isnan(rounded) || std::isinf(rounded))
+    {
+        return std::isnan(rounded) == std::isnan(value) && (std::isnan(value) || value == rounded) ? 0 : INFINITY;
+    }
+    double magnitude = std::fabs(rounded);
+    double ulp = std::nextafter(magnitude, INFINITY) - magnitude;
+    if (std::isinf(ulp))
+    {
+        ulp = magnitude - std::nextafter(magnitude, 0.0);
+    }
+    return static_cast<double>(std::fabs(static_cast<long double>(value) - exact) / ulp);
+}
+
+bool test_vecmath()
+{
+    // Аргументы по всему диапазону: равномерно для sin, cos и exp, по порядку для ln.
+    const size_t samples = 20000;
+    const double specials[] = {0.0, -0.0, 1.0, -1.0, DBL_MIN, -DBL_MIN, 4.9e-324, DBL_MAX, -DBL_MAX,
+                               INFINITY, -INFINITY, NAN};
+    std::vector<double> angles(std::begin(specials), std::end(specials));
+    std::vector<double> logs(std::begin(specials), std::end(specials));
+    std::vector<double> exps(std::begin(specials), std::end(specials));
+    std::vector<double> bases;
+    std::vector<double> powers;
+    for (size_t i = 0; i <= samples; ++i)
+    {
+        double t = static_cast<double>(i) / samples;
+        angles.push_back(-1e5 + 2e5 * t);
+        // Близко к k pi / 2, где вычитание при приведении теряет больше всего битов.
+        angles.push_back(std::nearbyint(6e4 * t) * M_PI_2);
+        angles.push_back(std::exp2(-1074 + 2097 * t) * (i % 2 == 0 ? 1 : -1));
+        logs.push_back(std::exp2(-1074 + 2098 * t));
+        logs.push_back(1 + (t - 0.5) * 1e-3);
+        exps.push_back(-746 + 1456 * t);
+        exps.push_back((t - 0.5) * 1e-6);
+        // Основание по всему диапазону, показатель - так, чтобы результат был конечным.
+        double base = std::exp2(-1000 + 2000 * t);
+        bases.push_back(base);
+        powers.push_back((-1070 + 2090 * std::fmod(t * 7919, 1.0)) / std::log2(base == 1 ? 2 : base));
+    }
+    // Особые случаи pow: отрицательное и нулевое основание, бесконечности, NaN.
+    const double special_bases[] = {-2.0, -0.5, 0.0, -0.0, 1.0, INFINITY, -INFINITY, NAN};
+    const double special_powers[] = {-3.0, -0.5, 0.0, 0.5, 2.0, 3.0, INFINITY, -INFINITY, NAN, 1e300};
+    for (double base : special_bases)
+    {
+        for (double power : special_powers)
+        {
+            bases.push_back(base);
+            powers.push_back(power);
+        }
+    }
+
+    bool accurate = true;
+    std::vector<double> out;
+    auto check = [&accurate](const std::vector<double> &values, double bound, auto exact)
+    {
+        for (size_t i = 0; i < values.size(); ++i)
+        {
+            accurate = accurate && ulp_error(values[i], exact(i)) <= bound;
+        }
+    };
+    for (int level = VECMATH_LIBM; level <= VecMath::best(); ++level)
+    {
+        VecMath::set_level(static_cast<VecMathLevel>(level));
+        accurate = accurate && VecMath::level() == level;
+
+        out.resize(angles.size());
+        VecMath::sin(angles.data(), out.data(), angles.size());
+        check(out, VecMath::SIN_ULP, [&](size_t i) { return std::sin(static_cast<long double>(angles[i])); });
+        VecMath::cos(angles.data(), out.data(), angles.size());
+        check(out, VecMath::COS_ULP, [&](size_t i) { return std::cos(static_cast<long double>(angles[i])); });
+
+        out.resize(logs.size());
+        VecMath::ln(logs.data(), out.data(), logs.size());
+        check(out, VecMath::LN_ULP, [&](size_t i) { return std::log(static_cast<long double>(logs[i])); });
+
+        out.resize(exps.size());
+        VecMath::exp(exps.data(), out.data(), exps.size());
+        check(out, VecMath::EXP_ULP, [&](size_t i) { return std::exp(static_cast<long double>(exps[i])); });
+
+        out.resize(bases.size());
+        VecMath::pow(bases.data(), powers.data(), out.data(), bases.size());
+        check(out, VecMath::POW_ULP, [&](size_t i)
+              { return std::pow(static_cast<long double>(bases[i]), static_cast<long double>(powers[i])); });
+
+        // Результат на месте аргумента и хвост короче вектора.
+        std::vector<double> inplace(exps.begin(), exps.begin() + 7);
+        VecMath::exp(inplace.data(), inplace.data(), inplace.size());
+        for (size_t i = 0; i < inplace.size(); ++i)
+        {
+            accurate = accurate && ulp_error(inplace[i], std::exp(static_cast<long double>(exps[i]))) <= VecMath::EXP_ULP;
+        }
+
+        // float считается в double: ошибка не больше ulp float.
+        std::vector<float> floats;
+        for (size_t i = 0; i < 1000; ++i)
+        {
+            floats.push_back(-80 + 0.17f * i);
+        }
+        std::vector<float> results(floats.size());
+        VecMath::exp(floats.data(), results.data(), floats.size());
+        for (size_t i = 0; i < floats.size(); ++i)
+        {
+            float exact = static_cast<float>(std::exp(static_cast<long double>(floats[i])));
+            accurate = accurate && (results[i] == exact ||
+                                    std::fabs(results[i] - exact) <= std::fabs(std::nextafter(exact, INFINITY) - exact));
+        }
+    }
+    VecMath::set_level(VecMath::best());
+    return accurate;
+}
+
+bool test_integrate()
+{
+    Lexer lexer{"sin(x) * a + x ^ 2"};
+    Parser<long double> parser{lexer};
+    Expression expr = parser.parseExpression();
+
+    Integrator<long double> integrator(expr, "x", {{"a", 3}});
+    IntegrationOptions options;
+    options.threads = 2;
+    IntegrationResult result = integrator.integrate(0, M_PIl, options);
+
+    long double expected = 6 + M_PIl * M_PIl * M_PIl / 3;
+    return result.converged && std::abs(result.value - expected) < 1e-12 && result.evaluations > 0;
+}
+
+bool test_ode()
+{
+    // Гармонический осциллятор: за период 2 pi решение возвращается в начальную точку.
+    Lexer velocity{"v"};
+    Lexer force{"0 - w ^ 2 * x"};
+    Parser<long double> velocity_parser{velocity};
+    Parser<long double> force_parser{force};
+    OdeSystem<long double> oscillator({velocity_parser.parseExpression(), force_parser.parseExpression()},
+                                      {"x", "v"}, "t", {{"w", 1}});
+    OdeOptions options;
+    options.threads = 2;
+    std::vector<OdeResult> orbits = oscillator.integrate_many({{1, 0}, {0, 1}, {2, -1}}, 0, 2 * M_PIl, options);
+    bool orbits_closed = orbits.size() == 3 && orbits[2].success &&
+                         std::abs(orbits[0].y[0] - 1) < 1e-8 && std::abs(orbits[1].y[1] - 1) < 1e-8 &&
+                         std::abs(orbits[2].y[0] - 2) < 1e-8 && std::abs(orbits[2].y[1] + 1) < 1e-8;
+
+    // Жёсткая система с собственными числами -1 и -1000: u + v = 2 e^(-t), u - v = 2 e^(-1000 t).
+    Lexer u_lexer{"500.5 * (v - u) - u"};
+    Lexer v_lexer{"500.5 * (u - v) - v"};
+    Parser<long double> u_parser{u_lexer};
+    Parser<long double> v_parser{v_lexer};
+    OdeSystem<long double> stiff({u_parser.parseExpression(), v_parser.parseExpression()}, {"u", "v"});
+    OdeOptions stiff_options;
+    stiff_options.rel_tolerance = 1e-5L;
+    stiff_options.abs_tolerance = 1e-8L;
+    OdeResult explicit_result = stiff.integrate({2, 0}, 0, 10, stiff_options);
+    stiff_options.method = ODE_ROSENBROCK;
+    OdeResult implicit_result = stiff.integrate({2, 0}, 0, 10, stiff_options);
+    long double expected = std::exp(-10.0L);
+
+    bool mismatch = false;
+    try
+    {
+        OdeSystem<long double> invalid({Expression<long double>("v")}, {"x", "v"});
+    }
+    catch (const std::invalid_argument &)
+    {
+        mismatch = true;
+    }
+
+    return orbits_closed && mismatch && explicit_result.success && implicit_result.success &&
+           std::abs(explicit_result.y[0] - expected) < 1e-8 && std::abs(implicit_result.y[1] - expected) < 1e-6 &&
+           implicit_result.jacobians > 0 && implicit_result.steps * 5 < explicit_result.steps;
+}
+
+bool test_diff_all()
+{
+    Lexer lexer{"(x + y) * sin(x + 2) * 2 ^ x + 3 * ln(x) + y * z / (z + w)"};
+    Parser<long double> parser{lexer};
+    Expression expr = parser.parseExpression();
+
+    std::map<std::string, long double> context = {{"x", 2}, {"y", 3}, {"z", 0.5}, {"w", 1.5}};
+    std::map<std::string, Expression<long double>> gradient = expr.diff_all();
+    if (gradient.size() != 4)
+    {
+        return false;
+    }
+    for (const auto &[name, derivative] : gradient)
+    {
+        if (std::abs(derivative.eval(context) - expr.diff(name).eval(context)) > 1e-14)
+        {
+            return false;
+        }
+    }
+
+    // Порядок задаётся списком, для отсутствующей переменной - ноль.
+    std::vector<Expression<long double>> selected = expr.diff_all({"w", "q", "x"});
+    bool ordered = selected.size() == 3 && selected[1].kind() == NODE_VALUE && selected[1].constant() == 0 &&
+                   std::abs(selected[0].eval(context) - gradient.at("w").eval(context)) < 1e-14 &&
+                   std::abs(selected[2].eval(context) - gradient.at("x").eval(context)) < 1e-14;
+
+    // Широкая сумма k * x_k: работа в узле суммы растёт с числом ненулевых производных, а не
+    // с произведением числа переменных на число слагаемых (иначе тест не уложится в таймаут).
+    const size_t width = 16384;
+    std::vector<Expression<long double>> terms;
+    for (size_t k = 0; k < width; ++k)
+    {
+        terms.push_back(Expression<long double>("x" + std::to_string(k)) * Expression<long double>(k + 1));
+    }
+    std::map<std::string, Expression<long double>> wide = Expression<long double>::ExprSum(std::move(terms)).diff_all();
+    bool scaled = wide.size() == width && wide.at("x0").eval({}) == 1 && wide.at("x16383").eval({}) == 16384 &&
+                  wide.at("x777").eval({}) == 778;
+
+    return ordered && scaled;
+}
+
+bool test_diff_independent()
+{
+    // Производная (поддерево по y) * x по x - само поддерево, без копирования.
+    Expression<long double> heavy = Expression<long double>("y");
+    for (int i = 0; i < 1000; ++i)
+    {
+        heavy = (heavy * Expression<long double>("y") + Expression<long double>(1)).ExprSin();
+    }
+    Expression<long double> expr = heavy * Expression<long double>("x");
+    Expression<long double> by_x = expr.diff("x");
+    if (by_x.node() != heavy.node())
+    {
+        return false;
+    }
+
+    // Независимое поддерево даёт ноль, односторонние правила сохраняют значение.
+    Lexer lexer{"x ^ 2 / (y + 1) - ln(y) * 3 + (x + 2) ^ y"};
+    Parser<long double> parser{lexer};
+    Expression<long double> mixed = parser.parseExpression();
+    std::map<std::string, long double> context = {{"x", 1.5}, {"y", 2}};
+    long double by_y = 1.5 * 1.5 * -1.0 / 9 - 1.5 + std::pow(3.5L, 2.0L) * std::log(3.5L);
+    long double by_z = mixed.diff("z").eval(context);
+    return by_z == 0 && std::abs(mixed.diff("y").eval(context) - by_y) < 1e-14 &&
+           std::abs(mixed.diff("x").eval(context) - (2 * 1.5 / 3 + 2 * 3.5)) < 1e-14;
+}
+
+bool test_bulk()
+{
+    Lexer lexer{"x * sin(y) + a"};
+    Parser<long double> parser{lexer};
+    Expression expr = parser.parseExpression();
+    BulkEvaluator<long double> evaluator(expr, {{"a", 0.5}});
+
+    // CSV со столбцами в произвольном порядке, лишним столбцом и пустыми строками.
+    size_t rows = 20000;
+    std::string csv = "id, y ,x\n";
+    std::vector<double> binary(2 * rows);
+    std::vector<long double> expected(rows);
+    for (size_t i = 0; i < rows; ++i)
+    {
+        double x = 0.25 * static_cast<double>(i);
+        double y = 1.0 / static_cast<double>(i + 1);
+        csv += std::to_string(i) + "," + std::to_string(y) + ", +" + std::to_string(x) + "\r\n";
+        if (i % 1000 == 0)
+        {
+            csv += "\n";
+        }
+        binary[i] = x;
+        binary[rows + i] = y;
+        expected[i] = expr.eval({{"x", x}, {"y", std::stold(std::to_string(y))}, {"a", 0.5}});
+    }
+
+    std::string path = "/tmp/bulk_test_" + std::to_string(::getpid()) + ".csv";
+    {
+        std::ofstream file(path, std::ios::binary);
+        file << csv;
+    }
+    std::vector<long double> from_csv;
+    {
+        MappedFile input(path);
+        from_csv = evaluator.eval_csv(input.data(), input.size(), 4);
+    }
+    std::remove(path.c_str());
+
+    std::vector<long double> from_columns = evaluator.eval_columns(
+        reinterpret_cast<const char *>(binary.data()), binary.size() * sizeof(double), {"x", "y"}, 3);
+    if (from_csv.size() != rows || from_columns.size() != rows)
+    {
+        return false;
+    }
+    for (size_t i = 0; i < rows; ++i)
+    {
+        long double exact = expr.eval({{"x", 0.25L * i}, {"y", static_cast<long double>(binary[rows + i])}, {"a", 0.5}});
+        if (std::abs(from_csv[i] - expected[i]) > 1e-15 || std::abs(from_columns[i] - exact) > 1e-15)
+        {
+            return false;
+        }
+    }
+
+    // Текстовый вывод восстанавливает значения точно, двоичный - с точностью double.
+    std::stringstream text;
+    BulkEvaluator<long double>::write_text(text, from_csv, 2);
+    std::stringstream bytes;
+    BulkEvaluator<long double>::write_binary(bytes, from_csv);
+    std::string raw = bytes.str();
+    for (size_t i = 0; i < rows; ++i)
+    {
+        long double value;
+        text >> value;
+        double stored;
+        std::memcpy(&stored, raw.data() + i * sizeof(double), sizeof(double));
+        if (value != from_csv[i] || stored != static_cast<double>(from_csv[i]))
+        {
+            return false;
+        }
+    }
+
+    // Значения параметров командной строки разбираются тем же разбором без округления до целого.
+    long double parsed = 0;
+    std::string half = "0.5";
+    std::string bad = "1.5x";
+    if (!BulkEvaluator<long double>::parse_value(half.data(), half.data() + half.size(), parsed) || parsed != 0.5L ||
+        BulkEvaluator<long double>::parse_value(bad.data(), bad.data() + bad.size(), parsed))
+    {
+        return false;
+    }
+
+    // Переменная без столбца и без параметра - ошибка.
+    try
+    {
+        BulkEvaluator<long double>(expr).eval_columns(reinterpret_cast<const char *>(binary.data()),
+                                                      binary.size() * sizeof(double), {"x", "y"});
+        return false;
+    }
+    catch (const std::runtime_error &)
+    {
+        return true;
+    }
+}
+
+bool test_codegen()
+{
+    Lexer lexer{"(x + y) * sin(x + 2) * 2 ^ x + 3 * ln(x) + (x * y) ^ 5 / (x * y) ^ 3 + y ^ 0.5 - x ^ (0 - 3)"};
+    Parser<long double> parser{lexer};
+    // -(-0): отрицательный ноль печатается в скобках, иначе минус перед ним даёт "--".
+    Expression expr = parser.parseExpression() + Expression<long double>("x") * -Expression<long double>(-0.0L);
+
+    CodeGenerator<long double> generator({"x", "y"});
+    generator.add_with_gradient("f", expr);
+    std::string header = generator.emit();
+
+    // Программа печатает значения сгенерированных функций в нескольких точках.
+    std::string base = "/tmp/codegen_test_" + std::to_string(::getpid());
+    {
+        std::ofstream file(base + ".hpp");
+        file << header;
+    }
+    {
+        std::ofstream file(base + ".cpp");
+        file << "#include \"" << base << ".hpp\"\n"
+             << "#include <cstdio>\n"
+             << "int main()\n{\n"
+             << "    const long double points[][2] = {{1.5L, 2.0L}, {0.25L, 3.0L}, {2.0L, 0.5L}};\n"
+             << "    for (const auto &point : points)\n    {\n"
+             << "        long double out[3];\n"
+             << "        generated::evaluate_all(point, out);\n"
+             << "        std::printf(\"%.21Lg %.21Lg %.21Lg %.21Lg %.21Lg %.21Lg\\n\", generated::f(point),\n"
+             << "                    generated::f_d_x(point), generated::f_d_y(point), out[0], out[1], out[2]);\n"
+             << "    }\n}\n";
+    }
+    std::string command = "c++ -std=c++17 -O2 -Wall -Werror " + base + ".cpp -o " + base + " && " + base + " > " +
+                          base + ".out";
+    bool built = std::system(command.c_str()) == 0;
+    std::ifstream output(base + ".out");
+    std::vector<long double> values;
+    for (long double value; output >> value;)
+    {
+        values.push_back(value);
+    }
+    for (const char *suffix : {".hpp", ".cpp", ".out", ""})
+    {
+        std::remove((base + suffix).c_str());
+    }
+    if (!built || values.size() != 18)
+    {
+        return false;
+    }
+
+    const long double points[][2] = {{1.5L, 2.0L}, {0.25L, 3.0L}, {2.0L, 0.5L}};
+    Expression<long double> by_x = expr.diff("x");
+    Expression<long double> by_y = expr.diff("y");
+    for (size_t i = 0; i < 3; ++i)
+    {
+        std::map<std::string, long double> context = {{"x", points[i][0]}, {"y", points[i][1]}};
+        long double expected[] = {expr.eval(context), by_x.eval(context), by_y.eval(context)};
+        for (size_t k = 0; k < 6; ++k)
+        {
+            long double reference = expected[k % 3];
+            if (std::abs(values[i * 6 + k] - reference) > 1e-15 * std::max(1.0L, std::abs(reference)))
+            {
+                return false;
+            }
+        }
+    }
+    // Константные показатели раскрыты в умножения.
+    return !std::regex_search(header, std::regex("std::pow\\([^;]*, [0-9.]+L\\)"));
+}
+
+bool test_server()
+{
+    ServerOptions options;
+    options.path = "/tmp/expr_server_test_" + std::to_string(::getpid()) + ".sock";
+    options.workers = 2;
+    EvalServer server{options};
+    std::thread loop([&] { server.run(); });
+
+    bool ok = false;
+    try
+    {
+        EvalClient client{options.path};
+        ServerHandle f = client.parse("x * y + sin(x)");
+        ServerHandle same = client.parse(" x*y + sin (x) ");
+        ServerHandle df = client.diff(f.handle, "x");
+        std::vector<double> point = {1.5, 2.0};
+        double expected = 1.5 * 2.0 + std::sin(1.5);
+        bool single = f.variables == std::vector<std::string>{"x", "y"} && same.handle != f.handle &&
+                      std::abs(client.eval(f.handle, point) - expected) < 1e-15 &&
+                      std::abs(client.eval(df.handle, point) - (2.0 + std::cos(1.5))) < 1e-15 &&
+                      client.print(f.handle) == client.print(same.handle);
+
+        // Пакет из трёх точек по две переменные.
+        std::vector<double> points = {1.5, 2.0, 0.0, 1.0, -1.0, 3.0};
+        std::vector<double> batch = client.eval_batch(f.handle, 3, points);
+        bool batched = batch.size() == 3 && std::abs(batch[0] - expected) < 1e-15 && batch[1] == 0 &&
+                       std::abs(batch[2] - (-3.0 + std::sin(-1.0))) < 1e-14;
+
+        // Конвейер: ответы приходят по порядку запросов, ошибки не прерывают соединение.
+        std::vector<uint32_t> ids;
+        for (int i = 0; i < 100; ++i)
+        {
+            std::vector<double> values = {static_cast<double>(i), 1.0};
+            ids.push_back(client.send(SERVER_EVAL, EvalClient::eval_payload(f.handle, values)));
+        }
+        ids.push_back(client.send(SERVER_EVAL, EvalClient::eval_payload(f.handle, {1.0})));
+        ids.push_back(client.send(SERVER_PARSE, "x + $"));
+        ids.push_back(client.send(SERVER_EVAL, EvalClient::eval_payload(999, point)));
+        bool pipelined = true;
+        for (int i = 0; i < 103; ++i)
+        {
+            ServerResponse response = client.receive();
+            double value = 0;
+            if (response.payload.size() == sizeof(double))
+            {
+                std::memcpy(&value, response.payload.data(), sizeof(double));
+            }
+            pipelined = pipelined && response.id == ids[i] &&
+                        (i < 100 ? response.status == SERVER_OK && std::abs(value - (i + std::sin(static_cast<double>(i)))) < 1e-13
+                                 : response.status == SERVER_ERROR);
+        }
+
+        // Описатели принадлежат соединению.
+        client.release(df.handle);
+        bool released = false;
+        try
+        {
+            client.print(df.handle);
+        }
+        catch (const std::runtime_error &)
+        {
+            released = true;
+        }
+        EvalClient other{options.path};
+        bool isolated = false;
+        try
+        {
+            other.print(f.handle);
+        }
+        catch (const std::runtime_error &)
+        {
+            isolated = true;
+        }
+
+        // Число точек пакета ограничено размером кадра ответа и для выражения без переменных.
+        ServerHandle constant = client.parse("2");
+        client.send(SERVER_BATCH, EvalClient::batch_payload(constant.handle, UINT32_MAX, {}));
+        bool limited = client.receive().status == SERVER_ERROR && client.eval_batch(constant.handle, 2, {}).size() == 2;
+
+        // Нагрузка из нескольких соединений; одинаковые тексты разбираются один раз.
+        LoadOptions load;
+        load.path = options.path;
+        load.expression = "x * y + sin(x)";
+        load.connections = 3;
+        load.requests = 500;
+        load.pipeline = 8;
+        load.batch = 4;
+        LoadReport report = run_load(load);
+        ServerStats stats = server.stats();
+        bool loaded = report.requests == 1500 && report.points == 6000 && report.latency_p99 >= report.latency_p50 &&
+                      stats.connections == 5 && stats.errors == 6 && stats.cache.misses == 3;
+
+        ok = single && batched && pipelined && released && isolated && limited && loaded;
+    }
+    catch (const std::exception &)
+    {
+        ok = false;
+    }
+    server.stop();
+    loop.join();
+    return ok;
+}
+
+int main(int argc, char *argv[])
 {
+    configure(argc, argv);
     printf("Start testing...\n");
     run_test("Test Constructor", test_constructor);
+    run_test("Test Inline Leaves", test_inline_leaves);
     run_test("Test Operations", test_operations);
     run_test("Test Functions", test_functions);
     run_test("Test Parser", test_parser);
+    run_test("Test Parser Sub Div", test_parser_sub_div);
     run_test("Test Diff", test_diff);
+    run_test("Test Diff All", test_diff_all);
+    run_test("Test Diff Independent", test_diff_independent);
     run_test("Test Complex ", test_complex);
+    run_test("Test Deep Expressions", test_deep_expressions);
+    run_test("Test Constant Power", test_constant_power);
+    run_test("Test N-ary", test_nary);
+    run_test("Test Mixed Precision", test_mixed_precision);
+    run_test("Test Optimizer", test_optimizer);
+    run_test("Test Compiled", test_compiled);
+    run_test("Test Fusion", test_fusion);
+    run_test("Test Rewrite", test_rewrite);
+    run_test("Test Parse Cache", test_parse_cache);
+    run_test("Test Incremental", test_incremental);
+    run_test("Test Analysis", test_analysis);
+    run_test("Test Memo", test_memo);
+    run_test("Test Taylor", test_taylor);
+    run_test("Test Checked Eval", test_checked_eval);
+    run_test("Test Trace", test_trace);
+    run_test("Test Allocations", test_allocations);
+    run_test("Test VecMath", test_vecmath, 10000U);
+    run_test("Test Integrate", test_integrate);
+    run_test("Test ODE", test_ode);
+    run_test("Test Bulk", test_bulk);
+    run_test("Test Server", test_server, 10000U);
+    // Тест запускает внешний компилятор.
+    run_test("Test Codegen", test_codegen, 30000U);
 
-    return EXIT_SUCCESS;
+    return summary();
 }
\ No newline at end of file
@@ -0,0 +1,201 @@
+#include "../includes/trace.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Событие трассировки (полный интервал, "ph": "X").
+struct TraceEvent
+{
+    const char *name;
+    uint64_t begin;
+    uint64_t duration;
+    uint64_t count;
+};
+
+// Кольцевой буфер событий одного потока. Пишет только поток-владелец; мьютекс без
+// конкуренции нужен лишь для согласованной выгрузки во время записи. После завершения
+// потока буфер со своими событиями достаётся следующему новому потоку (та же дорожка tid).
+struct TraceBuffer
+{
+    std::mutex mutex;
+    std::vector<TraceEvent> events;
+    // Число записанных событий (позиция записи - written % размер).
+    uint64_t written = 0;
+    uint32_t thread;
+};
+
+// Буферы всех потоков; буфер переживает свой поток, чтобы его можно было выгрузить.
+// Буферы завершившихся потоков лежат в free, поэтому буферов не больше, чем потоков,
+// писавших одновременно, сколько бы потоков ни создавалось.
+struct TraceRegistry
+{
+    std::mutex mutex;
+    std::vector<std::shared_ptr<TraceBuffer>> buffers;
+    std::vector<std::shared_ptr<TraceBuffer>> free;
+};
+
+static TraceRegistry &registry()
+{
+    static TraceRegistry instance;
+    return instance;
+}
+
+// Буфер потока; при завершении потока возвращается в реестр.
+struct TraceOwner
+{
+    std::shared_ptr<TraceBuffer> buffer;
+
+    ~TraceOwner()
+    {
+        if (buffer)
+        {
+            TraceRegistry &all = registry();
+            std::lock_guard<std::mutex> lock(all.mutex);
+            all.free.push_back(std::move(buffer));
+        }
+    }
+};
+
+static TraceBuffer &thread_buffer()
+{
+    thread_local TraceOwner owner;
+    if (!owner.buffer)
+    {
+        TraceRegistry &all = registry();
+        std::lock_guard<std::mutex> lock(all.mutex);
+        if (!all.free.empty())
+        {
+            owner.buffer = std::move(all.free.back());
+            all.free.pop_back();
+        }
+        else
+        {
+            owner.buffer = std::make_shared<TraceBuffer>();
+            owner.buffer->events.resize(Trace::BUFFER_EVENTS);
+            owner.buffer->thread = static_cast<uint32_t>(all.buffers.size() + 1);
+            all.buffers.push_back(owner.buffer);
+        }
+    }
+    return *owner.buffer;
+}
+
+static const std::chrono::steady_clock::time_point trace_epoch = std::chrono::steady_clock::now();
+
+std::atomic<bool> Trace::recording_{false};
+
+void Trace::start()
+{
+    recording_.store(true, std::memory_order_relaxed);
+}
+
+void Trace::stop()
+{
+    recording_.store(false, std::memory_order_relaxed);
+}
+
+uint64_t Trace::now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - trace_epoch).count();
+}
+
+void Trace::record(const char *name, uint64_t begin, uint64_t duration, uint64_t count)
+{
+    TraceBuffer &buffer = thread_buffer();
+    std::lock_guard<std::mutex> lock(buffer.mutex);
+    buffer.events[buffer.written % buffer.events.size()] = TraceEvent{name, begin, duration, count};
+    ++buffer.written;
+}
+
+void Trace::clear()
+{
+    TraceRegistry &all = registry();
+    std::lock_guard<std::mutex> lock(all.mutex);
+    for (auto &buffer : all.buffers)
+    {
+        std::lock_guard<std::mutex> buffer_lock(buffer->mutex);
+        buffer->written = 0;
+    }
+}
+
+size_t Trace::buffers()
+{
+    TraceRegistry &all = registry();
+    std::lock_guard<std::mutex> lock(all.mutex);
+    return all.buffers.size();
+}
+
+size_t Trace::size()
+{
+    TraceRegistry &all = registry();
+    std::lock_guard<std::mutex> lock(all.mutex);
+    size_t total = 0;
+    for (auto &buffer : all.buffers)
+    {
+        std::lock_guard<std::mutex> buffer_lock(buffer->mutex);
+        total += std::min<uint64_t>(buffer->written, buffer->events.size());
+    }
+    return total;
+}
+
+// Имя события в строке JSON (имена - литералы из кода, но кавычки и \ экранируются).
+static void write_json_string(std::ostream &out, const char *text)
+{
+    out << '"';
+    for (const char *c = text; *c != '\0'; ++c)
+    {
+        if (*c == '"' || *c == '\\')
+        {
+            out << '\\';
+        }
+        out << *c;
+    }
+    out << '"';
+}
+
+void Trace::write_chrome(std::ostream &out)
+{
+    // Копия событий под блокировками, запись в поток - без них.
+    std::vector<std::pair<uint32_t, TraceEvent>> events;
+    {
+        TraceRegistry &all = registry();
+        std::lock_guard<std::mutex> lock(all.mutex);
+        for (auto &buffer : all.buffers)
+        {
+            std::lock_guard<std::mutex> buffer_lock(buffer->mutex);
+            uint64_t size = buffer->events.size();
+            uint64_t first = buffer->written > size ? buffer->written - size : 0;
+            for (uint64_t i = first; i < buffer->written; ++i)
+            {
+                events.emplace_back(buffer->thread, buffer->events[i % size]);
+            }
+        }
+    }
+
+    // Время в микросекундах с дробной частью.
+    auto micros = [&out](uint64_t ns)
+    { out << ns / 1000 << '.' << static_cast<char>('0' + ns / 100 % 10) << static_cast<char>('0' + ns / 10 % 10)
+          << static_cast<char>('0' + ns % 10); };
+    out << "{\"traceEvents\":[\n"
+        << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"phases\"}},\n"
+        << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":2,\"args\":{\"name\":\"batches\"}}";
+    for (const auto &[thread, event] : events)
+    {
+        out << ",\n{\"name\":";
+        write_json_string(out, event.name);
+        out << ",\"ph\":\"X\",\"ts\":";
+        micros(event.begin);
+        out << ",\"dur\":";
+        micros(event.duration);
+        // Накопленные пачки не вложены в интервалы потока и выводятся отдельным процессом.
+        out << ",\"pid\":" << (event.count != 0 ? 2 : 1) << ",\"tid\":" << thread;
+        if (event.count != 0)
+        {
+            out << ",\"args\":{\"count\":" << event.count << '}';
+        }
+        out << '}';
+    }
+    out << "\n],\"displayTimeUnit\":\"ns\"}\n";
+}
@@ -0,0 +1,344 @@
+#include "../includes/vecmath.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cfloat>
+#include <cmath>
+
+// Точные суммы и произведения ядер (two_sum, two_prod) ломаются, если компилятор
+// сливает умножение и сложение в FMA (это разрешено для C++ и возможно с AVX-512).
+#pragma GCC optimize("fp-contract=off")
+
+// Постоянные ядер: разбиения ln 2 и pi/2 на части и коэффициенты многочленов ln,
+// sin и cos (fdlibm).
+static constexpr double VECMATH_ROUND_MAGIC = 0x1.8p52;
+static constexpr double VECMATH_SPLIT = 134217729.0;
+static constexpr double VECMATH_DBL_MIN = DBL_MIN;
+static constexpr double VECMATH_LOG2E = 1.44269504088896338700e+00;
+static constexpr double VECMATH_LN2_HI = 6.93147180369123816490e-01;
+static constexpr double VECMATH_LN2_LO = 1.90821492927058770002e-10;
+static constexpr double VECMATH_EXP_MAX = 7.09782712893383973096e+02;
+static constexpr double VECMATH_EXP_MIN = -7.45133219101941108420e+02;
+static constexpr double VECMATH_LG1 = 6.666666666666735130e-01;
+static constexpr double VECMATH_LG2 = 3.999999999940941908e-01;
+static constexpr double VECMATH_LG3 = 2.857142874366239149e-01;
+static constexpr double VECMATH_LG4 = 2.222219843214978396e-01;
+static constexpr double VECMATH_LG5 = 1.818357216161805012e-01;
+static constexpr double VECMATH_LG6 = 1.531383769920937332e-01;
+static constexpr double VECMATH_LG7 = 1.479819860511658591e-01;
+static constexpr double VECMATH_2_PI = 6.36619772367581382433e-01;
+static constexpr double VECMATH_PIO2_1 = 1.57079632673412561417e+00;
+static constexpr double VECMATH_PIO2_2 = 6.07710050630396597660e-11;
+static constexpr double VECMATH_PIO2_3 = 2.02226624871116645580e-21;
+static constexpr double VECMATH_PIO2_3T = 8.47842766036889956997e-32;
+static constexpr double VECMATH_SINCOS_LIMIT = 1e5;
+static constexpr double VECMATH_S1 = -1.66666666666666324348e-01;
+static constexpr double VECMATH_S2 = 8.33333333332248946124e-03;
+static constexpr double VECMATH_S3 = -1.98412698298579493134e-04;
+static constexpr double VECMATH_S4 = 2.75573137070700676789e-06;
+static constexpr double VECMATH_S5 = -2.50507602534068634195e-08;
+static constexpr double VECMATH_S6 = 1.58969099521155010221e-10;
+static constexpr double VECMATH_C1 = 4.16666666666666019037e-02;
+static constexpr double VECMATH_C2 = -1.38888888888741095749e-03;
+static constexpr double VECMATH_C3 = 2.48015872894767294178e-05;
+static constexpr double VECMATH_C4 = -2.75573143513906633035e-07;
+static constexpr double VECMATH_C5 = 2.08757232129817482790e-09;
+static constexpr double VECMATH_C6 = -1.13596475577881948265e-11;
+
+// Таблица ln: для j = 91..181 inverse = 128 / j в double, hi + lo = -ln(inverse).
+struct VecMathLogEntry
+{
+    double inverse;
+    double hi;
+    double lo;
+};
+
+static constexpr size_t VECMATH_LOG_TABLE_SIZE = 182;
+
+static const VecMathLogEntry *vecmath_log_table()
+{
+    static const auto table = []
+    {
+        std::array<VecMathLogEntry, VECMATH_LOG_TABLE_SIZE> entries{};
+        for (size_t j = 1; j < VECMATH_LOG_TABLE_SIZE; ++j)
+        {
+            double inverse = 128.0 / static_cast<double>(j);
+            long double value = -std::log(static_cast<long double>(inverse));
+            double hi = static_cast<double>(value);
+            entries[j] = {inverse, hi, static_cast<double>(value - hi)};
+        }
+        return entries;
+    }();
+    return table.data();
+}
+
+// Пересчёт аргументов вне быстрого пути.
+static double libm_sin(double x)
+{
+    return std::sin(x);
+}
+
+static double libm_cos(double x)
+{
+    return std::cos(x);
+}
+
+static double libm_log(double x)
+{
+    return std::log(x);
+}
+
+static double libm_exp(double x)
+{
+    return std::exp(x);
+}
+
+static double libm_pow(double x, double y)
+{
+    return std::pow(x, y);
+}
+
+struct VecMathKernels
+{
+    void (*sin)(const double *, double *, size_t);
+    void (*cos)(const double *, double *, size_t);
+    void (*ln)(const double *, double *, size_t);
+    void (*exp)(const double *, double *, size_t);
+    void (*pow)(const double *, const double *, double *, size_t);
+};
+
+// ======
+// |Ядра|
+// ======
+
+namespace vecmath_libm
+{
+    template <double (*Function)(double)>
+    static void map(const double *x, double *out, size_t count)
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            out[i] = Function(x[i]);
+        }
+    }
+
+    static void pow_array(const double *x, const double *y, double *out, size_t count)
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            out[i] = libm_pow(x[i], y[i]);
+        }
+    }
+
+    static const VecMathKernels kernels = {
+        map<libm_sin>, map<libm_cos>, map<libm_log>, map<libm_exp>, pow_array,
+    };
+}
+
+namespace vecmath_sse2
+{
+#define VECMATH_BYTES 16
+#include "vecmath_kernels.inc"
+#undef VECMATH_BYTES
+}
+
+#if defined(__x86_64__) && !defined(EXPR_NO_VECMATH)
+#define VECMATH_X86 1
+
+#pragma GCC push_options
+#pragma GCC target("avx2")
+namespace vecmath_avx2
+{
+#define VECMATH_BYTES 32
+#include "vecmath_kernels.inc"
+#undef VECMATH_BYTES
+}
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx512f,avx512dq")
+namespace vecmath_avx512
+{
+#define VECMATH_BYTES 64
+#include "vecmath_kernels.inc"
+#undef VECMATH_BYTES
+}
+#pragma GCC pop_options
+#endif
+
+// =========
+// |VecMath|
+// =========
+
+// В два элемента выборка из таблицы ln для pow не быстрее libm.
+static const VecMathKernels sse2_kernels = {
+    vecmath_sse2::kernels.sin, vecmath_sse2::kernels.cos, vecmath_sse2::kernels.ln,
+    vecmath_sse2::kernels.exp, vecmath_libm::kernels.pow,
+};
+
+// Уровни, не собранные на этой платформе, получают ядра SSE2 (а не libm), поэтому
+// по указателю на таблицу уровень восстанавливается однозначно.
+static const VecMathKernels &kernels_for(VecMathLevel level)
+{
+    switch (level)
+    {
+    case VECMATH_LIBM:
+        return vecmath_libm::kernels;
+#ifdef VECMATH_X86
+    case VECMATH_AVX2:
+        return vecmath_avx2::kernels;
+    case VECMATH_AVX512:
+        return vecmath_avx512::kernels;
+#endif
+    default:
+        return sse2_kernels;
+    }
+}
+
+static VecMathLevel detect_level()
+{
+#if defined(EXPR_NO_VECMATH)
+    return VECMATH_LIBM;
+#elif defined(VECMATH_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq"))
+    {
+        return VECMATH_AVX512;
+    }
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return VECMATH_AVX2;
+    }
+    return VECMATH_SSE2;
+#else
+    // Вне x86 векторы расширения GCC переводятся в инструкции платформы.
+    return VECMATH_SSE2;
+#endif
+}
+
+// Используемые ядра; выбираются по процессору при первом обращении.
+static std::atomic<const VecMathKernels *> &active_kernels()
+{
+    static std::atomic<const VecMathKernels *> active{&kernels_for(detect_level())};
+    return active;
+}
+
+VecMathLevel VecMath::best()
+{
+    static const VecMathLevel level = detect_level();
+    return level;
+}
+
+VecMathLevel VecMath::level()
+{
+    const VecMathKernels *active = active_kernels().load(std::memory_order_relaxed);
+    if (active == &vecmath_libm::kernels)
+    {
+        return VECMATH_LIBM;
+    }
+    // Без AVX все уровни выше SSE2 дают ядра SSE2, поэтому SSE2 проверяется первым.
+    for (VecMathLevel level : {VECMATH_SSE2, VECMATH_AVX2, VECMATH_AVX512})
+    {
+        if (active == &kernels_for(level))
+        {
+            return level;
+        }
+    }
+    return VECMATH_LIBM;
+}
+
+void VecMath::set_level(VecMathLevel level)
+{
+    active_kernels().store(&kernels_for(std::min(level, best())), std::memory_order_relaxed);
+}
+
+const char *VecMath::name(VecMathLevel level)
+{
+    switch (level)
+    {
+    case VECMATH_SSE2:
+        return "sse2";
+    case VECMATH_AVX2:
+        return "avx2";
+    case VECMATH_AVX512:
+        return "avx512";
+    default:
+        return "libm";
+    }
+}
+
+void VecMath::sin(const double *x, double *out, size_t count)
+{
+    active_kernels().load(std::memory_order_relaxed)->sin(x, out, count);
+}
+
+void VecMath::cos(const double *x, double *out, size_t count)
+{
+    active_kernels().load(std::memory_order_relaxed)->cos(x, out, count);
+}
+
+void VecMath::ln(const double *x, double *out, size_t count)
+{
+    active_kernels().load(std::memory_order_relaxed)->ln(x, out, count);
+}
+
+void VecMath::exp(const double *x, double *out, size_t count)
+{
+    active_kernels().load(std::memory_order_relaxed)->exp(x, out, count);
+}
+
+void VecMath::pow(const double *x, const double *y, double *out, size_t count)
+{
+    active_kernels().load(std::memory_order_relaxed)->pow(x, y, out, count);
+}
+
+// Версии для float: вычисление в double по частям и округление результата.
+static constexpr size_t FLOAT_CHUNK = 256;
+
+template <void (*Function)(const double *, double *, size_t)>
+static void map_float(const float *x, float *out, size_t count)
+{
+    double buffer[FLOAT_CHUNK];
+    for (size_t begin = 0; begin < count; begin += FLOAT_CHUNK)
+    {
+        size_t n = std::min(FLOAT_CHUNK, count - begin);
+        std::copy(x + begin, x + begin + n, buffer);
+        Function(buffer, buffer, n);
+        std::copy(buffer, buffer + n, out + begin);
+    }
+}
+
+void VecMath::sin(const float *x, float *out, size_t count)
+{
+    map_float<VecMath::sin>(x, out, count);
+}
+
+void VecMath::cos(const float *x, float *out, size_t count)
+{
+    map_float<VecMath::cos>(x, out, count);
+}
+
+void VecMath::ln(const float *x, float *out, size_t count)
+{
+    map_float<VecMath::ln>(x, out, count);
+}
+
+void VecMath::exp(const float *x, float *out, size_t count)
+{
+    map_float<VecMath::exp>(x, out, count);
+}
+
+void VecMath::pow(const float *x, const float *y, float *out, size_t count)
+{
+    double base[FLOAT_CHUNK];
+    double exponent[FLOAT_CHUNK];
+    for (size_t begin = 0; begin < count; begin += FLOAT_CHUNK)
+    {
+        size_t n = std::min(FLOAT_CHUNK, count - begin);
+        std::copy(x + begin, x + begin + n, base);
+        std::copy(y + begin, y + begin + n, exponent);
+        VecMath::pow(base, exponent, base, n);
+        std::copy(base, base + n, out + begin);
+    }
+}